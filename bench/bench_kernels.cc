@@ -0,0 +1,388 @@
+#include "raytracing/aabb.h"
+#include "raytracing/box.h"
+#include "raytracing/camera.h"
+#include "raytracing/flat_bvh.h"
+#include "raytracing/hittable.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/interval.h"
+#include "raytracing/material.h"
+#include "raytracing/perlin.h"
+#include "raytracing/quad.h"
+#include "raytracing/ray.h"
+#include "raytracing/rtweekend.h"
+#include "raytracing/scene_arena.h"
+#include "raytracing/sphere.h"
+#include "raytracing/vec3.h"
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <vector>
+
+// Microbenchmarks of the kernels on the hot path of a render. Each one runs
+// over a fixed set of random inputs, generated before timing starts, and
+// reports the number of calls as items.
+
+static const std::size_t input_count = 4096;
+
+static std::vector<ray> random_rays(double spread) {
+  // Rays from random points around the origin, aimed at random points within
+  // `spread` of it, so a unit sized object at the origin is hit by some.
+  std::vector<ray> rays;
+  for (std::size_t i = 0; i < input_count; i++) {
+    auto origin = 4 * random_unit_vector();
+    auto target = spread * vec3::random(-1, 1);
+    rays.emplace_back(origin, target - origin, random_double());
+  }
+  return rays;
+}
+
+template <typename F>
+static void run_over_rays(benchmark::State &state, double spread, F hit) {
+  auto rays = random_rays(spread);
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hit(rays[i]));
+    i = (i + 1) % rays.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_aabb_hit(benchmark::State &state) {
+  aabb box(point3(-1, -1, -1), point3(1, 1, 1));
+  run_over_rays(state, 2, [&](const ray &r) {
+    return box.hit(r, interval(0.001, infinity));
+  });
+}
+BENCHMARK(BM_aabb_hit);
+
+static void BM_sphere_hit(benchmark::State &state) {
+  sphere s(point3(0, 0, 0), 1, make_shared<lambertian>(color(.5, .5, .5)));
+  run_over_rays(state, 2, [&](const ray &r) {
+    hit_record rec;
+    return s.hit(r, interval(0.001, infinity), rec);
+  });
+}
+BENCHMARK(BM_sphere_hit);
+
+static void BM_moving_sphere_hit(benchmark::State &state) {
+  sphere s(point3(0, 0, 0), point3(0, 0.5, 0), 1,
+           make_shared<lambertian>(color(.5, .5, .5)));
+  run_over_rays(state, 2, [&](const ray &r) {
+    hit_record rec;
+    return s.hit(r, interval(0.001, infinity), rec);
+  });
+}
+BENCHMARK(BM_moving_sphere_hit);
+
+static void BM_quad_hit(benchmark::State &state) {
+  quad q(point3(-1, -1, 0), vec3(2, 0, 0), vec3(0, 2, 0),
+         make_shared<lambertian>(color(.5, .5, .5)));
+  run_over_rays(state, 2, [&](const ray &r) {
+    hit_record rec;
+    return q.hit(r, interval(0.001, infinity), rec);
+  });
+}
+BENCHMARK(BM_quad_hit);
+
+static void BM_box_hit(benchmark::State &state) {
+  // A unit box as the six quads box() used to build, or as one box.
+  auto mat = make_shared<lambertian>(color(.5, .5, .5));
+  point3 a(-1, -1, -1), b(1, 1, 1);
+  hittable_list sides;
+  sides.add(make_shared<quad>(point3(-1, -1, 1), vec3(2, 0, 0),
+                              vec3(0, 2, 0), mat));
+  sides.add(make_shared<quad>(point3(1, -1, 1), vec3(0, 0, -2),
+                              vec3(0, 2, 0), mat));
+  sides.add(make_shared<quad>(point3(1, -1, -1), vec3(-2, 0, 0),
+                              vec3(0, 2, 0), mat));
+  sides.add(make_shared<quad>(point3(-1, -1, -1), vec3(0, 0, 2),
+                              vec3(0, 2, 0), mat));
+  sides.add(make_shared<quad>(point3(-1, 1, 1), vec3(2, 0, 0),
+                              vec3(0, 0, -2), mat));
+  sides.add(make_shared<quad>(point3(-1, -1, -1), vec3(2, 0, 0),
+                              vec3(0, 0, 2), mat));
+  axis_aligned_box solid(a, b, mat);
+  const hittable &object =
+      state.range(0) ? static_cast<const hittable &>(solid) : sides;
+  run_over_rays(state, 2, [&](const ray &r) {
+    hit_record rec;
+    return object.hit(r, interval(0.001, infinity), rec);
+  });
+}
+BENCHMARK(BM_box_hit)->Arg(0)->Arg(1);
+
+static void BM_flat_bvh_hit(benchmark::State &state) {
+  // A grid of small spheres, like the bouncing spheres scene, made in a scene
+  // arena if the second argument is set. The same spheres and rays are used
+  // either way.
+  random_generator().seed(1);
+  shared_ptr<scene_arena> arena;
+  if (state.range(1))
+    arena = make_shared<scene_arena>();
+  auto mat = make_in<lambertian>(arena, color(.5, .5, .5));
+  hittable_list world;
+  auto n = int(state.range(0));
+  for (int a = 0; a < n; a++) {
+    for (int b = 0; b < n; b++) {
+      point3 center(4 * (a + 0.9 * random_double()) / n - 2, 0,
+                    4 * (b + 0.9 * random_double()) / n - 2);
+      world.add(make_in<sphere>(arena, center, 1.0 / n, mat));
+    }
+  }
+  auto bvh = make_in<flat_bvh>(arena, world.objects);
+
+  run_over_rays(state, 2, [&](const ray &r) {
+    hit_record rec;
+    return bvh->hit(r, interval(0.001, infinity), rec);
+  });
+  state.counters["objects"] = double(n * n);
+}
+BENCHMARK(BM_flat_bvh_hit)->ArgsProduct({{8, 32, 128}, {0, 1}});
+
+static void BM_flat_bvh_motion(benchmark::State &state) {
+  // A 40 by 40 grid of small spheres, each moving over the shutter interval
+  // by the first argument in tenths of its radius, in a random direction.
+  // With the second argument set, rays are tested against node bounds
+  // interpolated to their time; otherwise against boxes covering the whole
+  // shutter interval, as a hierarchy without motion bounds would.
+  random_generator().seed(1);
+  auto mat = make_shared<lambertian>(color(.5, .5, .5));
+  hittable_list world;
+  const int n = 40;
+  const double radius = 1.0 / n;
+  auto motion = double(state.range(0)) / 10 * radius;
+  for (int a = 0; a < n; a++) {
+    for (int b = 0; b < n; b++) {
+      point3 center(4 * (a + 0.9 * random_double()) / n - 2, 0,
+                    4 * (b + 0.9 * random_double()) / n - 2);
+      world.add(make_shared<sphere>(
+          center, center + motion * random_unit_vector(), radius, mat));
+    }
+  }
+  flat_bvh interpolated(world.objects);
+
+  const auto &arrays = interpolated.arrays();
+  std::vector<flat_bvh_node> whole(arrays.nodes,
+                                   arrays.nodes + arrays.node_count);
+  for (auto &node : whole) {
+    for (int i = 0; i < 6; i += 2) {
+      node.bounds[0][i] = std::fmin(node.bounds[0][i], node.bounds[1][i]);
+      node.bounds[0][i + 1] =
+          std::fmax(node.bounds[0][i + 1], node.bounds[1][i + 1]);
+    }
+    node.moving = 0;
+  }
+  flat_bvh whole_shutter(world.objects,
+                         {whole.data(), whole.size(), arrays.order,
+                          arrays.object_count, arrays.storage});
+
+  const auto &bvh = state.range(1) ? interpolated : whole_shutter;
+  run_over_rays(state, 2, [&](const ray &r) {
+    hit_record rec;
+    return bvh.hit(r, interval(0.001, infinity), rec);
+  });
+}
+BENCHMARK(BM_flat_bvh_motion)->ArgsProduct({{0, 5, 20, 50}, {0, 1}});
+
+template <typename F>
+static void run_over_frames(benchmark::State &state, F update) {
+  // A grid of small spheres in which every eighth one drifts a little each
+  // frame, as in an animation. Each iteration moves them to the next frame and
+  // brings the hierarchy up to date with update(bvh).
+  auto mat = make_shared<lambertian>(color(.5, .5, .5));
+  hittable_list world;
+  std::vector<shared_ptr<translate>> movers;
+  auto n = int(state.range(0));
+  for (int a = 0; a < n; a++) {
+    for (int b = 0; b < n; b++) {
+      point3 center(4 * (a + 0.5) / n - 2, 0, 4 * (b + 0.5) / n - 2);
+      shared_ptr<hittable> object = make_shared<sphere>(center, 1.0 / n, mat);
+      if ((a * n + b) % 8 == 0) {
+        movers.push_back(make_shared<translate>(object, vec3(0, 0, 0)));
+        object = movers.back();
+      }
+      world.add(object);
+    }
+  }
+  flat_bvh bvh(world.objects);
+
+  int frame = 0;
+  for (auto _ : state) {
+    frame++;
+    for (auto &m : movers)
+      m->set_offset(vec3(0.002 * frame / n, 0.01 * frame / n, 0));
+    update(bvh);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["objects"] = double(n * n);
+  state.counters["sah_cost"] = bvh.sah_cost();
+}
+
+static void BM_flat_bvh_frame_rebuild(benchmark::State &state) {
+  run_over_frames(state, [](flat_bvh &bvh) { bvh.rebuild(); });
+}
+BENCHMARK(BM_flat_bvh_frame_rebuild)->Arg(32)->Arg(128);
+
+static void BM_flat_bvh_frame_refit(benchmark::State &state) {
+  run_over_frames(state, [](flat_bvh &bvh) {
+    benchmark::DoNotOptimize(bvh.update());
+  });
+}
+BENCHMARK(BM_flat_bvh_frame_refit)->Arg(32)->Arg(128);
+
+static std::vector<point3> random_points() {
+  std::vector<point3> points;
+  for (std::size_t i = 0; i < input_count; i++)
+    points.push_back(16 * vec3::random(-1, 1));
+  return points;
+}
+
+static void BM_perlin_noise(benchmark::State &state) {
+  perlin noise;
+  auto points = random_points();
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(noise.noise(points[i]));
+    i = (i + 1) % points.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_perlin_noise);
+
+static void BM_perlin_turb(benchmark::State &state) {
+  perlin noise;
+  auto points = random_points();
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(noise.turb(points[i], 7));
+    i = (i + 1) % points.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_perlin_turb);
+
+static void BM_perlin_fast_turb(benchmark::State &state) {
+  perlin noise;
+  auto points = random_points();
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(noise.fast_turb(points[i], 7));
+    i = (i + 1) % points.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_perlin_fast_turb);
+
+// The sampling mappings, input_count points per iteration. Argument 0 maps
+// random numbers with the rejection loops the renderer used before, drawing
+// numbers until a point is accepted, and 1 with the mapping, as
+// random_unit_vector() and random_in_unit_disk() do. Argument 2 maps arrays of
+// inputs one point at a time, and 3 with the batch version.
+
+template <typename Reject, typename Map, typename Batch>
+static void run_over_samples(benchmark::State &state, Reject reject, Map map,
+                             Batch batch) {
+  random_generator().seed(1);
+  std::vector<double> u1, u2, x(input_count), y(input_count), z(input_count);
+  for (std::size_t i = 0; i < input_count; i++) {
+    u1.push_back(random_double());
+    u2.push_back(random_double());
+  }
+
+  for (auto _ : state) {
+    for (std::size_t i = 0; i < input_count && state.range(0) < 3; i++) {
+      if (state.range(0) == 0) {
+        benchmark::DoNotOptimize(reject());
+      } else if (state.range(0) == 1) {
+        auto r1 = random_double();
+        benchmark::DoNotOptimize(map(r1, random_double()));
+      } else {
+        benchmark::DoNotOptimize(map(u1[i], u2[i]));
+      }
+    }
+    if (state.range(0) == 3) {
+      batch(int(input_count), u1.data(), u2.data(), x.data(), y.data(),
+            z.data());
+      benchmark::DoNotOptimize(x.data());
+      benchmark::ClobberMemory();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * std::int64_t(input_count));
+}
+
+static vec3 rejection_unit_vector() {
+  while (true) {
+    auto p = vec3::random(-1, 1);
+    auto lensq = p.length_squared();
+    if (1e-160 < lensq && lensq <= 1)
+      return p / std::sqrt(lensq);
+  }
+}
+
+static void BM_sphere_sample(benchmark::State &state) {
+  run_over_samples(
+      state, rejection_unit_vector,
+      [](double u1, double u2) { return sphere_sample(u1, u2); },
+      [](int n, const double *u1, const double *u2, double *x, double *y,
+         double *z) { sphere_sample(n, u1, u2, x, y, z); });
+}
+BENCHMARK(BM_sphere_sample)->DenseRange(0, 3);
+
+static void BM_disk_sample(benchmark::State &state) {
+  run_over_samples(
+      state,
+      [] {
+        while (true) {
+          auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
+          if (p.length_squared() < 1)
+            return p;
+        }
+      },
+      [](double u1, double u2) { return disk_sample(u1, u2); },
+      [](int n, const double *u1, const double *u2, double *x, double *y,
+         double *) { disk_sample(n, u1, u2, x, y); });
+}
+BENCHMARK(BM_disk_sample)->DenseRange(0, 3);
+
+static void BM_cosine_hemisphere_sample(benchmark::State &state) {
+  // The rejection version is the Lambertian scattering direction: the normal
+  // plus a unit vector.
+  run_over_samples(
+      state,
+      [] { return unit_vector(vec3(0, 0, 1) + rejection_unit_vector()); },
+      [](double u1, double u2) { return cosine_hemisphere_sample(u1, u2); },
+      [](int n, const double *u1, const double *u2, double *x, double *y,
+         double *z) { cosine_hemisphere_sample(n, u1, u2, x, y, z); });
+}
+BENCHMARK(BM_cosine_hemisphere_sample)->DenseRange(0, 3);
+
+static void BM_camera_render(benchmark::State &state) {
+  // A single diffuse sphere under a sky, rendered on one thread, so the cost
+  // is dominated by the camera's own sampling and shading loop.
+  hittable_list world;
+  world.add(make_shared<sphere>(point3(0, 0, -1), 0.5,
+                                make_shared<lambertian>(color(.5, .5, .5))));
+  world.add(make_shared<sphere>(point3(0, -100.5, -1), 100,
+                                make_shared<lambertian>(color(.8, .8, 0))));
+
+  camera cam;
+  cam.image_width = 64;
+  cam.samples_per_pixel = 4;
+  cam.max_depth = 10;
+  cam.background = color(0.70, 0.80, 1.00);
+  cam.thread_count = 1;
+  cam.show_progress = false;
+
+  for (auto _ : state) {
+    std::ostringstream image;
+    cam.render(world, image);
+    benchmark::DoNotOptimize(image.str().size());
+  }
+
+  auto samples = double(cam.image_width) * cam.image_width *
+                 cam.samples_per_pixel;
+  state.SetItemsProcessed(state.iterations() * std::int64_t(samples));
+}
+BENCHMARK(BM_camera_render)->Unit(benchmark::kMillisecond)->UseRealTime();
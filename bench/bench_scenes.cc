@@ -0,0 +1,417 @@
+#include "raytracing/asset_loader.h"
+#include "raytracing/camera.h"
+#include "raytracing/hittable.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/image_writer.h"
+#include "raytracing/material.h"
+#include "raytracing/quad.h"
+#include "raytracing/sampler.h"
+#include "raytracing/scene_description.h"
+#include "raytracing/scene_parser.h"
+#include "raytracing/static_scene.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Renders every scene in the scenes directory at a small fixed resolution and
+// sample count, on one thread so results don't depend on the machine's core
+// count. Reports rays traced per second and nanoseconds per camera sample.
+
+static const int bench_width = 96;
+static const int bench_samples_per_pixel = 8;
+
+static const char *scene_names[] = {
+    "bouncing_spheres", "checkered_spheres", "earth",
+    "perlin_spheres",   "quads",             "simple_light",
+    "cornell_box",      "cornell_smoke",     "cornell_smoke_grid",
+};
+
+class ray_counter : public hittable {
+public:
+  // Passes hit tests through to the world, counting them. The camera tests
+  // the world once per ray segment, so this counts every ray traced.
+
+  ray_counter(const hittable &world) : world(world) {}
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    rays.fetch_add(1, std::memory_order_relaxed);
+    return world.hit(r, ray_t, rec);
+  }
+
+  aabb bounding_box() const override { return world.bounding_box(); }
+
+  std::uint64_t count() const { return rays.load(); }
+
+private:
+  const hittable &world;
+  mutable std::atomic<std::uint64_t> rays{0};
+};
+
+static std::uint64_t render_scene(benchmark::State &state,
+                                  const hittable &world, camera &cam) {
+  // Renders the world at the benchmark's size and sample count, reporting
+  // rays per second and nanoseconds per sample. Returns the rays traced.
+  cam.image_width = bench_width;
+  cam.samples_per_pixel = bench_samples_per_pixel;
+  cam.thread_count = 1;
+  cam.show_progress = false;
+
+  ray_counter counted(world);
+  for (auto _ : state) {
+    std::ostringstream image;
+    cam.render(counted, image);
+    benchmark::DoNotOptimize(image.str().size());
+  }
+
+  // Same height as the camera works out from the aspect ratio.
+  auto height = std::max(1, int(cam.image_width / cam.aspect_ratio));
+  auto samples = double(cam.image_width) * height * cam.samples_per_pixel;
+
+  state.counters["rays_per_second"] =
+      benchmark::Counter(double(counted.count()), benchmark::Counter::kIsRate);
+  state.counters["ns_per_sample"] = benchmark::Counter(
+      samples * 1e-9, benchmark::Counter::kIsIterationInvariantRate |
+                          benchmark::Counter::kInvert);
+  return counted.count();
+}
+
+static void BM_scene(benchmark::State &state, const std::string &name) {
+  scene_description scene;
+  auto filename = std::string(RAYTRACING_SOURCE_DIR) + "/scenes/" + name +
+                  ".scene";
+  if (!load_scene_file(filename, scene)) {
+    state.SkipWithError("could not load the scene file");
+    return;
+  }
+
+  asset_loader assets;
+  hittable_list world;
+  camera cam;
+  if (!scene.build(world, cam, assets)) {
+    state.SkipWithError("could not build the scene");
+    return;
+  }
+  assets.wait();
+
+  render_scene(state, world, cam);
+}
+
+// The Cornell box of scenes/cornell_box.scene, built at compile time.
+struct cornell_box_view : default_view {
+  static constexpr int image_width = 600;
+  static constexpr int samples_per_pixel = 200;
+  static constexpr int max_depth = 50;
+  static constexpr double vfov = 40;
+  static constexpr point3 lookfrom = point3(278, 278, -800);
+  static constexpr point3 lookat = point3(278, 278, 0);
+};
+
+static auto static_cornell_box() {
+  auto red = make_shared<lambertian>(color(.65, .05, .05));
+  auto white = make_shared<lambertian>(color(.73, .73, .73));
+  auto green = make_shared<lambertian>(color(.12, .45, .15));
+  auto light = make_shared<diffuse_light>(color(15, 15, 15));
+
+  return static_scene(
+      quad(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green),
+      quad(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red),
+      quad(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light),
+      quad(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white),
+      quad(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white),
+      quad(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white),
+      static_translate(
+          static_rotate_y(
+              static_box(point3(0, 0, 0), point3(165, 330, 165), white), 15),
+          vec3(265, 0, 295)),
+      static_translate(
+          static_rotate_y(
+              static_box(point3(0, 0, 0), point3(165, 165, 165), white), -18),
+          vec3(130, 0, 65)));
+}
+
+static void BM_static_cornell_box(benchmark::State &state) {
+  // Compare with BM_scene/cornell_box, the same scene built from its file.
+  auto world = static_cornell_box();
+  camera cam;
+  apply_view<cornell_box_view>(cam);
+  render_scene(state, world, cam);
+}
+BENCHMARK(BM_static_cornell_box)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_cornell_box_hit(benchmark::State &state) {
+  // Hit tests alone, of the Cornell box built from its file (argument 0) or at
+  // compile time (argument 1), for random rays from inside the box.
+  scene_description scene;
+  hittable_list dynamic_world;
+  camera cam;
+  if (!load_scene_file(std::string(RAYTRACING_SOURCE_DIR) +
+                           "/scenes/cornell_box.scene",
+                       scene) ||
+      !scene.build(dynamic_world, cam)) {
+    state.SkipWithError("could not load the scene");
+    return;
+  }
+  auto static_world = static_cornell_box();
+  const hittable &world =
+      state.range(0) ? static_cast<const hittable &>(static_world)
+                     : dynamic_world;
+
+  random_generator().seed(1);
+  std::vector<ray> rays;
+  for (int i = 0; i < 4096; i++)
+    rays.emplace_back(point3::random(1, 554), random_unit_vector());
+
+  std::size_t i = 0;
+  for (auto _ : state) {
+    hit_record rec;
+    benchmark::DoNotOptimize(
+        world.hit(rays[i], interval(0.001, infinity), rec));
+    i = (i + 1) % rays.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_cornell_box_hit)->Arg(0)->Arg(1);
+
+// Convergence of the samplers: how far images rendered with a few samples per
+// pixel are from a reference rendered with many.
+static const int convergence_width = 24;
+static const int reference_samples_per_pixel = 1024;
+
+static const char *convergence_scenes[] = {"bouncing_spheres", "cornell_box"};
+
+static std::vector<float> render_means(const hittable &world,
+                                       const camera &cam, int sample_count) {
+  // Renders the image on this thread, returning the mean of each pixel's
+  // samples as RGB triples in scanline order.
+  auto width = std::size_t(cam.image_width);
+  std::vector<float> image(width * cam.height() * 3);
+  for (const auto &tile : cam.tiles()) {
+    std::vector<float> sums(std::size_t(tile.x1 - tile.x0) *
+                                (tile.y1 - tile.y0) * 3,
+                            0.0f);
+    cam.render_samples(world, tile, sample_count, sums.data());
+    auto sum = sums.begin();
+    for (int j = tile.y0; j < tile.y1; j++)
+      for (int i = tile.x0; i < tile.x1; i++)
+        for (int c = 0; c < 3; c++)
+          image[(j * width + i) * 3 + c] = *sum++ / float(sample_count);
+  }
+  return image;
+}
+
+static void BM_sampler_convergence(benchmark::State &state,
+                                   const std::string &name) {
+  // Renders the scene with the sampler of argument 0 at the samples per pixel
+  // of argument 1, and reports the RMSE of its pixels, clamped to the
+  // displayable range, against the reference.
+  scene_description scene;
+  asset_loader assets;
+  hittable_list world;
+  camera cam;
+  if (!load_scene_file(std::string(RAYTRACING_SOURCE_DIR) + "/scenes/" +
+                           name + ".scene",
+                       scene) ||
+      !scene.build(world, cam, assets)) {
+    state.SkipWithError("could not load the scene");
+    return;
+  }
+  assets.wait();
+  cam.image_width = convergence_width;
+
+  static std::map<std::string, std::vector<float>> references;
+  auto &reference = references[name];
+  if (reference.empty()) {
+    cam.sampling = sampler_type::sobol;
+    cam.prepare();
+    reference = render_means(world, cam, reference_samples_per_pixel);
+  }
+
+  cam.sampling = sampler_type(state.range(0));
+  cam.prepare();
+  std::vector<float> image;
+  for (auto _ : state) {
+    random_generator().seed(1);
+    image = render_means(world, cam, int(state.range(1)));
+  }
+
+  double squared_error = 0;
+  for (std::size_t v = 0; v < image.size(); v++) {
+    auto error = std::clamp(image[v], 0.0f, 1.0f) -
+                 std::clamp(reference[v], 0.0f, 1.0f);
+    squared_error += double(error) * error;
+  }
+  state.counters["rmse"] = std::sqrt(squared_error / double(image.size()));
+  state.SetLabel(sampler_type_names[state.range(0)]);
+}
+
+static void BM_image_output(benchmark::State &state) {
+  // Renders scenes/bouncing_spheres.scene at 400 pixels wide, writing it in the
+  // format of argument 0. Reports how long writing held up the end of the
+  // render, the time to encode the same image all at once after rendering,
+  // as the renderer used to, and the size of the file.
+  scene_description scene;
+  hittable_list world;
+  camera cam;
+  if (!load_scene_file(std::string(RAYTRACING_SOURCE_DIR) +
+                           "/scenes/bouncing_spheres.scene",
+                       scene) ||
+      !scene.build(world, cam)) {
+    state.SkipWithError("could not load the scene");
+    return;
+  }
+  cam.image_width = 400;
+  cam.samples_per_pixel = 2;
+  cam.thread_count = 1;
+  cam.show_progress = false;
+  auto format = image_format(state.range(0));
+
+  double stall_seconds = 0;
+  std::size_t bytes = 0;
+  for (auto _ : state) {
+    std::ostringstream image;
+    image_writer writer(image, format);
+    cam.render(world, writer);
+    stall_seconds += cam.last_render_stats().output_seconds;
+    bytes = image.str().size();
+  }
+
+  auto means = render_means(world, cam, cam.samples_per_pixel);
+  std::vector<color> pixels;
+  for (std::size_t v = 0; v < means.size(); v += 3)
+    pixels.emplace_back(means[v], means[v + 1], means[v + 2]);
+  auto encode_start = render_clock::now();
+  std::ostringstream whole;
+  write_image(whole, format, cam.image_width, cam.height(), pixels);
+  auto encode_seconds = seconds_between(encode_start, render_clock::now());
+
+  state.counters["stall_ms"] =
+      1000 * stall_seconds / double(state.iterations());
+  state.counters["encode_ms"] = 1000 * encode_seconds;
+  state.counters["kib"] = double(bytes) / 1024;
+  state.SetLabel(image_format_names[state.range(0)]);
+}
+BENCHMARK(BM_image_output)
+    ->DenseRange(0, image_format_count - 1)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+class cache_miss_counter {
+public:
+  // Counts the cache misses of this thread, and of threads it starts from now
+  // on once they have ended, where the kernel gives access to the hardware
+  // counters. Virtual machines often don't.
+  cache_miss_counter() {
+#ifdef __linux__
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+  }
+
+  ~cache_miss_counter() {
+#ifdef __linux__
+    if (fd >= 0)
+      close(fd);
+#endif
+  }
+
+  bool available() const { return fd >= 0; }
+
+  std::uint64_t count() const {
+    std::uint64_t value = 0;
+#ifdef __linux__
+    if (fd >= 0 && read(fd, &value, sizeof(value)) != sizeof(value))
+      value = 0;
+#endif
+    return value;
+  }
+
+private:
+  int fd = -1;
+};
+
+static const char *ray_sorting_scenes[] = {"bouncing_spheres", "cornell_box"};
+
+static void BM_ray_sorting(benchmark::State &state, const std::string &name) {
+  // Renders the scene with its rays traced pixel by pixel (argument 0) or a
+  // bounce at a time in sorted order (argument 1), reporting cache misses per
+  // ray where they can be counted.
+  scene_description scene;
+  asset_loader assets;
+  hittable_list world;
+  camera cam;
+  if (!load_scene_file(std::string(RAYTRACING_SOURCE_DIR) + "/scenes/" +
+                           name + ".scene",
+                       scene) ||
+      !scene.build(world, cam, assets)) {
+    state.SkipWithError("could not load the scene");
+    return;
+  }
+  assets.wait();
+  cam.sort_rays = state.range(0) != 0;
+
+  cache_miss_counter misses;
+  auto rays = render_scene(state, world, cam);
+  if (misses.available() && rays > 0)
+    state.counters["misses_per_ray"] = double(misses.count()) / double(rays);
+  state.SetLabel(cam.sort_rays ? "sorted" : "pixel order");
+}
+
+int main(int argc, char **argv) {
+  // Image textures are named relative to the top of the source tree.
+  auto images = std::string("RTW_IMAGES=") + RAYTRACING_SOURCE_DIR;
+  if (!std::getenv("RTW_IMAGES"))
+    putenv(images.data());
+
+  for (auto name : scene_names) {
+    benchmark::RegisterBenchmark(
+        (std::string("BM_scene/") + name).c_str(),
+        [name](benchmark::State &state) { BM_scene(state, name); })
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+  }
+
+  for (auto name : convergence_scenes) {
+    benchmark::RegisterBenchmark(
+        (std::string("BM_sampler_convergence/") + name).c_str(),
+        [name](benchmark::State &state) {
+          BM_sampler_convergence(state, name);
+        })
+        ->ArgsProduct({{0, 1, 2, 3}, {4, 16, 64}})
+        ->Unit(benchmark::kMillisecond);
+  }
+
+  for (auto name : ray_sorting_scenes) {
+    benchmark::RegisterBenchmark(
+        (std::string("BM_ray_sorting/") + name).c_str(),
+        [name](benchmark::State &state) { BM_ray_sorting(state, name); })
+        ->Arg(0)
+        ->Arg(1)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+  }
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -70,6 +70,43 @@ class aabb {
     return true;
   }
 
+  bool hit(const ray &r, interval ray_t, const aabb &close) const {
+    // Tests the ray against the box interpolated between this box, at shutter
+    // open, and the given box at shutter close, at the time of the ray. This
+    // is the same as hit() on interpolate(*this, close, r.time()), without
+    // building the intermediate box.
+    const point3 &ray_orig = r.origin();
+    const vec3 &ray_dir = r.direction();
+    const double time = r.time();
+
+    for (int axis = 0; axis < 3; axis++) {
+      const interval &ax0 = axis_interval(axis);
+      const interval &ax1 = close.axis_interval(axis);
+      const double adinv = 1.0 / ray_dir[axis];
+
+      auto min = ax0.min + time * (ax1.min - ax0.min);
+      auto max = ax0.max + time * (ax1.max - ax0.max);
+      auto t0 = (min - ray_orig[axis]) * adinv;
+      auto t1 = (max - ray_orig[axis]) * adinv;
+
+      if (t0 < t1) {
+        if (t0 > ray_t.min)
+          ray_t.min = t0;
+        if (t1 < ray_t.max)
+          ray_t.max = t1;
+      } else {
+        if (t1 > ray_t.min)
+          ray_t.min = t1;
+        if (t0 < ray_t.max)
+          ray_t.max = t0;
+      }
+
+      if (ray_t.max <= ray_t.min)
+        return false;
+    }
+    return true;
+  }
+
   int longest_axis() const {
     // Returns the index of the longest axis of the bounding box.
 
@@ -109,4 +146,15 @@ inline aabb operator+(const vec3 &offset, const aabb &bbox) {
   return bbox + offset;
 }
 
+inline aabb interpolate(const aabb &a, const aabb &b, double t) {
+  // Returns the box whose bounds are linearly interpolated between boxes a (at
+  // t = 0) and b (at t = 1). For objects that move linearly, this contains the
+  // object at every time in between.
+  auto lerp = [t](const interval &i0, const interval &i1) {
+    return interval(i0.min + t * (i1.min - i0.min),
+                    i0.max + t * (i1.max - i0.max));
+  };
+  return aabb(lerp(a.x, b.x), lerp(a.y, b.y), lerp(a.z, b.z));
+}
+
 #endif
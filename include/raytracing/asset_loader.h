@@ -0,0 +1,51 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include "raytracing/rtw_stb_image.h"
+#include "raytracing/rtweekend.h"
+#include "raytracing/texture.h"
+#include "raytracing/texture_cache.h"
+#include "raytracing/thread_pool.h"
+#include <future>
+#include <string>
+#include <vector>
+
+class asset_loader {
+public:
+  // Loads scene assets in the background during scene construction. Each load
+  // returns immediately with an object the scene can reference right away; the
+  // data it refers to is decoded on a thread pool, and is waited for only when
+  // it is first used.
+
+  asset_loader(unsigned thread_count = 0,
+               texture_cache &cache = texture_cache::global())
+      : cache(cache), pool(thread_count) {}
+
+  shared_ptr<image_texture>
+  load_image(const std::string &filename,
+             texture_filter filter = texture_filter::nearest, double lod = 0) {
+    // Starts decoding the image file through the texture cache, and returns a
+    // texture that samples it once the decode has finished.
+    auto &images = cache;
+    auto image =
+        pool.submit([&images, filename] { return images.acquire(filename); })
+            .share();
+
+    pending.push_back(image);
+    return make_shared<image_texture>(image, filter, lod);
+  }
+
+  void wait() {
+    // Blocks until every asset requested so far has finished loading.
+    for (auto &image : pending)
+      image.wait();
+    pending.clear();
+  }
+
+private:
+  texture_cache &cache;
+  thread_pool pool;
+  std::vector<std::shared_future<shared_ptr<const rtw_image>>> pending;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef BOX_H
+#define BOX_H
+
+#include "raytracing/aabb.h"
+#include "raytracing/hittable.h"
+#include "raytracing/interval.h"
+#include "raytracing/ray.h"
+#include "raytracing/render_stats.h"
+#include "raytracing/rtweekend.h"
+#include "raytracing/scene_arena.h"
+#include "raytracing/vec3.h"
+#include <cmath>
+#include <utility>
+
+class axis_aligned_box : public hittable {
+public:
+  // A solid box with faces parallel to the axes, between two opposite
+  // corners. A ray is tested against all six faces at once, as the span it
+  // spends between each pair of parallel planes. The faces have the normals
+  // and texture coordinates of the six quads box() used to build, so that
+  // textures land the same way on them.
+  axis_aligned_box(const point3 &a, const point3 &b, shared_ptr<material> mat)
+      : mat(mat) {
+    for (int axis = 0; axis < 3; axis++) {
+      min[axis] = std::fmin(a[axis], b[axis]);
+      max[axis] = std::fmax(a[axis], b[axis]);
+    }
+    bbox = aabb(min, max);
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    if (!intersect(r, ray_t, rec))
+      return false;
+    rec.finalize(r);
+    return true;
+  }
+
+  bool intersect(const ray &r, interval ray_t,
+                 hit_record &rec) const override {
+    RAYTRACING_COUNT(ray_primitive_tests);
+
+    interval span;
+    if (!slabs(r, span))
+      return false;
+
+    // The nearest face in the ray interval is where the ray enters, or where
+    // it leaves if it starts inside.
+    if (ray_t.contains(span.min))
+      rec.t = span.min;
+    else if (ray_t.contains(span.max))
+      rec.t = span.max;
+    else
+      return false;
+    rec.object = this;
+
+    RAYTRACING_COUNT(primitive_hits);
+    return true;
+  }
+
+  void finalize(const ray &r, hit_record &rec) const override {
+    // The face hit is the one whose plane the hit point lies nearest.
+    rec.p = r.at(rec.t);
+    int axis = 0;
+    bool max_face = false;
+    auto nearest = infinity;
+    for (int a = 0; a < 3; a++) {
+      auto to_min = std::fabs(rec.p[a] - min[a]);
+      auto to_max = std::fabs(rec.p[a] - max[a]);
+      if (to_min < nearest) {
+        nearest = to_min;
+        axis = a;
+        max_face = false;
+      }
+      if (to_max < nearest) {
+        nearest = to_max;
+        axis = a;
+        max_face = true;
+      }
+    }
+
+    rec.mat = mat;
+    set_face_uv(rec, axis, max_face);
+    vec3 outward_normal(0, 0, 0);
+    outward_normal[axis] = max_face ? 1 : -1;
+    rec.set_face_normal(r, outward_normal);
+  }
+
+  bool hit_span(const ray &r, interval &span) const override {
+    return slabs(r, span);
+  }
+
+private:
+  point3 min, max;
+  shared_ptr<material> mat;
+  aabb bbox;
+
+  bool slabs(const ray &r, interval &span) const {
+    // Intersects the spans between the planes of each pair of faces. The
+    // spans are found by dividing rather than by multiplying with the inverse
+    // direction, which gives the same t as a quad on each face.
+    span = interval::universe;
+    const auto &origin = r.origin();
+    const auto &direction = r.direction();
+    for (int axis = 0; axis < 3; axis++) {
+      if (direction[axis] == 0) {
+        // Parallel to the faces: inside the slab for all t, or never.
+        if (origin[axis] < min[axis] || origin[axis] > max[axis])
+          return false;
+        continue;
+      }
+
+      auto t0 = (min[axis] - origin[axis]) / direction[axis];
+      auto t1 = (max[axis] - origin[axis]) / direction[axis];
+      if (t0 > t1)
+        std::swap(t0, t1);
+      span.min = std::fmax(span.min, t0);
+      span.max = std::fmin(span.max, t1);
+    }
+    return span.min <= span.max;
+  }
+
+  void set_face_uv(hit_record &rec, int axis, bool max_face) const {
+    // Each face's u and v run along its quad's edge vectors from its corner.
+    if (axis == 0) {
+      rec.u = across(rec.p, 2, max_face); // Right, left
+      rec.v = across(rec.p, 1, false);
+    } else if (axis == 1) {
+      rec.u = across(rec.p, 0, false);
+      rec.v = across(rec.p, 2, max_face); // Top, bottom
+    } else {
+      rec.u = across(rec.p, 0, !max_face); // Front, back
+      rec.v = across(rec.p, 1, false);
+    }
+  }
+
+  double across(const point3 &p, int axis, bool from_max) const {
+    // How far p is across the box along the axis, from its min or max face,
+    // as a fraction of the box's size.
+    auto size = max[axis] - min[axis];
+    return from_max ? (max[axis] - p[axis]) / size
+                    : (p[axis] - min[axis]) / size;
+  }
+};
+
+inline shared_ptr<hittable>
+box(const point3 &a, const point3 &b, shared_ptr<material> mat,
+    const shared_ptr<scene_arena> &arena = nullptr) {
+  // Returns the 3D box that contains the two opposite vertices a & b, made in
+  // arena if one is given.
+  return make_in<axis_aligned_box>(arena, a, b, mat);
+}
+
+#endif
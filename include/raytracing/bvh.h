@@ -6,6 +6,7 @@
 #include "raytracing/hittable_list.h"
 #include "raytracing/interval.h"
 #include "raytracing/ray.h"
+#include "raytracing/render_stats.h"
 #include "raytracing/rtweekend.h"
 #include <algorithm>
 #include <cstddef>
@@ -13,21 +14,36 @@
 
 class bvh_node : public hittable {
 public:
-  bvh_node(hittable_list list)
-      : bvh_node(list.objects, 0, list.objects.size()) {
+  bvh_node(hittable_list list, bool motion_bounds = true)
+      : bvh_node(list.objects, 0, list.objects.size(), motion_bounds) {
     // There's a C++ subtlety here. This constructor (without span indices)
     // creates an implicit copy of the hittable list, which we will modify. The
     // lifetime of the copied list only extends until this constructor exits.
     // That's OK, because we only need to persist the resulting bounding volume
     // hierarchy.
+    //
+    // With motion_bounds set, each node also keeps its bounds at shutter open
+    // and close, and tests rays against the box interpolated to the ray's time
+    // instead of the box covering the whole shutter interval.
   }
 
   bvh_node(std::vector<shared_ptr<hittable>> &objects, size_t start,
-           size_t end) {
+           size_t end, bool motion_bounds = true) {
     // Build the bounding box of the span of source objects.
     bbox = aabb::empty;
-    for (size_t object_index = start; object_index < end; object_index++)
-      bbox = aabb(bbox, objects[object_index]->bounding_box());
+    bbox_open = aabb::empty;
+    bbox_close = aabb::empty;
+    for (size_t object_index = start; object_index < end; object_index++) {
+      const auto &object = objects[object_index];
+      bbox = aabb(bbox, object->bounding_box());
+      if (motion_bounds) {
+        bbox_open = aabb(bbox_open, object->bounding_box_at(0));
+        bbox_close = aabb(bbox_close, object->bounding_box_at(1));
+      }
+    }
+
+    // Interpolation only pays off if the bounds actually change over time.
+    moving = motion_bounds && !same_box(bbox_open, bbox_close);
 
     int axis = bbox.longest_axis();
 
@@ -47,28 +63,59 @@ class bvh_node : public hittable {
                 comparator);
 
       auto mid = start + object_span / 2;
-      left = make_shared<bvh_node>(objects, start, mid);
-      right = make_shared<bvh_node>(objects, mid, end);
+      left = make_shared<bvh_node>(objects, start, mid, motion_bounds);
+      right = make_shared<bvh_node>(objects, mid, end, motion_bounds);
     }
   }
 
   bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-    if (!bbox.hit(r, ray_t))
+    if (!intersect(r, ray_t, rec))
       return false;
+    rec.finalize(r);
+    return true;
+  }
 
-    bool hit_left = left->hit(r, ray_t, rec);
-    bool hit_right =
-        right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+  bool intersect(const ray &r, interval ray_t,
+                 hit_record &rec) const override {
+    RAYTRACING_COUNT(ray_node_visits);
+
+    if (moving) {
+      if (!bbox_open.hit(r, ray_t, bbox_close))
+        return false;
+    } else if (!bbox.hit(r, ray_t)) {
+      return false;
+    }
+
+    bool hit_left = left->intersect(r, ray_t, rec);
+    bool hit_right = right->intersect(
+        r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
 
     return hit_left || hit_right;
   }
 
   aabb bounding_box() const override { return bbox; }
 
+  aabb bounding_box_at(double time) const override {
+    return moving ? interpolate(bbox_open, bbox_close, time) : bbox;
+  }
+
 private:
   shared_ptr<hittable> left;
   shared_ptr<hittable> right;
-  aabb bbox;
+  aabb bbox;       // Bounds over the whole shutter interval
+  aabb bbox_open;  // Bounds at shutter open (time 0)
+  aabb bbox_close; // Bounds at shutter close (time 1)
+  bool moving = false;
+
+  static bool same_box(const aabb &a, const aabb &b) {
+    for (int axis = 0; axis < 3; axis++) {
+      const auto &ia = a.axis_interval(axis);
+      const auto &ib = b.axis_interval(axis);
+      if (ia.min != ib.min || ia.max != ib.max)
+        return false;
+    }
+    return true;
+  }
 
   static bool box_compare(const shared_ptr<hittable> a,
                           const shared_ptr<hittable> b, int axis_index) {
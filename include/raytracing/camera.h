@@ -3,13 +3,39 @@
 
 #include "raytracing/color.h"
 #include "raytracing/hittable.h"
+#include "raytracing/image_writer.h"
 #include "raytracing/interval.h"
 #include "raytracing/material.h"
+#include "raytracing/numa.h"
 #include "raytracing/ray.h"
+#include "raytracing/ray_sort.h"
+#include "raytracing/render_stats.h"
 #include "raytracing/rtweekend.h"
+#include "raytracing/sampler.h"
+#include "raytracing/thread_pool.h"
 #include "raytracing/vec3.h"
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// A rectangle of pixels, from x0,y0 up to but not including x1,y1.
+struct image_tile {
+  int x0, y0, x1, y1;
+};
+
+// What rendering one tile cost.
+struct tile_cost {
+  image_tile tile;
+  double seconds;     // Wall-clock time spent rendering the tile
+  std::uint64_t rays; // Rays traced, if trace_stats_enabled, else zero
+};
 
 class camera {
 public:
@@ -28,29 +54,186 @@ class camera {
   double focus_dist =
       10; // Distance from camera lookfrom point to plane of perfect focus
 
-  void render(const hittable &world) {
-    initialize();
+  sampler_type sampling = sampler_type::independent; // Source of samples
+  bool sort_rays = false; // Trace bounces in sorted batches, see trace_sorted()
 
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+  // The part of the frame to render, as fractions of its width and height
+  // from the top left corner. Only the pixels inside are traced, with the
+  // view of the whole frame, and the image is just that part of it.
+  double crop_x0 = 0, crop_y0 = 0, crop_x1 = 1, crop_y1 = 1;
+
+  int thread_count = 0;      // Render threads, or 0 for one per hardware thread
+  int tile_size = 32;        // Width and height of the square tiles rendered
+  bool show_progress = true; // Report progress and timings on std::clog
+  bool time_tiles = false;   // Record tile costs, see last_tile_costs()
+  int preview_levels = 3;    // Halvings of resolution previewed, see render()
+
+  // Called with each preview image render() makes, and the width and height
+  // of the blocks of pixels it is made of.
+  using preview_function =
+      std::function<void(const std::vector<color> &pixels, int block_size)>;
+
+  void render(const hittable &world) { render(world, std::cout); }
+
+  void render(const hittable &world, std::ostream &out) {
+    // Renders the image and writes it to out as an ASCII PPM image.
+    image_writer writer(out);
+    render(world, writer);
+  }
 
-    for (int j = 0; j < image_height; j++) {
-      std::clog << "\rScanlines remaining: " << (image_height - j) << ' '
-                << std::flush;
-      for (int i = 0; i < image_width; i++) {
-        color pixel_color(0, 0, 0);
-        for (int sample = 0; sample < samples_per_pixel; sample++) {
-          ray r = get_ray(i, j);
-          pixel_color += ray_color(r, max_depth, world);
+  void render(const hittable &world, image_writer &writer,
+              const preview_function &preview = nullptr) {
+    // Renders the image tile by tile on a pool of threads. Each row of tiles
+    // is handed to the writer as soon as its last tile is done, so the image
+    // is encoded and written while the rest of it renders.
+    //
+    // Given a preview function, the image is first rendered at 1/2, 1/4, ...
+    // of its resolution, coarsest first, up to preview_levels halvings. Each
+    // level traces the pixels on a grid twice as fine as the level before,
+    // leaving out those already traced, and passes preview the image with
+    // every traced pixel filling the block of pixels it stands for. Pixels
+    // are traced only once, so the previews come at no extra cost.
+    render(std::vector<const hittable *>{&world}, numa_topology(), writer,
+           preview);
+  }
+
+  void render(const std::vector<const hittable *> &replicas,
+              const numa_topology &topology, image_writer &writer,
+              const preview_function &preview = nullptr) {
+    // Renders as above, with the threads split between the nodes of the
+    // topology and pinned to their node's CPUs. The threads of node n trace
+    // replicas[n], a copy of the world that should be in node n's memory,
+    // such as one built by on_each_node(). Each node is given a band of
+    // tiles to render, and its threads help with the other nodes' tiles only
+    // once those of their own node are all taken.
+    render_job job(replicas, writer);
+    begin_render(job, preview ? preview_levels : 0);
+    {
+      thread_pool pool(topology, unsigned(std::max(thread_count, 0)));
+      for (int stride = job.coarsest; stride >= 1; stride /= 2) {
+        std::vector<std::future<void>> pending;
+        submit_tiles(job, pool, stride, pending);
+        for (std::size_t done = 0; done < pending.size(); done++) {
+          if (show_progress) {
+            std::clog << '\r';
+            if (stride > 1)
+              std::clog << "Preview 1/" << stride << ": ";
+            std::clog << "Tiles remaining: " << (pending.size() - done)
+                      << ' ' << std::flush;
+          }
+          pending[done].wait();
         }
-        write_color(std::cout, pixel_samples_scale * pixel_color);
+
+        if (stride > 1)
+          preview(blocky(job.pixels, job.width, stride), stride);
+      }
+    }
+
+    if (show_progress)
+      std::clog << "\rDone.                            \n";
+    end_render(job);
+  }
+
+  static void render_views(const hittable &world, std::vector<camera> &views,
+                           const std::vector<image_writer *> &writers,
+                           int thread_count = 0) {
+    // Renders the world as seen by each camera, writing the image of views[k]
+    // to writers[k]. The views share the world and its BVHs and textures,
+    // and their tiles go through one pool of threads: the next view's tiles
+    // are queued behind those of the view being rendered, so the threads
+    // never wait between views, and at most two views' images are held at
+    // once. Each view's own thread count and previews are ignored.
+    std::vector<std::unique_ptr<render_job>> jobs(views.size());
+    std::vector<std::vector<std::future<void>>> pending(views.size());
+    thread_pool pool(unsigned(std::max(thread_count, 0)));
+    auto start = [&](std::size_t k) {
+      if (k >= views.size())
+        return;
+      jobs[k] = std::make_unique<render_job>(
+          std::vector<const hittable *>{&world}, *writers[k]);
+      views[k].begin_render(*jobs[k], 0);
+      views[k].submit_tiles(*jobs[k], pool, 1, pending[k]);
+    };
+
+    start(0);
+    for (std::size_t k = 0; k < views.size(); k++) {
+      start(k + 1);
+      for (auto &tile : pending[k])
+        tile.wait();
+      pending[k].clear();
+
+      if (views[k].show_progress)
+        std::clog << "View " << k + 1 << " of " << views.size() << ":\n";
+      views[k].end_render(*jobs[k]);
+      jobs[k].reset();
+    }
+  }
+
+  void prepare() {
+    // Works out the image height and view from the settings above. render()
+    // does this itself; call it before the functions below.
+    initialize();
+  }
+
+  int height() const { return image_height; }
+
+  const image_tile &region() const {
+    // The pixels of the frame inside the crop window, which are those
+    // rendered. The image is as wide and high as the region.
+    return crop_region;
+  }
+
+  std::vector<image_tile> tiles() const {
+    // Splits the region into tiles, in scanline order.
+    std::vector<image_tile> result;
+    const auto &r = crop_region;
+    for (int y = r.y0; y < r.y1; y += tile_size)
+      for (int x = r.x0; x < r.x1; x += tile_size)
+        result.push_back({x, y, std::min(x + tile_size, r.x1),
+                          std::min(y + tile_size, r.y1)});
+    return result;
+  }
+
+  void render_samples(const hittable &world, const image_tile &tile,
+                      int sample_count, float *sums,
+                      int first_sample = 0) const {
+    // Adds sample_count samples of each pixel of the tile to sums, which holds
+    // an RGB triple for each pixel of the tile in scanline order. The samples
+    // of a pixel can be split between calls, possibly in other processes, and
+    // their sums added up; each call then starts at the sample after the last
+    // one of the call before, so the samples are those of a single call.
+    if (sort_rays) {
+      std::vector<color> colors(std::size_t(tile.x1 - tile.x0) *
+                                (tile.y1 - tile.y0));
+      trace_sorted(world, tile, first_sample, sample_count, colors.data());
+      for (const auto &pixel_color : colors)
+        for (int c = 0; c < 3; c++)
+          *sums++ += float(pixel_color[c]);
+      return;
+    }
+
+    sampler_scope samples(pixel_sampler.get());
+    for (int j = tile.y0; j < tile.y1; j++) {
+      for (int i = tile.x0; i < tile.x1; i++) {
+        auto pixel_color =
+            sample_pixel(i, j, first_sample, sample_count, world, samples);
+        for (int c = 0; c < 3; c++)
+          *sums++ += float(pixel_color[c]);
       }
     }
+  }
 
-    std::clog << "\rDone.                 \n";
+  const render_stats &last_render_stats() const { return stats; }
+
+  const std::vector<tile_cost> &last_tile_costs() const {
+    // The cost of each tile of the last render, in scanline order, if
+    // time_tiles was set.
+    return tile_costs;
   }
 
 private:
   int image_height;           // Rendered image height
+  image_tile crop_region;     // Pixels inside the crop window
   double pixel_samples_scale; // Color scale factor for a sum of pixel samples
   point3 center;              // Camera center
   point3 pixel00_loc;         // Location of pixel 0, 0
@@ -59,12 +242,313 @@ class camera {
   vec3 u, v, w;               // Camera frame basis vectors
   vec3 defocus_disk_u;        // Defocus disk horizontal radius
   vec3 defocus_disk_v;        // Defocus disk vertical radius
+  render_stats stats;         // Timings of the last render
+
+  std::vector<tile_cost> tile_costs; // Tile costs of the last render
+
+  shared_ptr<const sampler> pixel_sampler; // Null for independent samples
+
+  // The dimensions of the sampler each part of a path draws from. Each bounce
+  // has its own, for the medium it passes through and the material it
+  // scatters from.
+  static constexpr std::uint32_t pixel_dimensions = 0; // Two
+  static constexpr std::uint32_t lens_dimensions = 2;  // Two
+  static constexpr std::uint32_t time_dimension = 4;
+  static constexpr std::uint32_t bounce_dimensions = 6;
+  static constexpr std::uint32_t dimensions_per_bounce = 4;
+
+  // The most paths trace_sorted() traces at once.
+  static constexpr int sort_batch_size = 1 << 16;
+
+  // A path being traced by trace_sorted(), apart from its ray.
+  struct path_state {
+    color throughput;    // Product of the attenuations along the path so far
+    std::uint32_t pixel; // Index of the pixel in its tile
+    std::uint32_t sample;
+  };
+
+  // A render in progress: the image, and what its tile tasks share.
+  struct render_job {
+    render_job(const std::vector<const hittable *> &replicas,
+               image_writer &writer)
+        : replicas(replicas), writer(writer) {}
+
+    std::vector<const hittable *> replicas; // The world for each node
+    image_writer &writer;
+    render_clock::time_point start; // When rendering began
+    int width = 0, height = 0;      // Size of the region, and the image
+    std::vector<color> pixels;      // The region's pixels in scanline order
+    std::vector<image_tile> tiles;
+    std::vector<int> tiles_left; // Tiles of each row of tiles not yet done
+    int coarsest = 1;            // Stride of the first preview level, or 1
+    std::once_flag first_pixel;
+    std::mutex counters_mutex;
+    std::mutex rows_mutex;
+
+    const hittable &world() const {
+      // The copy of the world for the node of the calling thread.
+      return *replicas[std::size_t(thread_pool::current_node()) %
+                       replicas.size()];
+    }
+  };
+
+  void begin_render(render_job &job, int levels) {
+    // Sets the camera and the job up to render, with the given number of
+    // preview levels, and starts the writer.
+    job.start = render_clock::now();
+    initialize();
+
+    job.width = crop_region.x1 - crop_region.x0;
+    job.height = crop_region.y1 - crop_region.y0;
+    job.pixels.assign(std::size_t(job.width) * job.height, color(0, 0, 0));
+    job.coarsest = 1 << std::clamp(levels, 0, 8);
+    stats.counters = trace_counters();
+
+    job.tiles = tiles();
+    tile_costs.assign(time_tiles ? job.tiles.size() : 0, {});
+    for (std::size_t t = 0; t < tile_costs.size(); t++)
+      tile_costs[t].tile = job.tiles[t];
+
+    job.tiles_left.assign((job.height + tile_size - 1) / tile_size, 0);
+    for (const auto &tile : job.tiles)
+      job.tiles_left[(tile.y0 - crop_region.y0) / tile_size]++;
+    job.writer.start(job.width, job.height);
+  }
+
+  void submit_tiles(render_job &job, thread_pool &pool, int stride,
+                    std::vector<std::future<void>> &pending) {
+    // Queues a task for each tile to render the pixels of the level of the
+    // given stride. At the last level, stride one, each row of tiles goes to
+    // the writer as soon as its last tile is done. The tiles are split into
+    // as many bands as the pool has nodes, each queued for one node, so that
+    // each node renders a part of the image of its own.
+    auto tile_count = job.tiles.size();
+    for (std::size_t t = 0; t < tile_count; t++) {
+      int node = int(t * std::size_t(pool.node_count()) / tile_count);
+      pending.push_back(pool.submit_to(node, [this, &job, t, stride] {
+        auto tile_start = render_clock::now();
+        const auto &tile = job.tiles[t];
+        render_tile(job.world(), tile, job.pixels.data(), job.first_pixel,
+                    stride, job.coarsest);
+
+        // Each task has its own slot, and the thread's counters hold only
+        // this tile's counts until they are collected.
+        if (time_tiles) {
+          tile_costs[t].seconds +=
+              seconds_between(tile_start, render_clock::now());
+          tile_costs[t].rays += thread_trace_counters().rays();
+        }
+        collect_trace_counters(stats.counters, job.counters_mutex);
+        if (stride > 1)
+          return;
+
+        auto row = tile.y0 - crop_region.y0;
+        std::lock_guard<std::mutex> lock(job.rows_mutex);
+        if (--job.tiles_left[row / tile_size] == 0)
+          job.writer.add_rows(&job.pixels[std::size_t(row) * job.width], row,
+                              tile.y1 - crop_region.y0);
+      }));
+    }
+  }
+
+  void end_render(render_job &job) {
+    // Waits for the writer to finish the image, and records the timings.
+    stats.setup_seconds = seconds_between(program_start, job.start);
+    auto output_start = render_clock::now();
+    stats.render_seconds = seconds_between(job.start, output_start);
+
+    job.writer.finish();
+    stats.output_seconds = seconds_between(output_start, render_clock::now());
+
+    if (show_progress)
+      stats.report(std::clog);
+  }
+
+  void render_tile(const hittable &world, const image_tile &tile,
+                   color *pixels, std::once_flag &first_pixel, int stride = 1,
+                   int coarsest = 1) {
+    // Renders the pixels of one tile that belong to the level of the given
+    // stride (see in_level()) into the image buffer. Tiles don't overlap, so
+    // any number of them can be rendered concurrently. Sorted tracing works
+    // on whole tiles, so it is only used without previews.
+    auto width = crop_region.x1 - crop_region.x0;
+    auto pixel = [&](int i, int j) -> color & {
+      return pixels[std::size_t(j - crop_region.y0) * width +
+                    (i - crop_region.x0)];
+    };
+
+    if (sort_rays && coarsest == 1) {
+      std::vector<color> colors(std::size_t(tile.x1 - tile.x0) *
+                                (tile.y1 - tile.y0));
+      trace_sorted(world, tile, 0, samples_per_pixel, colors.data());
+      auto pixel_color = colors.begin();
+      for (int j = tile.y0; j < tile.y1; j++)
+        for (int i = tile.x0; i < tile.x1; i++)
+          pixel(i, j) = pixel_samples_scale * *pixel_color++;
+
+      std::call_once(first_pixel, [this] {
+        stats.time_to_first_pixel =
+            seconds_between(program_start, render_clock::now());
+      });
+      return;
+    }
+
+    sampler_scope samples(pixel_sampler.get());
+    for (int j = tile.y0; j < tile.y1; j++) {
+      for (int i = tile.x0; i < tile.x1; i++) {
+        if (!in_level(i, j, stride, coarsest))
+          continue;
+        auto pixel_color =
+            sample_pixel(i, j, 0, samples_per_pixel, world, samples);
+        pixel(i, j) = pixel_samples_scale * pixel_color;
+
+        std::call_once(first_pixel, [this] {
+          stats.time_to_first_pixel =
+              seconds_between(program_start, render_clock::now());
+        });
+      }
+    }
+  }
+
+  bool in_level(int i, int j, int stride, int coarsest) const {
+    // Whether pixel i, j is traced by the preview level whose pixels are
+    // stride apart: it is on that level's grid, counted from the corner of
+    // the region, and unless the level is the coarsest, not on the grid of
+    // the level before.
+    int x = i - crop_region.x0, y = j - crop_region.y0;
+    if (x % stride != 0 || y % stride != 0)
+      return false;
+    return stride == coarsest || (x / stride) % 2 != 0 ||
+           (y / stride) % 2 != 0;
+  }
+
+  static std::vector<color> blocky(const std::vector<color> &pixels,
+                                   int width, int stride) {
+    // Returns the image with each pixel on the grid of the given stride
+    // copied over the stride by stride block it is the top left corner of.
+    std::vector<color> result(pixels.size());
+    int height = int(pixels.size() / std::size_t(width));
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++)
+        result[std::size_t(y) * width + x] =
+            pixels[std::size_t(y / stride * stride) * width +
+                   x / stride * stride];
+    return result;
+  }
+
+  color sample_pixel(int i, int j, int first_sample, int sample_count,
+                     const hittable &world, sampler_scope &samples) const {
+    // Returns the sum of the given samples of pixel i, j.
+    color pixel_color(0, 0, 0);
+    for (int sample = first_sample; sample < first_sample + sample_count;
+         sample++) {
+      samples.start_sample(i, j, std::uint32_t(sample));
+      pixel_color += ray_color(get_ray(i, j), max_depth, world);
+    }
+    return pixel_color;
+  }
+
+  void trace_sorted(const hittable &world, const image_tile &tile,
+                    int first_sample, int sample_count, color *sums) const {
+    // Adds the given samples of each pixel of the tile to sums, as
+    // sample_pixel() would, but traces them a bounce at a time: every path's
+    // ray of one bounce is traced before any ray of the next. The camera rays
+    // go in pixel order; the scattered rays of each later bounce are sorted by
+    // ray_sort_key() first, so that rays starting near each other and heading
+    // the same way go through the BVH one after another. Paths are taken a
+    // few samples of every pixel at a time, at most sort_batch_size at once.
+    sampler_scope samples(pixel_sampler.get());
+    auto width = tile.x1 - tile.x0;
+    auto pixel_count = width * (tile.y1 - tile.y0);
+    auto batch_samples = std::max(1, sort_batch_size / pixel_count);
+    auto bounds = world.bounding_box();
+
+    std::vector<ray> rays, next_rays;
+    std::vector<path_state> paths, next_paths;
+    std::vector<std::uint32_t> order;
+    auto end_sample = first_sample + sample_count;
+    for (int first = first_sample; first < end_sample; first += batch_samples) {
+      auto last = std::min(first + batch_samples, end_sample);
+      rays.clear();
+      paths.clear();
+      for (int p = 0; p < pixel_count; p++) {
+        for (int sample = first; sample < last; sample++) {
+          samples.start_sample(tile.x0 + p % width, tile.y0 + p / width,
+                               std::uint32_t(sample));
+          rays.push_back(get_ray(tile.x0 + p % width, tile.y0 + p / width));
+          paths.push_back(
+              {color(1, 1, 1), std::uint32_t(p), std::uint32_t(sample)});
+        }
+      }
+
+      for (int depth = 0; depth < max_depth && !rays.empty(); depth++) {
+        if (depth == 0) {
+          order.resize(rays.size());
+          for (std::size_t k = 0; k < order.size(); k++)
+            order[k] = std::uint32_t(k);
+        } else {
+          sort_ray_order(rays, bounds, order);
+        }
+
+        next_rays.clear();
+        next_paths.clear();
+        for (auto k : order) {
+          const auto &path = paths[k];
+          auto p = int(path.pixel);
+          samples.start_sample(tile.x0 + p % width, tile.y0 + p / width,
+                               path.sample);
+          start_sample_dimensions(
+              bounce_dimensions + dimensions_per_bounce * depth,
+              dimensions_per_bounce);
+
+          hit_record rec;
+          RAYTRACING_BEGIN_RAY();
+          bool hit = world.hit(rays[k], interval(0.001, infinity), rec);
+          RAYTRACING_END_RAY(depth);
+
+          if (!hit) {
+            RAYTRACING_COUNT(escaped);
+            sums[p] += path.throughput * background;
+            continue;
+          }
+
+          ray scattered;
+          color attenuation;
+          sums[p] += path.throughput * rec.mat->emitted(rec.u, rec.v, rec.p);
+          if (!rec.mat->scatter(rays[k], rec, attenuation, scattered)) {
+            RAYTRACING_COUNT(absorbed);
+            continue;
+          }
+
+          next_rays.push_back(scattered);
+          next_paths.push_back(
+              {path.throughput * attenuation, path.pixel, path.sample});
+        }
+        rays.swap(next_rays);
+        paths.swap(next_paths);
+      }
+
+      // Paths still going have reached the bounce limit.
+      RAYTRACING_ADD(depth_limited, rays.size());
+    }
+  }
 
   void initialize() {
     image_height = int(image_width / aspect_ratio);
     image_height = (image_height < 1) ? 1 : image_height;
 
     pixel_samples_scale = 1.0 / samples_per_pixel;
+    pixel_sampler = make_sampler(sampling);
+
+    // Crop window edges fall on the pixel boundaries right of or below
+    // them, and the region keeps at least one pixel.
+    auto edge = [](double fraction, int size) {
+      return int(std::ceil(std::clamp(fraction, 0.0, 1.0) * size));
+    };
+    crop_region.x0 = std::min(edge(crop_x0, image_width), image_width - 1);
+    crop_region.y0 = std::min(edge(crop_y0, image_height), image_height - 1);
+    crop_region.x1 = std::max(edge(crop_x1, image_width), crop_region.x0 + 1);
+    crop_region.y1 = std::max(edge(crop_y1, image_height), crop_region.y0 + 1);
 
     center = lookfrom;
 
@@ -107,12 +591,16 @@ class camera {
     // Construct a camera ray originating from the defocus disk and directed at
     // a randomly sampled point around the pixel location i, j.
 
+    start_sample_dimensions(pixel_dimensions, 2);
     auto offset = sample_square();
     auto pixel_sample = pixel00_loc + ((i + offset.x()) * pixel_delta_u) +
                         ((j + offset.y()) * pixel_delta_v);
 
+    start_sample_dimensions(lens_dimensions, 2);
     auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
     auto ray_direction = pixel_sample - ray_origin;
+
+    start_sample_dimensions(time_dimension, 1);
     auto ray_time = random_double();
 
     return ray(ray_origin, ray_direction, ray_time);
@@ -134,21 +622,35 @@ class camera {
 
   color ray_color(const ray &r, int depth, const hittable &world) const {
     // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
+    if (depth <= 0) {
+      RAYTRACING_COUNT(depth_limited);
       return color(0, 0, 0);
+    }
+
+    start_sample_dimensions(
+        bounce_dimensions + dimensions_per_bounce * (max_depth - depth),
+        dimensions_per_bounce);
 
     hit_record rec;
 
+    RAYTRACING_BEGIN_RAY();
+    bool hit = world.hit(r, interval(0.001, infinity), rec);
+    RAYTRACING_END_RAY(max_depth - depth);
+
     // If the ray hits nothing, return the background color.
-    if (!world.hit(r, interval(0.001, infinity), rec))
+    if (!hit) {
+      RAYTRACING_COUNT(escaped);
       return background;
+    }
 
     ray scattered;
     color attenuation;
     color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
 
-    if (!rec.mat->scatter(r, rec, attenuation, scattered))
+    if (!rec.mat->scatter(r, rec, attenuation, scattered)) {
+      RAYTRACING_COUNT(absorbed);
       return color_from_emission;
+    }
 
     color color_from_scatter =
         attenuation * ray_color(scattered, depth - 1, world);
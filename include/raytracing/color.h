@@ -15,24 +15,23 @@ inline double linear_to_gamma(double linear_component) {
   return 0;
 }
 
-inline void write_color(std::ostream &out, const color &pixel_color) {
-  auto r = pixel_color.x();
-  auto g = pixel_color.y();
-  auto b = pixel_color.z();
-
-  // Apply a linear to gamma transform for gamma 2
-  r = linear_to_gamma(r);
-  g = linear_to_gamma(g);
-  b = linear_to_gamma(b);
-
-  // Translate the [0,1] component values to the byte range [0,255].
+inline void color_to_bytes(const color &pixel_color, unsigned char *rgb) {
+  // Converts a linear color to the three bytes of an 8-bit image.
   static const interval intensity(0.000, 0.999);
-  int rbyte = int(256 * intensity.clamp(r));
-  int gbyte = int(256 * intensity.clamp(g));
-  int bbyte = int(256 * intensity.clamp(b));
+  for (int c = 0; c < 3; c++) {
+    // Apply a linear to gamma transform for gamma 2, then translate the [0,1]
+    // component value to the byte range [0,255].
+    auto value = linear_to_gamma(pixel_color[c]);
+    rgb[c] = (unsigned char)(256 * intensity.clamp(value));
+  }
+}
+
+inline void write_color(std::ostream &out, const color &pixel_color) {
+  unsigned char rgb[3];
+  color_to_bytes(pixel_color, rgb);
 
   // Write out the pixel color components.
-  out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
+  out << int(rgb[0]) << ' ' << int(rgb[1]) << ' ' << int(rgb[2]) << '\n';
 }
 
 #endif
@@ -25,33 +25,30 @@ class constant_medium : public hittable {
         phase_function(make_shared<isotropic>(albedo)) {}
 
   bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-    hit_record rec1, rec2;
-
-    if (!boundary->hit(r, interval::universe, rec1))
-      return false;
-
-    if (!boundary->hit(r, interval(rec1.t + 0.0001, infinity), rec2))
+    // Where the ray's line enters and leaves the boundary.
+    interval span;
+    if (!boundary->hit_span(r, span))
       return false;
 
-    if (rec1.t < ray_t.min)
-      rec1.t = ray_t.min;
-    if (rec2.t > ray_t.max)
-      rec2.t = ray_t.max;
+    if (span.min < ray_t.min)
+      span.min = ray_t.min;
+    if (span.max > ray_t.max)
+      span.max = ray_t.max;
 
-    if (rec1.t >= rec2.t)
+    if (span.min >= span.max)
       return false;
 
-    if (rec1.t < 0)
-      rec1.t = 0;
+    if (span.min < 0)
+      span.min = 0;
 
     auto ray_length = r.direction().length();
-    auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
+    auto distance_inside_boundary = (span.max - span.min) * ray_length;
     auto hit_distance = neg_inv_density * std::log(random_double());
 
     if (hit_distance > distance_inside_boundary)
       return false;
 
-    rec.t = rec1.t + hit_distance / ray_length;
+    rec.t = span.min + hit_distance / ray_length;
     rec.p = r.at(rec.t);
 
     rec.normal = vec3(1, 0, 0); // arbitrary
@@ -63,6 +60,10 @@ class constant_medium : public hittable {
 
   aabb bounding_box() const override { return boundary->bounding_box(); }
 
+  aabb bounding_box_at(double time) const override {
+    return boundary->bounding_box_at(time);
+  }
+
 private:
   shared_ptr<hittable> boundary;
   double neg_inv_density;
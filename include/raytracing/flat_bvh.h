@@ -0,0 +1,526 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include "raytracing/aabb.h"
+#include "raytracing/hittable.h"
+#include "raytracing/interval.h"
+#include "raytracing/ray.h"
+#include "raytracing/render_stats.h"
+#include "raytracing/rtweekend.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+// A node of a flat_bvh. Nodes are plain data, so a hierarchy can be saved to a
+// file and used straight from a memory mapping of it.
+struct flat_bvh_node {
+  double bounds[2][6]; // Min and max x, y, z at shutter open and close
+  std::uint32_t first; // Leaf: index of first object; interior: second child
+  std::uint16_t count; // Leaf: count of objects; interior: zero
+  std::uint8_t axis;   // Interior: axis the children were split along
+  std::uint8_t moving; // Whether the bounds change over the shutter interval
+};
+
+// The arrays that make up a flat_bvh, which may live in memory owned by the
+// hierarchy or in a memory mapped file.
+struct flat_bvh_layout {
+  const flat_bvh_node *nodes = nullptr;
+  std::size_t node_count = 0;
+  const std::uint32_t *order = nullptr; // Original index of each leaf object
+  std::size_t object_count = 0;
+  shared_ptr<const void> storage; // Keeps the arrays alive
+};
+
+class flat_bvh : public hittable {
+public:
+  // A bounding volume hierarchy stored as an array of nodes in depth-first
+  // order, traversed with an explicit stack. The first child of an interior
+  // node directly follows it, and the objects of each leaf are contiguous.
+  // It splits objects at the median along the longest axis like bvh_node, and
+  // likewise keeps the bounds at shutter open and close for moving objects.
+
+  flat_bvh(const std::vector<shared_ptr<hittable>> &objects) {
+    // Builds the hierarchy over the given objects.
+    auto built = make_shared<owned_arrays>();
+    built->order.resize(objects.size());
+    std::iota(built->order.begin(), built->order.end(), 0);
+
+    // Object bounds are looked up at every level, so find them only once.
+    std::vector<object_bounds> bounds;
+    bounds.reserve(objects.size());
+    for (const auto &object : objects)
+      bounds.push_back({object->bounding_box(), object->bounding_box_at(0),
+                        object->bounding_box_at(1)});
+
+    if (!objects.empty())
+      build(bounds, built->order, 0, objects.size(), built->nodes);
+
+    owned = built;
+    adopt(objects, {built->nodes.data(), built->nodes.size(),
+                    built->order.data(), built->order.size(), built});
+  }
+
+  flat_bvh(const std::vector<shared_ptr<hittable>> &objects,
+           const flat_bvh_layout &layout) {
+    // Uses a hierarchy built earlier over the same objects, which must be
+    // valid for them (see is_valid()).
+    adopt(objects, layout);
+  }
+
+  static flat_bvh_layout copy(const flat_bvh_layout &arrays) {
+    // Returns a copy of the arrays that owns its memory, for example to take a
+    // hierarchy out of a memory mapped file into memory local to this thread.
+    auto copied = make_shared<owned_arrays>();
+    copied->nodes.assign(arrays.nodes, arrays.nodes + arrays.node_count);
+    copied->order.assign(arrays.order, arrays.order + arrays.object_count);
+    return {copied->nodes.data(), copied->nodes.size(), copied->order.data(),
+            copied->order.size(), copied};
+  }
+
+  static bool is_valid(const flat_bvh_layout &layout,
+                       std::size_t object_count) {
+    // Returns whether the layout describes a well formed hierarchy over the
+    // given number of objects, so it is safe to traverse.
+    if (layout.object_count != object_count)
+      return false;
+    for (std::size_t i = 0; i < object_count; i++)
+      if (layout.order[i] >= object_count)
+        return false;
+
+    // Children follow their parent, so depths can be found in one pass. A
+    // node with two parents would take the depth of the later one, which may
+    // be shallower, so only trees are accepted.
+    std::vector<std::uint8_t> depth(layout.node_count, 0);
+    std::vector<char> has_parent(layout.node_count, 0);
+    for (std::size_t i = 0; i < layout.node_count; i++) {
+      const auto &node = layout.nodes[i];
+      if (node.count > 0) {
+        if (std::size_t(node.first) + node.count > object_count)
+          return false;
+        continue;
+      }
+
+      if (node.first <= i + 1 || node.first >= layout.node_count ||
+          node.axis > 2 || depth[i] + 1 >= max_depth ||
+          has_parent[i + 1] || has_parent[node.first])
+        return false;
+      has_parent[i + 1] = has_parent[node.first] = 1;
+      depth[i + 1] = depth[node.first] = std::uint8_t(depth[i] + 1);
+    }
+    return true;
+  }
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    if (!intersect(r, ray_t, rec))
+      return false;
+    rec.finalize(r);
+    return true;
+  }
+
+  bool intersect(const ray &r, interval ray_t,
+                 hit_record &rec) const override {
+    if (layout.node_count == 0)
+      return false;
+
+    // Per-ray values for the slab tests.
+    const point3 &origin = r.origin();
+    const double time = r.time();
+    double inv_dir[3];
+    for (int axis = 0; axis < 3; axis++)
+      inv_dir[axis] = 1.0 / r.direction()[axis];
+
+    // A median split hierarchy is at most about log2(objects) deep.
+    std::uint32_t stack[max_depth];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    bool hit_anything = false;
+    while (stack_size > 0) {
+      auto index = stack[--stack_size];
+      const auto &node = layout.nodes[index];
+      RAYTRACING_COUNT(ray_node_visits);
+      if (!node_hit(node, origin, inv_dir, time, ray_t))
+        continue;
+
+      if (node.count > 0) {
+        for (std::uint32_t i = node.first; i < node.first + node.count; i++) {
+          if (objects[i]->intersect(r, ray_t, rec)) {
+            hit_anything = true;
+            ray_t.max = rec.t;
+          }
+        }
+        continue;
+      }
+
+      // Visit the child nearer to the ray origin first, so that the closer
+      // hit culls more of the other.
+      auto first_child = index + 1, second_child = node.first;
+      if (inv_dir[node.axis] < 0)
+        std::swap(first_child, second_child);
+      stack[stack_size++] = second_child;
+      stack[stack_size++] = first_child;
+    }
+
+    return hit_anything;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  aabb bounding_box_at(double time) const override {
+    if (layout.node_count == 0 || !layout.nodes[0].moving)
+      return bbox;
+    return interpolate(box(layout.nodes[0], 0), box(layout.nodes[0], 1), time);
+  }
+
+  const flat_bvh_layout &arrays() const { return layout; }
+
+  // What update() did to the hierarchy, from least to most work.
+  enum class update_kind { refit, partial_rebuild, full_rebuild };
+
+  double partial_rebuild_ratio = 1.5; // Growth of a subtree's surface area
+  double full_rebuild_ratio = 2.0;    // Growth of the whole tree's SAH cost
+
+  update_kind update() {
+    // Brings the hierarchy up to date after its objects moved: refits it, then
+    // rebuilds the subtrees whose surface area grew by more than
+    // partial_rebuild_ratio since they were built, or the whole hierarchy if
+    // its SAH cost grew by more than full_rebuild_ratio. Must not be called
+    // while rays are being traced.
+    if (layout.node_count == 0)
+      return update_kind::refit;
+    if (built_area.empty())
+      record_quality();
+
+    refit();
+    if (sah_cost() > full_rebuild_ratio * built_cost) {
+      rebuild();
+      return update_kind::full_rebuild;
+    }
+
+    // Rebuild the highest subtrees that degraded; their descendants are then
+    // fresh. The root is left out, since its bounds are the same either way.
+    auto kind = update_kind::refit;
+    std::uint32_t i = 1;
+    while (i < layout.node_count) {
+      const auto &node = layout.nodes[i];
+      if (node.count == 0 &&
+          area(node) > partial_rebuild_ratio * built_area[i]) {
+        if (!rebuild_subtree(i))
+          return update_kind::full_rebuild;
+        kind = update_kind::partial_rebuild;
+        i = subtree_end(i);
+      } else {
+        i++;
+      }
+    }
+    return kind;
+  }
+
+  void refit() {
+    // Updates the bounds of every node to those of the objects below it in
+    // place, keeping the tree's structure. Children follow their parent, so
+    // going through the nodes backwards reaches both before the parent.
+    auto &nodes = writable_arrays().nodes;
+    for (auto i = nodes.size(); i-- > 0;) {
+      auto &node = nodes[i];
+      aabb open = aabb::empty, close = aabb::empty;
+      if (node.count > 0) {
+        for (auto k = node.first; k < node.first + node.count; k++) {
+          open = aabb(open, objects[k]->bounding_box_at(0));
+          close = aabb(close, objects[k]->bounding_box_at(1));
+        }
+      } else {
+        const auto &a = nodes[i + 1], &b = nodes[node.first];
+        open = aabb(box(a, 0), box(b, 0));
+        close = aabb(box(a, 1), box(b, 1));
+      }
+      set_bounds(node, 0, open);
+      set_bounds(node, 1, close);
+      node.moving = !same_bounds(node);
+    }
+    update_bbox();
+  }
+
+  void rebuild() {
+    // Builds the whole hierarchy again over its objects' current bounds.
+    auto &arrays = writable_arrays();
+    std::vector<std::uint32_t> order;
+    std::vector<flat_bvh_node> nodes;
+    build_range(0, objects.size(), order, nodes);
+    arrays.nodes = std::move(nodes);
+    reorder(arrays, 0, order);
+    record_quality();
+  }
+
+  double sah_cost() const {
+    // The surface area heuristic cost of tracing a ray through the hierarchy,
+    // relative to the cost of one object test: the expected count of node
+    // visits and object tests for a ray that hits the root.
+    if (layout.node_count == 0)
+      return 0;
+    auto root_area = area(layout.nodes[0]);
+    if (root_area <= 0)
+      return 0;
+
+    double cost = 0;
+    for (std::size_t i = 0; i < layout.node_count; i++) {
+      const auto &node = layout.nodes[i];
+      cost += area(node) / root_area * (node.count > 0 ? node.count : 1);
+    }
+    return cost;
+  }
+
+private:
+  static constexpr int max_depth = 64;
+
+  struct object_bounds {
+    aabb whole; // Over the whole shutter interval
+    aabb open;  // At shutter open
+    aabb close; // At shutter close
+  };
+
+  struct owned_arrays {
+    std::vector<flat_bvh_node> nodes;
+    std::vector<std::uint32_t> order;
+  };
+
+  flat_bvh_layout layout;
+  std::vector<shared_ptr<hittable>> objects; // In leaf order
+  aabb bbox;
+
+  // Set once the hierarchy is in arrays it may change, see writable_arrays().
+  shared_ptr<owned_arrays> owned;
+
+  // Quality when each node was last built, found by the first update().
+  std::vector<double> built_area;
+  double built_cost = 0;
+
+  void adopt(const std::vector<shared_ptr<hittable>> &source,
+             const flat_bvh_layout &arrays) {
+    layout = arrays;
+    objects.reserve(layout.object_count);
+    for (std::size_t i = 0; i < layout.object_count; i++)
+      objects.push_back(source[layout.order[i]]);
+    update_bbox();
+  }
+
+  void update_bbox() {
+    bbox = aabb::empty;
+    if (layout.node_count > 0)
+      bbox = aabb(box(layout.nodes[0], 0), box(layout.nodes[0], 1));
+  }
+
+  owned_arrays &writable_arrays() {
+    // Returns the arrays to change, first copying a hierarchy used from a
+    // memory mapped file. Pointers into them are refreshed on every call, so
+    // callers may resize them.
+    if (!owned) {
+      owned = make_shared<owned_arrays>();
+      owned->nodes.assign(layout.nodes, layout.nodes + layout.node_count);
+      owned->order.assign(layout.order, layout.order + layout.object_count);
+    }
+    layout = {owned->nodes.data(), owned->nodes.size(), owned->order.data(),
+              owned->order.size(), owned};
+    return *owned;
+  }
+
+  void build_range(std::size_t first, std::size_t end,
+                   std::vector<std::uint32_t> &order,
+                   std::vector<flat_bvh_node> &nodes) const {
+    // Builds a subtree over the objects in leaf positions [first, end), with
+    // node and object indices relative to the subtree. order receives the
+    // new leaf order, as offsets from first.
+    std::vector<object_bounds> bounds;
+    bounds.reserve(end - first);
+    for (auto i = first; i < end; i++)
+      bounds.push_back({objects[i]->bounding_box(),
+                        objects[i]->bounding_box_at(0),
+                        objects[i]->bounding_box_at(1)});
+
+    order.resize(end - first);
+    std::iota(order.begin(), order.end(), 0);
+    if (end > first)
+      build(bounds, order, 0, end - first, nodes);
+  }
+
+  void reorder(owned_arrays &arrays, std::size_t first,
+               const std::vector<std::uint32_t> &order) {
+    // Puts the objects from leaf position first on into their new order.
+    std::vector<shared_ptr<hittable>> moved(order.size());
+    std::vector<std::uint32_t> original(order.size());
+    for (std::size_t i = 0; i < order.size(); i++) {
+      moved[i] = objects[first + order[i]];
+      original[i] = arrays.order[first + order[i]];
+    }
+    std::move(moved.begin(), moved.end(), objects.begin() + first);
+    std::copy(original.begin(), original.end(), arrays.order.begin() + first);
+    writable_arrays();
+    update_bbox();
+  }
+
+  bool rebuild_subtree(std::uint32_t root) {
+    // Rebuilds the subtree at root in place. A median split subtree's shape
+    // depends only on its object count, so the new one fits exactly where the
+    // old one was; one that doesn't (from a snapshot of another build) makes
+    // for a full rebuild instead, and false is returned.
+    auto end_node = subtree_end(root);
+    auto first = root, last = end_node - 1;
+    while (layout.nodes[first].count == 0)
+      first++;
+    auto first_object = layout.nodes[first].first;
+    auto end_object = layout.nodes[last].first + layout.nodes[last].count;
+
+    std::vector<std::uint32_t> order;
+    std::vector<flat_bvh_node> nodes;
+    build_range(first_object, end_object, order, nodes);
+    if (nodes.size() != end_node - root) {
+      rebuild();
+      return false;
+    }
+
+    // Renumber the subtree's nodes and objects into their place in the tree.
+    auto &arrays = writable_arrays();
+    for (std::size_t i = 0; i < nodes.size(); i++) {
+      auto &node = nodes[i];
+      node.first += node.count > 0 ? first_object : root;
+      arrays.nodes[root + i] = node;
+      built_area[root + i] = area(node);
+    }
+    reorder(arrays, first_object, order);
+    return true;
+  }
+
+  std::uint32_t subtree_end(std::uint32_t index) const {
+    // Returns the index just past the subtree at index. The second child's
+    // subtree comes last, so follow second children down to a leaf.
+    while (layout.nodes[index].count == 0)
+      index = layout.nodes[index].first;
+    return index + 1;
+  }
+
+  void record_quality() {
+    built_area.resize(layout.node_count);
+    for (std::size_t i = 0; i < layout.node_count; i++)
+      built_area[i] = area(layout.nodes[i]);
+    built_cost = sah_cost();
+  }
+
+  static double area(const flat_bvh_node &node) {
+    // Surface area of the node's bounds over the whole shutter interval.
+    const double *open = node.bounds[0], *close = node.bounds[1];
+    double size[3];
+    for (int axis = 0; axis < 3; axis++)
+      size[axis] = std::fmax(open[2 * axis + 1], close[2 * axis + 1]) -
+                   std::fmin(open[2 * axis], close[2 * axis]);
+    return 2 * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+  }
+
+  static aabb box(const flat_bvh_node &node, int when) {
+    const double *b = node.bounds[when];
+    return aabb(interval(b[0], b[1]), interval(b[2], b[3]),
+                interval(b[4], b[5]));
+  }
+
+  static bool node_hit(const flat_bvh_node &node, const point3 &origin,
+                       const double *inv_dir, double time, interval ray_t) {
+    // Slab test against the node's bounds, interpolated to the ray's time if
+    // the node moves.
+    const double *open = node.bounds[0];
+    const double *close = node.bounds[1];
+
+    for (int axis = 0; axis < 3; axis++) {
+      auto min = open[2 * axis];
+      auto max = open[2 * axis + 1];
+      if (node.moving) {
+        min += time * (close[2 * axis] - min);
+        max += time * (close[2 * axis + 1] - max);
+      }
+
+      auto t0 = (min - origin[axis]) * inv_dir[axis];
+      auto t1 = (max - origin[axis]) * inv_dir[axis];
+      if (t0 > t1)
+        std::swap(t0, t1);
+
+      if (t0 > ray_t.min)
+        ray_t.min = t0;
+      if (t1 < ray_t.max)
+        ray_t.max = t1;
+
+      if (ray_t.max <= ray_t.min)
+        return false;
+    }
+    return true;
+  }
+
+  static void set_bounds(flat_bvh_node &node, int when, const aabb &box) {
+    for (int axis = 0; axis < 3; axis++) {
+      node.bounds[when][2 * axis] = box.axis_interval(axis).min;
+      node.bounds[when][2 * axis + 1] = box.axis_interval(axis).max;
+    }
+  }
+
+  static std::uint32_t build(const std::vector<object_bounds> &source,
+                             std::vector<std::uint32_t> &order,
+                             std::size_t start, std::size_t end,
+                             std::vector<flat_bvh_node> &nodes) {
+    // Appends the subtree over order[start, end) to nodes, and returns the
+    // index of its root.
+    auto index = std::uint32_t(nodes.size());
+    nodes.emplace_back();
+
+    aabb bbox = aabb::empty, open = aabb::empty, close = aabb::empty;
+    for (auto i = start; i < end; i++) {
+      const auto &object = source[order[i]];
+      bbox = aabb(bbox, object.whole);
+      open = aabb(open, object.open);
+      close = aabb(close, object.close);
+    }
+
+    int axis = bbox.longest_axis();
+    auto object_span = end - start;
+
+    // Leaves hold up to two objects, as in bvh_node.
+    if (object_span <= 2) {
+      auto &leaf = nodes[index];
+      set_bounds(leaf, 0, open);
+      set_bounds(leaf, 1, close);
+      leaf.first = std::uint32_t(start);
+      leaf.count = std::uint16_t(object_span);
+      leaf.axis = std::uint8_t(axis);
+      leaf.moving = !same_bounds(leaf);
+      return index;
+    }
+
+    // Only the halves matter, so partition around the median rather than
+    // sorting the whole span.
+    auto mid = start + object_span / 2;
+    std::nth_element(order.begin() + start, order.begin() + mid,
+                     order.begin() + end,
+                     [&](std::uint32_t a, std::uint32_t b) {
+                       return source[a].whole.axis_interval(axis).min <
+                              source[b].whole.axis_interval(axis).min;
+                     });
+
+    build(source, order, start, mid, nodes);
+    auto second = build(source, order, mid, end, nodes);
+
+    // Children were appended, so take the reference to this node only now.
+    auto &node = nodes[index];
+    set_bounds(node, 0, open);
+    set_bounds(node, 1, close);
+    node.first = second;
+    node.count = 0;
+    node.axis = std::uint8_t(axis);
+    node.moving = !same_bounds(node);
+    return index;
+  }
+
+  static bool same_bounds(const flat_bvh_node &node) {
+    return std::equal(node.bounds[0], node.bounds[0] + 6, node.bounds[1]);
+  }
+};
+
+#endif
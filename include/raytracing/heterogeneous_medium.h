@@ -0,0 +1,313 @@
+#ifndef HETEROGENEOUS_MEDIUM_H
+#define HETEROGENEOUS_MEDIUM_H
+
+#include "raytracing/aabb.h"
+#include "raytracing/color.h"
+#include "raytracing/hittable.h"
+#include "raytracing/interval.h"
+#include "raytracing/material.h"
+#include "raytracing/ray.h"
+#include "raytracing/rtweekend.h"
+#include "raytracing/texture.h"
+#include "raytracing/vec3.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+class density_grid {
+public:
+  // A 3D grid of density values, stored as bricks of brick_size^3 voxels.
+  // Bricks whose voxels all share one value (typically the empty space around
+  // smoke or clouds) are stored as that single value, so sparse volumes only
+  // pay for the bricks that actually vary. The maximum of each brick doubles
+  // as a coarse majorant grid for tracking through the volume.
+
+  static const int brick_size = 8;
+
+  density_grid() {}
+
+  density_grid(int nx, int ny, int nz, const std::vector<float> &values)
+      : nx(nx), ny(ny), nz(nz) {
+    // Builds the grid from dense values, ordered with x varying fastest, then
+    // y, then z.
+
+    bx = (nx + brick_size - 1) / brick_size;
+    by = (ny + brick_size - 1) / brick_size;
+    bz = (nz + brick_size - 1) / brick_size;
+
+    brick_offset.assign(std::size_t(bx) * by * bz, uniform_brick);
+    brick_value.assign(brick_offset.size(), 0.0f);
+    brick_max.assign(brick_offset.size(), 0.0f);
+
+    auto dense = [&](int x, int y, int z) {
+      x = std::min(x, nx - 1);
+      y = std::min(y, ny - 1);
+      z = std::min(z, nz - 1);
+      return values[(std::size_t(z) * ny + y) * nx + x];
+    };
+
+    for (int k = 0; k < bz; k++) {
+      for (int j = 0; j < by; j++) {
+        for (int i = 0; i < bx; i++) {
+          auto brick = brick_index(i, j, k);
+          auto first = dense(i * brick_size, j * brick_size, k * brick_size);
+          auto max = first;
+          bool uniform = true;
+
+          for_each_voxel(i, j, k, [&](int x, int y, int z) {
+            auto value = dense(x, y, z);
+            max = std::max(max, value);
+            uniform = uniform && value == first;
+          });
+
+          brick_max[brick] = max;
+          if (uniform) {
+            brick_value[brick] = first;
+            continue;
+          }
+
+          // Voxels past the grid edge repeat the edge value.
+          brick_offset[brick] = voxels.size();
+          for_each_voxel(i, j, k, [&](int x, int y, int z) {
+            voxels.push_back(dense(x, y, z));
+          });
+        }
+      }
+    }
+  }
+
+  int size_x() const { return nx; }
+  int size_y() const { return ny; }
+  int size_z() const { return nz; }
+
+  int bricks_x() const { return bx; }
+  int bricks_y() const { return by; }
+  int bricks_z() const { return bz; }
+
+  float value(int x, int y, int z) const {
+    // Returns the density of the voxel at x,y,z, which must lie in the grid.
+    auto brick = brick_index(x / brick_size, y / brick_size, z / brick_size);
+    if (brick_offset[brick] == uniform_brick)
+      return brick_value[brick];
+
+    auto within = ((z % brick_size) * brick_size + (y % brick_size)) *
+                      brick_size +
+                  (x % brick_size);
+    return voxels[brick_offset[brick] + within];
+  }
+
+  float majorant(int i, int j, int k) const {
+    // Returns the maximum density within the brick at brick coordinates i,j,k.
+    return brick_max[brick_index(i, j, k)];
+  }
+
+  std::size_t memory_bytes() const {
+    return voxels.size() * sizeof(float) +
+           brick_offset.size() * (sizeof(std::size_t) + 2 * sizeof(float));
+  }
+
+private:
+  static constexpr std::size_t uniform_brick = std::size_t(-1);
+
+  int nx = 0, ny = 0, nz = 0; // Grid resolution in voxels
+  int bx = 0, by = 0, bz = 0; // Grid resolution in bricks
+  std::vector<std::size_t> brick_offset; // Offset into voxels, or uniform
+  std::vector<float> brick_value;        // Value of each uniform brick
+  std::vector<float> brick_max;          // Maximum value in each brick
+  std::vector<float> voxels;             // Voxel data of non-uniform bricks
+
+  std::size_t brick_index(int i, int j, int k) const {
+    return (std::size_t(k) * by + j) * bx + i;
+  }
+
+  template <typename F> static void for_each_voxel(int i, int j, int k, F f) {
+    for (int z = 0; z < brick_size; z++)
+      for (int y = 0; y < brick_size; y++)
+        for (int x = 0; x < brick_size; x++)
+          f(i * brick_size + x, j * brick_size + y, k * brick_size + z);
+  }
+};
+
+class heterogeneous_medium : public hittable {
+public:
+  // A participating medium whose density varies through space, given by a
+  // density grid stretched over an axis-aligned box. Each voxel value is
+  // multiplied by `density`. Scattering distances are sampled with delta
+  // tracking against the per-brick majorants: bricks that are empty are
+  // skipped outright, and dense bricks are tracked with a tight bound instead
+  // of the maximum over the whole volume.
+
+  heterogeneous_medium(const aabb &bounds, const density_grid &grid,
+                       double density, shared_ptr<texture> tex)
+      : bounds(bounds), grid(grid), density(density),
+        phase_function(make_shared<isotropic>(tex)) {}
+
+  heterogeneous_medium(const aabb &bounds, const density_grid &grid,
+                       double density, const color &albedo)
+      : bounds(bounds), grid(grid), density(density),
+        phase_function(make_shared<isotropic>(albedo)) {}
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    double t;
+    bool scattered = false;
+
+    track(r, ray_t, [&](double t_collision, double density_ratio) {
+      // Delta tracking: a tentative collision is real with a probability equal
+      // to the ratio of the actual density to the majorant.
+      if (random_double() >= density_ratio)
+        return true;
+
+      t = t_collision;
+      scattered = true;
+      return false;
+    });
+
+    if (!scattered)
+      return false;
+
+    rec.t = t;
+    rec.p = r.at(t);
+
+    rec.normal = vec3(1, 0, 0); // arbitrary
+    rec.front_face = true;      // also arbitrary
+    rec.mat = phase_function;
+
+    return true;
+  }
+
+  double transmittance(const ray &r, interval ray_t) const {
+    // Estimates the fraction of light that passes through the medium along the
+    // ray segment, using ratio tracking. Each tentative collision attenuates
+    // the estimate instead of terminating it, which gives a lower variance
+    // estimate than counting delta tracking survivors.
+    auto estimate = 1.0;
+
+    track(r, ray_t, [&](double, double density_ratio) {
+      estimate *= 1 - density_ratio;
+      return estimate > 0;
+    });
+
+    return estimate;
+  }
+
+  aabb bounding_box() const override { return bounds; }
+
+private:
+  aabb bounds;
+  density_grid grid;
+  double density;
+  shared_ptr<material> phase_function;
+
+  template <typename F>
+  void track(const ray &r, interval ray_t, F on_collision) const {
+    // Walks the ray through the bricks of the grid (the majorant grid) in
+    // order, and samples tentative collisions within each brick from an
+    // exponential distribution with the brick's majorant as its rate. Calls
+    // on_collision(t, density / majorant) for each one, until it returns
+    // false or the ray leaves the volume.
+
+    if (!clip_to_bounds(r, ray_t))
+      return;
+
+    // Work in brick coordinates, where each brick is a unit cube.
+    vec3 brick_extent(bounds.x.size() * density_grid::brick_size /
+                          grid.size_x(),
+                      bounds.y.size() * density_grid::brick_size /
+                          grid.size_y(),
+                      bounds.z.size() * density_grid::brick_size /
+                          grid.size_z());
+    vec3 min(bounds.x.min, bounds.y.min, bounds.z.min);
+    auto origin = r.origin() - min;
+    vec3 o, d;
+    for (int axis = 0; axis < 3; axis++) {
+      o[axis] = origin[axis] / brick_extent[axis];
+      d[axis] = r.direction()[axis] / brick_extent[axis];
+    }
+
+    int brick_count[3] = {grid.bricks_x(), grid.bricks_y(), grid.bricks_z()};
+    int cell[3], step[3];
+    double t_next[3], t_delta[3];
+
+    auto t = ray_t.min;
+    auto entry = o + t * d;
+    for (int axis = 0; axis < 3; axis++) {
+      cell[axis] = std::clamp(int(std::floor(entry[axis])), 0,
+                              brick_count[axis] - 1);
+      step[axis] = d[axis] >= 0 ? 1 : -1;
+
+      if (d[axis] == 0) {
+        t_next[axis] = infinity;
+        t_delta[axis] = infinity;
+      } else {
+        auto boundary = cell[axis] + (step[axis] > 0 ? 1 : 0);
+        t_next[axis] = (boundary - o[axis]) / d[axis];
+        t_delta[axis] = std::fabs(1 / d[axis]);
+      }
+    }
+
+    auto ray_length = r.direction().length();
+
+    while (t < ray_t.max) {
+      auto axis = (t_next[0] < t_next[1])
+                      ? (t_next[0] < t_next[2] ? 0 : 2)
+                      : (t_next[1] < t_next[2] ? 1 : 2);
+      auto t_exit = std::fmin(t_next[axis], ray_t.max);
+
+      auto majorant = density * grid.majorant(cell[0], cell[1], cell[2]);
+      if (majorant > 0) {
+        while (true) {
+          t -= std::log(1 - random_double()) / (majorant * ray_length);
+          if (t >= t_exit)
+            break;
+
+          // The ratio can only exceed one through rounding at brick borders.
+          auto ratio = std::fmin(density_at(r.at(t)) / majorant, 1.0);
+          if (!on_collision(t, ratio))
+            return;
+        }
+      }
+
+      // Exponential distances are memoryless, so tracking restarts afresh at
+      // the boundary of the next brick.
+      t = t_exit;
+      cell[axis] += step[axis];
+      if (cell[axis] < 0 || cell[axis] >= brick_count[axis])
+        return;
+      t_next[axis] += t_delta[axis];
+    }
+  }
+
+  bool clip_to_bounds(const ray &r, interval &ray_t) const {
+    // Narrows the ray interval to the part inside the bounding box.
+    for (int axis = 0; axis < 3; axis++) {
+      const interval &ax = bounds.axis_interval(axis);
+      const double adinv = 1.0 / r.direction()[axis];
+
+      auto t0 = (ax.min - r.origin()[axis]) * adinv;
+      auto t1 = (ax.max - r.origin()[axis]) * adinv;
+      if (t0 > t1)
+        std::swap(t0, t1);
+
+      ray_t.min = std::fmax(ray_t.min, t0);
+      ray_t.max = std::fmin(ray_t.max, t1);
+
+      if (ray_t.max <= ray_t.min)
+        return false;
+    }
+    return true;
+  }
+
+  double density_at(const point3 &p) const {
+    // Returns the scaled density of the voxel containing p.
+    auto voxel = [](double x, const interval &ax, int n) {
+      return std::clamp(int((x - ax.min) / ax.size() * n), 0, n - 1);
+    };
+
+    return density * grid.value(voxel(p.x(), bounds.x, grid.size_x()),
+                                voxel(p.y(), bounds.y, grid.size_y()),
+                                voxel(p.z(), bounds.z, grid.size_z()));
+  }
+};
+
+#endif
@@ -4,10 +4,12 @@
 #include "raytracing/aabb.h"
 #include "raytracing/interval.h"
 #include "raytracing/ray.h"
+#include "raytracing/render_stats.h"
 #include "raytracing/rtweekend.h"
 #include "raytracing/vec3.h"
 #include <cmath>
 
+class hittable;
 class material;
 
 class hit_record {
@@ -19,6 +21,24 @@ class hit_record {
   double u;
   double v;
   bool front_face;
+  const hittable *object = nullptr; // Primitive yet to finalize the record
+
+  inline void finalize(const ray &r);
+
+  bool defer_to(const hittable *transform) {
+    // Makes a transform of the object yet to finalize the record finalize it
+    // instead, so that it can map the ray into the object's space and the
+    // attributes back out, passing the record on with finalize_inner().
+    // Returns false, leaving the record alone, if too many transforms are
+    // nested already.
+    if (inner_count == max_inner)
+      return false;
+    inner[inner_count++] = object;
+    object = transform;
+    return true;
+  }
+
+  inline void finalize_inner(const ray &r);
 
   void set_face_normal(const ray &r, const vec3 &outward_normal) {
     // Sets the hit record normal vector.
@@ -26,6 +46,11 @@ class hit_record {
     front_face = dot(r.direction(), outward_normal) < 0;
     normal = front_face ? outward_normal : -outward_normal;
   }
+
+private:
+  static constexpr int max_inner = 4;
+  const hittable *inner[max_inner]; // Objects that transforms deferred for
+  int inner_count = 0;
 };
 
 class hittable {
@@ -34,9 +59,64 @@ class hittable {
 
   virtual bool hit(const ray &r, interval ray_t, hit_record &rec) const = 0;
 
+  virtual bool intersect(const ray &r, interval ray_t,
+                         hit_record &rec) const {
+    // Finds the same hit as hit(), but may only set rec.t and rec.object,
+    // leaving the position, normal, texture coordinates and material for
+    // rec.finalize() to fill in. Aggregates call this on their objects, so
+    // that of all the candidate hits along a ray only the closest one pays
+    // for its attributes. Like hit(), it leaves rec alone if nothing is hit.
+    if (!hit(r, ray_t, rec))
+      return false;
+    rec.object = nullptr;
+    return true;
+  }
+
+  virtual void finalize(const ray &, hit_record &) const {
+    // Fills in the attributes of a hit that intersect() left out.
+  }
+
   virtual aabb bounding_box() const = 0;
+
+  virtual aabb bounding_box_at(double /*time*/) const {
+    // Returns the bounding box of the object at the given time in the [0,1]
+    // shutter interval. Objects that don't move use their overall box.
+    return bounding_box();
+  }
+
+  virtual bool hit_span(const ray &r, interval &span) const {
+    // For closed objects, sets span to where the ray's line enters and leaves
+    // the object, the first hit at any t and the next one after it. Objects
+    // that can find both at once override this.
+    hit_record rec;
+    if (!hit(r, interval::universe, rec))
+      return false;
+    span.min = rec.t;
+    if (!hit(r, interval(rec.t + 0.0001, infinity), rec))
+      return false;
+    span.max = rec.t;
+    return true;
+  }
 };
 
+inline void hit_record::finalize(const ray &r) {
+  // Completes the record of a hit found by intersect(), if it isn't already.
+  if (!object)
+    return;
+  auto primitive = object;
+  object = nullptr;
+  primitive->finalize(r, *this);
+  inner_count = 0;
+  RAYTRACING_COUNT(finalized_hits);
+}
+
+inline void hit_record::finalize_inner(const ray &r) {
+  // For the finalize() of a transform that called defer_to(): finalizes the
+  // record with the object the transform deferred for, given the ray in that
+  // object's space.
+  inner[--inner_count]->finalize(r, *this);
+}
+
 class translate : public hittable {
 public:
   translate(shared_ptr<hittable> object, const vec3 &offset)
@@ -59,8 +139,44 @@ class translate : public hittable {
     return true;
   }
 
+  bool intersect(const ray &r, interval ray_t,
+                 hit_record &rec) const override {
+    ray offset_r(r.origin() - offset, r.direction(), r.time());
+    if (!object->intersect(offset_r, ray_t, rec))
+      return false;
+
+    // Attributes the object left out are moved once they are filled in, and
+    // those it already filled in are moved now.
+    if (!rec.object || !rec.defer_to(this)) {
+      rec.finalize(offset_r);
+      rec.p += offset;
+    }
+    return true;
+  }
+
+  void finalize(const ray &r, hit_record &rec) const override {
+    rec.finalize_inner(ray(r.origin() - offset, r.direction(), r.time()));
+    rec.p += offset;
+  }
+
+  bool hit_span(const ray &r, interval &span) const override {
+    ray offset_r(r.origin() - offset, r.direction(), r.time());
+    return object->hit_span(offset_r, span);
+  }
+
   aabb bounding_box() const override { return bbox; }
 
+  aabb bounding_box_at(double time) const override {
+    return object->bounding_box_at(time) + offset;
+  }
+
+  void set_offset(const vec3 &new_offset) {
+    // Moves the object somewhere else, as for the next frame of an animation.
+    // Hierarchies holding it must be updated before they are used again.
+    offset = new_offset;
+    bbox = object->bounding_box() + offset;
+  }
+
 private:
   shared_ptr<hittable> object;
   vec3 offset;
@@ -73,38 +189,67 @@ class rotate_y : public hittable {
     auto radians = degrees_to_radians(angle);
     sin_theta = std::sin(radians);
     cos_theta = std::cos(radians);
-    bbox = object->bounding_box();
+    bbox = rotated_box(object->bounding_box());
+  }
 
-    point3 min(infinity, infinity, infinity);
-    point3 max(-infinity, -infinity, -infinity);
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
 
-    for (int i = 0; i < 2; i++) {
-      for (int j = 0; j < 2; j++) {
-        for (int k = 0; k < 2; k++) {
-          auto x = i * bbox.x.max + (1 - i) * bbox.x.min;
-          auto y = j * bbox.y.max + (1 - j) * bbox.y.min;
-          auto z = k * bbox.z.max + (1 - k) * bbox.z.min;
+    // Transform the ray from world space to object space.
 
-          auto newx = cos_theta * x + sin_theta * z;
-          auto newz = -sin_theta * x + cos_theta * z;
+    ray rotated_r = to_object(r);
 
-          vec3 tester(newx, y, newz);
+    // Determine whether an intersection exists in object space (and if so,
+    // where).
 
-          for (int c = 0; c < 3; c++) {
-            min[c] = std::fmin(min[c], tester[c]);
-            max[c] = std::fmax(max[c], tester[c]);
-          }
-        }
-      }
+    if (!object->hit(rotated_r, ray_t, rec))
+      return false;
+
+    // Transform the intersection from object space back to world space.
+
+    to_world(rec);
+
+    return true;
+  }
+
+  bool intersect(const ray &r, interval ray_t,
+                 hit_record &rec) const override {
+    // As translate does, leaving the object's attributes to be rotated once
+    // they are filled in.
+    ray rotated_r = to_object(r);
+    if (!object->intersect(rotated_r, ray_t, rec))
+      return false;
+
+    if (!rec.object || !rec.defer_to(this)) {
+      rec.finalize(rotated_r);
+      to_world(rec);
     }
+    return true;
+  }
 
-    bbox = aabb(min, max);
+  void finalize(const ray &r, hit_record &rec) const override {
+    rec.finalize_inner(to_object(r));
+    to_world(rec);
   }
 
-  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+  bool hit_span(const ray &r, interval &span) const override {
+    // Rotating the ray doesn't change its t values.
+    return object->hit_span(to_object(r), span);
+  }
 
-    // Transform the ray from world space to object space.
+  aabb bounding_box() const override { return bbox; }
 
+  aabb bounding_box_at(double time) const override {
+    return rotated_box(object->bounding_box_at(time));
+  }
+
+private:
+  shared_ptr<hittable> object;
+  double sin_theta;
+  double cos_theta;
+  aabb bbox;
+
+  ray to_object(const ray &r) const {
+    // Transforms a world space ray to object space.
     auto origin =
         point3((cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
                r.origin().y(),
@@ -115,16 +260,11 @@ class rotate_y : public hittable {
              r.direction().y(),
              (sin_theta * r.direction().x()) + (cos_theta * r.direction().z()));
 
-    ray rotated_r(origin, direction, r.time());
-
-    // Determine whether an intersection exists in object space (and if so,
-    // where).
-
-    if (!object->hit(rotated_r, ray_t, rec))
-      return false;
-
-    // Transform the intersection from object space back to world space.
+    return ray(origin, direction, r.time());
+  }
 
+  void to_world(hit_record &rec) const {
+    // Transforms the hit point and normal from object space to world space.
     rec.p = point3((cos_theta * rec.p.x()) + (sin_theta * rec.p.z()), rec.p.y(),
                    (-sin_theta * rec.p.x()) + (cos_theta * rec.p.z()));
 
@@ -132,17 +272,35 @@ class rotate_y : public hittable {
         vec3((cos_theta * rec.normal.x()) + (sin_theta * rec.normal.z()),
              rec.normal.y(),
              (-sin_theta * rec.normal.x()) + (cos_theta * rec.normal.z()));
-
-    return true;
   }
 
-  aabb bounding_box() const override { return bbox; }
+  aabb rotated_box(const aabb &box) const {
+    // Returns the world space box that encloses the given object space box.
+    point3 min(infinity, infinity, infinity);
+    point3 max(-infinity, -infinity, -infinity);
 
-private:
-  shared_ptr<hittable> object;
-  double sin_theta;
-  double cos_theta;
-  aabb bbox;
+    for (int i = 0; i < 2; i++) {
+      for (int j = 0; j < 2; j++) {
+        for (int k = 0; k < 2; k++) {
+          auto x = i * box.x.max + (1 - i) * box.x.min;
+          auto y = j * box.y.max + (1 - j) * box.y.min;
+          auto z = k * box.z.max + (1 - k) * box.z.min;
+
+          auto newx = cos_theta * x + sin_theta * z;
+          auto newz = -sin_theta * x + cos_theta * z;
+
+          vec3 tester(newx, y, newz);
+
+          for (int c = 0; c < 3; c++) {
+            min[c] = std::fmin(min[c], tester[c]);
+            max[c] = std::fmax(max[c], tester[c]);
+          }
+        }
+      }
+    }
+
+    return aabb(min, max);
+  }
 };
 
 #endif
@@ -23,15 +23,23 @@ class hittable_list : public hittable {
   }
 
   bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-    hit_record temp_rec;
+    if (!intersect(r, ray_t, rec))
+      return false;
+    rec.finalize(r);
+    return true;
+  }
+
+  bool intersect(const ray &r, interval ray_t,
+                 hit_record &rec) const override {
+    // Objects only write to rec when they are hit, so each closer hit simply
+    // replaces the one before it.
     bool hit_anything = false;
     auto closest_so_far = ray_t.max;
 
     for (const auto &object : objects) {
-      if (object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+      if (object->intersect(r, interval(ray_t.min, closest_so_far), rec)) {
         hit_anything = true;
-        closest_so_far = temp_rec.t;
-        rec = temp_rec;
+        closest_so_far = rec.t;
       }
     }
 
@@ -40,6 +48,13 @@ class hittable_list : public hittable {
 
   aabb bounding_box() const override { return bbox; }
 
+  aabb bounding_box_at(double time) const override {
+    aabb box;
+    for (const auto &object : objects)
+      box = aabb(box, object->bounding_box_at(time));
+    return box;
+  }
+
 private:
   aabb bbox;
 };
@@ -0,0 +1,615 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "raytracing/color.h"
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class image_format : std::uint8_t {
+  ascii_ppm, // PPM with decimal values (P3), as the renderer always wrote
+  ppm,       // PPM with byte values (P6)
+  png,       // PNG, filtered and deflate compressed
+  qoi,       // QOI, the "Quite OK Image" format
+};
+
+inline constexpr int image_format_count = 4;
+
+inline const char *const image_format_names[image_format_count] = {
+    "ascii_ppm", "ppm", "png", "qoi"};
+
+inline image_format image_format_for_file(const std::string &name) {
+  // Picks the format from a file name's extension: PNG and QOI for .png and
+  // .qoi, and ASCII PPM for anything else.
+  auto dot = name.rfind('.');
+  auto extension = dot == std::string::npos ? "" : name.substr(dot);
+  if (extension == ".png")
+    return image_format::png;
+  if (extension == ".qoi")
+    return image_format::qoi;
+  return image_format::ascii_ppm;
+}
+
+class image_encoder {
+public:
+  // Encodes an image of 8-bit RGB pixels a few rows at a time, in order from
+  // the top. Each call appends the bytes it produced to out.
+  virtual ~image_encoder() = default;
+
+  virtual void begin(int width, int height, std::string &out) = 0;
+  virtual void add_rows(const unsigned char *rgb, int row_count,
+                        std::string &out) = 0;
+  virtual void end(std::string &out) = 0;
+};
+
+class ppm_encoder : public image_encoder {
+public:
+  ppm_encoder(bool ascii) : ascii(ascii) {}
+
+  void begin(int width, int height, std::string &out) override {
+    this->width = width;
+    out += ascii ? "P3\n" : "P6\n";
+    out += std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+  }
+
+  void add_rows(const unsigned char *rgb, int row_count,
+                std::string &out) override {
+    auto size = std::size_t(width) * row_count * 3;
+    if (!ascii) {
+      out.append(reinterpret_cast<const char *>(rgb), size);
+      return;
+    }
+
+    // The same text as write_color().
+    for (std::size_t i = 0; i < size; i += 3) {
+      out += std::to_string(rgb[i]) + ' ' + std::to_string(rgb[i + 1]) + ' ' +
+             std::to_string(rgb[i + 2]) + '\n';
+    }
+  }
+
+  void end(std::string &) override {}
+
+private:
+  bool ascii;
+  int width = 0;
+};
+
+class deflate_stream {
+public:
+  // A zlib stream compressed with LZ77 and the fixed Huffman codes of
+  // deflate, as used by PNG. Each call to compress() adds one block of its own,
+  // whose matches may reach back into the data of earlier calls. Fixed codes
+  // cost some compression against codes built for the data, but let every
+  // block be written as soon as its data arrives.
+
+  static constexpr std::size_t window_size = 32 * 1024;
+  static constexpr int min_match = 3;
+  static constexpr int max_match = 258;
+  static constexpr int max_chain = 32; // Earlier positions tried per match
+
+  void begin(std::string &out) {
+    // The zlib header: deflate with a 32 KiB window, default compression.
+    out += char(0x78);
+    out += char(0x9c);
+  }
+
+  void compress(const unsigned char *data, std::size_t size,
+                std::string &out) {
+    adler = adler32(adler, data, size);
+
+    // Keep the last window of earlier data for matches to refer back to.
+    if (history.size() > 2 * window_size) {
+      auto drop = history.size() - window_size;
+      history.erase(history.begin(), history.begin() + std::ptrdiff_t(drop));
+      base += drop;
+    }
+    auto start = history.size();
+    history.insert(history.end(), data, data + size);
+
+    put_bits(2, 3); // Not the final block, fixed codes
+    for (auto i = start; i < history.size();) {
+      int length = 0;
+      std::size_t distance = 0;
+      find_match(i, length, distance);
+      if (length >= min_match) {
+        put_length(length);
+        put_distance(distance);
+        for (int k = 0; k < length; k++)
+          insert_hash(i++);
+      } else {
+        put_literal(history[i]);
+        insert_hash(i++);
+      }
+    }
+    put_literal(256); // End of block
+    out += bytes;
+    bytes.clear();
+  }
+
+  void end(std::string &out) {
+    // An empty final block, then the Adler-32 checksum of all the data.
+    put_bits(3, 3);
+    put_literal(256);
+    if (bit_count > 0)
+      put_bits(0, 8 - bit_count);
+    out += bytes;
+    bytes.clear();
+    for (int shift = 24; shift >= 0; shift -= 8)
+      out += char((adler >> shift) & 0xff);
+  }
+
+  static std::uint32_t adler32(std::uint32_t adler, const unsigned char *data,
+                               std::size_t size) {
+    std::uint32_t a = adler & 0xffff, b = adler >> 16;
+    while (size > 0) {
+      // The sums can't overflow within this many bytes.
+      auto count = std::min<std::size_t>(size, 5552);
+      for (std::size_t i = 0; i < count; i++) {
+        a += data[i];
+        b += a;
+      }
+      a %= 65521;
+      b %= 65521;
+      data += count;
+      size -= count;
+    }
+    return (b << 16) | a;
+  }
+
+private:
+  static constexpr int hash_bits = 15;
+
+  std::vector<unsigned char> history; // Earlier data, then this block's
+  std::size_t base = 0; // Stream position of the first byte of history
+  std::vector<std::int64_t> head =
+      std::vector<std::int64_t>(std::size_t(1) << hash_bits, -1);
+  std::vector<std::int64_t> previous =
+      std::vector<std::int64_t>(window_size, -1);
+  std::uint32_t adler = 1;
+  std::string bytes;      // Whole bytes of the block so far
+  std::uint32_t bits = 0; // Bits not yet making up a byte, from bit 0
+  int bit_count = 0;
+
+  std::size_t hash_at(std::size_t i) const {
+    auto key = std::uint32_t(history[i]) << 16 |
+               std::uint32_t(history[i + 1]) << 8 | history[i + 2];
+    return (key * 2654435761u) >> (32 - hash_bits);
+  }
+
+  void insert_hash(std::size_t i) {
+    // Chains every position by the hash of the three bytes starting there.
+    if (i + min_match > history.size())
+      return;
+    auto &first = head[hash_at(i)];
+    previous[(base + i) % window_size] = first;
+    first = std::int64_t(base + i);
+  }
+
+  void find_match(std::size_t i, int &length, std::size_t &distance) const {
+    // Finds the longest earlier copy of the data at i, trying the nearest
+    // positions with the same hash first.
+    if (i + min_match > history.size())
+      return;
+    auto limit = int(std::min<std::size_t>(max_match, history.size() - i));
+    auto position = base + i;
+    auto candidate = head[hash_at(i)];
+    for (int chain = 0; chain < max_chain && candidate >= 0; chain++) {
+      auto from = std::size_t(candidate);
+      if (position - from >= window_size || from < base)
+        break;
+
+      auto earlier = &history[from - base], here = &history[i];
+      int n = 0;
+      while (n < limit && earlier[n] == here[n])
+        n++;
+      if (n > length) {
+        length = n;
+        distance = position - from;
+        if (n == limit)
+          break;
+      }
+      candidate = previous[from % window_size];
+    }
+  }
+
+  void put_bits(std::uint32_t value, int count) {
+    // Deflate packs values from the least significant bit of each byte.
+    bits |= value << bit_count;
+    bit_count += count;
+    while (bit_count >= 8) {
+      bytes += char(bits & 0xff);
+      bits >>= 8;
+      bit_count -= 8;
+    }
+  }
+
+  void put_code(std::uint32_t code, int length) {
+    // Huffman codes are stored from their most significant bit.
+    std::uint32_t reversed = 0;
+    for (int b = 0; b < length; b++)
+      reversed |= ((code >> b) & 1) << (length - 1 - b);
+    put_bits(reversed, length);
+  }
+
+  void put_literal(int symbol) {
+    // The fixed literal/length code of deflate.
+    if (symbol < 144)
+      put_code(0x30 + symbol, 8);
+    else if (symbol < 256)
+      put_code(0x190 + symbol - 144, 9);
+    else if (symbol < 280)
+      put_code(symbol - 256, 7);
+    else
+      put_code(0xc0 + symbol - 280, 8);
+  }
+
+  void put_length(int length) {
+    static const int base_lengths[29] = {
+        3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+        31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const int extra_bits[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                       1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                       4, 4, 4, 4, 5, 5, 5, 5, 0};
+    int code = 28;
+    while (base_lengths[code] > length)
+      code--;
+    put_literal(257 + code);
+    put_bits(std::uint32_t(length - base_lengths[code]), extra_bits[code]);
+  }
+
+  void put_distance(std::size_t distance) {
+    static const int base_distances[30] = {
+        1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+        33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+        1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+    int code = 29;
+    while (std::size_t(base_distances[code]) > distance)
+      code--;
+    put_code(std::uint32_t(code), 5);
+    // Codes 0 to 3 have no extra bits, then two codes for each count.
+    int extra = code < 4 ? 0 : code / 2 - 1;
+    put_bits(std::uint32_t(distance - base_distances[code]), extra);
+  }
+};
+
+class png_encoder : public image_encoder {
+public:
+  // Writes each call's rows as one IDAT chunk. Every row is filtered with
+  // whichever of the five PNG filters gives the smallest sum of absolute
+  // differences, the usual heuristic for photographic images.
+
+  void begin(int width, int height, std::string &out) override {
+    this->width = width;
+    above.assign(std::size_t(width) * 3, 0);
+    out += "\x89PNG\r\n\x1a\n";
+
+    std::string header;
+    put_u32(header, std::uint32_t(width));
+    put_u32(header, std::uint32_t(height));
+    header += char(8); // Bits per channel
+    header += char(2); // RGB
+    header += std::string(3, '\0'); // Deflate, adaptive filters, no interlace
+    put_chunk(out, "IHDR", header);
+
+    deflate.begin(pending);
+  }
+
+  void add_rows(const unsigned char *rgb, int row_count,
+                std::string &out) override {
+    auto row_size = std::size_t(width) * 3;
+    std::vector<unsigned char> filtered;
+    filtered.reserve((row_size + 1) * std::size_t(row_count));
+    for (int row = 0; row < row_count; row++) {
+      auto line = rgb + std::size_t(row) * row_size;
+      filter_row(line, filtered);
+      above.assign(line, line + row_size);
+    }
+
+    deflate.compress(filtered.data(), filtered.size(), pending);
+    put_chunk(out, "IDAT", pending);
+    pending.clear();
+  }
+
+  void end(std::string &out) override {
+    deflate.end(pending);
+    put_chunk(out, "IDAT", pending);
+    pending.clear();
+    put_chunk(out, "IEND", "");
+  }
+
+  static std::uint32_t crc32(std::uint32_t crc, const unsigned char *data,
+                             std::size_t size) {
+    static const auto table = [] {
+      std::array<std::uint32_t, 256> entries{};
+      for (std::uint32_t n = 0; n < 256; n++) {
+        auto c = n;
+        for (int k = 0; k < 8; k++)
+          c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        entries[n] = c;
+      }
+      return entries;
+    }();
+
+    crc = ~crc;
+    for (std::size_t i = 0; i < size; i++)
+      crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+  }
+
+private:
+  int width = 0;
+  std::vector<unsigned char> above; // The previous row, zeros for the first
+  deflate_stream deflate;
+  std::string pending; // Compressed data for the next IDAT chunk
+
+  static void put_u32(std::string &out, std::uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+      out += char((value >> shift) & 0xff);
+  }
+
+  static void put_chunk(std::string &out, const char *type,
+                        const std::string &data) {
+    put_u32(out, std::uint32_t(data.size()));
+    auto start = out.size();
+    out += type;
+    out += data;
+    auto crc = crc32(0, reinterpret_cast<const unsigned char *>(&out[start]),
+                     out.size() - start);
+    put_u32(out, crc);
+  }
+
+  static unsigned char paeth(int a, int b, int c) {
+    auto p = a + b - c;
+    auto pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+      return (unsigned char)a;
+    return (unsigned char)(pb <= pc ? b : c);
+  }
+
+  void filter_row(const unsigned char *line,
+                  std::vector<unsigned char> &filtered) const {
+    auto row_size = std::size_t(width) * 3;
+    std::vector<unsigned char> best(row_size), trial(row_size);
+    int best_type = 0;
+    long best_cost = -1;
+    for (int type = 0; type < 5; type++) {
+      long cost = 0;
+      for (std::size_t i = 0; i < row_size; i++) {
+        // Left, up and up-left neighbours of the byte, in the same channel.
+        int a = i >= 3 ? line[i - 3] : 0;
+        int b = above[i];
+        int c = i >= 3 ? above[i - 3] : 0;
+        int predicted = type == 0   ? 0
+                        : type == 1 ? a
+                        : type == 2 ? b
+                        : type == 3 ? (a + b) / 2
+                                    : paeth(a, b, c);
+        trial[i] = (unsigned char)(line[i] - predicted);
+        cost += std::abs(int((signed char)trial[i]));
+      }
+      if (best_cost < 0 || cost < best_cost) {
+        best_cost = cost;
+        best_type = type;
+        best.swap(trial);
+      }
+    }
+    filtered.push_back((unsigned char)best_type);
+    filtered.insert(filtered.end(), best.begin(), best.end());
+  }
+};
+
+class qoi_encoder : public image_encoder {
+public:
+  // QOI codes each pixel against the one before it and a small table of
+  // recently seen colors, so it streams without any lookback buffer.
+
+  void begin(int width, int height, std::string &out) override {
+    this->width = width;
+    out += "qoif";
+    for (auto value : {std::uint32_t(width), std::uint32_t(height)})
+      for (int shift = 24; shift >= 0; shift -= 8)
+        out += char((value >> shift) & 0xff);
+    out += char(3); // RGB
+    out += char(0); // sRGB with linear alpha
+  }
+
+  void add_rows(const unsigned char *rgb, int row_count,
+                std::string &out) override {
+    auto size = std::size_t(width) * row_count * 3;
+    for (std::size_t i = 0; i < size; i += 3) {
+      pixel px = {rgb[i], rgb[i + 1], rgb[i + 2], 255};
+      if (px == last) {
+        if (++run == 62)
+          flush_run(out);
+        continue;
+      }
+      flush_run(out);
+
+      auto slot = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+      if (index[slot] == px) {
+        out += char(slot); // QOI_OP_INDEX
+      } else {
+        index[slot] = px;
+        int dr = std::int8_t(px[0] - last[0]);
+        int dg = std::int8_t(px[1] - last[1]);
+        int db = std::int8_t(px[2] - last[2]);
+        int dr_dg = dr - dg, db_dg = db - dg;
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 &&
+            db <= 1) {
+          out += char(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+        } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                   db_dg >= -8 && db_dg <= 7) {
+          out += char(0x80 | (dg + 32));
+          out += char((dr_dg + 8) << 4 | (db_dg + 8));
+        } else {
+          out += char(0xfe); // QOI_OP_RGB
+          out += char(px[0]);
+          out += char(px[1]);
+          out += char(px[2]);
+        }
+      }
+      last = px;
+    }
+  }
+
+  void end(std::string &out) override {
+    flush_run(out);
+    out += std::string(7, '\0');
+    out += char(1);
+  }
+
+private:
+  using pixel = std::array<unsigned char, 4>; // RGBA, with opaque alpha
+
+  int width = 0;
+  pixel last = {0, 0, 0, 255};
+  std::array<pixel, 64> index{}; // Transparent black, as the decoder starts
+  int run = 0;
+
+  void flush_run(std::string &out) {
+    if (run > 0)
+      out += char(0xc0 | (run - 1)); // QOI_OP_RUN
+    run = 0;
+  }
+};
+
+inline std::unique_ptr<image_encoder> make_image_encoder(image_format format) {
+  switch (format) {
+  case image_format::png:
+    return std::make_unique<png_encoder>();
+  case image_format::qoi:
+    return std::make_unique<qoi_encoder>();
+  case image_format::ppm:
+    return std::make_unique<ppm_encoder>(false);
+  default:
+    return std::make_unique<ppm_encoder>(true);
+  }
+}
+
+class image_writer {
+public:
+  // Converts, encodes and writes an image on a thread of its own while it is
+  // still being rendered. Rows can be handed over in any order as they are
+  // finished; each is encoded and written to the stream once all the rows
+  // above it have been, so the file grows as the render goes and only the
+  // last rows are left to write when it ends.
+
+  image_writer(std::ostream &out,
+               image_format format = image_format::ascii_ppm)
+      : out(out), encoder(make_image_encoder(format)) {}
+
+  image_writer(const image_writer &) = delete;
+  image_writer &operator=(const image_writer &) = delete;
+
+  ~image_writer() { finish(); }
+
+  void start(int width, int height) {
+    // Writes the header, then starts the thread that writes the rows.
+    this->width = width;
+    this->height = height;
+    next_row = 0;
+    std::string bytes;
+    encoder->begin(width, height, bytes);
+    out.write(bytes.data(), std::streamsize(bytes.size()));
+    writer = std::thread([this] { run(); });
+  }
+
+  void add_rows(const color *pixels, int y0, int y1) {
+    // Queues rows y0 up to but not including y1, whose pixels are those from
+    // pixels on. They are read on the writer's thread, so they must not change
+    // until finish() returns.
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ready[y0] = {pixels, y1};
+    }
+    wake.notify_one();
+  }
+
+  bool finish() {
+    // Waits for every row to be written, returning false if the stream failed.
+    // Rows that were never added are left out.
+    if (writer.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        finishing = true;
+      }
+      wake.notify_one();
+      writer.join();
+    }
+    return bool(out);
+  }
+
+private:
+  struct rows {
+    const color *pixels;
+    int y1;
+  };
+
+  std::ostream &out;
+  std::unique_ptr<image_encoder> encoder;
+  int width = 0, height = 0;
+  int next_row = 0;          // First row not yet written
+  std::map<int, rows> ready; // Rows waiting for those above them, by y0
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool finishing = false;
+  std::thread writer;
+
+  void run() {
+    std::vector<unsigned char> rgb;
+    std::string bytes;
+    while (true) {
+      rows next;
+      int y0;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] {
+          return finishing || next_row >= height ||
+                 (!ready.empty() && ready.begin()->first == next_row);
+        });
+        if (ready.empty() || ready.begin()->first != next_row)
+          break;
+        y0 = next_row;
+        next = ready.begin()->second;
+        ready.erase(ready.begin());
+        next_row = next.y1;
+      }
+
+      // Converting the pixels and encoding them happens outside the lock, so
+      // render threads are never held up by it.
+      auto pixel_count = std::size_t(width) * (next.y1 - y0);
+      rgb.resize(pixel_count * 3);
+      for (std::size_t p = 0; p < pixel_count; p++)
+        color_to_bytes(next.pixels[p], &rgb[3 * p]);
+      bytes.clear();
+      encoder->add_rows(rgb.data(), next.y1 - y0, bytes);
+      out.write(bytes.data(), std::streamsize(bytes.size()));
+    }
+
+    bytes.clear();
+    encoder->end(bytes);
+    out.write(bytes.data(), std::streamsize(bytes.size()));
+    out.flush();
+  }
+};
+
+inline bool write_image(std::ostream &out, image_format format, int width,
+                        int height, const std::vector<color> &pixels) {
+  // Writes a whole image at once.
+  image_writer writer(out, format);
+  writer.start(width, height);
+  writer.add_rows(pixels.data(), 0, height);
+  return writer.finish();
+}
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#define RAYTRACING_HAVE_AFFINITY 1
+#endif
+
+// One more than the highest CPU number that can be pinned to, which is also
+// the highest that CPU lists may hold.
+#ifdef RAYTRACING_HAVE_AFFINITY
+inline constexpr int cpu_limit = CPU_SETSIZE;
+#else
+inline constexpr int cpu_limit = 1024;
+#endif
+
+inline bool parse_cpu_list(const std::string &text, std::vector<int> &cpus) {
+  // Appends the CPUs of a list of CPU numbers and ranges such as
+  // "0-3,8,10-11", as Linux writes them, to cpus. Returns false if the list
+  // is malformed or names a CPU at or above cpu_limit; an empty list is not
+  // malformed.
+  std::size_t at = 0;
+  auto number = [&](int &value) {
+    if (at >= text.size() || text[at] < '0' || text[at] > '9')
+      return false;
+    value = 0;
+    while (at < text.size() && text[at] >= '0' && text[at] <= '9') {
+      value = value * 10 + (text[at++] - '0');
+      if (value >= cpu_limit)
+        return false;
+    }
+    return true;
+  };
+
+  while (at < text.size() && text[at] != '\n') {
+    int first, last;
+    if (!number(first))
+      return false;
+    last = first;
+    if (at < text.size() && text[at] == '-') {
+      at++;
+      if (!number(last) || last < first)
+        return false;
+    }
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus.push_back(cpu);
+    if (at < text.size() && text[at] == ',')
+      at++;
+  }
+  return true;
+}
+
+class numa_topology {
+public:
+  // The NUMA nodes of the machine, and the CPUs of each that the process may
+  // run on. A default topology is a single node whose CPUs are unknown, and
+  // whose threads are left wherever the system puts them.
+
+  numa_topology() : node_cpus(1) {}
+
+  static numa_topology detect() {
+    // The nodes Linux lists in /sys, keeping only CPUs the process is allowed
+    // to run on, so that numactl --cpunodebind and taskset narrow it down.
+    // Nodes left without CPUs, such as those with memory only, are dropped.
+    // Elsewhere, or if no node has CPUs, the default topology.
+    numa_topology topology;
+    topology.node_cpus.clear();
+#ifdef RAYTRACING_HAVE_AFFINITY
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    for (int node = 0;; node++) {
+      std::ifstream file("/sys/devices/system/node/node" +
+                         std::to_string(node) + "/cpulist");
+      if (!file)
+        break;
+      std::string text;
+      std::getline(file, text);
+
+      std::vector<int> listed, cpus;
+      if (!parse_cpu_list(text, listed))
+        continue;
+      for (int cpu : listed)
+        if (!restricted || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+          cpus.push_back(cpu);
+      if (!cpus.empty())
+        topology.node_cpus.push_back(cpus);
+    }
+#endif
+    if (topology.node_cpus.empty())
+      return numa_topology();
+    return topology;
+  }
+
+  static bool parse(const std::string &layout, numa_topology &topology) {
+    // Reads a topology given by hand, as the CPU lists of its nodes separated
+    // by semicolons, such as "0-3;4-7". A CPU may be listed in several nodes,
+    // so that a machine with few CPUs can stand in for one with more nodes.
+    numa_topology parsed;
+    parsed.node_cpus.clear();
+    std::size_t start = 0;
+    while (true) {
+      auto end = layout.find(';', start);
+      auto part = layout.substr(start, end - start);
+      std::vector<int> cpus;
+      if (!parse_cpu_list(part, cpus) || cpus.empty())
+        return false;
+      parsed.node_cpus.push_back(cpus);
+      if (end == std::string::npos)
+        break;
+      start = end + 1;
+    }
+    topology = parsed;
+    return true;
+  }
+
+  int node_count() const { return int(node_cpus.size()); }
+
+  const std::vector<int> &cpus(int node) const { return node_cpus[node]; }
+
+  std::vector<int> worker_nodes(unsigned thread_count) const {
+    // The node each of thread_count threads runs on. Threads are dealt out to
+    // the CPUs of all nodes in turn, so that each node gets a share in
+    // proportion to its CPUs, and consecutive threads go to different nodes.
+    // The k-th CPU of a node with n CPUs is dealt at k/n of the way through.
+    std::vector<std::pair<double, int>> slots;
+    for (std::size_t node = 0; node < node_cpus.size(); node++) {
+      auto size = std::max<std::size_t>(node_cpus[node].size(), 1);
+      for (std::size_t k = 0; k < size; k++)
+        slots.push_back({double(k) / size, int(node)});
+    }
+    std::stable_sort(slots.begin(), slots.end(),
+                     [](const auto &a, const auto &b) {
+                       return a.first < b.first;
+                     });
+
+    std::vector<int> nodes;
+    for (unsigned i = 0; i < thread_count; i++)
+      nodes.push_back(slots[i % slots.size()].second);
+    return nodes;
+  }
+
+private:
+  std::vector<std::vector<int>> node_cpus;
+};
+
+inline bool pin_thread_to_cpus(const std::vector<int> &cpus) {
+  // Restricts the calling thread to the given CPUs. Threads it starts from
+  // then on inherit the restriction. Returns false if that isn't possible
+  // here, or if cpus is empty.
+#ifdef RAYTRACING_HAVE_AFFINITY
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  bool any = false;
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+      any = true;
+    }
+  }
+  return any && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpus;
+  return false;
+#endif
+}
+
+inline void on_each_node(const numa_topology &topology,
+                         const std::function<void(int node)> &work) {
+  // Calls work for each node of the topology at once, each on a thread of
+  // its own pinned to the node's CPUs. Linux places memory on the node of the
+  // thread that first writes to it, so what work builds is kept in the
+  // node's own memory, as are the results of any threads it starts.
+  std::vector<std::thread> threads;
+  for (int node = 0; node < topology.node_count(); node++)
+    threads.emplace_back([&topology, &work, node] {
+      pin_thread_to_cpus(topology.cpus(node));
+      work(node);
+    });
+  for (auto &thread : threads)
+    thread.join();
+}
+
+#endif
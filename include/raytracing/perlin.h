@@ -3,10 +3,15 @@
 
 #include "raytracing/rtweekend.h"
 #include "raytracing/vec3.h"
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 
 class perlin {
 public:
+  // Number of points evaluated together by the batched noise kernel.
+  static constexpr int batch_width = 8;
+
   perlin() {
     for (int i = 0; i < point_count; i++) {
       randvec[i] = unit_vector(vec3::random(-1, 1));
@@ -15,6 +20,8 @@ class perlin {
     perlin_generate_perm(perm_x);
     perlin_generate_perm(perm_y);
     perlin_generate_perm(perm_z);
+
+    build_compact_tables();
   }
 
   double noise(const point3 &p) const {
@@ -51,6 +58,86 @@ class perlin {
     return std::fabs(accum);
   }
 
+  void noise(int n, const double *x, const double *y, const double *z,
+             double *out) const {
+    // Evaluates the noise function at n points, given as separate coordinate
+    // arrays. Points are processed batch_width at a time using the compact
+    // single-precision tables, so the per-lane loops are branch-free and can be
+    // vectorized by the compiler. Results match the scalar noise() to within
+    // single-precision rounding.
+
+    for (int start = 0; start < n; start += batch_width) {
+      int count = std::min(batch_width, n - start);
+      noise_batch(count, x + start, y + start, z + start, out + start);
+    }
+  }
+
+  void turb(int n, const double *x, const double *y, const double *z,
+            int depth, double *out) const {
+    // Batched version of turb(), evaluating one octave for all n points at a
+    // time.
+
+    for (int start = 0; start < n; start += batch_width) {
+      int count = std::min(batch_width, n - start);
+
+      double px[batch_width], py[batch_width], pz[batch_width];
+      double accum[batch_width] = {};
+      double octave[batch_width];
+
+      for (int lane = 0; lane < count; lane++) {
+        px[lane] = x[start + lane];
+        py[lane] = y[start + lane];
+        pz[lane] = z[start + lane];
+      }
+
+      auto weight = 1.0;
+      for (int i = 0; i < depth; i++) {
+        noise_batch(count, px, py, pz, octave);
+        for (int lane = 0; lane < count; lane++) {
+          accum[lane] += weight * octave[lane];
+          px[lane] *= 2;
+          py[lane] *= 2;
+          pz[lane] *= 2;
+        }
+        weight *= 0.5;
+      }
+
+      for (int lane = 0; lane < count; lane++)
+        out[start + lane] = std::fabs(accum[lane]);
+    }
+  }
+
+  double fast_turb(const point3 &p, int depth) const {
+    // Same result as turb(p, depth), but the octaves of the single point are
+    // independent noise lookups, so they are evaluated together as one batch.
+
+    double x[batch_width], y[batch_width], z[batch_width];
+    double octave[batch_width];
+    auto accum = 0.0;
+    auto scale = 1.0;
+    auto weight = 1.0;
+
+    for (int start = 0; start < depth; start += batch_width) {
+      int count = std::min(batch_width, depth - start);
+
+      for (int lane = 0; lane < count; lane++) {
+        x[lane] = scale * p.x();
+        y[lane] = scale * p.y();
+        z[lane] = scale * p.z();
+        scale *= 2;
+      }
+
+      noise_batch(count, x, y, z, octave);
+
+      for (int lane = 0; lane < count; lane++) {
+        accum += weight * octave[lane];
+        weight *= 0.5;
+      }
+    }
+
+    return std::fabs(accum);
+  }
+
 private:
   static const int point_count = 256;
   vec3 randvec[point_count];
@@ -58,6 +145,83 @@ class perlin {
   int perm_y[point_count];
   int perm_z[point_count];
 
+  // Compact copies of the tables above for the batched kernel: byte-sized
+  // permutations and single-precision gradients stored as separate components.
+  std::uint8_t perm_x8[point_count];
+  std::uint8_t perm_y8[point_count];
+  std::uint8_t perm_z8[point_count];
+  float grad_x[point_count];
+  float grad_y[point_count];
+  float grad_z[point_count];
+
+  void build_compact_tables() {
+    for (int i = 0; i < point_count; i++) {
+      perm_x8[i] = static_cast<std::uint8_t>(perm_x[i]);
+      perm_y8[i] = static_cast<std::uint8_t>(perm_y[i]);
+      perm_z8[i] = static_cast<std::uint8_t>(perm_z[i]);
+      grad_x[i] = static_cast<float>(randvec[i].x());
+      grad_y[i] = static_cast<float>(randvec[i].y());
+      grad_z[i] = static_cast<float>(randvec[i].z());
+    }
+  }
+
+  static int fast_floor(double x) {
+    int i = int(x);
+    return i - (x < i);
+  }
+
+  float grad_dot(int hash, float x, float y, float z) const {
+    return grad_x[hash] * x + grad_y[hash] * y + grad_z[hash] * z;
+  }
+
+  void noise_batch(int count, const double *x, const double *y,
+                   const double *z, double *out) const {
+    // Evaluates up to batch_width points. The lanes are independent and the
+    // loop body is branch-free, so the compiler can interleave or vectorize
+    // them.
+
+    for (int lane = 0; lane < count; lane++) {
+      // Split each coordinate into its lattice cell and fractional offset in
+      // double precision, so large coordinates keep their accuracy.
+      auto i = fast_floor(x[lane]);
+      auto j = fast_floor(y[lane]);
+      auto k = fast_floor(z[lane]);
+      auto u = float(x[lane] - i);
+      auto v = float(y[lane] - j);
+      auto w = float(z[lane] - k);
+
+      // Hash the eight lattice corners surrounding the point. Each axis needs
+      // only two permutation lookups, shared between the corners.
+      int x0 = perm_x8[i & 255], x1 = perm_x8[(i + 1) & 255];
+      int y0 = perm_y8[j & 255], y1 = perm_y8[(j + 1) & 255];
+      int z0 = perm_z8[k & 255], z1 = perm_z8[(k + 1) & 255];
+
+      auto c000 = grad_dot(x0 ^ y0 ^ z0, u, v, w);
+      auto c001 = grad_dot(x0 ^ y0 ^ z1, u, v, w - 1);
+      auto c010 = grad_dot(x0 ^ y1 ^ z0, u, v - 1, w);
+      auto c011 = grad_dot(x0 ^ y1 ^ z1, u, v - 1, w - 1);
+      auto c100 = grad_dot(x1 ^ y0 ^ z0, u - 1, v, w);
+      auto c101 = grad_dot(x1 ^ y0 ^ z1, u - 1, v, w - 1);
+      auto c110 = grad_dot(x1 ^ y1 ^ z0, u - 1, v - 1, w);
+      auto c111 = grad_dot(x1 ^ y1 ^ z1, u - 1, v - 1, w - 1);
+
+      // Hermitian smoothing, then trilinear interpolation of the corner
+      // contributions (equivalent to the weighted sum in perlin_interp).
+      auto uu = u * u * (3 - 2 * u);
+      auto vv = v * v * (3 - 2 * v);
+      auto ww = w * w * (3 - 2 * w);
+
+      auto c00 = c000 + ww * (c001 - c000);
+      auto c01 = c010 + ww * (c011 - c010);
+      auto c10 = c100 + ww * (c101 - c100);
+      auto c11 = c110 + ww * (c111 - c110);
+      auto c0 = c00 + vv * (c01 - c00);
+      auto c1 = c10 + vv * (c11 - c10);
+
+      out[lane] = c0 + uu * (c1 - c0);
+    }
+  }
+
   static void perlin_generate_perm(int *p) {
     for (int i = 0; i < point_count; i++)
       p[i] = i;
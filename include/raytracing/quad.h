@@ -3,9 +3,9 @@
 
 #include "raytracing/aabb.h"
 #include "raytracing/hittable.h"
-#include "raytracing/hittable_list.h"
 #include "raytracing/interval.h"
 #include "raytracing/ray.h"
+#include "raytracing/render_stats.h"
 #include "raytracing/rtweekend.h"
 #include "raytracing/vec3.h"
 #include <cmath>
@@ -32,6 +32,16 @@ class quad : public hittable {
   aabb bounding_box() const override { return bbox; }
 
   bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    if (!intersect(r, ray_t, rec))
+      return false;
+    rec.finalize(r);
+    return true;
+  }
+
+  bool intersect(const ray &r, interval ray_t,
+                 hit_record &rec) const override {
+    RAYTRACING_COUNT(ray_primitive_tests);
+
     auto denom = dot(normal, r.direction());
 
     // No hit if the ray is parallel to the plane.
@@ -50,31 +60,36 @@ class quad : public hittable {
     auto alpha = dot(w, cross(planar_hitpt_vector, v));
     auto beta = dot(w, cross(u, planar_hitpt_vector));
 
-    if (!is_interior(alpha, beta, rec))
+    if (!is_interior(alpha, beta))
       return false;
 
-    // Ray hits the 2D shape; set the rest of the hit record and return true.
+    // Ray hits the 2D shape; the rest of the hit record is set if it turns
+    // out to be the closest.
 
     rec.t = t;
-    rec.p = intersection;
+    rec.object = this;
+
+    RAYTRACING_COUNT(primitive_hits);
+    return true;
+  }
+
+  void finalize(const ray &r, hit_record &rec) const override {
+    rec.p = r.at(rec.t);
     rec.mat = mat;
     rec.set_face_normal(r, normal);
 
-    return true;
+    // The plane coordinates of the hit point are its UV coordinates.
+    vec3 planar_hitpt_vector = rec.p - Q;
+    rec.u = dot(w, cross(planar_hitpt_vector, v));
+    rec.v = dot(w, cross(u, planar_hitpt_vector));
   }
 
-  virtual bool is_interior(double a, double b, hit_record &rec) const {
+  virtual bool is_interior(double a, double b) const {
     interval unit_interval = interval(0, 1);
     // Given the hit point in plane coordinates, return false if it is outside
-    // the primitive, otherwise set the hit record UV coordinates and return
-    // true.
+    // the primitive, otherwise return true.
 
-    if (!unit_interval.contains(a) || !unit_interval.contains(b))
-      return false;
-
-    rec.u = a;
-    rec.v = b;
-    return true;
+    return unit_interval.contains(a) && unit_interval.contains(b);
   }
 
 private:
@@ -87,38 +102,4 @@ class quad : public hittable {
   double D;
 };
 
-inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b,
-                                     shared_ptr<material> mat) {
-  // Returns the 3D box (six sides) that contains the two opposite vertices a &
-  // b.
-
-  auto sides = make_shared<hittable_list>();
-
-  // Construct the two opposite vertices with the minimum and maximum
-  // coordinates.
-  auto min = point3(std::fmin(a.x(), b.x()), std::fmin(a.y(), b.y()),
-                    std::fmin(a.z(), b.z()));
-  auto max = point3(std::fmax(a.x(), b.x()), std::fmax(a.y(), b.y()),
-                    std::fmax(a.z(), b.z()));
-
-  auto dx = vec3(max.x() - min.x(), 0, 0);
-  auto dy = vec3(0, max.y() - min.y(), 0);
-  auto dz = vec3(0, 0, max.z() - min.z());
-
-  sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()), dx, dy,
-                               mat)); // front
-  sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz, dy,
-                               mat)); // right
-  sides->add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx, dy,
-                               mat)); // back
-  sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dz, dy,
-                               mat)); // left
-  sides->add(make_shared<quad>(point3(min.x(), max.y(), max.z()), dx, -dz,
-                               mat)); // top
-  sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dx, dz,
-                               mat)); // bottom
-
-  return sides;
-}
-
 #endif
@@ -0,0 +1,109 @@
+#ifndef RAY_SORT_H
+#define RAY_SORT_H
+
+#include "raytracing/aabb.h"
+#include "raytracing/ray.h"
+#include "raytracing/vec3.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Sorting rays so that rays likely to visit the same parts of the scene are
+// traced one after another. Diffuse bounces send rays in all directions from
+// all over the scene, so tracing them in the order their paths were started
+// walks the BVH almost at random; in sorted order consecutive rays start near
+// each other and head the same way, and find the nodes they need still in
+// the cache.
+
+inline std::uint32_t spread_bits(std::uint32_t v) {
+  // Moves the low 10 bits of v apart so that two zero bits follow each one.
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+inline std::uint32_t morton_code(std::uint32_t x, std::uint32_t y,
+                                 std::uint32_t z) {
+  // Interleaves the bits of three 10-bit coordinates, so that points close on
+  // the Z-order curve through a 1024^3 grid are close in the code.
+  return (spread_bits(x) << 2) | (spread_bits(y) << 1) | spread_bits(z);
+}
+
+inline int direction_octant(const vec3 &direction) {
+  // Which of the eight octants a direction points into, as the signs of its
+  // components. Rays of the same octant visit BVH children in the same order.
+  return (direction.x() < 0 ? 4 : 0) | (direction.y() < 0 ? 2 : 0) |
+         (direction.z() < 0 ? 1 : 0);
+}
+
+class ray_sort_grid {
+public:
+  // Sort keys for rays starting within bounds: the direction's octant, then
+  // the Morton code of the origin's cell in a 512^3 grid over bounds, 30 bits
+  // in all. Origins outside bounds count as on its nearest face, and axes
+  // along which bounds is empty or unbounded are left out.
+  ray_sort_grid(const aabb &bounds) {
+    for (int a = 0; a < 3; a++) {
+      const auto &axis = bounds.axis_interval(a);
+      auto size = axis.size();
+      bool usable = size > 0 && size < infinity;
+      min[a] = usable ? axis.min : 0;
+      scale[a] = usable ? 511 / size : 0;
+    }
+  }
+
+  std::uint32_t key(const ray &r) const {
+    std::uint32_t cell[3];
+    for (int a = 0; a < 3; a++) {
+      auto t = (r.origin()[a] - min[a]) * scale[a];
+      cell[a] = std::uint32_t(std::clamp(t, 0.0, 511.0));
+    }
+    return std::uint32_t(direction_octant(r.direction())) << 27 |
+           morton_code(cell[0], cell[1], cell[2]);
+  }
+
+private:
+  double min[3];
+  double scale[3]; // Cells per unit length
+};
+
+inline std::uint32_t ray_sort_key(const ray &r, const aabb &bounds) {
+  return ray_sort_grid(bounds).key(r);
+}
+
+inline void sort_ray_order(const std::vector<ray> &rays, const aabb &bounds,
+                           std::vector<std::uint32_t> &order) {
+  // Sets order to the indices of rays, sorted by ray_sort_key(). Rays with the
+  // same key keep their order. The keys are radix sorted ten bits at a time,
+  // which takes a fixed three passes over the rays rather than the many
+  // unpredictable comparisons of a comparison sort.
+  ray_sort_grid grid(bounds);
+  auto count = rays.size();
+  std::vector<std::uint64_t> keyed(count), sorted(count);
+  for (std::size_t i = 0; i < count; i++)
+    keyed[i] = std::uint64_t(grid.key(rays[i])) << 32 | i;
+
+  for (int shift = 32; shift < 62; shift += 10) {
+    std::uint32_t starts[1024] = {};
+    for (auto value : keyed)
+      starts[(value >> shift) & 1023]++;
+    std::uint32_t total = 0;
+    for (auto &start : starts) {
+      auto bucket = start;
+      start = total;
+      total += bucket;
+    }
+    for (auto value : keyed)
+      sorted[starts[(value >> shift) & 1023]++] = value;
+    keyed.swap(sorted);
+  }
+
+  order.resize(count);
+  for (std::size_t i = 0; i < count; i++)
+    order[i] = std::uint32_t(keyed[i] & 0xffffffff);
+}
+
+#endif
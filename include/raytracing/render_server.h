@@ -0,0 +1,324 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include "raytracing/asset_loader.h"
+#include "raytracing/camera.h"
+#include "raytracing/color.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/render_stats.h"
+#include "raytracing/rtweekend.h"
+#include "raytracing/scene_description.h"
+#include "raytracing/scene_parser.h"
+#include "raytracing/scene_snapshot.h"
+#include "raytracing/socket.h"
+#include "raytracing/thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A long-running process that keeps scenes built between renders, so repeated
+// renders of a scene with other camera settings skip parsing, BVH construction
+// and texture decoding. Clients send the scene source with each request, and
+// scenes are looked up by a hash of it. Rendered tiles stream back as they
+// finish. Image textures are found as for a local render, from the server's
+// working directory or RTW_IMAGES, not from wherever the client's scene is.
+//
+// Messages (see send_message()) are in native byte order:
+//
+//   render  client to server: scene name and source, camera settings in the
+//           scene file format
+//   stop    client to server: stop serving
+//   image   server to client: image width, height and tile count
+//   tile    server to client: tile bounds, and its pixels as float RGB
+//   done    server to client: render seconds, whether the scene was cached
+//   error   server to client: message saying why the request failed
+
+enum class server_message : std::uint32_t {
+  render = 1,
+  stop,
+  image,
+  tile,
+  done,
+  error
+};
+
+class render_server {
+public:
+  std::size_t max_scenes = 8; // Most built scenes kept at once
+  double idle_timeout = 10;   // Seconds a client may stay silent or not read
+
+  render_server(int thread_count = 0)
+      : pool(unsigned(std::max(thread_count, 0))) {}
+
+  bool serve(const socket_handle &listener) {
+    // Answers requests from clients connecting to listener, one client at a
+    // time, until one asks the server to stop. A client that sends nothing
+    // for idle_timeout seconds, stalls within a request, or stops reading its
+    // tiles is disconnected so that the clients waiting behind it get their
+    // turn. Accepting is retried when it fails for now, for example with too
+    // many files open.
+    while (true) {
+      auto client = listener.accept();
+      if (!client.is_open()) {
+        if (socket_handle::accept_failed_for_now()) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          continue;
+        }
+        std::cerr << "ERROR: The render server's socket failed.\n";
+        return false;
+      }
+      client.set_receive_timeout(idle_timeout);
+      client.set_send_timeout(idle_timeout);
+
+      std::uint32_t type;
+      message_payload request;
+      while (receive_message(client, type, request)) {
+        if (type == std::uint32_t(server_message::stop))
+          return true;
+        if (type != std::uint32_t(server_message::render) ||
+            !answer(client, request))
+          break;
+      }
+    }
+  }
+
+private:
+  struct cached_scene {
+    std::uint64_t source_hash;
+    std::string source; // Compared on a hash match, in case hashes collide
+    hittable_list world;
+    camera cam;
+    std::uint64_t last_used = 0;
+  };
+
+  thread_pool pool;
+  std::vector<shared_ptr<cached_scene>> scenes;
+  std::uint64_t requests = 0;
+
+  bool answer(const socket_handle &client, message_payload &request) {
+    // Renders the requested image, sending its tiles as they finish. Returns
+    // false if the connection failed.
+    std::string name, source, settings;
+    if (!request.get_string(name) || !request.get_string(source) ||
+        !request.get_string(settings))
+      return false;
+
+    auto error = [&](const std::string &text) {
+      message_payload reply;
+      reply.put_string(text);
+      return send_message(client, std::uint32_t(server_message::error), reply);
+    };
+
+    auto start = render_clock::now();
+    bool was_cached = true;
+    auto scene = find(source);
+    if (!scene) {
+      was_cached = false;
+      scene = build(name, source);
+      if (!scene)
+        return error("could not build the scene '" + name + "'");
+    }
+
+    auto cam = scene->cam;
+    if (!apply_camera_settings(settings, cam, name + " (camera settings)"))
+      return error("invalid camera settings for '" + name + "'");
+    cam.prepare();
+
+    // The client gets the camera's region as the image, and tiles placed
+    // within it.
+    auto tiles = cam.tiles();
+    auto region = cam.region();
+    message_payload image;
+    image.put(std::int32_t(region.x1 - region.x0));
+    image.put(std::int32_t(region.y1 - region.y0));
+    image.put(std::uint32_t(tiles.size()));
+    if (!send_message(client, std::uint32_t(server_message::image), image))
+      return false;
+
+    // Tiles render on the server's threads, and each is sent as soon as it
+    // is done. Once the client is gone, the remaining tiles are skipped.
+    std::mutex sending;
+    std::atomic<bool> connected(true);
+    std::vector<std::future<void>> pending;
+    for (const auto &tile : tiles) {
+      pending.push_back(pool.submit([&, tile] {
+        if (!connected)
+          return;
+        std::vector<float> sums(std::size_t(tile.x1 - tile.x0) *
+                                    (tile.y1 - tile.y0) * 3,
+                                0.0f);
+        cam.render_samples(scene->world, tile, cam.samples_per_pixel,
+                           sums.data());
+
+        message_payload reply;
+        reply.put(image_tile{tile.x0 - region.x0, tile.y0 - region.y0,
+                             tile.x1 - region.x0, tile.y1 - region.y0});
+        auto scale = 1.0f / float(cam.samples_per_pixel);
+        for (auto sum : sums)
+          reply.put(sum * scale);
+        std::lock_guard<std::mutex> lock(sending);
+        if (!send_message(client, std::uint32_t(server_message::tile), reply))
+          connected = false;
+      }));
+    }
+    for (auto &tile : pending)
+      tile.wait();
+
+    message_payload done;
+    done.put(seconds_between(start, render_clock::now()));
+    done.put(std::uint8_t(was_cached));
+    return connected &&
+           send_message(client, std::uint32_t(server_message::done), done);
+  }
+
+  shared_ptr<cached_scene> find(const std::string &source) {
+    auto hash = fnv1a_hash(source);
+    for (auto &scene : scenes) {
+      if (scene->source_hash == hash && scene->source == source) {
+        scene->last_used = ++requests;
+        return scene;
+      }
+    }
+    return nullptr;
+  }
+
+  shared_ptr<cached_scene> build(const std::string &name,
+                                 const std::string &source) {
+    // Builds the scene and adds it to the cache, making room if needed. Its
+    // textures are decoded before it is used, so later renders never wait.
+    auto built = make_shared<cached_scene>();
+    built->source_hash = fnv1a_hash(source);
+    built->source = source;
+    built->last_used = ++requests;
+
+    scene_description scene;
+    scene.source = name;
+    {
+      asset_loader assets;
+      if (!scene_parser(scene).parse(source) ||
+          !scene.build(built->world, built->cam, assets))
+        return nullptr;
+      assets.wait();
+    }
+
+    if (scenes.size() >= max_scenes && !scenes.empty()) {
+      auto oldest = scenes.begin();
+      for (auto s = scenes.begin(); s != scenes.end(); ++s)
+        if ((*s)->last_used < (*oldest)->last_used)
+          oldest = s;
+      scenes.erase(oldest);
+    }
+    scenes.push_back(built);
+    return built;
+  }
+};
+
+struct server_render_result {
+  std::vector<color> pixels; // The image in scanline order
+  int width = 0;
+  int height = 0;
+  double render_seconds = 0; // Server time, including any scene build
+  bool was_cached = false;   // Whether the server had the scene built
+};
+
+inline bool request_server_render(const std::string &address,
+                                  const std::string &scene_name,
+                                  const std::string &source,
+                                  const std::string &camera_settings,
+                                  server_render_result &result,
+                                  bool show_progress = true) {
+  // Has the render server at address render the scene, with the camera
+  // settings (in the scene file format) applied on top of the scene's own.
+  auto server = socket_handle::connect(address);
+  if (!server.is_open()) {
+    std::cerr << "ERROR: Could not connect to render server '" << address
+              << "'.\n";
+    return false;
+  }
+
+  message_payload request;
+  request.put_string(scene_name);
+  request.put_string(source);
+  request.put_string(camera_settings);
+  if (!send_message(server, std::uint32_t(server_message::render), request))
+    return false;
+
+  std::uint32_t type, tiles_remaining = 0;
+  message_payload reply;
+  while (receive_message(server, type, reply)) {
+    switch (server_message(type)) {
+    case server_message::image: {
+      std::int32_t width, height;
+      if (!reply.get(width) || !reply.get(height) ||
+          !reply.get(tiles_remaining) || width < 0 || height < 0)
+        return false;
+      result.width = width;
+      result.height = height;
+      result.pixels.assign(std::size_t(width) * height, color(0, 0, 0));
+      break;
+    }
+
+    case server_message::tile: {
+      image_tile tile;
+      if (!reply.get(tile) || tile.x0 < 0 || tile.y0 < 0 ||
+          tile.x1 > result.width || tile.y1 > result.height ||
+          tile.x0 > tile.x1 || tile.y0 > tile.y1)
+        return false;
+      for (int j = tile.y0; j < tile.y1; j++) {
+        for (int i = tile.x0; i < tile.x1; i++) {
+          float c[3];
+          if (!reply.get_floats(c, 3))
+            return false;
+          result.pixels[std::size_t(j) * result.width + i] =
+              color(c[0], c[1], c[2]);
+        }
+      }
+      if (show_progress && tiles_remaining > 0)
+        std::clog << "\rTiles remaining: " << --tiles_remaining << ' '
+                  << std::flush;
+      break;
+    }
+
+    case server_message::done: {
+      std::uint8_t was_cached;
+      if (!reply.get(result.render_seconds) || !reply.get(was_cached))
+        return false;
+      result.was_cached = was_cached != 0;
+      if (show_progress)
+        std::clog << "\rDone in " << result.render_seconds << " s"
+                  << (result.was_cached ? ", scene was cached" : "") << ".\n";
+      return true;
+    }
+
+    case server_message::error: {
+      std::string text;
+      reply.get_string(text);
+      std::cerr << "ERROR: Render server: " << text << ".\n";
+      return false;
+    }
+
+    default:
+      return false;
+    }
+  }
+
+  std::cerr << "ERROR: Lost the connection to the render server.\n";
+  return false;
+}
+
+inline bool request_server_stop(const std::string &address) {
+  // Asks the render server at address to stop.
+  auto server = socket_handle::connect(address);
+  return server.is_open() &&
+         send_message(server, std::uint32_t(server_message::stop), {});
+}
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+
+using render_clock = std::chrono::steady_clock;
+
+// Time at which the program started, taken during static initialization.
+inline const render_clock::time_point program_start = render_clock::now();
+
+inline double seconds_between(render_clock::time_point from,
+                              render_clock::time_point to) {
+  return std::chrono::duration<double>(to - from).count();
+}
+
+// Whether trace counters are compiled in. Define RAYTRACING_STATS (the CMake
+// option of the same name does) to count the work done tracing rays.
+#ifdef RAYTRACING_STATS
+inline constexpr bool trace_stats_enabled = true;
+#else
+inline constexpr bool trace_stats_enabled = false;
+#endif
+
+struct trace_counters {
+  // Counts of the work done tracing rays. Histograms have power of two bins:
+  // bin 0 counts zeros, and bin b > 0 counts values in [2^(b-1), 2^b).
+
+  static constexpr int depth_bins = 64;     // Deeper bounces share the last
+  static constexpr int histogram_bins = 24; // Larger values share the last
+
+  std::uint64_t rays_by_depth[depth_bins] = {}; // Rays traced, by bounce
+  std::uint64_t node_visits = 0;                // BVH nodes tested
+  std::uint64_t primitive_tests = 0;            // Primitive hit tests
+  std::uint64_t primitive_hits = 0;             // Primitive tests that hit
+  std::uint64_t finalized_hits = 0;             // Hits given attributes
+  std::uint64_t escaped = 0;       // Paths that left the scene
+  std::uint64_t absorbed = 0;      // Paths whose scatter() returned false
+  std::uint64_t depth_limited = 0; // Paths cut off at the bounce limit
+  std::uint64_t node_visits_per_ray[histogram_bins] = {};
+  std::uint64_t primitive_tests_per_ray[histogram_bins] = {};
+
+  // Transcendental functions called for hit attributes, such as a sphere's
+  // texture coordinates, and the number that would be called if every
+  // candidate hit computed its attributes rather than only the closest.
+  std::uint64_t transcendental_calls = 0;
+  std::uint64_t eager_transcendental_calls = 0;
+
+  // Counts for the ray being traced, which hit tests add to. They are added
+  // to the totals and histograms above when the ray ends.
+  std::uint64_t ray_node_visits = 0;
+  std::uint64_t ray_primitive_tests = 0;
+
+  std::uint64_t rays() const {
+    std::uint64_t total = 0;
+    for (auto count : rays_by_depth)
+      total += count;
+    return total;
+  }
+
+  void begin_ray() {
+    ray_node_visits = 0;
+    ray_primitive_tests = 0;
+  }
+
+  void end_ray(int depth) {
+    rays_by_depth[depth < depth_bins ? depth : depth_bins - 1]++;
+    node_visits += ray_node_visits;
+    primitive_tests += ray_primitive_tests;
+    node_visits_per_ray[bin(ray_node_visits)]++;
+    primitive_tests_per_ray[bin(ray_primitive_tests)]++;
+  }
+
+  void merge(const trace_counters &other) {
+    for (int i = 0; i < depth_bins; i++)
+      rays_by_depth[i] += other.rays_by_depth[i];
+    node_visits += other.node_visits;
+    primitive_tests += other.primitive_tests;
+    primitive_hits += other.primitive_hits;
+    finalized_hits += other.finalized_hits;
+    transcendental_calls += other.transcendental_calls;
+    eager_transcendental_calls += other.eager_transcendental_calls;
+    escaped += other.escaped;
+    absorbed += other.absorbed;
+    depth_limited += other.depth_limited;
+    for (int i = 0; i < histogram_bins; i++) {
+      node_visits_per_ray[i] += other.node_visits_per_ray[i];
+      primitive_tests_per_ray[i] += other.primitive_tests_per_ray[i];
+    }
+  }
+
+  static int bin(std::uint64_t value) {
+    int b = 0;
+    while (value > 0 && b < histogram_bins - 1) {
+      value >>= 1;
+      b++;
+    }
+    return b;
+  }
+};
+
+inline trace_counters &thread_trace_counters() {
+  // The counters of the calling thread, so counting needs no synchronization.
+  thread_local trace_counters counters;
+  return counters;
+}
+
+inline void collect_trace_counters(trace_counters &totals, std::mutex &mutex) {
+  // Adds the calling thread's counters to totals and clears them.
+#ifdef RAYTRACING_STATS
+  auto &counters = thread_trace_counters();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    totals.merge(counters);
+  }
+  counters = trace_counters();
+#else
+  (void)totals;
+  (void)mutex;
+#endif
+}
+
+// Counting on the hot path goes through these, which compile to nothing
+// unless RAYTRACING_STATS is defined.
+#ifdef RAYTRACING_STATS
+#define RAYTRACING_COUNT(counter) (thread_trace_counters().counter++)
+#define RAYTRACING_ADD(counter, n) (thread_trace_counters().counter += (n))
+#define RAYTRACING_BEGIN_RAY() thread_trace_counters().begin_ray()
+#define RAYTRACING_END_RAY(depth) thread_trace_counters().end_ray(depth)
+#else
+#define RAYTRACING_COUNT(counter) ((void)0)
+#define RAYTRACING_ADD(counter, n) ((void)0)
+#define RAYTRACING_BEGIN_RAY() ((void)0)
+#define RAYTRACING_END_RAY(depth) ((void)0)
+#endif
+
+class render_stats {
+public:
+  double setup_seconds = 0;       // Program start until rendering started
+  double time_to_first_pixel = 0; // Program start until the first pixel
+  double render_seconds = 0;      // Rendering, from start to finish
+  double output_seconds = 0;      // Writing the image after rendering
+  trace_counters counters;        // Zero unless trace_stats_enabled
+
+  void report(std::ostream &out) const {
+    out << "Scene setup: " << setup_seconds << " s, "
+        << "time to first pixel: " << time_to_first_pixel << " s, "
+        << "render: " << render_seconds << " s, "
+        << "output: " << output_seconds << " s\n";
+    if (!trace_stats_enabled)
+      return;
+
+    auto rays = counters.rays();
+    auto per_ray = [rays](std::uint64_t count) {
+      return rays ? double(count) / rays : 0.0;
+    };
+    out << "Rays: " << rays << ", " << rays / render_seconds << " per second\n"
+        << "BVH nodes per ray: " << per_ray(counters.node_visits) << '\n'
+        << "Primitive tests per ray: " << per_ray(counters.primitive_tests)
+        << ", hit rate "
+        << (counters.primitive_tests ? double(counters.primitive_hits) /
+                                           counters.primitive_tests
+                                     : 0.0)
+        << '\n'
+        << "Hits finalized per ray: " << per_ray(counters.finalized_hits)
+        << ", transcendental calls per ray: "
+        << per_ray(counters.transcendental_calls) << " (of "
+        << per_ray(counters.eager_transcendental_calls) << " if eager)\n"
+        << "Paths escaped: " << counters.escaped
+        << ", absorbed: " << counters.absorbed
+        << ", cut off at the bounce limit: " << counters.depth_limited << '\n';
+
+    out << "Rays by depth:";
+    for (int i = 0; i <= last_used(counters.rays_by_depth); i++)
+      out << ' ' << counters.rays_by_depth[i];
+    out << "\nRays by BVH nodes visited (power of two bins):";
+    for (int i = 0; i <= last_used(counters.node_visits_per_ray); i++)
+      out << ' ' << counters.node_visits_per_ray[i];
+    out << "\nRays by primitive tests (power of two bins):";
+    for (int i = 0; i <= last_used(counters.primitive_tests_per_ray); i++)
+      out << ' ' << counters.primitive_tests_per_ray[i];
+    out << '\n';
+  }
+
+  void report_json(std::ostream &out) const {
+    // Writes the stats as a JSON object. Trace counters are included only
+    // when compiled in.
+    out << "{\n"
+        << "  \"trace_stats_enabled\": "
+        << (trace_stats_enabled ? "true" : "false") << ",\n"
+        << "  \"seconds\": {\"setup\": " << setup_seconds
+        << ", \"first_pixel\": " << time_to_first_pixel
+        << ", \"render\": " << render_seconds
+        << ", \"output\": " << output_seconds << "}";
+
+    if (trace_stats_enabled) {
+      out << ",\n  \"rays\": " << counters.rays()
+          << ",\n  \"node_visits\": " << counters.node_visits
+          << ",\n  \"primitive_tests\": " << counters.primitive_tests
+          << ",\n  \"primitive_hits\": " << counters.primitive_hits
+          << ",\n  \"finalized_hits\": " << counters.finalized_hits
+          << ",\n  \"transcendental_calls\": "
+          << counters.transcendental_calls
+          << ",\n  \"eager_transcendental_calls\": "
+          << counters.eager_transcendental_calls
+          << ",\n  \"paths\": {\"escaped\": " << counters.escaped
+          << ", \"absorbed\": " << counters.absorbed
+          << ", \"depth_limited\": " << counters.depth_limited << "}";
+      out << ",\n  \"rays_by_depth\": ";
+      json_array(out, counters.rays_by_depth);
+      out << ",\n  \"node_visits_per_ray\": ";
+      json_array(out, counters.node_visits_per_ray);
+      out << ",\n  \"primitive_tests_per_ray\": ";
+      json_array(out, counters.primitive_tests_per_ray);
+    }
+    out << "\n}\n";
+  }
+
+private:
+  template <std::size_t N>
+  static int last_used(const std::uint64_t (&bins)[N]) {
+    // Index of the last nonzero bin, so trailing empty bins can be left out.
+    int last = 0;
+    for (std::size_t i = 0; i < N; i++)
+      if (bins[i])
+        last = int(i);
+    return last;
+  }
+
+  template <std::size_t N>
+  static void json_array(std::ostream &out, const std::uint64_t (&bins)[N]) {
+    out << '[';
+    for (int i = 0; i <= last_used(bins); i++)
+      out << (i ? ", " : "") << bins[i];
+    out << ']';
+  }
+};
+
+#endif
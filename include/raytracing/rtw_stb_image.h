@@ -8,15 +8,150 @@
 #pragma warning(push, 0)
 #endif
 
+// The implementation is compiled into every translation unit that includes this
+// header, so keep its symbols internal to avoid duplicate definitions. Internal
+// functions a translation unit does not call would otherwise warn as unused.
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#define STB_IMAGE_STATIC
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
 #include "external/stb_image.h"
 
+#include "raytracing/color.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+class image_pager {
+public:
+  // Keeps count of the image tiles in memory for a cache that evicts them to
+  // stay within a memory budget. Images stamp each tile they read with the
+  // pager's clock, so the cache can tell which were used least recently, and
+  // report the tiles they bring back into memory.
+  virtual void tile_paged_in(std::size_t bytes, bool decoded) = 0;
+
+  // Bytes of tiles that can be brought back without going over the budget.
+  virtual std::size_t room() const = 0;
+
+  std::uint64_t now() const { return clock.load(std::memory_order_relaxed); }
+
+protected:
+  ~image_pager() = default;
+
+  std::atomic<std::uint64_t> clock{1}; // Advanced by the cache
+};
+
+class tile_reclaimer {
+public:
+  // Frees the pixels of evicted image tiles once no lookup can still be
+  // reading them. A thread looking up a pixel announces the epoch it started
+  // in, and tiles evicted during an epoch are freed only once every thread
+  // that announced that epoch or an earlier one is done.
+
+  static tile_reclaimer &global() {
+    static tile_reclaimer reclaimer;
+    return reclaimer;
+  }
+
+  tile_reclaimer() {}
+  tile_reclaimer(const tile_reclaimer &) = delete;
+  tile_reclaimer &operator=(const tile_reclaimer &) = delete;
+
+  ~tile_reclaimer() {
+    for (const auto &tile : retired)
+      delete[] tile.second;
+  }
+
+  class reading {
+  public:
+    // Announces a lookup for the life of the object. Nested lookups keep the
+    // epoch of the outermost one.
+    reading() : slot(thread_slot()), outer(slot.load()) {
+      if (outer == 0)
+        slot.store(global().epoch.load());
+    }
+
+    ~reading() {
+      if (outer == 0)
+        slot.store(0, std::memory_order_release);
+    }
+
+  private:
+    std::atomic<std::uint64_t> &slot;
+    std::uint64_t outer;
+  };
+
+  void retire(unsigned char *pixels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    retired.push_back({epoch.load(), pixels});
+  }
+
+  void reclaim() {
+    // Moves on to the next epoch, and frees the tiles retired before the
+    // oldest epoch a lookup is still in.
+    epoch++;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto oldest = std::uint64_t(-1);
+    for (const auto *slot : slots) {
+      auto announced = slot->load();
+      if (announced != 0 && announced < oldest)
+        oldest = announced;
+    }
+
+    std::size_t kept = 0;
+    for (const auto &tile : retired) {
+      if (tile.first < oldest)
+        delete[] tile.second;
+      else
+        retired[kept++] = tile;
+    }
+    retired.resize(kept);
+  }
+
+private:
+  // Each thread's announced epoch, or zero while it isn't looking anything
+  // up, listed for as long as the thread lives.
+  struct registration {
+    registration() {
+      std::lock_guard<std::mutex> lock(global().mutex);
+      global().slots.push_back(&slot);
+    }
+
+    ~registration() {
+      auto &slots = global().slots;
+      std::lock_guard<std::mutex> lock(global().mutex);
+      slots.erase(std::find(slots.begin(), slots.end(), &slot));
+    }
+
+    std::atomic<std::uint64_t> slot{0};
+  };
+
+  std::atomic<std::uint64_t> epoch{1};
+  std::mutex mutex;
+  std::vector<const std::atomic<std::uint64_t> *> slots;
+  std::vector<std::pair<std::uint64_t, unsigned char *>> retired;
+
+  static std::atomic<std::uint64_t> &thread_slot() {
+    thread_local registration thread;
+    return thread.slot;
+  }
+};
 
 class rtw_image {
 public:
+  // Side length, in pixels, of the square tiles that pixel data is stored in.
+  static const int tile_size = 8;
+
   rtw_image() {}
 
   rtw_image(const char *image_filename) {
@@ -28,81 +163,199 @@ class rtw_image {
     // six levels up. If the image was not loaded successfully, width() and
     // height() will return 0.
 
-    auto filename = std::string(image_filename);
-    auto imagedir = getenv("RTW_IMAGES");
-
     // Hunt for the image file in some likely locations.
-    if (imagedir && load(std::string(imagedir) + "/" + image_filename))
-      return;
-    if (load(filename))
-      return;
-    if (load("images/" + filename))
-      return;
-    if (load("../images/" + filename))
-      return;
-    if (load("../../images/" + filename))
-      return;
-    if (load("../../../images/" + filename))
-      return;
-    if (load("../../../../images/" + filename))
-      return;
-    if (load("../../../../../images/" + filename))
-      return;
-    if (load("../../../../../../images/" + filename))
-      return;
+    for (const auto &path : candidate_paths(image_filename))
+      if (load(path))
+        return;
 
     std::cerr << "ERROR: Could not load image file '" << image_filename
               << "'.\n";
   }
 
+  static std::vector<std::string> candidate_paths(const std::string &filename) {
+    // Returns the locations searched for an image file, in search order. See
+    // the rtw_image(const char *) constructor.
+    std::vector<std::string> paths;
+
+    auto imagedir = getenv("RTW_IMAGES");
+    if (imagedir)
+      paths.push_back(std::string(imagedir) + "/" + filename);
+
+    paths.push_back(filename);
+    std::string prefix = "images/";
+    for (int level = 0; level <= 6; level++) {
+      paths.push_back(prefix + filename);
+      prefix = "../" + prefix;
+    }
+    return paths;
+  }
+
+  rtw_image(int width, int height, const float *rgb_data) {
+    // Builds an image from linear RGB floating point data laid out like the
+    // output of stbi_loadf(): three floats per pixel, rows from top to bottom.
+    store(width, height, 3, rgb_data);
+  }
+
+  rtw_image(const rtw_image &) = delete;
+  rtw_image &operator=(const rtw_image &) = delete;
+
   ~rtw_image() {
-    delete[] bdata;
-    STBI_FREE(fdata);
+    for (auto &slot : tiles)
+      delete[] slot.pixels.load();
   }
 
   bool load(const std::string &filename) {
     // Loads the linear (gamma=1) image data from the given file name. Returns
-    // true if the load succeeded. The resulting data buffer contains the three
-    // [0.0, 1.0] floating-point values for the first pixel (red, then green,
-    // then blue). Pixels are contiguous, going left to right for the width of
-    // the image, followed by the next row below, for the full height of the
-    // image.
-
-    auto n =
-        bytes_per_pixel; // Dummy out parameter: original components per pixel
-    fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n,
-                       bytes_per_pixel);
+    // true if the load succeeded. The floating point data returned by the
+    // decoder is only kept long enough to convert it to 8-bit tiled storage.
+    // Images that were stored with one or two components are kept as a single
+    // luminance channel, all others as RGB. The file is remembered, so that
+    // evicted tiles can be decoded from it again.
+
+    int width = 0, height = 0, components = 0;
+    auto *fdata = stbi_loadf(filename.c_str(), &width, &height, &components, 0);
     if (fdata == nullptr)
       return false;
 
-    bytes_per_scanline = image_width * bytes_per_pixel;
-    convert_to_bytes();
+    store(width, height, components, fdata);
+    STBI_FREE(fdata);
+    source = filename;
     return true;
   }
 
-  int width() const { return (fdata == nullptr) ? 0 : image_width; }
-  int height() const { return (fdata == nullptr) ? 0 : image_height; }
+  int width() const { return width(0); }
+  int height() const { return height(0); }
 
-  const unsigned char *pixel_data(int x, int y) const {
-    // Return the address of the three RGB bytes of the pixel at x,y. If there
-    // is no image data, returns magenta.
-    static unsigned char magenta[] = {255, 0, 255};
-    if (bdata == nullptr)
-      return magenta;
+  int width(int level) const {
+    return (level < mip_levels()) ? levels[level].width : 0;
+  }
 
-    x = clamp(x, 0, image_width);
-    y = clamp(y, 0, image_height);
+  int height(int level) const {
+    return (level < mip_levels()) ? levels[level].height : 0;
+  }
+
+  int mip_levels() const { return int(levels.size()); }
 
-    return bdata + y * bytes_per_scanline + x * bytes_per_pixel;
+  int channels() const { return pixel_channels; }
+
+  std::size_t memory_bytes() const {
+    // Returns the number of bytes of pixel data the image has in memory.
+    std::size_t bytes = 0;
+    for (int t = 0; t < tile_count(); t++)
+      if (tile_resident(t))
+        bytes += tile_bytes();
+    return bytes;
+  }
+
+  color texel(int x, int y, int level = 0) const {
+    // Returns the linear [0,1] color of the pixel at x,y in the given mip
+    // level. Coordinates outside the image are clamped to the nearest edge. If
+    // there is no image data, returns magenta.
+    if (levels.empty())
+      return color(1, 0, 1);
+
+    unsigned char pixel[3];
+    texel_bytes(clamp(level, 0, mip_levels()), x, y, pixel);
+
+    auto color_scale = 1.0 / 255.0;
+    if (pixel_channels == 1)
+      return color(color_scale * pixel[0], color_scale * pixel[0],
+                   color_scale * pixel[0]);
+
+    return color(color_scale * pixel[0], color_scale * pixel[1],
+                 color_scale * pixel[2]);
+  }
+
+  color bilinear(double x, double y, int level = 0) const {
+    // Returns the bilinearly filtered color at the continuous texel-space
+    // position x,y of the given mip level, where pixel centers lie at half
+    // integer coordinates.
+    x -= 0.5;
+    y -= 0.5;
+
+    auto x0 = int(std::floor(x));
+    auto y0 = int(std::floor(y));
+    auto fx = x - x0;
+    auto fy = y - y0;
+
+    auto top = (1 - fx) * texel(x0, y0, level) + fx * texel(x0 + 1, y0, level);
+    auto bottom =
+        (1 - fx) * texel(x0, y0 + 1, level) + fx * texel(x0 + 1, y0 + 1, level);
+
+    return (1 - fy) * top + fy * bottom;
+  }
+
+  // Each tile of every mip level is held in memory on its own, and those of
+  // images loaded from a file can be evicted while the image is in use; a
+  // lookup that finds its tile evicted brings it back. Tiles of the full
+  // size image are decoded again from the file, which is decoded whole, and
+  // those of smaller mip levels are filtered again from the level above.
+  // Since decoding the file is costly, full size tiles are brought back a
+  // whole row of tiles at a time, as lookups near a tile are likely to need
+  // its neighbors next. Each decode also brings back as many other evicted
+  // full size tiles as the budget has room for, and serves all the tiles
+  // that filtering a smaller level's tile finds missing.
+
+  void attach(image_pager *cache) const {
+    // Has the image report the tiles it brings back to cache, and stamp
+    // tiles with its clock as they are used. Call before the image is shared.
+    pager.store(cache);
+    for (int t = 0; t < tile_count(); t++)
+      tiles[t].last_use.store(cache ? cache->now() : 0);
+  }
+
+  bool evictable() const { return !source.empty(); }
+
+  int tile_count() const { return int(tiles.size()); }
+
+  std::size_t tile_bytes() const {
+    return std::size_t(tile_size) * tile_size * pixel_channels;
+  }
+
+  bool tile_resident(int t) const { return tiles[t].pixels.load() != nullptr; }
+
+  std::uint64_t tile_last_use(int t) const {
+    return tiles[t].last_use.load(std::memory_order_relaxed);
+  }
+
+  std::size_t evict_tile(int t) const {
+    // Hands the tile's pixels to the reclaimer to free, if the image can
+    // decode them again, and returns the number of bytes freed. Lookups
+    // still reading the pixels finish first.
+    if (!evictable())
+      return 0;
+    auto *freed = tiles[t].pixels.exchange(nullptr);
+    if (!freed)
+      return 0;
+    tile_reclaimer::global().retire(freed);
+    return tile_bytes();
   }
 
 private:
-  const int bytes_per_pixel = 3;
-  float *fdata = nullptr;         // Linear floating point pixel data
-  unsigned char *bdata = nullptr; // Linear 8-bit pixel data
-  int image_width = 0;            // Loaded image width
-  int image_height = 0;           // Loaded image height
-  int bytes_per_scanline = 0;
+  struct mip_level {
+    int width;
+    int height;
+    int tiles_x;    // Number of tiles across one row of the level
+    int first_tile; // Index of the level's first tile in `tiles`
+  };
+
+  struct tile {
+    std::atomic<unsigned char *> pixels{nullptr}; // Null while evicted
+    std::atomic<std::uint64_t> last_use{0};       // Pager clock when last used
+  };
+
+  int pixel_channels = 0; // Stored bytes per pixel: 1 (luminance) or 3 (RGB)
+  std::vector<mip_level> levels;
+  std::string source; // File the image was loaded from, if any
+  mutable std::vector<tile> tiles; // Linear 8-bit pixel data, all levels
+  mutable std::atomic<image_pager *> pager{nullptr};
+  mutable std::recursive_mutex paging; // Held while bringing tiles back
+
+  // The file's pixels, while they are decoded to bring back tiles, and the
+  // nesting depth of page_in(). Guarded by paging.
+  mutable float *decoded_pixels = nullptr;
+  mutable int decoded_components = 0;
+  mutable int paging_depth = 0;
 
   static int clamp(int x, int low, int high) {
     // Return the value clamped to the range [low, high).
@@ -121,26 +374,248 @@ class rtw_image {
     return static_cast<unsigned char>(256.0 * value);
   }
 
-  void convert_to_bytes() {
-    // Convert the linear floating point pixel data to bytes, storing the
-    // resulting byte data in the `bdata` member.
+  void texel_bytes(int level, int x, int y, unsigned char *out) const {
+    // Copies the stored bytes of the pixel at x,y, clamped to the level.
+    // Pixels are grouped in tile_size x tile_size tiles, so that neighboring
+    // pixels in both directions are close in memory, and the pixels within
+    // each tile are stored row by row.
+    const auto &lvl = levels[level];
+    x = clamp(x, 0, lvl.width);
+    y = clamp(y, 0, lvl.height);
+    auto t = lvl.first_tile + (y / tile_size) * lvl.tiles_x + x / tile_size;
+    auto within = (y % tile_size) * tile_size + x % tile_size;
 
-    int total_bytes = image_width * image_height * bytes_per_pixel;
-    bdata = new unsigned char[total_bytes];
+    auto &slot = tiles[t];
+    if (auto cache = pager.load(std::memory_order_relaxed)) {
+      auto now = cache->now();
+      if (slot.last_use.load(std::memory_order_relaxed) != now)
+        slot.last_use.store(now, std::memory_order_relaxed);
+    }
+    tile_reclaimer::reading reading;
+    const auto *pixels = slot.pixels.load();
+    if (!pixels)
+      pixels = page_in(level, t);
 
-    // Iterate through all pixel components, converting from [0.0, 1.0] float
-    // values to unsigned [0, 255] byte values.
+    const auto *pixel = pixels + std::size_t(within) * pixel_channels;
+    for (int c = 0; c < pixel_channels; c++)
+      out[c] = pixel[c];
+  }
 
-    auto *bptr = bdata;
-    auto *fptr = fdata;
-    for (auto i = 0; i < total_bytes; i++, fptr++, bptr++)
-      *bptr = float_to_byte(*fptr);
+  void store(int width, int height, int components, const float *fdata) {
+    // Converts the linear floating point pixel data (with the given number of
+    // components per pixel) to 8-bit tiled storage, and builds the mip chain.
+
+    pixel_channels = (components < 3) ? 1 : 3;
+    allocate_levels(width, height);
+
+    for (int t = 0; t < levels[0].tiles_x * tiles_y(levels[0]); t++)
+      tiles[t].pixels.store(convert_tile(t, components, fdata));
+    for (int level = 1; level < mip_levels(); level++)
+      for (int t = levels[level].first_tile; t < end_tile(level); t++)
+        tiles[t].pixels.store(downsample_tile(level, t));
+  }
+
+  void allocate_levels(int width, int height) {
+    // Lays out every mip level, down to 1x1, each padded to whole tiles.
+
+    levels.clear();
+    int total = 0;
+    int w = width, h = height;
+
+    while (true) {
+      mip_level lvl;
+      lvl.width = w;
+      lvl.height = h;
+      lvl.tiles_x = (w + tile_size - 1) / tile_size;
+      lvl.first_tile = total;
+      levels.push_back(lvl);
+      total += lvl.tiles_x * tiles_y(lvl);
+
+      if (w == 1 && h == 1)
+        break;
+      w = (w > 1) ? w / 2 : 1;
+      h = (h > 1) ? h / 2 : 1;
+    }
+
+    for (auto &slot : tiles)
+      delete[] slot.pixels.load();
+    tiles = std::vector<tile>(std::size_t(total));
+  }
+
+  static int tiles_y(const mip_level &lvl) {
+    return (lvl.height + tile_size - 1) / tile_size;
+  }
+
+  int end_tile(int level) const {
+    return levels[level].first_tile + levels[level].tiles_x *
+                                          tiles_y(levels[level]);
+  }
+
+  unsigned char *new_tile() const { return new unsigned char[tile_bytes()](); }
+
+  unsigned char *convert_tile(int t, int components, const float *fdata) const {
+    // Converts the pixels of tile t of the full size image from the decoded
+    // floating point data. Pixels past the edge of the image stay zero.
+    const auto &base = levels[0];
+    auto tile_x = t % base.tiles_x * tile_size;
+    auto tile_y = t / base.tiles_x * tile_size;
+
+    auto *result = new_tile();
+    for (int j = 0; j < tile_size && tile_y + j < base.height; j++) {
+      for (int i = 0; i < tile_size && tile_x + i < base.width; i++) {
+        const float *src =
+            fdata + (std::size_t(tile_y + j) * base.width + tile_x + i) *
+                        components;
+        auto *pixel = result + std::size_t(j * tile_size + i) * pixel_channels;
+        for (int c = 0; c < pixel_channels; c++)
+          pixel[c] = float_to_byte(src[c]);
+      }
+    }
+    return result;
+  }
+
+  unsigned char *downsample_tile(int level, int t) const {
+    // Fills tile t of the given level with the 2x2 box-filtered level above.
+    const auto &src = levels[level - 1];
+    const auto &dst = levels[level];
+    auto tile_x = (t - dst.first_tile) % dst.tiles_x * tile_size;
+    auto tile_y = (t - dst.first_tile) / dst.tiles_x * tile_size;
+
+    auto *result = new_tile();
+    for (int j = 0; j < tile_size && tile_y + j < dst.height; j++) {
+      for (int i = 0; i < tile_size && tile_x + i < dst.width; i++) {
+        auto x = tile_x + i, y = tile_y + j;
+        auto x0 = clamp(2 * x, 0, src.width),
+             x1 = clamp(2 * x + 1, 0, src.width);
+        auto y0 = clamp(2 * y, 0, src.height),
+             y1 = clamp(2 * y + 1, 0, src.height);
+
+        unsigned char p00[3], p01[3], p10[3], p11[3];
+        texel_bytes(level - 1, x0, y0, p00);
+        texel_bytes(level - 1, x1, y0, p01);
+        texel_bytes(level - 1, x0, y1, p10);
+        texel_bytes(level - 1, x1, y1, p11);
+
+        auto *pixel = result + std::size_t(j * tile_size + i) * pixel_channels;
+        for (int c = 0; c < pixel_channels; c++)
+          pixel[c] = static_cast<unsigned char>(
+              (p00[c] + p01[c] + p10[c] + p11[c] + 2) / 4);
+      }
+    }
+    return result;
+  }
+
+  const unsigned char *page_in(int level, int t) const {
+    // Brings back an evicted tile, unless another lookup already has. The
+    // caller's lookup keeps the tile from being freed until it is read.
+    std::lock_guard<std::recursive_mutex> lock(paging);
+    unsigned char *pixels = tiles[t].pixels.load();
+    if (pixels)
+      return pixels;
+
+    // Tiles of smaller levels may need several full size tiles brought back
+    // while they are filtered; the file is decoded for the first of them,
+    // and the decoded pixels kept until the outermost page_in() is done.
+    paging_depth++;
+    auto cache = pager.load();
+    if (level > 0) {
+      pixels = downsample_tile(level, t);
+      // Counted before it can be seen, so that it is never evicted uncounted.
+      if (cache)
+        cache->tile_paged_in(tile_bytes(), false);
+      tiles[t].pixels.store(pixels);
+    } else {
+      pixels = restore_row(t, cache);
+    }
+
+    if (--paging_depth == 0 && decoded_pixels) {
+      refill(cache);
+      STBI_FREE(decoded_pixels);
+      decoded_pixels = nullptr;
+    }
+    return pixels;
+  }
+
+  unsigned char *restore_row(int t, image_pager *cache) const {
+    // Brings back the evicted tiles in the row of full size tiles holding
+    // tile t, which is one of them, counting them as just used. Returns the
+    // pixels of tile t.
+    bool decoded = decode();
+    auto first = t / levels[0].tiles_x * levels[0].tiles_x;
+    std::vector<int> evicted;
+    std::vector<unsigned char *> restored;
+    unsigned char *pixels = nullptr;
+    for (int r = first; r < first + levels[0].tiles_x; r++) {
+      if (tiles[r].pixels.load())
+        continue;
+      evicted.push_back(r);
+      if (decoded_pixels)
+        restored.push_back(convert_tile(r, decoded_components, decoded_pixels));
+      else
+        restored.push_back(new_tile());
+      if (r == t)
+        pixels = restored.back();
+    }
+
+    if (cache) {
+      for (int r : evicted)
+        tiles[r].last_use.store(cache->now(), std::memory_order_relaxed);
+      cache->tile_paged_in(evicted.size() * tile_bytes(), decoded);
+    }
+    for (std::size_t k = 0; k < evicted.size(); k++)
+      tiles[evicted[k]].pixels.store(restored[k]);
+    return pixels;
+  }
+
+  bool decode() const {
+    // Decodes the file again, unless page_in() already has. Returns whether
+    // it did.
+    if (decoded_pixels)
+      return false;
+    int width = 0, height = 0, components = 0;
+    auto *fdata = stbi_loadf(source.c_str(), &width, &height, &components, 0);
+    if (fdata && width == levels[0].width && height == levels[0].height) {
+      decoded_pixels = fdata;
+      decoded_components = components;
+    } else {
+      std::cerr << "ERROR: Could not reload image file '" << source << "'.\n";
+      if (fdata)
+        STBI_FREE(fdata);
+    }
+    return true;
+  }
+
+  void refill(image_pager *cache) const {
+    // Brings back the other evicted full size tiles the budget has room for
+    // from the decoded pixels, those used most recently first.
+    std::vector<int> evicted;
+    for (int t = 0; t < end_tile(0); t++)
+      if (!tiles[t].pixels.load())
+        evicted.push_back(t);
+    std::sort(evicted.begin(), evicted.end(), [this](int a, int b) {
+      return tile_last_use(a) > tile_last_use(b);
+    });
+    auto room = cache ? cache->room() / tile_bytes() : evicted.size();
+    evicted.resize(std::min(evicted.size(), room));
+    if (evicted.empty())
+      return;
+
+    std::vector<unsigned char *> refilled;
+    for (int t : evicted)
+      refilled.push_back(convert_tile(t, decoded_components, decoded_pixels));
+    if (cache)
+      cache->tile_paged_in(refilled.size() * tile_bytes(), false);
+    for (std::size_t k = 0; k < evicted.size(); k++)
+      tiles[evicted[k]].pixels.store(refilled[k]);
   }
 };
 
-// Restore MSVC compiler warnings
+// Restore MSVC and GCC/Clang compiler warnings
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
 
 #endif
@@ -1,6 +1,8 @@
 #ifndef RTWEEKEND_H
 #define RTWEEKEND_H
 
+#include <atomic>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <random>
@@ -21,10 +23,52 @@ inline double degrees_to_radians(double degrees) {
   return degrees * pi / 180.0;
 }
 
+inline std::mt19937 &random_generator() {
+  // Each thread draws from its own generator, so threads can sample without
+  // locking. The first thread to ask gets the default seed, and every later
+  // thread the next seed in turn.
+  static std::atomic<std::mt19937::result_type> next_seed(
+      std::mt19937::default_seed);
+  thread_local std::mt19937 generator(next_seed++);
+  return generator;
+}
+
+class sample_stream {
+public:
+  // A source of the numbers random_double() returns, such as the samples of a
+  // low-discrepancy sequence (see sampler.h). The numbers are drawn in groups
+  // of dimensions: the renderer starts a group before the draws for one step
+  // of a path, so the same step of every path gets the same dimensions.
+  virtual ~sample_stream() = default;
+
+  virtual void start_dimensions(std::uint32_t first, std::uint32_t count) = 0;
+  virtual double next() = 0;
+};
+
+inline sample_stream *&thread_sample_stream() {
+  // The stream random_double() draws from on this thread, if any.
+  thread_local sample_stream *stream = nullptr;
+  return stream;
+}
+
+inline void start_sample_dimensions(std::uint32_t first, std::uint32_t count) {
+  // Starts a group of dimensions of the thread's sample stream, if it has one.
+  if (auto stream = thread_sample_stream())
+    stream->start_dimensions(first, count);
+}
+
+inline double random_uniform() {
+  // Returns a random real in [0,1) from the thread's generator.
+  thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+  return distribution(random_generator());
+}
+
 inline double random_double() {
-  static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-  static std::mt19937 generator;
-  return distribution(generator);
+  // Returns a real in [0,1): the next number of the thread's sample stream if
+  // it has one, otherwise a random one.
+  if (auto stream = thread_sample_stream())
+    return stream->next();
+  return random_uniform();
 }
 
 inline double random_double(double min, double max) {
@@ -0,0 +1,375 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "raytracing/rtweekend.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Samplers give the numbers a path draws in place of independent random ones.
+// Spreading each pixel's samples evenly over every dimension a path uses (the
+// position in the pixel, the lens, the time, and each bounce) makes images
+// converge faster than with random samples, which clump and leave gaps.
+
+enum class sampler_type : std::uint8_t {
+  independent, // Random numbers, as without a sampler
+  halton,      // Halton sequence, rotated per pixel
+  sobol,       // Owen-scrambled Sobol points, scrambled per pixel
+  blue_noise   // Owen-scrambled Sobol points, shifted per pixel by blue noise
+};
+
+inline constexpr int sampler_type_count = 4;
+
+inline const char *const sampler_type_names[sampler_type_count] = {
+    "independent", "halton", "sobol", "blue_noise"};
+
+class sampler {
+public:
+  // value(x, y, index, dimension) is the given dimension of the index-th
+  // sample of pixel x, y, in [0,1). Samplers hold no state, so any number of
+  // threads can share one.
+  virtual ~sampler() = default;
+
+  virtual double value(int x, int y, std::uint32_t index,
+                       std::uint32_t dimension) const = 0;
+};
+
+inline std::uint32_t hash_sample(std::uint32_t a, std::uint32_t b = 0,
+                                 std::uint32_t c = 0, std::uint32_t d = 0) {
+  // Mixes the arguments into 32 well distributed bits.
+  std::uint32_t h = 0x9e3779b9u;
+  for (auto value : {a, b, c, d}) {
+    h ^= value + 0x7f4a7c15u + (h << 6) + (h >> 2);
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+  }
+  return h;
+}
+
+inline double bits_to_unit(std::uint32_t bits) {
+  // Maps 32 bits to [0,1).
+  return bits * 0x1p-32;
+}
+
+inline double wrap_unit(double value) {
+  // Wraps a sum of two numbers in [0,1) back into [0,1).
+  return value >= 1 ? value - 1 : value;
+}
+
+inline std::uint32_t reverse_bits(std::uint32_t x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+  x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+  x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+  x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+  return x;
+}
+
+inline std::uint32_t nested_uniform_scramble(std::uint32_t x,
+                                             std::uint32_t seed) {
+  // Owen scrambling of the bits of x, a fraction with its most significant bit
+  // first: each bit is flipped or not depending on the seed and the bits above
+  // it. Scrambled points keep the stratification of the originals. This is
+  // Laine and Karras' hash, which scrambles from the least significant bit up,
+  // applied to the reversed bits.
+  x = reverse_bits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverse_bits(x);
+}
+
+inline std::uint32_t sobol_2d(std::uint32_t index, int dimension) {
+  // The first two dimensions of the Sobol sequence, as 32 bit fractions. The
+  // first is the van der Corput sequence; the direction numbers of the
+  // second follow from its primitive polynomial, x + 1.
+  if (dimension == 0)
+    return reverse_bits(index);
+
+  std::uint32_t result = 0;
+  for (std::uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+    if (index & 1)
+      result ^= v;
+  return result;
+}
+
+inline double scrambled_sobol(std::uint32_t index, std::uint32_t dimension,
+                              std::uint32_t seed) {
+  // Padded Sobol points: each pair of dimensions is the 2D Sobol sequence,
+  // with its own Owen scrambling and its own shuffled order of samples, so
+  // the pairs are independent of each other. Shuffling the index with a
+  // nested uniform scramble keeps every power of two run of samples a
+  // stratified set.
+  auto pair_seed = hash_sample(seed, dimension / 2);
+  auto shuffled = nested_uniform_scramble(index, pair_seed);
+  auto bits = sobol_2d(shuffled, int(dimension % 2));
+  return bits_to_unit(
+      nested_uniform_scramble(bits, hash_sample(pair_seed, dimension)));
+}
+
+class halton_sampler : public sampler {
+public:
+  // The Halton sequence, with a prime base per dimension. The digits of each
+  // dimension are scrambled by random permutations, as the unscrambled
+  // dimensions of large bases are correlated with each other at low sample
+  // counts. Each pixel then rotates the sequence by its own random offset (a
+  // Cranley-Patterson rotation), so neighbouring pixels don't repeat the same
+  // pattern. Dimensions past the last base are random.
+  static constexpr std::uint32_t max_dimensions = 64;
+
+  halton_sampler() {
+    for (std::uint32_t n = 2; bases.size() < max_dimensions; n++)
+      if (std::none_of(bases.begin(), bases.end(),
+                       [n](std::uint32_t p) { return n % p == 0; }))
+        bases.push_back(n);
+
+    // Enough digits for 32 bit precision, each with its own permutation.
+    std::mt19937 generator(1);
+    for (auto base : bases) {
+      first_permutation.push_back(permutations.size());
+      for (double factor = 1; factor > 0x1p-32; factor /= base) {
+        auto digits = permutations.size();
+        for (std::uint32_t digit = 0; digit < base; digit++)
+          permutations.push_back(std::uint16_t(digit));
+        std::shuffle(permutations.begin() + digits, permutations.end(),
+                     generator);
+      }
+    }
+    first_permutation.push_back(permutations.size());
+  }
+
+  double value(int x, int y, std::uint32_t index,
+               std::uint32_t dimension) const override {
+    auto pixel = hash_sample(std::uint32_t(x), std::uint32_t(y), dimension);
+    if (dimension >= max_dimensions)
+      return bits_to_unit(hash_sample(pixel, index));
+    return wrap_unit(scrambled_radical_inverse(dimension, index) +
+                     bits_to_unit(pixel));
+  }
+
+  static double radical_inverse(std::uint32_t base, std::uint32_t index) {
+    // Mirrors the digits of index in the given base about the radix point.
+    double inverse_base = 1.0 / base, factor = inverse_base, result = 0;
+    for (; index > 0; index /= base, factor *= inverse_base)
+      result += (index % base) * factor;
+    return std::min(result, 1 - 0x1p-53);
+  }
+
+private:
+  std::vector<std::uint32_t> bases;
+  std::vector<std::uint16_t> permutations;     // Of the digits, in turn
+  std::vector<std::size_t> first_permutation; // Of each dimension
+
+  double scrambled_radical_inverse(std::uint32_t dimension,
+                                   std::uint32_t index) const {
+    // radical_inverse(), with each digit replaced by its permutation. The
+    // zeros past the last digit of index are permuted too.
+    auto base = bases[dimension];
+    double inverse_base = 1.0 / base, factor = inverse_base, result = 0;
+    for (auto p = first_permutation[dimension];
+         p < first_permutation[dimension + 1];
+         p += base, index /= base, factor *= inverse_base)
+      result += permutations[p + index % base] * factor;
+    return std::min(result, 1 - 0x1p-53);
+  }
+};
+
+class sobol_sampler : public sampler {
+public:
+  // Padded, Owen-scrambled Sobol points (see scrambled_sobol()), scrambled
+  // differently for each pixel.
+  double value(int x, int y, std::uint32_t index,
+               std::uint32_t dimension) const override {
+    return scrambled_sobol(index, dimension,
+                           hash_sample(std::uint32_t(x), std::uint32_t(y)));
+  }
+};
+
+inline std::vector<float> make_blue_noise_mask(int size) {
+  // Returns a size by size tileable blue noise mask, made with Ulichney's
+  // void-and-cluster method: its values are the order in which pixels are
+  // added to an ever denser, ever evenly spread pattern, scaled to [0,1).
+  // Clusters and voids are found by blurring the pattern with a Gaussian.
+  auto count = std::size_t(size) * size;
+  std::vector<double> kernel(count);
+  for (int dy = 0; dy < size; dy++) {
+    for (int dx = 0; dx < size; dx++) {
+      auto x = std::min(dx, size - dx), y = std::min(dy, size - dy);
+      kernel[std::size_t(dy) * size + dx] = std::exp(-(x * x + y * y) / 4.5);
+    }
+  }
+
+  std::vector<char> pattern(count, 0);
+  std::vector<double> energy(count, 0.0);
+  auto toggle = [&](std::size_t p) {
+    // Adds or removes a pixel of the pattern, updating the blurred energy.
+    double sign = pattern[p] ? -1 : 1;
+    pattern[p] = !pattern[p];
+    int px = int(p % size), py = int(p / size);
+    for (int y = 0; y < size; y++) {
+      auto row = std::size_t((y - py + size) % size) * size;
+      for (int x = 0; x < size; x++)
+        energy[std::size_t(y) * size + x] +=
+            sign * kernel[row + std::size_t((x - px + size) % size)];
+    }
+  };
+  auto tightest_cluster = [&] {
+    std::size_t best = count;
+    for (std::size_t p = 0; p < count; p++)
+      if (pattern[p] && (best == count || energy[p] > energy[best]))
+        best = p;
+    return best;
+  };
+  auto largest_void = [&] {
+    std::size_t best = count;
+    for (std::size_t p = 0; p < count; p++)
+      if (!pattern[p] && (best == count || energy[p] < energy[best]))
+        best = p;
+    return best;
+  };
+
+  // Start from a random tenth of the pixels, and move pixels from the
+  // tightest cluster to the largest void until the pattern is even.
+  std::mt19937 generator(1);
+  std::size_t initial_count = count / 10;
+  for (std::size_t added = 0; added < initial_count;) {
+    auto p = std::size_t(generator() % count);
+    if (!pattern[p]) {
+      toggle(p);
+      added++;
+    }
+  }
+  for (std::size_t moves = 0; moves < count; moves++) {
+    auto cluster = tightest_cluster();
+    toggle(cluster);
+    auto gap = largest_void();
+    toggle(gap);
+    if (gap == cluster)
+      break;
+  }
+  auto initial_pattern = pattern;
+  auto initial_energy = energy;
+
+  // The pixels of the initial pattern are ranked by removing the tightest
+  // cluster in turn, and the rest by filling the largest void in turn.
+  std::vector<float> mask(count);
+  for (auto rank = initial_count; rank-- > 0;) {
+    auto cluster = tightest_cluster();
+    toggle(cluster);
+    mask[cluster] = float(rank);
+  }
+  pattern = initial_pattern;
+  energy = initial_energy;
+  for (auto rank = initial_count; rank < count; rank++) {
+    auto gap = largest_void();
+    toggle(gap);
+    mask[gap] = float(rank);
+  }
+
+  for (auto &value : mask)
+    value = float((value + 0.5) / double(count));
+  return mask;
+}
+
+class blue_noise_sampler : public sampler {
+public:
+  // The same Owen-scrambled Sobol points for every pixel, each pixel shifting
+  // them by a value of a blue noise mask (a Cranley-Patterson rotation). The
+  // errors of neighbouring pixels then differ as much as they can, which looks
+  // like fine grain at low sample counts rather than blotches. Each dimension
+  // reads the mask at its own offset.
+  static constexpr int mask_size = 64;
+
+  blue_noise_sampler() : mask(shared_mask()) {}
+
+  double value(int x, int y, std::uint32_t index,
+               std::uint32_t dimension) const override {
+    auto offset = hash_sample(dimension, 0x2545f491u);
+    auto mx = (std::uint32_t(x) + offset) % mask_size;
+    auto my = (std::uint32_t(y) + (offset >> 16)) % mask_size;
+    return wrap_unit(scrambled_sobol(index, dimension, 0) +
+                     mask[my * mask_size + mx]);
+  }
+
+private:
+  const std::vector<float> &mask;
+
+  static const std::vector<float> &shared_mask() {
+    // Made when first needed, which takes a few tens of milliseconds.
+    static const std::vector<float> mask = make_blue_noise_mask(mask_size);
+    return mask;
+  }
+};
+
+inline shared_ptr<const sampler> make_sampler(sampler_type type) {
+  // Returns a sampler of the given type, or null for independent samples.
+  switch (type) {
+  case sampler_type::halton:
+    return make_shared<halton_sampler>();
+  case sampler_type::sobol:
+    return make_shared<sobol_sampler>();
+  case sampler_type::blue_noise:
+    return make_shared<blue_noise_sampler>();
+  default:
+    return nullptr;
+  }
+}
+
+class sampler_scope : public sample_stream {
+public:
+  // Makes random_double() return the samples of a sampler on this thread for
+  // as long as the scope exists. start_sample() picks the pixel and sample;
+  // start_dimensions() then picks which dimensions the next draws are. Draws
+  // past the dimensions started are random. With no sampler, random_double()
+  // stays random.
+  explicit sampler_scope(const sampler *source)
+      : source(source), previous(thread_sample_stream()) {
+    if (source)
+      thread_sample_stream() = this;
+  }
+
+  ~sampler_scope() {
+    if (source)
+      thread_sample_stream() = previous;
+  }
+
+  sampler_scope(const sampler_scope &) = delete;
+  sampler_scope &operator=(const sampler_scope &) = delete;
+
+  void start_sample(int x, int y, std::uint32_t index) {
+    pixel_x = x;
+    pixel_y = y;
+    sample_index = index;
+    start_dimensions(0, 0);
+  }
+
+  void start_dimensions(std::uint32_t first, std::uint32_t count) override {
+    next_dimension = first;
+    end_dimension = first + count;
+  }
+
+  double next() override {
+    if (next_dimension < end_dimension)
+      return source->value(pixel_x, pixel_y, sample_index, next_dimension++);
+    return random_uniform();
+  }
+
+private:
+  const sampler *source;
+  sample_stream *previous;
+  int pixel_x = 0;
+  int pixel_y = 0;
+  std::uint32_t sample_index = 0;
+  std::uint32_t next_dimension = 0;
+  std::uint32_t end_dimension = 0;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef SCENE_ARENA_H
+#define SCENE_ARENA_H
+
+#include "raytracing/rtweekend.h"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class scene_arena {
+public:
+  // Memory for the objects of a built scene. It is handed out from large
+  // blocks in the order objects are made, so objects made together, such as
+  // the primitives of one part of a scene, lie next to each other rather than
+  // scattered over the heap. Nothing is freed on its own: the blocks are
+  // released all at once when the arena is destroyed. Objects made with
+  // make_in() keep their arena alive. Not thread safe.
+
+  static constexpr std::size_t first_block_size = 4 * 1024;
+  static constexpr std::size_t max_block_size = 1024 * 1024;
+
+  scene_arena() {}
+
+  scene_arena(const scene_arena &) = delete;
+  scene_arena &operator=(const scene_arena &) = delete;
+
+  void *allocate(std::size_t bytes, std::size_t alignment) {
+    void *p = next;
+    if (!std::align(alignment, bytes, p, space)) {
+      // Blocks double in size up to a limit, so that small scenes waste little
+      // and large ones need few blocks. Larger objects get a block of their
+      // own size.
+      auto size = std::max(block_size, bytes + alignment);
+      block_size = std::min(2 * block_size, max_block_size);
+      blocks.emplace_back(new std::byte[size]);
+      reserved += size;
+      p = blocks.back().get();
+      space = size;
+      std::align(alignment, bytes, p, space);
+    }
+
+    next = static_cast<std::byte *>(p) + bytes;
+    space -= bytes;
+    used += bytes;
+    return p;
+  }
+
+  std::size_t bytes_used() const { return used; }         // Handed out
+  std::size_t bytes_reserved() const { return reserved; } // In all blocks
+  std::size_t block_count() const { return blocks.size(); }
+
+private:
+  std::vector<std::unique_ptr<std::byte[]>> blocks;
+  std::size_t block_size = first_block_size; // Size of the next block
+  void *next = nullptr;                      // Start of the last block's space
+  std::size_t space = 0;                     // Bytes free in the last block
+  std::size_t used = 0;
+  std::size_t reserved = 0;
+};
+
+template <typename T> class arena_allocator {
+public:
+  // A standard allocator that takes memory from a scene_arena. Deallocation
+  // does nothing, as the arena frees its memory in one go.
+  using value_type = T;
+
+  arena_allocator(shared_ptr<scene_arena> arena) : arena(std::move(arena)) {}
+
+  template <typename U>
+  arena_allocator(const arena_allocator<U> &other) : arena(other.arena) {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *, std::size_t) {}
+
+  template <typename U> bool operator==(const arena_allocator<U> &o) const {
+    return arena == o.arena;
+  }
+  template <typename U> bool operator!=(const arena_allocator<U> &o) const {
+    return arena != o.arena;
+  }
+
+  shared_ptr<scene_arena> arena;
+};
+
+template <typename T, typename... Args>
+shared_ptr<T> make_in(const shared_ptr<scene_arena> &arena, Args &&...args) {
+  // Like make_shared, but with the object and its reference counts placed in
+  // the arena, or on the heap if there is no arena.
+  if (!arena)
+    return make_shared<T>(std::forward<Args>(args)...);
+  return std::allocate_shared<T>(arena_allocator<T>(arena),
+                                 std::forward<Args>(args)...);
+}
+
+#endif
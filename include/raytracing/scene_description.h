@@ -0,0 +1,409 @@
+#ifndef SCENE_DESCRIPTION_H
+#define SCENE_DESCRIPTION_H
+
+#include "raytracing/aabb.h"
+#include "raytracing/asset_loader.h"
+#include "raytracing/box.h"
+#include "raytracing/camera.h"
+#include "raytracing/color.h"
+#include "raytracing/constant_medium.h"
+#include "raytracing/flat_bvh.h"
+#include "raytracing/heterogeneous_medium.h"
+#include "raytracing/hittable.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/material.h"
+#include "raytracing/perlin.h"
+#include "raytracing/quad.h"
+#include "raytracing/rtweekend.h"
+#include "raytracing/sampler.h"
+#include "raytracing/scene_arena.h"
+#include "raytracing/sphere.h"
+#include "raytracing/texture.h"
+#include "raytracing/vec3.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Operations a scene statement can perform.
+enum class scene_op : std::uint8_t {
+  camera,                 // Set the camera field named by `name`
+  texture_checker,        // Define checker texture `name`
+  texture_noise,          // Define Perlin noise texture `name`
+  texture_image,          // Define image texture `name` from file `ref`
+  material_lambertian,    // Define diffuse material `name`
+  material_metal,         // Define metal material `name`
+  material_dielectric,    // Define dielectric material `name`
+  material_diffuse_light, // Define emissive material `name`
+  sphere,                 // Sphere with material `ref`
+  moving_sphere,          // Sphere moving over the shutter interval
+  quad,                   // Parallelogram with material `ref`
+  box,                    // Six-sided box with material `ref`
+  smoke,                  // Procedural smoke in a grid-based medium
+  rotate_y,               // Rotate object `name` about the Y axis
+  translate,              // Move object `name`
+  constant_medium,        // Fill the boundary of object `name` with a medium
+  add,                    // Add object `name` to the world
+  bvh,                    // Wrap the world so far in a BVH
+  animate                 // Move object `name` from frame to frame
+};
+
+inline constexpr int scene_op_count = int(scene_op::animate) + 1;
+
+// One statement of a scene, with its arguments stored in the number and string
+// tables of the scene description. Statements are plain data, so a whole scene
+// can be copied or saved as a few flat arrays.
+struct scene_statement {
+  static constexpr std::uint32_t no_string = std::uint32_t(-1);
+
+  scene_op op;
+  std::uint32_t line;  // Line in the source file, for error messages
+  std::uint32_t name;  // Defined or modified name, or no_string
+  std::uint32_t ref;   // Referenced name or file name, or no_string
+  std::uint32_t first; // Index of the first number argument
+  std::uint32_t count; // Count of number arguments
+};
+
+inline bool is_valid_count(double value) {
+  // Returns whether value is a whole number from 1 to the largest int, as
+  // settings that count something must be.
+  return value >= 1 && value <= std::numeric_limits<int>::max() &&
+         value == std::floor(value);
+}
+
+// Checks of the value of a camera setting, returning what is wrong with it or
+// null if it is in range.
+inline const char *check_count(const double *v) {
+  return is_valid_count(v[0]) ? nullptr
+                              : "expected a whole number of at least 1";
+}
+
+inline const char *check_positive(const double *v) {
+  return v[0] > 0 ? nullptr : "expected a number above 0";
+}
+
+inline const char *check_view_angle(const double *v) {
+  return v[0] > 0 && v[0] < 180 ? nullptr
+                                : "expected an angle between 0 and 180";
+}
+
+// A camera setting that can be given in a scene file.
+struct camera_field {
+  const char *name;
+  int count; // Count of numbers the setting takes
+  void (*apply)(camera &cam, const double *values);
+  const char *(*check)(const double *values) = nullptr; // Range, if limited
+};
+
+inline const camera_field camera_fields[] = {
+    {"aspect_ratio", 1,
+     [](camera &c, const double *v) { c.aspect_ratio = v[0]; },
+     check_positive},
+    {"image_width", 1,
+     [](camera &c, const double *v) { c.image_width = int(v[0]); },
+     check_count},
+    {"samples_per_pixel", 1,
+     [](camera &c, const double *v) { c.samples_per_pixel = int(v[0]); },
+     check_count},
+    {"max_depth", 1,
+     [](camera &c, const double *v) { c.max_depth = int(v[0]); },
+     check_count},
+    {"background", 3,
+     [](camera &c, const double *v) {
+       c.background = color(v[0], v[1], v[2]);
+     }},
+    {"vfov", 1, [](camera &c, const double *v) { c.vfov = v[0]; },
+     check_view_angle},
+    {"lookfrom", 3,
+     [](camera &c, const double *v) { c.lookfrom = point3(v[0], v[1], v[2]); }},
+    {"lookat", 3,
+     [](camera &c, const double *v) { c.lookat = point3(v[0], v[1], v[2]); }},
+    {"vup", 3,
+     [](camera &c, const double *v) { c.vup = vec3(v[0], v[1], v[2]); }},
+    {"defocus_angle", 1,
+     [](camera &c, const double *v) { c.defocus_angle = v[0]; }},
+    {"focus_dist", 1, [](camera &c, const double *v) { c.focus_dist = v[0]; },
+     check_positive},
+    {"sampler", 1, // A sampler_type, by number
+     [](camera &c, const double *v) {
+       c.sampling = sampler_type(
+           int(std::clamp(v[0], 0.0, double(sampler_type_count - 1))));
+     }},
+    {"sort_rays", 1,
+     [](camera &c, const double *v) { c.sort_rays = v[0] != 0; }},
+    {"crop", 4, // Left, top, right and bottom, as fractions of the frame
+     [](camera &c, const double *v) {
+       c.crop_x0 = v[0];
+       c.crop_y0 = v[1];
+       c.crop_x1 = v[2];
+       c.crop_y1 = v[3];
+     }},
+};
+
+inline const camera_field *find_camera_field(std::string_view name) {
+  for (const auto &field : camera_fields)
+    if (name == field.name)
+      return &field;
+  return nullptr;
+}
+
+// Most cells a smoke grid may have, which bounds the memory a scene file can
+// ask for at 64 MiB of densities.
+inline constexpr double max_smoke_cells = 1 << 24;
+
+inline density_grid smoke_grid(int nx, int ny, int nz) {
+  // Procedural smoke: turbulence that fades out towards the sides of the
+  // volume, with thin wisps cut to zero so there is empty space to skip.
+  perlin noise;
+  std::vector<float> values;
+
+  for (int z = 0; z < nz; z++) {
+    for (int y = 0; y < ny; y++) {
+      for (int x = 0; x < nx; x++) {
+        auto p = point3((x + 0.5) / nx, (y + 0.5) / ny, (z + 0.5) / nz);
+        auto falloff = std::fmax(0, 1 - 2 * (p - point3(.5, .5, .5)).length());
+        auto value = falloff * (1 + 2 * noise.turb(4 * p, 5)) - 0.15;
+        values.push_back(float(std::fmax(0, value)));
+      }
+    }
+  }
+
+  return density_grid(nx, ny, nz, values);
+}
+
+class scene_animation {
+public:
+  // The parts of a built scene that change from frame to frame: the objects
+  // given a velocity with `animate`, and the hierarchies that may hold them.
+
+  void add_mover(shared_ptr<translate> object, const vec3 &velocity) {
+    movers.push_back({object, velocity});
+  }
+
+  void add_hierarchy(shared_ptr<flat_bvh> bvh) { hierarchies.push_back(bvh); }
+
+  bool empty() const { return movers.empty(); }
+
+  flat_bvh::update_kind set_frame(int frame, bool always_rebuild = false) {
+    // Moves every animated object to where it is at the given frame, and
+    // brings the hierarchies up to date by refitting them, or by rebuilding
+    // them if always_rebuild is set. Returns the most work any needed.
+    auto kind = flat_bvh::update_kind::refit;
+    if (movers.empty())
+      return kind;
+
+    for (const auto &m : movers)
+      m.object->set_offset(double(frame) * m.velocity);
+
+    // Inner hierarchies were added first, so they are updated before any that
+    // hold them.
+    for (const auto &bvh : hierarchies) {
+      if (always_rebuild) {
+        bvh->rebuild();
+        kind = flat_bvh::update_kind::full_rebuild;
+      } else {
+        kind = std::max(kind, bvh->update());
+      }
+    }
+    return kind;
+  }
+
+private:
+  struct mover {
+    shared_ptr<translate> object;
+    vec3 velocity; // Offset per frame
+  };
+
+  std::vector<mover> movers;
+  std::vector<shared_ptr<flat_bvh>> hierarchies;
+};
+
+class scene_description {
+public:
+  // A parsed scene: a list of statements that build the world and set up the
+  // camera when run in order. Names of textures, materials and objects index
+  // the string table, and each kind of name has its own namespace.
+
+  std::string source; // File the scene was read from
+  std::vector<scene_statement> statements;
+  std::vector<double> numbers;
+  std::vector<std::string> strings;
+
+  // Hierarchies built earlier for the bvh statements, in order, for example
+  // loaded from a scene snapshot. Statements without one build their own.
+  std::vector<flat_bvh_layout> bvh_layouts;
+
+  bool build(hittable_list &world, camera &cam) const {
+    asset_loader assets;
+    return build(world, cam, assets);
+  }
+
+  bool build(hittable_list &world, camera &cam, asset_loader &assets,
+             std::vector<flat_bvh_layout> *built_bvhs = nullptr,
+             scene_animation *animation = nullptr,
+             shared_ptr<scene_arena> arena = nullptr) const {
+    // Runs the statements, adding objects to world and settings to cam. Image
+    // textures are loaded through assets, and may still be decoding when this
+    // returns. The hierarchies of the bvh statements are appended to
+    // built_bvhs if it is given, and the animated objects are recorded in
+    // animation. Objects are made in arena, or in an arena of their own if
+    // none is given. Reports the first undefined name and returns false if
+    // there is one.
+    if (!arena)
+      arena = make_shared<scene_arena>();
+    std::size_t bvh_count = 0;
+    std::vector<shared_ptr<texture>> textures(strings.size());
+    std::vector<shared_ptr<material>> materials(strings.size());
+    std::vector<shared_ptr<hittable>> objects(strings.size());
+
+    for (const auto &s : statements) {
+      const double *n = numbers.data() + s.first;
+      auto point = [n](int i) { return point3(n[i], n[i + 1], n[i + 2]); };
+
+      auto error = [&](const char *kind, std::uint32_t name) {
+        std::cerr << "ERROR: " << source << ':' << s.line << ": undefined "
+                  << kind << " '" << strings[name] << "'.\n";
+        return false;
+      };
+
+      // The texture referenced by the statement, or else a solid color from
+      // the last three numbers.
+      auto texture_arg = [&]() -> shared_ptr<texture> {
+        if (s.ref == scene_statement::no_string)
+          return make_in<solid_color>(arena, point(int(s.count) - 3));
+        return textures[s.ref];
+      };
+
+      shared_ptr<hittable> object;
+
+      switch (s.op) {
+      case scene_op::camera:
+        find_camera_field(strings[s.name])->apply(cam, n);
+        continue;
+
+      case scene_op::texture_checker:
+        textures[s.name] =
+            make_in<checker_texture>(arena, n[0], point(1), point(4));
+        continue;
+      case scene_op::texture_noise:
+        textures[s.name] = make_in<noise_texture>(arena, n[0]);
+        continue;
+      case scene_op::texture_image:
+        textures[s.name] = assets.load_image(strings[s.ref]);
+        continue;
+
+      case scene_op::material_lambertian:
+      case scene_op::material_diffuse_light: {
+        auto tex = texture_arg();
+        if (!tex)
+          return error("texture", s.ref);
+        if (s.op == scene_op::material_lambertian)
+          materials[s.name] = make_in<lambertian>(arena, tex);
+        else
+          materials[s.name] = make_in<diffuse_light>(arena, tex);
+        continue;
+      }
+      case scene_op::material_metal:
+        materials[s.name] = make_in<metal>(arena, point(0), n[3]);
+        continue;
+      case scene_op::material_dielectric:
+        materials[s.name] = make_in<dielectric>(arena, n[0]);
+        continue;
+
+      case scene_op::sphere:
+      case scene_op::moving_sphere:
+      case scene_op::quad:
+      case scene_op::box: {
+        auto mat = materials[s.ref];
+        if (!mat)
+          return error("material", s.ref);
+        if (s.op == scene_op::sphere)
+          object = make_in<sphere>(arena, point(0), n[3], mat);
+        else if (s.op == scene_op::moving_sphere)
+          object = make_in<sphere>(arena, point(0), point(3), n[6], mat);
+        else if (s.op == scene_op::quad)
+          object = make_in<quad>(arena, point(0), point(3), point(6), mat);
+        else
+          object = box(point(0), point(3), mat, arena);
+        break;
+      }
+      case scene_op::smoke: {
+        auto tex = texture_arg();
+        if (!tex)
+          return error("texture", s.ref);
+        object = make_in<heterogeneous_medium>(
+            arena, aabb(point(0), point(3)),
+            smoke_grid(int(n[6]), int(n[7]), int(n[8])), n[9], tex);
+        break;
+      }
+
+      case scene_op::rotate_y:
+      case scene_op::translate:
+      case scene_op::animate:
+      case scene_op::constant_medium:
+      case scene_op::add: {
+        auto &target = objects[s.name];
+        if (!target)
+          return error("object", s.name);
+        if (s.op == scene_op::rotate_y) {
+          target = make_in<rotate_y>(arena, target, n[0]);
+        } else if (s.op == scene_op::translate) {
+          target = make_in<translate>(arena, target, point(0));
+        } else if (s.op == scene_op::animate) {
+          // Animated objects start where they are, and move once frames are
+          // set.
+          auto mover = make_in<translate>(arena, target, vec3(0, 0, 0));
+          if (animation)
+            animation->add_mover(mover, point(0));
+          target = mover;
+        } else if (s.op == scene_op::constant_medium) {
+          auto tex = texture_arg();
+          if (!tex)
+            return error("texture", s.ref);
+          target = make_in<constant_medium>(arena, target, n[0], tex);
+        } else {
+          world.add(target);
+        }
+        continue;
+      }
+
+      case scene_op::bvh: {
+        shared_ptr<flat_bvh> bvh;
+        if (bvh_count < bvh_layouts.size()) {
+          const auto &layout = bvh_layouts[bvh_count];
+          if (!flat_bvh::is_valid(layout, world.objects.size())) {
+            std::cerr << "ERROR: " << source << ':' << s.line
+                      << ": saved BVH does not match the scene.\n";
+            return false;
+          }
+          bvh = make_in<flat_bvh>(arena, world.objects, layout);
+        } else {
+          bvh = make_in<flat_bvh>(arena, world.objects);
+        }
+
+        bvh_count++;
+        if (built_bvhs)
+          built_bvhs->push_back(bvh->arrays());
+        if (animation)
+          animation->add_hierarchy(bvh);
+        world = hittable_list(bvh);
+        continue;
+      }
+      }
+
+      // New objects are added to the world, unless they were given a name.
+      if (s.name == scene_statement::no_string)
+        world.add(object);
+      else
+        objects[s.name] = object;
+    }
+
+    return true;
+  }
+};
+
+#endif
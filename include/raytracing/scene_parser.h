@@ -0,0 +1,408 @@
+#ifndef SCENE_PARSER_H
+#define SCENE_PARSER_H
+
+#include "raytracing/scene_description.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+class scene_parser {
+public:
+  // Reads the text form of a scene, one statement per line. Text after a '#'
+  // is a comment. Names are single words, and colors are three numbers.
+  //
+  //   camera FIELD NUMBERS...            (see camera_fields)
+  //   texture NAME checker SCALE EVEN_RGB ODD_RGB
+  //   texture NAME noise SCALE
+  //   texture NAME image FILE
+  //   material NAME lambertian RGB|TEXTURE
+  //   material NAME metal RGB FUZZ
+  //   material NAME dielectric REFRACTION_INDEX
+  //   material NAME diffuse_light RGB|TEXTURE
+  //   [object NAME] sphere CENTER RADIUS MATERIAL
+  //   [object NAME] moving_sphere CENTER1 CENTER2 RADIUS MATERIAL
+  //   [object NAME] quad Q U V MATERIAL
+  //   [object NAME] box CORNER1 CORNER2 MATERIAL
+  //   [object NAME] smoke CORNER1 CORNER2 NX NY NZ DENSITY RGB|TEXTURE
+  //   rotate_y NAME DEGREES
+  //   translate NAME OFFSET
+  //   animate NAME VELOCITY
+  //   constant_medium NAME DENSITY RGB|TEXTURE
+  //   add NAME
+  //   bvh
+  //
+  // Objects are added to the world as they are read, unless they are given a
+  // name with `object`. Named objects can then be transformed in place, and are
+  // added to the world with `add`. `bvh` puts everything added so far in a
+  // bounding volume hierarchy. `animate` moves a named object by VELOCITY each
+  // frame when rendering a sequence of frames (see scene_animation).
+
+  scene_parser(scene_description &scene) : scene(scene) {}
+
+  bool parse(std::string_view text) {
+    // Appends the statements in text to the scene. Reports the first syntax
+    // error and returns false if there is one.
+    std::uint32_t line = 0;
+    while (!text.empty()) {
+      auto end = text.find('\n');
+      auto line_text = text.substr(0, end);
+      text = end == std::string_view::npos ? std::string_view()
+                                           : text.substr(end + 1);
+
+      line++;
+      if (!parse_statement(line_text, line))
+        return false;
+    }
+    return true;
+  }
+
+  bool parse_file(const std::string &filename) {
+    // Parses the scene in the given file, read into memory in one go.
+    std::string text;
+    if (!read_file(filename, text))
+      return false;
+
+    scene.source = filename;
+    return parse(text);
+  }
+
+  static bool read_file(const std::string &filename, std::string &text) {
+    // Reads the whole scene file into text.
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+      std::cerr << "ERROR: Could not open scene file '" << filename << "'.\n";
+      return false;
+    }
+
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    text = contents.str();
+    return true;
+  }
+
+  static bool is_well_formed(const scene_statement &s,
+                             const scene_description &scene) {
+    // Returns whether the statement is one the parser could have produced for
+    // the scene: its names and numbers lie within the scene's tables, and it
+    // has the arguments its operation takes. For checking scenes that were
+    // read from somewhere else.
+    const auto none = scene_statement::no_string;
+    auto string_ok = [&](std::uint32_t i) {
+      return i == none || i < scene.strings.size();
+    };
+    if (!string_ok(s.name) || !string_ok(s.ref) ||
+        s.first > scene.numbers.size() ||
+        s.count > scene.numbers.size() - s.first)
+      return false;
+
+    if (s.op == scene_op::camera) {
+      auto field =
+          s.name == none ? nullptr : find_camera_field(scene.strings[s.name]);
+      return field && s.ref == none && s.count == std::uint32_t(field->count) &&
+             !range_error(s, field, scene.numbers.data() + s.first);
+    }
+
+    for (const auto &candidate : statements) {
+      if (candidate.op != s.op)
+        continue;
+
+      std::string_view args = candidate.args;
+      std::string_view keyword = candidate.keyword;
+      auto has = [&](char c) { return args.find(c) != args.npos; };
+
+      bool name_required =
+          has('N') || keyword == "texture" || keyword == "material";
+      if (s.name == none ? name_required
+                         : !name_required && keyword != "object")
+        return false;
+
+      if ((has('r') || has('s')) ? s.ref == none : !has('c') && s.ref != none)
+        return false;
+
+      auto count = std::count(args.begin(), args.end(), 'n');
+      if (has('c') && s.ref == none)
+        count += 3;
+      return s.count == std::uint32_t(count) &&
+             !range_error(s, nullptr, scene.numbers.data() + s.first);
+    }
+    return false;
+  }
+
+private:
+  // Statement syntax. Arguments are given by one character each:
+  //   N  name of the object modified by the statement
+  //   n  number
+  //   c  color (three numbers) or texture name
+  //   r  name of a material
+  //   s  file name
+  struct syntax {
+    const char *keyword;
+    const char *kind;
+    scene_op op;
+    const char *args;
+  };
+
+  static constexpr syntax statements[] = {
+      {"texture", "checker", scene_op::texture_checker, "nnnnnnn"},
+      {"texture", "noise", scene_op::texture_noise, "n"},
+      {"texture", "image", scene_op::texture_image, "s"},
+      {"material", "lambertian", scene_op::material_lambertian, "c"},
+      {"material", "metal", scene_op::material_metal, "nnnn"},
+      {"material", "dielectric", scene_op::material_dielectric, "n"},
+      {"material", "diffuse_light", scene_op::material_diffuse_light, "c"},
+      {"object", "sphere", scene_op::sphere, "nnnnr"},
+      {"object", "moving_sphere", scene_op::moving_sphere, "nnnnnnnr"},
+      {"object", "quad", scene_op::quad, "nnnnnnnnnr"},
+      {"object", "box", scene_op::box, "nnnnnnr"},
+      {"object", "smoke", scene_op::smoke, "nnnnnnnnnnc"},
+      {"rotate_y", nullptr, scene_op::rotate_y, "Nn"},
+      {"translate", nullptr, scene_op::translate, "Nnnn"},
+      {"animate", nullptr, scene_op::animate, "Nnnn"},
+      {"constant_medium", nullptr, scene_op::constant_medium, "Nnc"},
+      {"add", nullptr, scene_op::add, "N"},
+      {"bvh", nullptr, scene_op::bvh, ""},
+  };
+
+  scene_description &scene;
+  std::unordered_map<std::string, std::uint32_t> string_index;
+
+  static const char *range_error(const scene_statement &s,
+                                 const camera_field *field, const double *n) {
+    // Returns what is wrong with the numbers of the statement, which has the
+    // arguments of its operation, or null if they are in range. Camera
+    // settings are sent by render server clients too, so every one must be
+    // finite and in its field's range. Grid sizes are cast to int and
+    // allocated from.
+    if (field) {
+      for (int i = 0; i < field->count; i++)
+        if (!std::isfinite(n[i]))
+          return "expected a finite number";
+      if (field->check)
+        return field->check(n);
+    }
+
+    if (s.op == scene_op::smoke) {
+      if (!is_valid_count(n[6]) || !is_valid_count(n[7]) ||
+          !is_valid_count(n[8]))
+        return "expected grid sizes that are whole numbers of at least 1";
+      if (n[6] * n[7] * n[8] > max_smoke_cells)
+        return "smoke grid has too many cells";
+    }
+    return nullptr;
+  }
+
+  static const syntax *find_syntax(std::string_view keyword,
+                                   std::string_view kind) {
+    // Returns the syntax of the statement with the given keyword and kind, or
+    // null if there is none. Statements without a kind match an empty kind.
+    for (const auto &candidate : statements) {
+      if (keyword == candidate.keyword &&
+          (candidate.kind ? kind == candidate.kind : kind.empty()))
+        return &candidate;
+    }
+    return nullptr;
+  }
+
+  static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+
+  static std::string_view next_word(std::string_view &text) {
+    // Removes and returns the first word of text, or an empty view at the end
+    // of the line or at a comment.
+    std::size_t start = 0;
+    while (start < text.size() && is_space(text[start]))
+      start++;
+    if (start == text.size() || text[start] == '#') {
+      text = std::string_view();
+      return text;
+    }
+
+    auto end = start;
+    while (end < text.size() && !is_space(text[end]) && text[end] != '#')
+      end++;
+
+    auto word = text.substr(start, end - start);
+    text.remove_prefix(end);
+    return word;
+  }
+
+  static bool to_number(std::string_view word, double &value) {
+    auto end = word.data() + word.size();
+    auto result = std::from_chars(word.data(), end, value);
+    return result.ec == std::errc() && result.ptr == end;
+  }
+
+  std::uint32_t intern(std::string_view word) {
+    // Returns the index of word in the string table, adding it if needed.
+    auto [it, added] = string_index.emplace(
+        std::string(word), std::uint32_t(scene.strings.size()));
+    if (added)
+      scene.strings.push_back(it->first);
+    return it->second;
+  }
+
+  bool error(std::uint32_t line, const std::string &message) const {
+    std::cerr << "ERROR: " << scene.source << ':' << line << ": " << message
+              << ".\n";
+    return false;
+  }
+
+  bool parse_statement(std::string_view text, std::uint32_t line) {
+    auto keyword = next_word(text);
+    if (keyword.empty())
+      return true;
+
+    scene_statement s{scene_op::bvh,
+                      line,
+                      scene_statement::no_string,
+                      scene_statement::no_string,
+                      std::uint32_t(scene.numbers.size()),
+                      0};
+
+    const char *args = "";
+    const camera_field *field = nullptr;
+
+    if (keyword == "camera") {
+      auto field_name = next_word(text);
+      field = find_camera_field(field_name);
+      if (!field)
+        return error(line, "unknown camera setting '" +
+                               std::string(field_name) + "'");
+
+      s.op = scene_op::camera;
+      s.name = intern(field_name);
+      if (!parse_numbers(text, field->count, line))
+        return false;
+    } else {
+      const syntax *found = nullptr;
+      if (keyword == "texture" || keyword == "material" ||
+          keyword == "object") {
+        // Definitions give the defined name before the kind.
+        auto name = next_word(text);
+        auto kind = next_word(text);
+        if (name.empty())
+          return error(line, "missing name");
+        found = find_syntax(keyword, kind);
+        keyword = kind;
+        s.name = intern(name);
+      } else {
+        // Other statements, and objects that are added without a name.
+        found = find_syntax(keyword, {});
+        if (!found)
+          found = find_syntax("object", keyword);
+      }
+
+      if (!found)
+        return error(line, "unknown statement '" + std::string(keyword) + "'");
+
+      s.op = found->op;
+      args = found->args;
+    }
+
+    for (; *args; args++) {
+      switch (*args) {
+      case 'N': {
+        auto name = next_word(text);
+        if (name.empty())
+          return error(line, "missing name");
+        s.name = intern(name);
+        break;
+      }
+      case 'n':
+        if (!parse_numbers(text, 1, line))
+          return false;
+        break;
+      case 'c': {
+        // A color starts with a number, a texture name doesn't.
+        auto rest = text;
+        auto word = next_word(rest);
+        double value;
+        if (!word.empty() && to_number(word, value)) {
+          if (!parse_numbers(text, 3, line))
+            return false;
+        } else {
+          if (word.empty())
+            return error(line, "missing color or texture");
+          s.ref = intern(word);
+          text = rest;
+        }
+        break;
+      }
+      case 'r':
+      case 's': {
+        auto word = next_word(text);
+        if (word.empty())
+          return error(line, *args == 'r' ? "missing material"
+                                          : "missing file name");
+        s.ref = intern(word);
+        break;
+      }
+      }
+    }
+
+    auto extra = next_word(text);
+    if (!extra.empty())
+      return error(line, "unexpected '" + std::string(extra) + "'");
+
+    s.count = std::uint32_t(scene.numbers.size()) - s.first;
+    if (auto problem = range_error(s, field, scene.numbers.data() + s.first))
+      return error(line, problem);
+
+    scene.statements.push_back(s);
+    return true;
+  }
+
+  bool parse_numbers(std::string_view &text, int count, std::uint32_t line) {
+    for (int i = 0; i < count; i++) {
+      auto word = next_word(text);
+      double value;
+      if (word.empty())
+        return error(line, "expected a number");
+      if (!to_number(word, value))
+        return error(line, "expected a number, found '" + std::string(word) +
+                               "'");
+      scene.numbers.push_back(value);
+    }
+    return true;
+  }
+};
+
+inline bool load_scene_file(const std::string &filename,
+                            scene_description &scene) {
+  // Reads the scene in the given file. See scene_parser for the format.
+  return scene_parser(scene).parse_file(filename);
+}
+
+inline bool apply_camera_settings(std::string_view text, camera &cam,
+                                  const std::string &source) {
+  // Applies camera statements, in the scene file format, to cam. Reports the
+  // first error, naming source as where the text came from, and returns false
+  // if the text has one or any other kind of statement.
+  scene_description settings;
+  settings.source = source;
+  if (!scene_parser(settings).parse(text))
+    return false;
+
+  for (const auto &s : settings.statements) {
+    if (s.op != scene_op::camera) {
+      std::cerr << "ERROR: " << source << ':' << s.line
+                << ": only camera settings are allowed here.\n";
+      return false;
+    }
+  }
+
+  // Camera statements load no assets, so one loader thread is plenty.
+  hittable_list unused;
+  asset_loader assets(1);
+  return settings.build(unused, cam, assets);
+}
+
+#endif
@@ -0,0 +1,380 @@
+#ifndef SCENE_SNAPSHOT_H
+#define SCENE_SNAPSHOT_H
+
+#include "raytracing/flat_bvh.h"
+#include "raytracing/rtweekend.h"
+#include "raytracing/scene_description.h"
+#include "raytracing/scene_parser.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define RAYTRACING_HAVE_MMAP 1
+#endif
+
+inline std::uint64_t fnv1a_hash(std::string_view data,
+                                std::uint64_t hash = 14695981039346656037ull) {
+  // 64-bit FNV-1a hash of the given bytes.
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+class mapped_file {
+public:
+  // A read-only view of a whole file. The file is memory mapped where the
+  // platform supports it, so only the pages that are used get read, and read
+  // into memory otherwise.
+
+  mapped_file() {}
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  ~mapped_file() { close(); }
+
+  bool open(const std::string &filename) {
+    close();
+
+#ifdef RAYTRACING_HAVE_MMAP
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+      auto mapping = mmap(nullptr, std::size_t(info.st_size), PROT_READ,
+                          MAP_PRIVATE, fd, 0);
+      if (mapping != MAP_FAILED) {
+        bytes = static_cast<const unsigned char *>(mapping);
+        byte_count = std::size_t(info.st_size);
+      }
+    }
+    ::close(fd);
+    return bytes != nullptr;
+#else
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in)
+      return false;
+    buffer.resize(std::size_t(in.tellg()));
+    in.seekg(0);
+    in.read(reinterpret_cast<char *>(buffer.data()), buffer.size());
+    bytes = buffer.data();
+    byte_count = buffer.size();
+    return bool(in);
+#endif
+  }
+
+  const unsigned char *data() const { return bytes; }
+  std::size_t size() const { return byte_count; }
+
+private:
+  const unsigned char *bytes = nullptr;
+  std::size_t byte_count = 0;
+#ifndef RAYTRACING_HAVE_MMAP
+  std::vector<unsigned char> buffer;
+#endif
+
+  void close() {
+#ifdef RAYTRACING_HAVE_MMAP
+    if (bytes)
+      munmap(const_cast<unsigned char *>(bytes), byte_count);
+#endif
+    bytes = nullptr;
+    byte_count = 0;
+  }
+};
+
+class scene_snapshot {
+public:
+  // A binary snapshot of a parsed scene and the BVHs built for it, so later
+  // runs can skip parsing and BVH construction. The file starts with a header
+  // holding the hash of the scene source it was made from, followed by
+  // 8-byte aligned sections holding the arrays of the scene description and
+  // the flattened BVH nodes. BVH nodes are used in place from the mapped
+  // file, and the rest is copied out of it.
+  //
+  // Snapshots hold raw native data, so they are only meant to be read by the
+  // build that wrote them; the header records the format version, the byte
+  // order and a stamp of the record layouts and compiler to catch mismatches.
+
+  static constexpr std::uint32_t version = 2;
+
+  static bool write(const std::string &filename, const scene_description &scene,
+                    const std::vector<flat_bvh_layout> &bvhs,
+                    std::uint64_t source_hash) {
+    // Writes the snapshot to a temporary file next to filename, and moves it
+    // into place once complete, so readers never see a partial snapshot.
+    std::vector<std::uint64_t> string_offsets{0};
+    std::string string_data;
+    for (const auto &str : scene.strings) {
+      string_data += str;
+      string_offsets.push_back(string_data.size());
+    }
+
+    std::vector<bvh_entry> bvh_table;
+    std::size_t node_count = 0, order_count = 0;
+    for (const auto &bvh : bvhs) {
+      bvh_table.push_back(
+          {node_count, bvh.node_count, order_count, bvh.object_count});
+      node_count += bvh.node_count;
+      order_count += bvh.object_count;
+    }
+
+    // Statements have padding after their op, which is zeroed rather than
+    // written as whatever the copies in memory hold.
+    std::vector<scene_statement> statement_records(scene.statements.size());
+    std::memset(statement_records.data(), 0,
+                statement_records.size() * sizeof(scene_statement));
+    for (std::size_t i = 0; i < scene.statements.size(); i++) {
+      const auto &s = scene.statements[i];
+      auto &record = statement_records[i];
+      record.op = s.op;
+      record.line = s.line;
+      record.name = s.name;
+      record.ref = s.ref;
+      record.first = s.first;
+      record.count = s.count;
+    }
+
+    header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, file_magic, sizeof(h.magic));
+    h.version = version;
+    h.byte_order = byte_order_mark;
+    h.layout_stamp = layout_stamp();
+    h.source_hash = source_hash;
+
+    std::uint64_t offset = sizeof(header);
+    auto place = [&](section which, std::size_t bytes) {
+      h.sections[which] = {offset, bytes};
+      offset += padded(bytes);
+    };
+    place(statements, scene.statements.size() * sizeof(scene_statement));
+    place(numbers, scene.numbers.size() * sizeof(double));
+    place(string_offset_table, string_offsets.size() * sizeof(std::uint64_t));
+    place(string_bytes, string_data.size());
+    place(bvh_entries, bvh_table.size() * sizeof(bvh_entry));
+    place(bvh_nodes, node_count * sizeof(flat_bvh_node));
+    place(bvh_order, order_count * sizeof(std::uint32_t));
+    h.file_size = offset;
+
+    auto temporary = filename + ".tmp";
+    {
+      std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+      auto put = [&](const void *data, std::size_t bytes) {
+        // Writes the data, if given, and the padding that follows it.
+        if (data)
+          out.write(static_cast<const char *>(data), std::streamsize(bytes));
+        static const char zeros[alignment] = {};
+        out.write(zeros, std::streamsize(padded(bytes) - bytes));
+      };
+
+      put(&h, sizeof(h));
+      put(statement_records.data(),
+          statement_records.size() * sizeof(scene_statement));
+      put(scene.numbers.data(), scene.numbers.size() * sizeof(double));
+      put(string_offsets.data(), string_offsets.size() * sizeof(std::uint64_t));
+      put(string_data.data(), string_data.size());
+      put(bvh_table.data(), bvh_table.size() * sizeof(bvh_entry));
+      // The arrays of all BVHs are each stored as one section, padded at the
+      // end like the others.
+      for (const auto &bvh : bvhs)
+        out.write(reinterpret_cast<const char *>(bvh.nodes),
+                  std::streamsize(bvh.node_count * sizeof(flat_bvh_node)));
+      put(nullptr, node_count * sizeof(flat_bvh_node));
+      for (const auto &bvh : bvhs)
+        out.write(reinterpret_cast<const char *>(bvh.order),
+                  std::streamsize(bvh.object_count * sizeof(std::uint32_t)));
+      put(nullptr, order_count * sizeof(std::uint32_t));
+
+      if (!out) {
+        std::cerr << "ERROR: Could not write scene snapshot '" << temporary
+                  << "'.\n";
+        std::remove(temporary.c_str());
+        return false;
+      }
+    }
+
+    // Renaming over an existing file fails on some platforms.
+    bool moved = std::rename(temporary.c_str(), filename.c_str()) == 0;
+    if (!moved) {
+      std::remove(filename.c_str());
+      moved = std::rename(temporary.c_str(), filename.c_str()) == 0;
+    }
+    if (!moved) {
+      std::cerr << "ERROR: Could not write scene snapshot '" << filename
+                << "'.\n";
+      std::remove(temporary.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  static bool read(const std::string &filename, std::uint64_t source_hash,
+                   scene_description &scene) {
+    // Loads the snapshot into scene, with its BVH layouts referring to the
+    // mapped file. Returns false, leaving scene unchanged, if there is no
+    // snapshot or it was made from a different scene source or by a
+    // different version or build.
+    auto file = make_shared<mapped_file>();
+    if (!file->open(filename) || file->size() < sizeof(header))
+      return false;
+
+    header h;
+    std::memcpy(&h, file->data(), sizeof(h));
+    if (std::memcmp(h.magic, file_magic, sizeof(h.magic)) != 0 ||
+        h.version != version || h.byte_order != byte_order_mark ||
+        h.layout_stamp != layout_stamp() || h.source_hash != source_hash ||
+        h.file_size != file->size())
+      return false;
+
+    for (const auto &s : h.sections)
+      if (s.offset % alignment != 0 || s.offset > h.file_size ||
+          s.bytes > h.file_size - s.offset)
+        return false;
+
+    auto loaded_statements = view<scene_statement>(*file, h, statements);
+    auto loaded_numbers = view<double>(*file, h, numbers);
+    auto offsets = view<std::uint64_t>(*file, h, string_offset_table);
+    auto chars = view<char>(*file, h, string_bytes);
+    auto entries = view<bvh_entry>(*file, h, bvh_entries);
+    auto nodes = view<flat_bvh_node>(*file, h, bvh_nodes);
+    auto order = view<std::uint32_t>(*file, h, bvh_order);
+
+    scene_description loaded;
+    loaded.statements.assign(loaded_statements.first,
+                             loaded_statements.first + loaded_statements.count);
+    loaded.numbers.assign(loaded_numbers.first,
+                          loaded_numbers.first + loaded_numbers.count);
+
+    if (offsets.count == 0 || offsets.first[0] != 0)
+      return false;
+    for (std::size_t i = 1; i < offsets.count; i++) {
+      if (offsets.first[i] < offsets.first[i - 1] ||
+          offsets.first[i] > chars.count)
+        return false;
+      loaded.strings.emplace_back(chars.first + offsets.first[i - 1],
+                                  offsets.first[i] - offsets.first[i - 1]);
+    }
+
+    for (std::size_t i = 0; i < entries.count; i++) {
+      const auto &e = entries.first[i];
+      if (e.first_node > nodes.count ||
+          e.node_count > nodes.count - e.first_node ||
+          e.first_order > order.count ||
+          e.object_count > order.count - e.first_order)
+        return false;
+      loaded.bvh_layouts.push_back({nodes.first + e.first_node, e.node_count,
+                                    order.first + e.first_order, e.object_count,
+                                    file});
+    }
+
+    for (const auto &s : loaded.statements)
+      if (!scene_parser::is_well_formed(s, loaded))
+        return false;
+
+    loaded.source = scene.source;
+    scene = std::move(loaded);
+    return true;
+  }
+
+private:
+  static constexpr char file_magic[8] = {'R', 'T', 'S', 'N', 'A', 'P', 0, 0};
+  static constexpr std::uint32_t byte_order_mark = 0x01020304;
+  static constexpr std::size_t alignment = 8;
+
+  enum section {
+    statements,
+    numbers,
+    string_offset_table,
+    string_bytes,
+    bvh_entries,
+    bvh_nodes,
+    bvh_order,
+    section_count
+  };
+
+  struct section_range {
+    std::uint64_t offset;
+    std::uint64_t bytes;
+  };
+
+  struct header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t layout_stamp;
+    std::uint64_t source_hash;
+    std::uint64_t file_size;
+    section_range sections[section_count];
+  };
+
+  struct bvh_entry {
+    std::uint64_t first_node;
+    std::uint64_t node_count;
+    std::uint64_t first_order;
+    std::uint64_t object_count;
+  };
+
+  // Records other than statements are written as they are in memory, so
+  // they must have no padding.
+  static_assert(sizeof(header) == 40 + sizeof(section_range) * section_count);
+  static_assert(sizeof(bvh_entry) == 4 * sizeof(std::uint64_t));
+  static_assert(sizeof(flat_bvh_node) == sizeof(double) * 12 + 8);
+
+  template <typename T> struct array_view {
+    const T *first;
+    std::size_t count;
+  };
+
+  static std::uint64_t layout_stamp() {
+    // A hash of the sizes and member offsets of the stored records and of the
+    // compiler, so that snapshots written by a build that lays the records
+    // out differently are not read as if they matched.
+    std::string layout;
+    for (std::size_t n :
+         {sizeof(scene_statement), offsetof(scene_statement, op),
+          offsetof(scene_statement, line), offsetof(scene_statement, name),
+          offsetof(scene_statement, ref), offsetof(scene_statement, first),
+          offsetof(scene_statement, count), sizeof(flat_bvh_node),
+          offsetof(flat_bvh_node, bounds), offsetof(flat_bvh_node, first),
+          offsetof(flat_bvh_node, count), offsetof(flat_bvh_node, axis),
+          offsetof(flat_bvh_node, moving), sizeof(double),
+          sizeof(std::size_t)})
+      layout += std::to_string(n) + ',';
+#ifdef __VERSION__
+    layout += __VERSION__;
+#endif
+    return fnv1a_hash(layout);
+  }
+
+  static std::uint64_t padded(std::uint64_t bytes) {
+    return (bytes + alignment - 1) / alignment * alignment;
+  }
+
+  template <typename T>
+  static array_view<T> view(const mapped_file &file, const header &h,
+                            section which) {
+    // The elements of a section, in place in the mapped file. Sections are
+    // aligned, and element sizes divide the alignment or are multiples of it.
+    const auto &range = h.sections[which];
+    return {reinterpret_cast<const T *>(file.data() + range.offset),
+            std::size_t(range.bytes / sizeof(T))};
+  }
+};
+
+#endif
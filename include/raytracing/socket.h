@@ -0,0 +1,353 @@
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define RAYTRACING_HAVE_SOCKETS 1
+#endif
+
+class socket_handle {
+public:
+  // An open stream socket, closed when the handle is destroyed. Addresses are
+  // either "HOST:PORT" for TCP, or a file system path for a Unix domain
+  // socket, written "unix:PATH" or any path containing a slash.
+
+  socket_handle() {}
+  explicit socket_handle(int fd) : fd(fd) {}
+
+  socket_handle(const socket_handle &) = delete;
+  socket_handle &operator=(const socket_handle &) = delete;
+
+  socket_handle(socket_handle &&other) noexcept
+      : fd(std::exchange(other.fd, -1)) {}
+
+  socket_handle &operator=(socket_handle &&other) noexcept {
+    if (this != &other) {
+      close();
+      fd = std::exchange(other.fd, -1);
+    }
+    return *this;
+  }
+
+  ~socket_handle() { close(); }
+
+  bool is_open() const { return fd >= 0; }
+  int native() const { return fd; }
+
+  void close() {
+#ifdef RAYTRACING_HAVE_SOCKETS
+    if (fd >= 0)
+      ::close(fd);
+#endif
+    fd = -1;
+  }
+
+  bool send_all(const void *data, std::size_t bytes) const {
+    // Sends all the bytes, or returns false if the connection failed.
+#ifdef RAYTRACING_HAVE_SOCKETS
+    auto next = static_cast<const char *>(data);
+    while (bytes > 0) {
+      auto sent = ::send(fd, next, bytes, send_flags);
+      if (sent <= 0)
+        return false;
+      next += sent;
+      bytes -= std::size_t(sent);
+    }
+    return true;
+#else
+    (void)data;
+    return bytes == 0;
+#endif
+  }
+
+  bool receive_all(void *data, std::size_t bytes) const {
+    // Receives exactly the given number of bytes, or returns false if the
+    // connection failed or was closed first.
+#ifdef RAYTRACING_HAVE_SOCKETS
+    auto next = static_cast<char *>(data);
+    while (bytes > 0) {
+      auto received = ::recv(fd, next, bytes, 0);
+      if (received <= 0)
+        return false;
+      next += received;
+      bytes -= std::size_t(received);
+    }
+    return true;
+#else
+    (void)data;
+    return bytes == 0;
+#endif
+  }
+
+  bool set_receive_timeout(double seconds) const {
+    // Makes receives fail once they have waited the given number of seconds
+    // for data, rather than wait for as long as the peer stays silent.
+#ifdef RAYTRACING_HAVE_SOCKETS
+    return set_timeout(SO_RCVTIMEO, seconds);
+#else
+    (void)seconds;
+    return false;
+#endif
+  }
+
+  bool set_send_timeout(double seconds) const {
+    // Makes sends fail once they have waited the given number of seconds for
+    // room to send, rather than wait for as long as the peer stops reading.
+#ifdef RAYTRACING_HAVE_SOCKETS
+    return set_timeout(SO_SNDTIMEO, seconds);
+#else
+    (void)seconds;
+    return false;
+#endif
+  }
+
+  socket_handle accept() const {
+    // Waits for and returns the next connection to a listening socket, or a
+    // closed handle if accepting failed (see accept_failed_for_now()).
+#ifdef RAYTRACING_HAVE_SOCKETS
+    return socket_handle(::accept(fd, nullptr, nullptr));
+#else
+    return socket_handle();
+#endif
+  }
+
+  static bool accept_failed_for_now() {
+    // Returns whether the last accept() failed for a reason that passes, so
+    // that it is worth trying again: a signal, a client that gave up before
+    // it was accepted, or running out of descriptors or memory for a while.
+#ifdef RAYTRACING_HAVE_SOCKETS
+    switch (errno) {
+    case EINTR:
+    case ECONNABORTED:
+    case EPROTO:
+    case EMFILE:
+    case ENFILE:
+    case ENOBUFS:
+    case ENOMEM:
+      return true;
+    default:
+      return false;
+    }
+#else
+    return false;
+#endif
+  }
+
+  static socket_handle listen(const std::string &address) {
+    // Returns a socket listening at the address, or a closed handle after
+    // reporting an error. A Unix socket path that already exists is replaced.
+    return open(address, true);
+  }
+
+  static socket_handle connect(const std::string &address) {
+    // Returns a socket connected to the address, or a closed handle if
+    // nothing is listening there.
+    return open(address, false);
+  }
+
+private:
+  int fd = -1;
+
+#ifdef RAYTRACING_HAVE_SOCKETS
+  bool set_timeout(int option, double seconds) const {
+    timeval limit{};
+    limit.tv_sec = decltype(limit.tv_sec)(seconds);
+    limit.tv_usec = decltype(limit.tv_usec)((seconds - limit.tv_sec) * 1e6);
+    if (limit.tv_sec == 0 && limit.tv_usec == 0)
+      limit.tv_usec = 1; // Zero would mean no limit
+    return setsockopt(fd, SOL_SOCKET, option, &limit, sizeof(limit)) == 0;
+  }
+#endif
+
+#ifdef MSG_NOSIGNAL
+  // A closed connection fails the send rather than raising SIGPIPE.
+  static constexpr int send_flags = MSG_NOSIGNAL;
+#else
+  static constexpr int send_flags = 0;
+#endif
+
+  static bool is_unix_address(const std::string &address) {
+    return address.rfind("unix:", 0) == 0 ||
+           address.find('/') != std::string::npos;
+  }
+
+  static socket_handle open(const std::string &address, bool listening) {
+#ifdef RAYTRACING_HAVE_SOCKETS
+    if (is_unix_address(address)) {
+      auto path = address.rfind("unix:", 0) == 0 ? address.substr(5) : address;
+      sockaddr_un where{};
+      if (path.size() >= sizeof(where.sun_path)) {
+        std::cerr << "ERROR: Socket path '" << path << "' is too long.\n";
+        return socket_handle();
+      }
+      where.sun_family = AF_UNIX;
+      std::memcpy(where.sun_path, path.c_str(), path.size() + 1);
+
+      socket_handle s(::socket(AF_UNIX, SOCK_STREAM, 0));
+      if (listening)
+        ::unlink(path.c_str());
+      auto address_of = reinterpret_cast<const sockaddr *>(&where);
+      if (!s.is_open() || !s.bind_or_connect(address_of, sizeof(where),
+                                             listening, address))
+        return socket_handle();
+      return s;
+    }
+
+    auto colon = address.rfind(':');
+    if (colon == std::string::npos) {
+      std::cerr << "ERROR: Address '" << address
+                << "' is neither HOST:PORT nor a socket path.\n";
+      return socket_handle();
+    }
+    auto host = address.substr(0, colon);
+    auto port = address.substr(colon + 1);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    addrinfo *found = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(),
+                    &hints, &found) != 0) {
+      std::cerr << "ERROR: Could not resolve address '" << address << "'.\n";
+      return socket_handle();
+    }
+
+    socket_handle s;
+    for (auto info = found; info && !s.is_open(); info = info->ai_next) {
+      s = socket_handle(
+          ::socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+      if (!s.is_open())
+        continue;
+
+      int on = 1;
+      if (listening)
+        setsockopt(s.fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      else
+        setsockopt(s.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+      // Only the last candidate reports its failure.
+      if (!s.bind_or_connect(info->ai_addr, info->ai_addrlen, listening,
+                             info->ai_next ? std::string() : address))
+        s.close();
+    }
+    freeaddrinfo(found);
+    return s;
+#else
+    (void)listening;
+    std::cerr << "ERROR: Cannot open '" << address
+              << "': sockets are not supported on this platform.\n";
+    return socket_handle();
+#endif
+  }
+
+#ifdef RAYTRACING_HAVE_SOCKETS
+  bool bind_or_connect(const sockaddr *where, socklen_t size, bool listening,
+                       const std::string &address) const {
+    // Binds and listens, or connects. Reports failures to listen, as these
+    // are usually mistakes, but not failures to connect, which callers may
+    // retry. An empty address suppresses the report.
+    if (!listening)
+      return ::connect(fd, where, size) == 0;
+
+    if (::bind(fd, where, size) == 0 && ::listen(fd, SOMAXCONN) == 0)
+      return true;
+    if (!address.empty())
+      std::cerr << "ERROR: Could not listen at '" << address << "'.\n";
+    return false;
+  }
+#endif
+};
+
+class message_payload {
+public:
+  // The payload of a message, written front to back with put() or read front
+  // to back with get(). Values are copied as they are in memory.
+
+  message_payload() {}
+  message_payload(std::string bytes) : bytes(std::move(bytes)) {}
+
+  template <typename T> void put(const T &value) {
+    bytes.append(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  void put_string(std::string_view text) {
+    put(std::uint32_t(text.size()));
+    bytes.append(text);
+  }
+
+  template <typename T> bool get(T &value) {
+    if (bytes.size() - next < sizeof(T))
+      return false;
+    std::memcpy(&value, bytes.data() + next, sizeof(T));
+    next += sizeof(T);
+    return true;
+  }
+
+  bool get_string(std::string &text) {
+    std::uint32_t size;
+    if (!get(size) || bytes.size() - next < size)
+      return false;
+    text.assign(bytes, next, size);
+    next += size;
+    return true;
+  }
+
+  bool get_floats(float *values, std::size_t count) {
+    if ((bytes.size() - next) / sizeof(float) < count)
+      return false;
+    std::memcpy(values, bytes.data() + next, count * sizeof(float));
+    next += count * sizeof(float);
+    return true;
+  }
+
+  bool at_end() const { return next == bytes.size(); }
+
+  const std::string &data() const { return bytes; }
+
+private:
+  std::string bytes;
+  std::size_t next = 0;
+};
+
+// Largest message payload accepted, to catch corrupt or foreign streams.
+inline constexpr std::uint32_t max_message_payload = 1u << 30;
+
+inline bool send_message(const socket_handle &s, std::uint32_t type,
+                         const message_payload &payload) {
+  // Sends a message: its 32-bit type and payload size, then the payload.
+  std::uint32_t head[2] = {type, std::uint32_t(payload.data().size())};
+  return s.send_all(head, sizeof(head)) &&
+         s.send_all(payload.data().data(), payload.data().size());
+}
+
+inline bool receive_message(const socket_handle &s, std::uint32_t &type,
+                            message_payload &payload) {
+  // Receives a message sent with send_message().
+  std::uint32_t head[2];
+  if (!s.receive_all(head, sizeof(head)) || head[1] > max_message_payload)
+    return false;
+  std::string bytes(head[1], '\0');
+  if (!s.receive_all(bytes.data(), bytes.size()))
+    return false;
+  type = head[0];
+  payload = message_payload(std::move(bytes));
+  return true;
+}
+
+#endif
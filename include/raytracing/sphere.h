@@ -5,6 +5,7 @@
 #include "raytracing/hittable.h"
 #include "raytracing/interval.h"
 #include "raytracing/ray.h"
+#include "raytracing/render_stats.h"
 #include "raytracing/rtweekend.h"
 #include "raytracing/vec3.h"
 #include <cmath>
@@ -23,9 +24,24 @@ class sphere : public hittable {
   sphere(const point3 &center1, const point3 &center2, double radius,
          shared_ptr<material> mat)
       : center(center1, center2 - center1), radius(std::fmax(0, radius)),
-        mat(mat) {}
+        mat(mat) {
+    auto rvec = vec3(radius, radius, radius);
+    aabb box1(center.at(0) - rvec, center.at(0) + rvec);
+    aabb box2(center.at(1) - rvec, center.at(1) + rvec);
+    bbox = aabb(box1, box2);
+  }
 
   bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    if (!intersect(r, ray_t, rec))
+      return false;
+    rec.finalize(r);
+    return true;
+  }
+
+  bool intersect(const ray &r, interval ray_t,
+                 hit_record &rec) const override {
+    RAYTRACING_COUNT(ray_primitive_tests);
+
     point3 current_center = center.at(r.time());
     vec3 oc = current_center - r.origin();
     auto a = r.direction().length_squared();
@@ -47,17 +63,30 @@ class sphere : public hittable {
     }
 
     rec.t = root;
+    rec.object = this;
+
+    RAYTRACING_COUNT(primitive_hits);
+    RAYTRACING_ADD(eager_transcendental_calls, 2);
+    return true;
+  }
+
+  void finalize(const ray &r, hit_record &rec) const override {
     rec.p = r.at(rec.t);
-    vec3 outward_normal = (rec.p - current_center) / radius;
+    vec3 outward_normal = (rec.p - center.at(r.time())) / radius;
     rec.set_face_normal(r, outward_normal);
     get_sphere_uv(outward_normal, rec.u, rec.v);
     rec.mat = mat;
 
-    return true;
+    RAYTRACING_ADD(transcendental_calls, 2);
   }
 
   aabb bounding_box() const override { return bbox; }
 
+  aabb bounding_box_at(double time) const override {
+    auto rvec = vec3(radius, radius, radius);
+    return aabb(center.at(time) - rvec, center.at(time) + rvec);
+  }
+
 private:
   ray center;
   double radius;
@@ -0,0 +1,241 @@
+#ifndef STATIC_SCENE_H
+#define STATIC_SCENE_H
+
+#include "raytracing/aabb.h"
+#include "raytracing/box.h"
+#include "raytracing/camera.h"
+#include "raytracing/color.h"
+#include "raytracing/hittable.h"
+#include "raytracing/interval.h"
+#include "raytracing/ray.h"
+#include "raytracing/rtweekend.h"
+#include "raytracing/vec3.h"
+#include <cmath>
+#include <tuple>
+#include <utility>
+
+// Scenes whose objects are all known at compile time, held by value with their
+// concrete types instead of behind shared_ptr<hittable>. The whole hit test of
+// such a scene is one function the compiler can inline and unroll, down to the
+// primitives' own hit functions; only the camera's call into the scene goes
+// through the hittable interface. Materials and textures stay shared, as they
+// are only used once a hit is found.
+
+template <typename T>
+inline bool hit_static(const T &object, const ray &r, interval ray_t,
+                       hit_record &rec) {
+  // Calls the hit function of the object's own type directly, rather than
+  // through the vtable.
+  return object.T::hit(r, ray_t, rec);
+}
+
+template <typename T>
+inline bool intersect_static(const T &object, const ray &r, interval ray_t,
+                             hit_record &rec) {
+  return object.T::intersect(r, ray_t, rec);
+}
+
+template <typename... Objects> class static_scene final : public hittable {
+public:
+  static_scene(Objects... objects) : objects(std::move(objects)...) {
+    bbox = std::apply(
+        [](const auto &...object) {
+          aabb box = aabb::empty;
+          ((box = aabb(box, object.bounding_box())), ...);
+          return box;
+        },
+        this->objects);
+  }
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    if (!intersect(r, ray_t, rec))
+      return false;
+    rec.finalize(r);
+    return true;
+  }
+
+  bool intersect(const ray &r, interval ray_t,
+                 hit_record &rec) const override {
+    bool hit_anything = false;
+    auto test = [&](const auto &object) {
+      // Each hit shortens the ray for the objects after it.
+      if (intersect_static(object, r, ray_t, rec)) {
+        hit_anything = true;
+        ray_t.max = rec.t;
+      }
+    };
+    std::apply([&](const auto &...object) { (test(object), ...); }, objects);
+    return hit_anything;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+private:
+  std::tuple<Objects...> objects;
+  aabb bbox;
+};
+
+template <typename T> class static_translate final : public hittable {
+public:
+  // translate, for an object held by value.
+  static_translate(T object, const vec3 &offset)
+      : object(std::move(object)), offset(offset) {
+    bbox = this->object.bounding_box() + offset;
+  }
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    ray offset_r(r.origin() - offset, r.direction(), r.time());
+    if (!hit_static(object, offset_r, ray_t, rec))
+      return false;
+
+    rec.p += offset;
+    return true;
+  }
+
+  bool intersect(const ray &r, interval ray_t,
+                 hit_record &rec) const override {
+    ray offset_r(r.origin() - offset, r.direction(), r.time());
+    if (!intersect_static(object, offset_r, ray_t, rec))
+      return false;
+
+    if (!rec.object || !rec.defer_to(this)) {
+      rec.finalize(offset_r);
+      rec.p += offset;
+    }
+    return true;
+  }
+
+  void finalize(const ray &r, hit_record &rec) const override {
+    rec.finalize_inner(ray(r.origin() - offset, r.direction(), r.time()));
+    rec.p += offset;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+private:
+  T object;
+  vec3 offset;
+  aabb bbox;
+};
+
+template <typename T> class static_rotate_y final : public hittable {
+public:
+  // rotate_y, for an object held by value.
+  static_rotate_y(T object, double angle) : object(std::move(object)) {
+    auto radians = degrees_to_radians(angle);
+    sin_theta = std::sin(radians);
+    cos_theta = std::cos(radians);
+    bbox = rotated_box(this->object.bounding_box());
+  }
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    // Transform the ray into object space, test it, and transform the hit
+    // back to world space.
+    ray rotated_r(to_object(r.origin()), to_object(r.direction()), r.time());
+    if (!hit_static(object, rotated_r, ray_t, rec))
+      return false;
+
+    rec.p = to_world(rec.p);
+    rec.normal = to_world(rec.normal);
+    return true;
+  }
+
+  bool intersect(const ray &r, interval ray_t,
+                 hit_record &rec) const override {
+    ray rotated_r(to_object(r.origin()), to_object(r.direction()), r.time());
+    if (!intersect_static(object, rotated_r, ray_t, rec))
+      return false;
+
+    if (!rec.object || !rec.defer_to(this)) {
+      rec.finalize(rotated_r);
+      rec.p = to_world(rec.p);
+      rec.normal = to_world(rec.normal);
+    }
+    return true;
+  }
+
+  void finalize(const ray &r, hit_record &rec) const override {
+    rec.finalize_inner(
+        ray(to_object(r.origin()), to_object(r.direction()), r.time()));
+    rec.p = to_world(rec.p);
+    rec.normal = to_world(rec.normal);
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+private:
+  T object;
+  double sin_theta;
+  double cos_theta;
+  aabb bbox;
+
+  vec3 to_object(const vec3 &v) const {
+    return vec3(cos_theta * v.x() - sin_theta * v.z(), v.y(),
+                sin_theta * v.x() + cos_theta * v.z());
+  }
+
+  vec3 to_world(const vec3 &v) const {
+    return vec3(cos_theta * v.x() + sin_theta * v.z(), v.y(),
+                -sin_theta * v.x() + cos_theta * v.z());
+  }
+
+  aabb rotated_box(const aabb &box) const {
+    // Returns the world space box that encloses the given object space box.
+    point3 min(infinity, infinity, infinity);
+    point3 max(-infinity, -infinity, -infinity);
+    for (int i = 0; i < 8; i++) {
+      auto corner = to_world(point3(i & 1 ? box.x.max : box.x.min,
+                                    i & 2 ? box.y.max : box.y.min,
+                                    i & 4 ? box.z.max : box.z.min));
+      for (int c = 0; c < 3; c++) {
+        min[c] = std::fmin(min[c], corner[c]);
+        max[c] = std::fmax(max[c], corner[c]);
+      }
+    }
+    return aabb(min, max);
+  }
+};
+
+inline axis_aligned_box static_box(const point3 &a, const point3 &b,
+                                   shared_ptr<material> mat) {
+  // box(), held by value.
+  return axis_aligned_box(a, b, mat);
+}
+
+// Camera settings known at compile time, as the static members of a type.
+// Views derive from default_view and hide the members they change:
+//
+//   struct my_view : default_view {
+//     static constexpr double vfov = 40;
+//   };
+//
+// The defaults are those of camera.
+struct default_view {
+  static constexpr double aspect_ratio = 1.0;
+  static constexpr int image_width = 100;
+  static constexpr int samples_per_pixel = 10;
+  static constexpr int max_depth = 10;
+  static constexpr color background = color(0, 0, 0);
+  static constexpr double vfov = 90;
+  static constexpr point3 lookfrom = point3(0, 0, 0);
+  static constexpr point3 lookat = point3(0, 0, -1);
+  static constexpr vec3 vup = vec3(0, 1, 0);
+  static constexpr double defocus_angle = 0;
+  static constexpr double focus_dist = 10;
+};
+
+template <typename View> void apply_view(camera &cam) {
+  cam.aspect_ratio = View::aspect_ratio;
+  cam.image_width = View::image_width;
+  cam.samples_per_pixel = View::samples_per_pixel;
+  cam.max_depth = View::max_depth;
+  cam.background = View::background;
+  cam.vfov = View::vfov;
+  cam.lookfrom = View::lookfrom;
+  cam.lookat = View::lookat;
+  cam.vup = View::vup;
+  cam.defocus_angle = View::defocus_angle;
+  cam.focus_dist = View::focus_dist;
+}
+
+#endif
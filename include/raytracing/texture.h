@@ -6,8 +6,12 @@
 #include "raytracing/perlin.h"
 #include "raytracing/rtw_stb_image.h"
 #include "raytracing/rtweekend.h"
+#include "raytracing/texture_cache.h"
 #include "raytracing/vec3.h"
 #include <cmath>
+#include <future>
+#include <mutex>
+#include <string>
 
 class texture {
 public:
@@ -57,11 +61,30 @@ class checker_texture : public texture {
   shared_ptr<texture> odd;
 };
 
+// Reconstruction filter used when looking up image texture pixels.
+enum class texture_filter {
+  nearest,  // The single closest pixel of the base image
+  bilinear, // Weighted blend of the four closest pixels of the base image
+  trilinear // Bilinear lookups in the two mip levels around the given LOD
+};
+
 class image_texture : public texture {
 public:
-  image_texture(const char *filename) : image(filename) {}
+  image_texture(const char *filename,
+                texture_filter filter = texture_filter::nearest, double lod = 0)
+      : filename(filename), filter(filter), lod(lod) {}
+
+  image_texture(shared_ptr<const rtw_image> image,
+                texture_filter filter = texture_filter::nearest, double lod = 0)
+      : filter(filter), lod(lod), image(image) {}
+
+  image_texture(std::shared_future<shared_ptr<const rtw_image>> pending_image,
+                texture_filter filter = texture_filter::nearest, double lod = 0)
+      : filter(filter), lod(lod), pending_image(pending_image) {}
 
   color value(double u, double v, const point3 &p) const override {
+    const auto &image = get_image();
+
     // If we have no texture data, then return solid cyan as a debugging aid.
     if (image.height() <= 0)
       return color(0, 1, 1);
@@ -70,17 +93,59 @@ class image_texture : public texture {
     u = interval(0, 1).clamp(u);
     v = 1.0 - interval(0, 1).clamp(v); // Flip V to image coordinates
 
+    switch (filter) {
+    case texture_filter::bilinear:
+      return image.bilinear(u * image.width(), v * image.height());
+    case texture_filter::trilinear:
+      return trilinear(image, u, v);
+    default:
+      break;
+    }
+
     auto i = int(u * image.width());
     auto j = int(v * image.height());
-    auto pixel = image.pixel_data(i, j);
-
-    auto color_scale = 1.0 / 255.0;
-    return color(color_scale * pixel[0], color_scale * pixel[1],
-                 color_scale * pixel[2]);
+    return image.texel(i, j);
   }
 
 private:
-  rtw_image image;
+  std::string filename;
+  texture_filter filter;
+  double lod; // Mip level of detail used by trilinear filtering
+  std::shared_future<shared_ptr<const rtw_image>> pending_image;
+  mutable std::once_flag load_once;
+  mutable shared_ptr<const rtw_image> image;
+
+  const rtw_image &get_image() const {
+    // Image files are decoded through the shared texture cache the first time
+    // the texture is sampled, so unused textures cost nothing and textures
+    // naming the same file share one copy. Images loaded in the background are
+    // waited for at this point.
+    std::call_once(load_once, [this] {
+      if (pending_image.valid())
+        image = pending_image.get();
+      else if (!image)
+        image = texture_cache::global().acquire(filename);
+    });
+    return *image;
+  }
+
+  color trilinear(const rtw_image &image, double u, double v) const {
+    // Blend bilinear lookups from the two mip levels that bracket the level of
+    // detail. There are no ray differentials to derive a footprint from, so the
+    // LOD is a fixed property of the texture.
+    auto max_level = image.mip_levels() - 1;
+    auto clamped = interval(0, max_level).clamp(lod);
+    auto level0 = int(clamped);
+    auto level1 = (level0 < max_level) ? level0 + 1 : level0;
+    auto t = clamped - level0;
+
+    auto c0 = image.bilinear(u * image.width(level0), v * image.height(level0),
+                             level0);
+    auto c1 = image.bilinear(u * image.width(level1), v * image.height(level1),
+                             level1);
+
+    return (1 - t) * c0 + t * c1;
+  }
 };
 
 class noise_texture : public texture {
@@ -89,7 +154,7 @@ class noise_texture : public texture {
 
   color value(double u, double v, const point3 &p) const override {
     return color(.5, .5, .5) *
-           (1 + std::sin(scale * p.z() + 10 * noise.turb(p, 7)));
+           (1 + std::sin(scale * p.z() + 10 * noise.fast_turb(p, 7)));
   }
 
 private:
@@ -0,0 +1,220 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "raytracing/rtw_stb_image.h"
+#include "raytracing/rtweekend.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class texture_cache : private image_pager {
+public:
+  // Decoded images shared by all textures naming the same file. The cache
+  // keeps the pixel data of its images within a memory budget by evicting
+  // their least recently used tiles, even while textures are using them;
+  // tiles are brought back when a texture next looks them up.
+
+  texture_cache() {}
+
+  texture_cache(std::size_t memory_budget) : memory_budget(memory_budget) {}
+
+  texture_cache(const texture_cache &) = delete;
+  texture_cache &operator=(const texture_cache &) = delete;
+
+  ~texture_cache() {
+    std::lock_guard<std::mutex> lock(mutex);
+    detach_locked();
+  }
+
+  static texture_cache &global() {
+    // Returns the process-wide cache shared by all image textures.
+    static texture_cache cache;
+    return cache;
+  }
+
+  shared_ptr<const rtw_image> acquire(const std::string &filename) {
+    // Returns the decoded image for the given file name, decoding it on first
+    // use. Names that resolve to the same file share a single image. Decoding
+    // happens outside the cache lock, so different files can be decoded
+    // concurrently; callers asking for a file that is still being decoded wait
+    // for that decode instead of starting their own.
+
+    std::unique_lock<std::mutex> lock(mutex);
+    auto path = resolve_locked(filename);
+
+    auto it = entries.find(path);
+    if (it != entries.end()) {
+      auto pending = it->second.image;
+      lock.unlock();
+      return pending.get();
+    }
+
+    std::promise<shared_ptr<const rtw_image>> decoded;
+    entries[path].image = decoded.get_future().share();
+    decodes++;
+    lock.unlock();
+
+    auto image = make_shared<rtw_image>();
+    if (!image->load(path))
+      std::cerr << "ERROR: Could not load image file '" << filename << "'.\n";
+    image->attach(this);
+
+    // The new tiles count as used before any used from here on.
+    lock.lock();
+    clock++;
+    auto found = entries.find(path);
+    if (found != entries.end()) {
+      found->second.decoded = image;
+      resident_bytes += image->memory_bytes();
+    }
+    evict_locked();
+    lock.unlock();
+
+    decoded.set_value(image);
+    return image;
+  }
+
+  std::string resolve(const std::string &filename) {
+    // Returns the path that the given image file name refers to, searching the
+    // same locations as rtw_image. Results are remembered, so each name is
+    // only searched for once.
+    std::lock_guard<std::mutex> lock(mutex);
+    return resolve_locked(filename);
+  }
+
+  void set_memory_budget(std::size_t bytes) {
+    // Sets the number of bytes of decoded pixel data the cache aims to keep
+    // resident, evicting tiles as needed.
+    std::lock_guard<std::mutex> lock(mutex);
+    memory_budget = bytes;
+    evict_locked();
+  }
+
+  std::size_t memory_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return resident_bytes;
+  }
+
+  std::size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+  }
+
+  std::size_t decode_count() const {
+    // Returns the number of image decodes started, including those that
+    // brought back evicted tiles.
+    std::lock_guard<std::mutex> lock(mutex);
+    return decodes;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    detach_locked();
+    entries.clear();
+    resolved.clear();
+    resident_bytes = 0;
+  }
+
+private:
+  struct entry {
+    std::shared_future<shared_ptr<const rtw_image>> image;
+    shared_ptr<const rtw_image> decoded; // Set once counted in resident_bytes
+  };
+
+  // A resident tile that could be evicted.
+  struct tile_use {
+    std::uint64_t last_use;
+    const rtw_image *image;
+    int tile;
+  };
+
+  mutable std::mutex mutex;
+  std::unordered_map<std::string, entry> entries; // Keyed by resolved path
+  std::unordered_map<std::string, std::string> resolved; // Name to path
+  std::size_t memory_budget = std::size_t(-1);
+  std::size_t resident_bytes = 0;
+  std::size_t decodes = 0;
+
+  void tile_paged_in(std::size_t bytes, bool decoded) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    resident_bytes += bytes;
+    if (decoded)
+      decodes++;
+    evict_locked();
+  }
+
+  std::size_t room() const override {
+    std::lock_guard<std::mutex> lock(mutex);
+    return resident_bytes < memory_budget ? memory_budget - resident_bytes : 0;
+  }
+
+  std::string resolve_locked(const std::string &filename) {
+    auto it = resolved.find(filename);
+    if (it != resolved.end())
+      return it->second;
+
+    // Probing for existence is much cheaper than attempting a full decode at
+    // every candidate location. If the file is not found anywhere, the name is
+    // used as-is and the decode will report the error.
+    auto path = filename;
+    for (const auto &candidate : rtw_image::candidate_paths(filename)) {
+      if (std::ifstream(candidate, std::ios::binary).good()) {
+        path = candidate;
+        break;
+      }
+    }
+
+    resolved[filename] = path;
+    return path;
+  }
+
+  void evict_locked() {
+    // Frees the least recently used tiles of all images until the resident
+    // pixel data is down to 15/16 of the budget, so that each pass makes
+    // room for many tiles to come back. Tiles are stamped with the clock as
+    // they are used, and the clock moves on with each pass, so that tiles
+    // used since the last pass are the last to go.
+    if (resident_bytes <= memory_budget)
+      return;
+    auto target = memory_budget - memory_budget / 16;
+
+    std::vector<tile_use> uses;
+    for (const auto &[path, e] : entries) {
+      const auto *image = e.decoded.get();
+      if (!image || !image->evictable())
+        continue;
+      for (int t = 0; t < image->tile_count(); t++)
+        if (image->tile_resident(t))
+          uses.push_back({image->tile_last_use(t), image, t});
+    }
+    std::sort(uses.begin(), uses.end(),
+              [](const tile_use &a, const tile_use &b) {
+                return a.last_use < b.last_use;
+              });
+    clock++;
+
+    for (const auto &use : uses) {
+      if (resident_bytes <= target)
+        break;
+      resident_bytes -= use.image->evict_tile(use.tile);
+    }
+    tile_reclaimer::global().reclaim();
+  }
+
+  void detach_locked() {
+    // Images that outlive the cache keep the tiles they have, and bring back
+    // evicted ones without reporting them.
+    for (const auto &[path, e] : entries)
+      if (e.decoded)
+        e.decoded->attach(nullptr);
+  }
+};
+
+#endif
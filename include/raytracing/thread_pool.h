@@ -0,0 +1,141 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "raytracing/numa.h"
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class thread_pool {
+public:
+  thread_pool(unsigned thread_count = 0)
+      : thread_pool(numa_topology(), thread_count) {}
+
+  thread_pool(const numa_topology &topology, unsigned thread_count = 0)
+      : queues(std::size_t(topology.node_count())) {
+    // Starts the given number of worker threads, or one per hardware thread if
+    // the count is zero, split between the nodes of the topology. Each worker
+    // is pinned to its node's CPUs if they are known, and takes the tasks
+    // queued for its node before those of other nodes.
+    if (thread_count == 0)
+      thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0)
+      thread_count = 1;
+
+    for (int node : topology.worker_nodes(thread_count)) {
+      workers.emplace_back([this, cpus = topology.cpus(node), node] {
+        pin_thread_to_cpus(cpus);
+        run(node);
+      });
+    }
+  }
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  ~thread_pool() {
+    // Finishes all queued tasks, then stops the worker threads.
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  template <typename F>
+  std::future<std::invoke_result_t<F>> submit(F &&task) {
+    // Queues a task and returns a future for its result.
+    return submit_to(0, std::forward<F>(task));
+  }
+
+  template <typename F>
+  std::future<std::invoke_result_t<F>> submit_to(int node, F &&task) {
+    // Queues a task for the workers of the given node, and returns a future
+    // for its result. Workers of other nodes run it only once their own
+    // node's tasks are all taken.
+    using result = std::invoke_result_t<F>;
+
+    auto packaged =
+        std::make_shared<std::packaged_task<result()>>(std::forward<F>(task));
+    auto future = packaged->get_future();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queues[std::size_t(node) % queues.size()].push_back(
+          [packaged] { (*packaged)(); });
+      queued++;
+    }
+    wake.notify_one();
+
+    return future;
+  }
+
+  unsigned size() const { return unsigned(workers.size()); }
+
+  int node_count() const { return int(queues.size()); }
+
+  static int current_node() {
+    // The node of the worker thread calling this, or 0 on other threads.
+    return this_node();
+  }
+
+private:
+  std::vector<std::thread> workers;
+  // The tasks waiting for the workers of each node, and how many in all.
+  std::vector<std::deque<std::function<void()>>> queues;
+  std::size_t queued = 0;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  static int &this_node() {
+    thread_local int node = 0;
+    return node;
+  }
+
+  void run(int node) {
+    this_node() = node;
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (queued == 0)
+          return;
+
+        // Takes the oldest task of its own node, or else steals the newest
+        // of the next node that has any, which is the one its workers would
+        // get to last.
+        auto &own = queues[std::size_t(node)];
+        if (!own.empty()) {
+          task = std::move(own.front());
+          own.pop_front();
+        } else {
+          for (std::size_t k = 1; k < queues.size(); k++) {
+            auto &other = queues[(std::size_t(node) + k) % queues.size()];
+            if (!other.empty()) {
+              task = std::move(other.back());
+              other.pop_back();
+              break;
+            }
+          }
+        }
+        queued--;
+      }
+      task();
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,424 @@
+#ifndef TILE_FARM_H
+#define TILE_FARM_H
+
+#include "raytracing/asset_loader.h"
+#include "raytracing/camera.h"
+#include "raytracing/color.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/render_stats.h"
+#include "raytracing/rtweekend.h"
+#include "raytracing/scene_description.h"
+#include "raytracing/scene_parser.h"
+#include "raytracing/socket.h"
+#include "raytracing/thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef RAYTRACING_HAVE_SOCKETS
+#include <poll.h>
+#endif
+
+// Rendering one image with many processes. A coordinator splits the image into
+// work units, each a tile and a number of samples per pixel, and hands them
+// out to worker processes that connect to it. Workers render each unit into a
+// buffer of float sample sums and send it back, and the coordinator adds the
+// sums up into the image. Units given to a worker that disconnects or stops
+// answering are handed out again, and the render fails if no worker is left
+// to take them for too long.
+//
+// Messages (see send_message()) are in native byte order, so coordinator and
+// workers must run on machines of the same kind:
+//
+//   hello   worker to coordinator: protocol version, units it takes at once
+//   job     coordinator to worker: scene name and source, camera settings in
+//           the scene file format
+//   unit    coordinator to worker: unit id, tile bounds, samples, first
+//           sample, random seed
+//   result  worker to coordinator: unit id, float RGB sums of the tile
+//   failed  worker to coordinator: the job's scene could not be built
+//   done    coordinator to worker: the image is complete
+
+enum class farm_message : std::uint32_t {
+  hello = 1,
+  job,
+  unit,
+  result,
+  failed,
+  done
+};
+
+inline constexpr std::uint32_t farm_protocol_version = 3;
+
+inline bool send_farm_message(const socket_handle &s, farm_message type,
+                              const message_payload &payload = {}) {
+  return send_message(s, std::uint32_t(type), payload);
+}
+
+inline bool receive_farm_message(const socket_handle &s, farm_message &type,
+                                 message_payload &payload) {
+  std::uint32_t raw;
+  if (!receive_message(s, raw, payload))
+    return false;
+  type = farm_message(raw);
+  return true;
+}
+
+class tile_coordinator {
+public:
+  // Renders an image by handing its units out to workers connecting to a
+  // listening socket. Workers build the scene and apply the camera settings,
+  // given in the scene file format, on top of its camera; the coordinator's
+  // camera must be the same one, and its tile size sets the size of the
+  // units.
+
+  double unit_timeout = 300;  // Seconds a worker may take to return a unit
+  double read_timeout = 10;   // Seconds a worker may pause or stop reading
+  double worker_timeout = 60; // Seconds to wait while no worker is working
+  double time_limit = 0;      // Seconds the whole render may take, or zero
+  bool show_progress = true;  // Report progress on std::clog
+
+  tile_coordinator(std::string scene_name, std::string scene_source,
+                   std::string camera_settings, camera &cam, int passes = 1)
+      : scene_name(std::move(scene_name)),
+        scene_source(std::move(scene_source)),
+        camera_settings(std::move(camera_settings)), cam(cam) {
+    // Splits each tile's samples per pixel into the given number of passes,
+    // each a unit of its own, so more workers can share small images.
+    cam.prepare();
+    for (const auto &tile : cam.tiles()) {
+      for (int pass = 0; pass < passes; pass++) {
+        int first = cam.samples_per_pixel * pass / passes;
+        int samples = cam.samples_per_pixel * (pass + 1) / passes - first;
+        if (samples > 0)
+          units.push_back({tile, samples, first});
+      }
+    }
+  }
+
+  std::size_t unit_count() const { return units.size(); }
+
+  bool run(const socket_handle &listener, std::vector<color> &pixels) {
+    // Hands out units to workers connecting to listener until all of them are
+    // done, then sets pixels to the image of the camera's region in scanline
+    // order. Returns false if no worker has been working for worker_timeout
+    // seconds while units were left, or if time_limit is exceeded.
+#ifdef RAYTRACING_HAVE_SOCKETS
+    const auto &region = cam.region();
+    auto width = region.x1 - region.x0, height = region.y1 - region.y0;
+    std::vector<double> sums(std::size_t(width) * height * 3, 0.0);
+
+    std::deque<std::uint32_t> waiting;
+    for (std::uint32_t id = 0; id < units.size(); id++)
+      waiting.push_back(id);
+    std::size_t remaining = units.size();
+    std::vector<worker> workers;
+
+    auto assign = [&](worker &w) {
+      // Sends the worker units until it has as many as it asked for.
+      while (w.outstanding.size() < w.capacity && !waiting.empty()) {
+        auto id = waiting.front();
+        const auto &u = units[id];
+        message_payload unit;
+        unit.put(id);
+        unit.put(u.tile);
+        unit.put(std::int32_t(u.samples));
+        unit.put(std::int32_t(u.first_sample));
+        unit.put(unit_seed(id));
+        if (!send_farm_message(w.connection, farm_message::unit, unit))
+          return false;
+        waiting.pop_front();
+        w.outstanding.push_back(id);
+        w.deadline = render_clock::now() + seconds(unit_timeout);
+      }
+      return true;
+    };
+
+    auto drop = [&](worker &w) {
+      // Closes the connection and hands the worker's units out again.
+      for (auto id : w.outstanding)
+        waiting.push_front(id);
+      w.outstanding.clear();
+      w.connection.close();
+    };
+
+    auto receive = [&](worker &w) {
+      // Handles one message from the worker. Returns false if it should be
+      // dropped.
+      farm_message type;
+      message_payload payload;
+      if (!receive_farm_message(w.connection, type, payload))
+        return false;
+
+      if (type == farm_message::hello) {
+        std::uint32_t version, capacity;
+        if (w.capacity > 0 || !payload.get(version) ||
+            !payload.get(capacity) || version != farm_protocol_version ||
+            capacity == 0) {
+          std::cerr << "ERROR: Dropping a worker with a bad greeting.\n";
+          return false;
+        }
+        w.capacity = capacity;
+
+        message_payload job;
+        job.put_string(scene_name);
+        job.put_string(scene_source);
+        job.put_string(camera_settings);
+        return send_farm_message(w.connection, farm_message::job, job) &&
+               assign(w);
+      }
+
+      if (type == farm_message::result) {
+        std::uint32_t id;
+        if (!payload.get(id) || !w.take(id))
+          return false;
+        const auto &tile = units[id].tile;
+        std::vector<float> tile_sums(tile_values(tile));
+        if (!payload.get_floats(tile_sums.data(), tile_sums.size()) ||
+            !payload.at_end())
+          return false;
+
+        std::size_t k = 0;
+        for (int j = tile.y0 - region.y0; j < tile.y1 - region.y0; j++)
+          for (int i = tile.x0 - region.x0; i < tile.x1 - region.x0; i++)
+            for (int c = 0; c < 3; c++)
+              sums[(std::size_t(j) * width + i) * 3 + c] += tile_sums[k++];
+
+        remaining--;
+        w.deadline = render_clock::now() + seconds(unit_timeout);
+        if (show_progress)
+          std::clog << "\rUnits remaining: " << remaining << ' ' << std::flush;
+        return assign(w);
+      }
+
+      if (type == farm_message::failed)
+        std::cerr << "ERROR: A worker could not build the scene.\n";
+      return false;
+    };
+
+    // Messages are only read once poll() finds them arriving. A worker that
+    // stalls partway through one, or stops reading what it is sent, is
+    // dropped after read_timeout.
+    auto started = render_clock::now(), last_worked = started;
+    while (remaining > 0) {
+      std::vector<pollfd> polled{{listener.native(), POLLIN, 0}};
+      for (const auto &w : workers)
+        polled.push_back({w.connection.native(), POLLIN, 0});
+      if (::poll(polled.data(), nfds_t(polled.size()), 1000) < 0)
+        continue;
+
+      if (polled[0].revents & POLLIN) {
+        auto connection = listener.accept();
+        if (connection.is_open()) {
+          connection.set_receive_timeout(read_timeout);
+          connection.set_send_timeout(read_timeout);
+          workers.emplace_back();
+          workers.back().connection = std::move(connection);
+          workers.back().deadline = render_clock::now() + seconds(read_timeout);
+        }
+      } else if (polled[0].revents & (POLLERR | POLLNVAL)) {
+        std::cerr << "ERROR: The coordinator's socket failed.\n";
+        return false;
+      }
+
+      auto now = render_clock::now();
+      for (std::size_t i = 1; i < polled.size(); i++) {
+        auto &w = workers[i - 1];
+        // Workers must greet the coordinator promptly, and then return units
+        // within unit_timeout.
+        bool waited_on = w.capacity == 0 || !w.outstanding.empty();
+        if (polled[i].revents && !receive(w))
+          drop(w);
+        else if (waited_on && now > w.deadline)
+          drop(w);
+      }
+
+      // Dropped workers' units go to those that are still connected.
+      workers.erase(std::remove_if(workers.begin(), workers.end(),
+                                   [](const worker &w) {
+                                     return !w.connection.is_open();
+                                   }),
+                    workers.end());
+      for (auto &w : workers)
+        if (w.capacity > 0 && !assign(w))
+          drop(w);
+
+      now = render_clock::now();
+      for (const auto &w : workers)
+        if (!w.outstanding.empty())
+          last_worked = now;
+      if (remaining > 0 && now - last_worked > seconds(worker_timeout)) {
+        std::cerr << "ERROR: No workers rendered the " << remaining
+                  << " units left for " << worker_timeout << " seconds.\n";
+        return false;
+      }
+      if (remaining > 0 && time_limit > 0 &&
+          now - started > seconds(time_limit)) {
+        std::cerr << "ERROR: The render did not finish in " << time_limit
+                  << " seconds.\n";
+        return false;
+      }
+    }
+
+    for (auto &w : workers)
+      send_farm_message(w.connection, farm_message::done);
+    if (show_progress)
+      std::clog << "\rDone.                 \n";
+
+    pixels.assign(std::size_t(width) * height, color(0, 0, 0));
+    auto scale = 1.0 / cam.samples_per_pixel;
+    for (std::size_t p = 0; p < pixels.size(); p++)
+      pixels[p] = scale * color(sums[3 * p], sums[3 * p + 1], sums[3 * p + 2]);
+    return true;
+#else
+    (void)listener;
+    (void)pixels;
+    std::cerr << "ERROR: Sockets are not supported on this platform.\n";
+    return false;
+#endif
+  }
+
+  static std::size_t tile_values(const image_tile &tile) {
+    // Count of floats in the sample sums of a tile.
+    return std::size_t(tile.x1 - tile.x0) * (tile.y1 - tile.y0) * 3;
+  }
+
+private:
+  struct work_unit {
+    image_tile tile;
+    int samples;
+    int first_sample; // Index of the unit's first sample of each pixel
+  };
+
+  struct worker {
+    socket_handle connection;
+    std::uint32_t capacity = 0; // Zero until the worker has said hello
+    std::vector<std::uint32_t> outstanding;
+    render_clock::time_point deadline;
+
+    bool take(std::uint32_t id) {
+      // Removes the unit from those outstanding, if it is one of them.
+      for (auto &u : outstanding) {
+        if (u == id) {
+          u = outstanding.back();
+          outstanding.pop_back();
+          return true;
+        }
+      }
+      return false;
+    }
+  };
+
+  std::string scene_name;
+  std::string scene_source;
+  std::string camera_settings;
+  camera &cam;
+  std::vector<work_unit> units;
+
+  static render_clock::duration seconds(double count) {
+    return std::chrono::duration_cast<render_clock::duration>(
+        std::chrono::duration<double>(count));
+  }
+
+  static std::uint32_t unit_seed(std::uint32_t id) {
+    // Each unit has its own seed, so the image doesn't depend on which
+    // worker rendered which unit.
+    return std::uint32_t(0x9e3779b9u * (id + 1));
+  }
+};
+
+inline bool run_tile_worker(const std::string &address, int thread_count = 0,
+                            double connect_timeout = 10) {
+  // Connects to the coordinator at address, retrying until connect_timeout
+  // seconds have passed, and renders units for it on thread_count threads
+  // (one per hardware thread if zero) until the image is done. Returns false
+  // if the connection or the scene failed.
+  socket_handle connection;
+  auto give_up = render_clock::now() +
+                 std::chrono::duration_cast<render_clock::duration>(
+                     std::chrono::duration<double>(connect_timeout));
+  while (!(connection = socket_handle::connect(address)).is_open()) {
+    if (render_clock::now() > give_up) {
+      std::cerr << "ERROR: Could not connect to coordinator '" << address
+                << "'.\n";
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  unsigned threads = thread_count > 0 ? unsigned(thread_count)
+                                      : std::thread::hardware_concurrency();
+  message_payload hello;
+  hello.put(farm_protocol_version);
+  hello.put(std::uint32_t(std::max(threads, 1u)));
+  if (!send_farm_message(connection, farm_message::hello, hello))
+    return false;
+
+  farm_message type;
+  message_payload job;
+  scene_description scene;
+  std::string source, settings;
+  if (!receive_farm_message(connection, type, job) ||
+      type != farm_message::job || !job.get_string(scene.source) ||
+      !job.get_string(source) || !job.get_string(settings)) {
+    std::cerr << "ERROR: Did not receive a job from the coordinator.\n";
+    return false;
+  }
+
+  asset_loader assets;
+  hittable_list world;
+  camera cam;
+  if (!scene_parser(scene).parse(source) ||
+      !scene.build(world, cam, assets) ||
+      !apply_camera_settings(settings, cam,
+                             scene.source + " (camera settings)")) {
+    send_farm_message(connection, farm_message::failed);
+    return false;
+  }
+  cam.prepare();
+
+  // Units render concurrently, and each sends its own result. The pool is
+  // destroyed first, so its tasks can use everything above.
+  std::mutex sending;
+  thread_pool pool(threads);
+  while (receive_farm_message(connection, type, job)) {
+    if (type == farm_message::done)
+      return true;
+
+    std::uint32_t id, seed;
+    image_tile tile;
+    std::int32_t samples, first_sample;
+    if (type != farm_message::unit || !job.get(id) || !job.get(tile) ||
+        !job.get(samples) || !job.get(first_sample) || !job.get(seed) ||
+        tile.x0 < 0 || tile.y0 < 0 || tile.x1 > cam.image_width ||
+        tile.y1 > cam.height() || tile.x0 > tile.x1 || tile.y0 > tile.y1) {
+      std::cerr << "ERROR: Received a malformed unit from the coordinator.\n";
+      return false;
+    }
+
+    pool.submit([&, id, seed, tile, samples, first_sample] {
+      random_generator().seed(seed);
+      std::vector<float> sums(tile_coordinator::tile_values(tile), 0.0f);
+      cam.render_samples(world, tile, samples, sums.data(), first_sample);
+
+      message_payload result;
+      result.put(id);
+      for (auto value : sums)
+        result.put(value);
+      std::lock_guard<std::mutex> lock(sending);
+      send_farm_message(connection, farm_message::result, result);
+    });
+  }
+
+  std::cerr << "ERROR: Lost the connection to the coordinator.\n";
+  return false;
+}
+
+#endif
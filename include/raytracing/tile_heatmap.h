@@ -0,0 +1,78 @@
+#ifndef TILE_HEATMAP_H
+#define TILE_HEATMAP_H
+
+#include "raytracing/camera.h"
+#include "raytracing/color.h"
+#include "raytracing/interval.h"
+#include <algorithm>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+// Writers for the tile costs recorded by a camera with time_tiles set, to
+// show where in the image the render time went.
+
+inline double seconds_per_pixel(const tile_cost &cost) {
+  auto pixels = double(cost.tile.x1 - cost.tile.x0) *
+                double(cost.tile.y1 - cost.tile.y0);
+  return pixels > 0 ? cost.seconds / pixels : 0;
+}
+
+inline color heat_color(double heat) {
+  // Maps heat in [0,1] to a false colour running from black through blue,
+  // red and yellow to white, so that both cool and hot regions stay legible.
+  static const color stops[] = {color(0, 0, 0), color(0, 0, 1), color(1, 0, 0),
+                                color(1, 1, 0), color(1, 1, 1)};
+  const int last = int(sizeof(stops) / sizeof(stops[0])) - 1;
+
+  heat = interval(0, 1).clamp(heat) * last;
+  int i = std::min(int(heat), last - 1);
+  auto f = heat - i;
+  return (1 - f) * stops[i] + f * stops[i + 1];
+}
+
+inline void write_tile_heatmap(std::ostream &out,
+                               const std::vector<tile_cost> &costs,
+                               const image_tile &region) {
+  // Writes a PPM image of the camera's region (see camera::region()), the
+  // same size as the rendered image, with each tile filled with the heat
+  // colour of its time per pixel relative to the slowest tile.
+  int width = region.x1 - region.x0, height = region.y1 - region.y0;
+  double slowest = 0;
+  for (const auto &cost : costs)
+    slowest = std::max(slowest, seconds_per_pixel(cost));
+
+  std::vector<color> pixels(std::size_t(width) * height);
+  for (const auto &cost : costs) {
+    auto c = heat_color(slowest > 0 ? seconds_per_pixel(cost) / slowest : 0);
+    for (int j = std::max(cost.tile.y0, region.y0);
+         j < std::min(cost.tile.y1, region.y1); j++)
+      for (int i = std::max(cost.tile.x0, region.x0);
+           i < std::min(cost.tile.x1, region.x1); i++)
+        pixels[std::size_t(j - region.y0) * width + (i - region.x0)] = c;
+  }
+
+  // The colours are meant for display as they are, so they are written
+  // without the gamma transform of write_color().
+  static const interval intensity(0.000, 0.999);
+  out << "P3\n" << width << ' ' << height << "\n255\n";
+  for (const auto &c : pixels) {
+    out << int(256 * intensity.clamp(c.x())) << ' '
+        << int(256 * intensity.clamp(c.y())) << ' '
+        << int(256 * intensity.clamp(c.z())) << '\n';
+  }
+}
+
+inline void write_tile_costs_csv(std::ostream &out,
+                                 const std::vector<tile_cost> &costs) {
+  // Writes one row per tile, with its pixel bounds in the frame, time and ray
+  // count.
+  out << "x0,y0,x1,y1,seconds,rays,ns_per_pixel\n";
+  for (const auto &cost : costs) {
+    out << cost.tile.x0 << ',' << cost.tile.y0 << ',' << cost.tile.x1 << ','
+        << cost.tile.y1 << ',' << cost.seconds << ',' << cost.rays << ','
+        << seconds_per_pixel(cost) * 1e9 << '\n';
+  }
+}
+
+#endif
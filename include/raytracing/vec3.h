@@ -9,8 +9,8 @@ class vec3 {
 public:
   double e[3];
 
-  vec3() : e{0, 0, 0} {}
-  vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+  constexpr vec3() : e{0, 0, 0} {}
+  constexpr vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
 
   double x() const { return e[0]; }
   double y() const { return e[1]; }
@@ -100,23 +100,120 @@ inline vec3 cross(const vec3 &u, const vec3 &v) {
 
 inline vec3 unit_vector(const vec3 &v) { return v / v.length(); }
 
-inline vec3 random_in_unit_disk() {
-  while (true) {
-    auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
-    if (p.length_squared() < 1)
-      return p;
+// Mappings from two uniform numbers in [0,1) to points spread evenly over a
+// shape. They take a fixed number of inputs and have no loops over attempts,
+// so a sampler's evenly spread inputs give evenly spread points (see
+// sampler.h). They have no branches either: where there is a choice, both
+// sides are computed and blended with a 0 or 1 weight, as compilers would
+// otherwise branch to divisions and other operations that may raise floating
+// point exceptions. Batches of points can then be mapped by vectorized loops,
+// see the batch versions below.
+
+inline void sin_cos_turns(double turns, double &s, double &c) {
+  // The sine and cosine of an angle in turns, in [-1,1], by polynomials
+  // accurate to about 1e-14. Unlike std::sin and std::cos, they can be
+  // vectorized.
+
+  // Split the angle into a number of quarter turns, q, and the rest, which is
+  // within an eighth of a turn.
+  auto q = int(4 * turns + 4.5) - 4;
+  auto t = 2 * pi * (turns - 0.25 * q);
+  auto t2 = t * t;
+
+  // Taylor series of the rest to the 15th and 14th power, by Horner's rule.
+  double sin_sum = 1, cos_sum = 1;
+  for (int k = 7; k > 0; k--) {
+    sin_sum = 1 - t2 * (1.0 / ((2 * k) * (2 * k + 1))) * sin_sum;
+    cos_sum = 1 - t2 * (1.0 / ((2 * k - 1) * (2 * k))) * cos_sum;
   }
+  sin_sum *= t;
+
+  // Each quarter turn swaps the sine and cosine, and negates the new sine.
+  auto swap = double(q & 1);
+  s = (1 - 2 * ((q >> 1) & 1)) * (sin_sum + swap * (cos_sum - sin_sum));
+  c = (1 - 2 * (((q + 1) >> 1) & 1)) * (cos_sum + swap * (sin_sum - cos_sum));
 }
 
-inline vec3 random_unit_vector() {
-  while (true) {
-    auto p = vec3::random(-1, 1);
-    auto lensq = p.length_squared();
-    if (1e-160 < lensq && lensq <= 1)
-      return p / sqrt(lensq);
+inline vec3 sphere_sample(double u1, double u2) {
+  // Uniform on the unit sphere: the height is uniform, which makes the area
+  // uniform, and so is the angle around the axis.
+  auto z = 1 - 2 * u1;
+  auto r2 = 1 - z * z;
+  auto r = std::sqrt(r2 > 0 ? r2 : 0);
+  double s, c;
+  sin_cos_turns(u2, s, c);
+  return vec3(r * c, r * s, z);
+}
+
+inline vec3 disk_sample(double u1, double u2) {
+  // Uniform in the unit disk in the xy plane, by Shirley and Chiu's concentric
+  // mapping: squares about the centre of [-1,1]^2 map to circles, so nearby
+  // inputs stay nearby. Points nearer the x axis (wide) take their radius
+  // from a and their angle from b / a, the others the other way around.
+  auto a = 2 * u1 - 1, b = 2 * u2 - 1;
+  auto wide = double(a * a > b * b);
+  auto r = b + wide * (a - b);
+  auto ratio = (a + wide * (b - a)) / (r + double(r == 0));
+  auto turns = (1 - wide) * 0.25 + (2 * wide - 1) * ratio / 8;
+  double s, c;
+  sin_cos_turns(turns, s, c);
+  return vec3(r * c, r * s, 0);
+}
+
+inline vec3 cosine_hemisphere_sample(double u1, double u2) {
+  // Cosine weighted on the hemisphere about +z: a uniform point in the disk,
+  // raised onto the hemisphere (Malley's method).
+  auto p = disk_sample(u1, u2);
+  auto z2 = 1 - p.x() * p.x() - p.y() * p.y();
+  return vec3(p.x(), p.y(), std::sqrt(z2 > 0 ? z2 : 0));
+}
+
+// Batch versions of the mappings, for n pairs of inputs given as separate
+// arrays, writing the points to separate coordinate arrays. Lanes are
+// independent and branch-free, so the compiler vectorizes the loops.
+
+inline void sphere_sample(int n, const double *u1, const double *u2,
+                          double *x, double *y, double *z) {
+  for (int i = 0; i < n; i++) {
+    auto p = sphere_sample(u1[i], u2[i]);
+    x[i] = p.x();
+    y[i] = p.y();
+    z[i] = p.z();
   }
 }
 
+inline void disk_sample(int n, const double *u1, const double *u2, double *x,
+                        double *y) {
+  for (int i = 0; i < n; i++) {
+    auto p = disk_sample(u1[i], u2[i]);
+    x[i] = p.x();
+    y[i] = p.y();
+  }
+}
+
+inline void cosine_hemisphere_sample(int n, const double *u1,
+                                     const double *u2, double *x, double *y,
+                                     double *z) {
+  for (int i = 0; i < n; i++) {
+    auto p = cosine_hemisphere_sample(u1[i], u2[i]);
+    x[i] = p.x();
+    y[i] = p.y();
+    z[i] = p.z();
+  }
+}
+
+inline vec3 random_in_unit_disk() {
+  auto u1 = random_double();
+  auto u2 = random_double();
+  return disk_sample(u1, u2);
+}
+
+inline vec3 random_unit_vector() {
+  auto u1 = random_double();
+  auto u2 = random_double();
+  return sphere_sample(u1, u2);
+}
+
 inline vec3 random_on_hemisphere(const vec3 &normal) {
   vec3 on_unit_sphere = random_unit_vector();
 
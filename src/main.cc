@@ -1,363 +1,580 @@
-#include "raytracing/bvh.h"
+#include "raytracing/asset_loader.h"
 #include "raytracing/camera.h"
-#include "raytracing/color.h"
-#include "raytracing/constant_medium.h"
-#include "raytracing/hittable.h"
 #include "raytracing/hittable_list.h"
-#include "raytracing/material.h"
-#include "raytracing/quad.h"
-#include "raytracing/rtweekend.h"
-#include "raytracing/sphere.h"
-#include "raytracing/texture.h"
-#include "raytracing/vec3.h"
-
-void bouncing_spheres() {
-  hittable_list world;
-
-  auto checker =
-      make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-  world.add(make_shared<sphere>(point3(0, -1000, 0), 1000,
-                                make_shared<lambertian>(checker)));
-
-  for (int a = -11; a < 11; a++) {
-    for (int b = -11; b < 11; b++) {
-      auto choose_mat = random_double();
-      point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-      if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-        shared_ptr<material> sphere_material;
-
-        if (choose_mat < 0.8) {
-          // diffuse
-          auto albedo = color::random() * color::random();
-          sphere_material = make_shared<lambertian>(albedo);
-          auto center2 = center + vec3(0, random_double(0, .5), 0);
-          world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
-        } else if (choose_mat < 0.95) {
-          // metal
-          auto albedo = color::random(0.5, 1);
-          auto fuzz = random_double(0, 0.5);
-          sphere_material = make_shared<metal>(albedo, fuzz);
-          world.add(make_shared<sphere>(center, 0.2, sphere_material));
-        } else {
-          // glass
-          sphere_material = make_shared<dielectric>(1.5);
-          world.add(make_shared<sphere>(center, 0.2, sphere_material));
-        }
-      }
-    }
-  }
-
-  auto material1 = make_shared<dielectric>(1.5);
-  world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-  auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-  world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-  auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-  world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-  world = hittable_list(make_shared<bvh_node>(world));
-
-  camera cam;
-
-  cam.aspect_ratio = 16.0 / 9.0;
-  cam.image_width = 400;
-  cam.samples_per_pixel = 100;
-  cam.max_depth = 50;
-  cam.background = color(0.70, 0.80, 1.00);
-
-  cam.vfov = 20;
-  cam.lookfrom = point3(13, 2, 3);
-  cam.lookat = point3(0, 0, 0);
-  cam.vup = vec3(0, 1, 0);
-
-  cam.defocus_angle = 0.6;
-  cam.focus_dist = 10.0;
-
-  cam.render(world);
+#include "raytracing/image_writer.h"
+#include "raytracing/numa.h"
+#include "raytracing/render_server.h"
+#include "raytracing/sampler.h"
+#include "raytracing/scene_arena.h"
+#include "raytracing/scene_description.h"
+#include "raytracing/scene_parser.h"
+#include "raytracing/scene_snapshot.h"
+#include "raytracing/socket.h"
+#include "raytracing/texture_cache.h"
+#include "raytracing/tile_farm.h"
+#include "raytracing/tile_heatmap.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static void print_usage(std::ostream &out) {
+  out << "Usage: RaytracingExecutable [options] SCENE_FILE\n"
+         "       RaytracingExecutable --connect ADDRESS [--threads N]\n"
+         "       RaytracingExecutable --serve ADDRESS [--threads N]\n"
+         "\n"
+         "Renders the scene in SCENE_FILE as an image. With --listen, the\n"
+         "image is rendered by worker processes started with --connect. With\n"
+         "--server, it is rendered by a render server started with --serve.\n"
+         "\n"
+         "Options:\n"
+         "  --scene FILE    Scene file to render (same as SCENE_FILE)\n"
+         "  --width N       Image width in pixels; the height follows from\n"
+         "                  the scene's aspect ratio\n"
+         "  --spp N         Samples per pixel\n"
+         "  --depth N       Maximum number of ray bounces\n"
+         "  --sampler NAME  Where samples come from: independent (random),\n"
+         "                  halton, sobol or blue_noise\n"
+         "  --threads N     Render threads, 0 for one per hardware thread\n"
+         "  --sort-rays     Trace each bounce's rays as a batch, sorted by\n"
+         "                  where they start and which way they go\n"
+         "  --crop \"LEFT TOP RIGHT BOTTOM\"\n"
+         "                  Render only this part of the frame, given as\n"
+         "                  fractions of its width and height, such as\n"
+         "                  \"0.25 0.25 0.75 0.5\"\n"
+         "  --preview FILE  Write previews at 1/8, 1/4 and 1/2 resolution to\n"
+         "                  FILE, replacing it as each is done\n"
+         "  --camera SETTING\n"
+         "                  Camera setting as in a scene file, such as\n"
+         "                  \"lookfrom 0 0 9\"; may be repeated\n"
+         "  --output FILE   Write the image to FILE instead of standard "
+         "output\n"
+         "  --format NAME   Image format: ascii_ppm, ppm (binary), png or\n"
+         "                  qoi; by default png or qoi for output files with\n"
+         "                  those extensions, otherwise ascii_ppm\n"
+         "  --cache FILE    Load the parsed scene and its BVHs from the\n"
+         "                  snapshot FILE, or write it there after building\n"
+         "                  the scene; by default nothing is cached\n"
+         "  --frames N      Render N frames of the scene's animation, written\n"
+         "                  to the output file name with the frame number\n"
+         "                  added, such as out_0001.ppm\n"
+         "  --rebuild-bvh   Rebuild BVHs every frame rather than refit them\n"
+         "  --view SETTINGS Render a view of the scene with the camera\n"
+         "                  settings SETTINGS, separated by semicolons, such\n"
+         "                  as \"lookfrom 0 2 9; vfov 40\"; may be repeated.\n"
+         "                  Views are written to the output file name with\n"
+         "                  the view number added, such as out_0001.ppm\n"
+         "  --turntable N   Render N views from around the scene, turning\n"
+         "                  the camera about its up direction through the\n"
+         "                  point it looks at\n"
+         "  --numa          Split the render threads between the machine's\n"
+         "                  NUMA nodes, each with its own copy of the scene\n"
+         "  --numa-layout \"CPUS;CPUS...\"\n"
+         "                  As --numa, with the CPUs of each node given by\n"
+         "                  hand, such as \"0-3;4-7\"\n"
+         "  --stats FILE    Write render statistics to FILE as JSON\n"
+         "  --heatmap NAME  Write the render time of each tile as a false\n"
+         "                  colour image NAME.ppm and a table NAME.csv\n"
+         "  --listen ADDRESS\n"
+         "                  Hand out the image's tiles to workers connecting\n"
+         "                  to ADDRESS, which is HOST:PORT or a socket path\n"
+         "  --passes N      Split each tile's samples into N units of work\n"
+         "  --connect ADDRESS\n"
+         "                  Render tiles for the coordinator at ADDRESS\n"
+         "  --serve ADDRESS Keep scenes built between renders requested by\n"
+         "                  clients connecting to ADDRESS\n"
+         "  --server ADDRESS\n"
+         "                  Render with the render server at ADDRESS\n"
+         "  --stop-server ADDRESS\n"
+         "                  Stop the render server at ADDRESS\n"
+         "  --help          Show this message\n";
 }
 
-void checkered_spheres() {
-  hittable_list world;
-
-  auto checker =
-      make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-
-  world.add(make_shared<sphere>(point3(0, -10, 0), 10,
-                                make_shared<lambertian>(checker)));
-  world.add(make_shared<sphere>(point3(0, 10, 0), 10,
-                                make_shared<lambertian>(checker)));
-
-  camera cam;
-
-  cam.aspect_ratio = 16.0 / 9.0;
-  cam.image_width = 400;
-  cam.samples_per_pixel = 100;
-  cam.max_depth = 50;
-  cam.background = color(0.70, 0.80, 1.00);
-
-  cam.vfov = 20;
-  cam.lookfrom = point3(13, 2, 3);
-  cam.lookat = point3(0, 0, 0);
-  cam.vup = vec3(0, 1, 0);
-
-  cam.defocus_angle = 0;
-
-  cam.render(world);
+static std::string frame_file(const std::string &name, int frame) {
+  // Inserts the frame number before the file name's extension.
+  char number[16];
+  std::snprintf(number, sizeof(number), "_%04d", frame);
+  auto dot = name.rfind('.');
+  auto slash = name.rfind('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    return name + number;
+  return name.substr(0, dot) + number + name.substr(dot);
 }
 
-void earth() {
-  auto earth_texture =
-      make_shared<image_texture>("assets/textures/earthmap.jpg");
-  auto earth_surface = make_shared<lambertian>(earth_texture);
-  auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
-
-  camera cam;
-
-  cam.aspect_ratio = 16.0 / 9.0;
-  cam.image_width = 400;
-  cam.samples_per_pixel = 100;
-  cam.max_depth = 50;
-  cam.background = color(0.70, 0.80, 1.00);
-
-  cam.vfov = 20;
-  cam.lookfrom = point3(0, 0, 12);
-  cam.lookat = point3(0, 0, 0);
-  cam.vup = vec3(0, 1, 0);
-
-  cam.defocus_angle = 0;
-
-  cam.render(hittable_list(globe));
+static std::vector<camera> turntable_views(const camera &cam, int count) {
+  // Views from count points evenly spaced around the circle lookfrom makes
+  // turning about the vup axis through lookat, starting from lookfrom.
+  std::vector<camera> views(count, cam);
+  auto axis = unit_vector(cam.vup);
+  auto offset = cam.lookfrom - cam.lookat;
+  for (int k = 0; k < count; k++) {
+    auto angle = 2 * pi * k / count;
+    auto cos_angle = std::cos(angle), sin_angle = std::sin(angle);
+    views[k].lookfrom = cam.lookat + cos_angle * offset +
+                        sin_angle * cross(axis, offset) +
+                        (1 - cos_angle) * dot(axis, offset) * axis;
+  }
+  return views;
 }
 
-void perlin_spheres() {
-  hittable_list world;
-
-  auto pertext = make_shared<noise_texture>(4);
-  world.add(make_shared<sphere>(point3(0, -1000, 0), 1000,
-                                make_shared<lambertian>(pertext)));
-  world.add(make_shared<sphere>(point3(0, 2, 0), 2,
-                                make_shared<lambertian>(pertext)));
-
-  camera cam;
-
-  cam.aspect_ratio = 16.0 / 9.0;
-  cam.image_width = 400;
-  cam.samples_per_pixel = 100;
-  cam.max_depth = 50;
-  cam.background = color(0.70, 0.80, 1.00);
-
-  cam.vfov = 20;
-  cam.lookfrom = point3(13, 2, 3);
-  cam.lookat = point3(0, 0, 0);
-  cam.vup = vec3(0, 1, 0);
-
-  cam.defocus_angle = 0;
+// A copy of the scene for one NUMA node. It has its own texture cache, so
+// that its images are decoded into the node's memory too.
+struct scene_replica {
+  scene_replica(unsigned threads) : assets(threads, textures) {}
 
-  cam.render(world);
-}
-
-void quads() {
+  texture_cache textures;
+  asset_loader assets;
   hittable_list world;
-
-  // Materials
-  auto left_red = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-  auto back_green = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-  auto right_blue = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-  auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-  auto lower_teal = make_shared<lambertian>(color(0.2, 0.8, 0.8));
-
-  // Quads
-  world.add(make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0),
-                              left_red));
-  world.add(make_shared<quad>(point3(-2, -2, 0), vec3(4, 0, 0), vec3(0, 4, 0),
-                              back_green));
-  world.add(make_shared<quad>(point3(3, -2, 1), vec3(0, 0, 4), vec3(0, 4, 0),
-                              right_blue));
-  world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4),
-                              upper_orange));
-  world.add(make_shared<quad>(point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4),
-                              lower_teal));
-
-  camera cam;
-
-  cam.aspect_ratio = 1.0;
-  cam.image_width = 400;
-  cam.samples_per_pixel = 100;
-  cam.max_depth = 50;
-  cam.background = color(0.70, 0.80, 1.00);
-
-  cam.vfov = 80;
-  cam.lookfrom = point3(0, 0, 9);
-  cam.lookat = point3(0, 0, 0);
-  cam.vup = vec3(0, 1, 0);
-
-  cam.defocus_angle = 0;
-
-  cam.render(world);
+  shared_ptr<scene_arena> arena = make_shared<scene_arena>();
+};
+
+static bool
+build_replicas(const scene_description &scene, const numa_topology &topology,
+               camera &cam, std::vector<flat_bvh_layout> &bvhs,
+               std::vector<std::unique_ptr<scene_replica>> &replicas) {
+  // Builds a copy of the scene for each node of the topology, each on a
+  // thread pinned to the node's CPUs, so that the copy's objects, BVHs and
+  // textures are placed in the node's memory as they are first written. The
+  // first node's copy also sets cam and bvhs. Every copy draws the same
+  // random numbers, so that they are all the same scene. Hierarchies loaded
+  // from a snapshot are copied as well, rather than all sharing its mapping.
+  replicas.resize(std::size_t(topology.node_count()));
+  std::vector<char> built(replicas.size());
+  on_each_node(topology, [&](int node) {
+    random_generator().seed(std::mt19937::default_seed);
+    auto &replica = replicas[node] =
+        std::make_unique<scene_replica>(unsigned(topology.cpus(node).size()));
+    auto node_scene = scene;
+    for (auto &layout : node_scene.bvh_layouts)
+      layout = flat_bvh::copy(layout);
+    camera node_cam;
+    built[node] = node_scene.build(replica->world, node == 0 ? cam : node_cam,
+                                   replica->assets, node == 0 ? &bvhs : nullptr,
+                                   nullptr, replica->arena);
+  });
+  return std::find(built.begin(), built.end(), 0) == built.end();
 }
 
-void simple_light() {
-  hittable_list world;
-
-  auto pertext = make_shared<noise_texture>(4);
-  world.add(make_shared<sphere>(point3(0, -1000, 0), 1000,
-                                make_shared<lambertian>(pertext)));
-  world.add(make_shared<sphere>(point3(0, 2, 0), 2,
-                                make_shared<lambertian>(pertext)));
-
-  auto difflight = make_shared<diffuse_light>(color(4, 4, 4));
-  world.add(make_shared<sphere>(point3(0, 7, 0), 2, difflight));
-  world.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0),
-                              difflight));
+static bool parse_count(const char *text, int minimum, int &value) {
+  auto end = text + std::strlen(text);
+  auto result = std::from_chars(text, end, value);
+  return result.ec == std::errc() && result.ptr == end && value >= minimum;
+}
 
-  camera cam;
+int main(int argc, char *argv[]) {
+  std::string scene_file;
+  std::string output_file;
+  std::string cache_file;
+  std::string stats_file;
+  std::string heatmap_name;
+  std::string preview_file;
+  std::vector<std::string> view_settings;
+  std::string listen_address, connect_address;
+  std::string serve_address, server_address;
+  std::string camera_settings;
+  bool rebuild_bvh = false, sort_rays = false;
+  bool numa = false;
+  numa_topology topology;
+  int format = -1;
+  int width = -1, spp = -1, depth = -1, threads = -1, passes = 1, frames = 0;
+  int turntable = 0;
+
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+
+    if (arg == "--help" || arg == "-h") {
+      print_usage(std::cout);
+      return 0;
+    }
 
-  cam.aspect_ratio = 16.0 / 9.0;
-  cam.image_width = 400;
-  cam.samples_per_pixel = 100;
-  cam.max_depth = 50;
-  cam.background = color(0, 0, 0);
+    if (arg == "--rebuild-bvh") {
+      rebuild_bvh = true;
+      continue;
+    }
 
-  cam.vfov = 20;
-  cam.lookfrom = point3(26, 3, 6);
-  cam.lookat = point3(0, 2, 0);
-  cam.vup = vec3(0, 1, 0);
+    if (arg == "--sort-rays") {
+      sort_rays = true;
+      continue;
+    }
 
-  cam.defocus_angle = 0;
+    if (arg == "--numa") {
+      numa = true;
+      topology = numa_topology::detect();
+      continue;
+    }
 
-  cam.render(world);
-}
+    if (arg.substr(0, 2) != "--") {
+      scene_file = argv[i];
+      continue;
+    }
 
-void cornell_box() {
-  hittable_list world;
+    if (i + 1 == argc) {
+      std::cerr << "ERROR: Missing value for option '" << arg << "'.\n";
+      return 1;
+    }
+    const char *value = argv[++i];
+
+    int *count = arg == "--width"       ? &width
+                 : arg == "--spp"       ? &spp
+                 : arg == "--depth"     ? &depth
+                 : arg == "--threads"   ? &threads
+                 : arg == "--passes"    ? &passes
+                 : arg == "--frames"    ? &frames
+                 : arg == "--turntable" ? &turntable
+                                        : nullptr;
+    if (count) {
+      // Only the thread count can be zero.
+      if (!parse_count(value, count == &threads ? 0 : 1, *count)) {
+        std::cerr << "ERROR: Invalid value '" << value << "' for option '"
+                  << arg << "'.\n";
+        return 1;
+      }
+    } else if (arg == "--scene") {
+      scene_file = value;
+    } else if (arg == "--output") {
+      output_file = value;
+    } else if (arg == "--cache") {
+      cache_file = value;
+    } else if (arg == "--stats") {
+      stats_file = value;
+    } else if (arg == "--heatmap") {
+      heatmap_name = value;
+    } else if (arg == "--listen") {
+      listen_address = value;
+    } else if (arg == "--connect") {
+      connect_address = value;
+    } else if (arg == "--sampler") {
+      auto name = std::find(std::begin(sampler_type_names),
+                            std::end(sampler_type_names), std::string(value));
+      if (name == std::end(sampler_type_names)) {
+        std::cerr << "ERROR: Unknown sampler '" << value << "'.\n";
+        return 1;
+      }
+      camera_settings += "camera sampler " +
+                         std::to_string(name - sampler_type_names) + "\n";
+    } else if (arg == "--format") {
+      auto name = std::find(std::begin(image_format_names),
+                            std::end(image_format_names), std::string(value));
+      if (name == std::end(image_format_names)) {
+        std::cerr << "ERROR: Unknown image format '" << value << "'.\n";
+        return 1;
+      }
+      format = int(name - image_format_names);
+    } else if (arg == "--crop") {
+      camera_settings += "camera crop " + std::string(value) + "\n";
+    } else if (arg == "--view") {
+      // Each setting becomes a camera statement.
+      std::string settings = "camera ";
+      for (auto c : std::string_view(value))
+        settings += c == ';' ? std::string("\ncamera ") : std::string(1, c);
+      view_settings.push_back(settings + "\n");
+    } else if (arg == "--preview") {
+      preview_file = value;
+    } else if (arg == "--numa-layout") {
+      numa = true;
+      if (!numa_topology::parse(value, topology)) {
+        std::cerr << "ERROR: Invalid NUMA layout '" << value << "'.\n";
+        return 1;
+      }
+    } else if (arg == "--camera") {
+      camera_settings += "camera " + std::string(value) + "\n";
+    } else if (arg == "--serve") {
+      serve_address = value;
+    } else if (arg == "--server") {
+      server_address = value;
+    } else if (arg == "--stop-server") {
+      return request_server_stop(value) ? 0 : 1;
+    } else {
+      std::cerr << "ERROR: Unknown option '" << arg << "'.\n";
+      print_usage(std::cerr);
+      return 1;
+    }
+  }
 
-  auto red = make_shared<lambertian>(color(.65, .05, .05));
-  auto white = make_shared<lambertian>(color(.73, .73, .73));
-  auto green = make_shared<lambertian>(color(.12, .45, .15));
-  auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-  world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0),
-                              vec3(0, 0, 555), green));
-  world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555),
-                              red));
-  world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0),
-                              vec3(0, 0, -105), light));
-  world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555),
-                              white));
-  world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0),
-                              vec3(0, 0, -555), white));
-  world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0),
-                              vec3(0, 555, 0), white));
-
-  shared_ptr<hittable> box1 =
-      box(point3(0, 0, 0), point3(165, 330, 165), white);
-  box1 = make_shared<rotate_y>(box1, 15);
-  box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-  world.add(box1);
-
-  shared_ptr<hittable> box2 =
-      box(point3(0, 0, 0), point3(165, 165, 165), white);
-  box2 = make_shared<rotate_y>(box2, -18);
-  box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-  world.add(box2);
+  // Workers get the scene and settings from the coordinator.
+  if (!connect_address.empty())
+    return run_tile_worker(connect_address, std::max(threads, 0)) ? 0 : 1;
 
-  camera cam;
+  if (!serve_address.empty()) {
+    auto listener = socket_handle::listen(serve_address);
+    render_server server(std::max(threads, 0));
+    return listener.is_open() && server.serve(listener) ? 0 : 1;
+  }
 
-  cam.aspect_ratio = 1.0;
-  cam.image_width = 600;
-  cam.samples_per_pixel = 200;
-  cam.max_depth = 50;
-  cam.background = color(0, 0, 0);
+  if (scene_file.empty()) {
+    print_usage(std::cerr);
+    return 1;
+  }
 
-  cam.vfov = 40;
-  cam.lookfrom = point3(278, 278, -800);
-  cam.lookat = point3(278, 278, 0);
-  cam.vup = vec3(0, 1, 0);
+  std::string source;
+  if (!scene_parser::read_file(scene_file, source))
+    return 1;
+
+  // Command line settings override the scene file's. They are applied as
+  // camera statements, so that a render server can apply them the same way.
+  if (width >= 0)
+    camera_settings += "camera image_width " + std::to_string(width) + "\n";
+  if (spp >= 0)
+    camera_settings += "camera samples_per_pixel " + std::to_string(spp) + "\n";
+  if (depth >= 0)
+    camera_settings += "camera max_depth " + std::to_string(depth) + "\n";
+  if (sort_rays)
+    camera_settings += "camera sort_rays 1\n";
+
+  if (frames > 0 && (output_file.empty() || !listen_address.empty() ||
+                     !server_address.empty())) {
+    std::cerr << "ERROR: --frames needs --output, and renders locally.\n";
+    return 1;
+  }
+  bool many_views = turntable > 0 || !view_settings.empty();
+  if (many_views && (output_file.empty() || frames > 0 ||
+                     !listen_address.empty() || !server_address.empty() ||
+                     (turntable > 0 && !view_settings.empty()))) {
+    std::cerr << "ERROR: --view and --turntable need --output, render "
+                 "locally, and can't be combined with each other or with "
+                 "--frames.\n";
+    return 1;
+  }
+  if (!preview_file.empty() && (frames > 0 || many_views ||
+                                !listen_address.empty() ||
+                                !server_address.empty())) {
+    std::cerr << "ERROR: --preview renders a single image locally.\n";
+    return 1;
+  }
+  if (numa && (frames > 0 || many_views || !listen_address.empty() ||
+               !server_address.empty())) {
+    std::cerr << "ERROR: --numa renders a single image locally.\n";
+    return 1;
+  }
+  if (!stats_file.empty() &&
+      (!listen_address.empty() || !server_address.empty())) {
+    std::cerr << "ERROR: --stats reports on an image rendered locally.\n";
+    return 1;
+  }
+  if (!heatmap_name.empty() &&
+      (!listen_address.empty() || !server_address.empty())) {
+    std::cerr << "ERROR: --heatmap times tiles rendered locally.\n";
+    return 1;
+  }
 
-  cam.defocus_angle = 0;
+  auto output_format = format >= 0 ? image_format(format)
+                                  : image_format_for_file(output_file);
 
-  cam.render(world);
-}
+  std::ofstream file_out;
+  if (!output_file.empty() && frames == 0 && !many_views) {
+    file_out.open(output_file, std::ios::binary);
+    if (!file_out) {
+      std::cerr << "ERROR: Could not open output file '" << output_file
+                << "'.\n";
+      return 1;
+    }
+  }
+  std::ostream &out = output_file.empty() ? std::cout : file_out;
+
+  if (!server_address.empty()) {
+    server_render_result result;
+    if (!request_server_render(server_address, scene_file, source,
+                               camera_settings, result))
+      return 1;
+    if (!write_image(out, output_format, result.width, result.height,
+                     result.pixels)) {
+      std::cerr << "ERROR: Could not write the image.\n";
+      return 1;
+    }
+    return 0;
+  }
 
-void cornell_smoke() {
+  // A snapshot saved by an earlier run of the same scene source spares
+  // parsing it and building its BVHs.
+  bool use_cache = !cache_file.empty();
+  auto source_hash = fnv1a_hash(source);
+
+  scene_description scene;
+  scene.source = scene_file;
+  bool from_snapshot =
+      use_cache && scene_snapshot::read(cache_file, source_hash, scene);
+  if (!from_snapshot && !scene_parser(scene).parse(source))
+    return 1;
+
+  // Image textures decode in the background while the rest of the scene is
+  // built, and are waited for when rendering first needs them. NUMA replicas
+  // each have a loader of their own.
+  std::unique_ptr<asset_loader> assets;
   hittable_list world;
-
-  auto red = make_shared<lambertian>(color(.65, .05, .05));
-  auto white = make_shared<lambertian>(color(.73, .73, .73));
-  auto green = make_shared<lambertian>(color(.12, .45, .15));
-  auto light = make_shared<diffuse_light>(color(7, 7, 7));
-
-  world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0),
-                              vec3(0, 0, 555), green));
-  world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555),
-                              red));
-  world.add(make_shared<quad>(point3(113, 554, 127), vec3(330, 0, 0),
-                              vec3(0, 0, 305), light));
-  world.add(make_shared<quad>(point3(0, 555, 0), vec3(555, 0, 0),
-                              vec3(0, 0, 555), white));
-  world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555),
-                              white));
-  world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0),
-                              vec3(0, 555, 0), white));
-
-  shared_ptr<hittable> box1 =
-      box(point3(0, 0, 0), point3(165, 330, 165), white);
-  box1 = make_shared<rotate_y>(box1, 15);
-  box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-
-  shared_ptr<hittable> box2 =
-      box(point3(0, 0, 0), point3(165, 165, 165), white);
-  box2 = make_shared<rotate_y>(box2, -18);
-  box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-
-  world.add(make_shared<constant_medium>(box1, 0.01, color(0, 0, 0)));
-  world.add(make_shared<constant_medium>(box2, 0.01, color(1, 1, 1)));
-
   camera cam;
+  std::vector<flat_bvh_layout> bvhs;
+  scene_animation animation;
+  auto arena = make_shared<scene_arena>();
+  std::vector<std::unique_ptr<scene_replica>> replicas;
+  if (numa) {
+    // Each node traces a copy of the scene in its own memory.
+    if (!build_replicas(scene, topology, cam, bvhs, replicas))
+      return 1;
+    arena = replicas[0]->arena;
+    std::clog << "NUMA nodes: " << topology.node_count() << '\n';
+  } else {
+    assets = std::make_unique<asset_loader>();
+    if (!scene.build(world, cam, *assets, &bvhs, &animation, arena))
+      return 1;
+  }
+  std::clog << "Scene objects: " << arena->bytes_used() / 1024.0 << " KiB in "
+            << arena->block_count() << " arena blocks\n";
+
+  if (use_cache && !from_snapshot)
+    scene_snapshot::write(cache_file, scene, bvhs, source_hash);
+
+  if (!apply_camera_settings(camera_settings, cam, "command line"))
+    return 1;
+  if (threads >= 0)
+    cam.thread_count = threads;
+  cam.time_tiles = !heatmap_name.empty();
+
+  if (frames > 0) {
+    // Each frame moves the animated objects, then refits the hierarchies
+    // holding them, or rebuilds those that degraded too far.
+    const char *kind_names[] = {"refit", "partial rebuild", "full rebuild"};
+    for (int frame = 0; frame < frames; frame++) {
+      auto start = render_clock::now();
+      auto kind = animation.set_frame(frame, rebuild_bvh);
+      auto update_seconds = seconds_between(start, render_clock::now());
+
+      auto name = frame_file(output_file, frame);
+      std::ofstream frame_out(name, std::ios::binary);
+      if (!frame_out) {
+        std::cerr << "ERROR: Could not open output file '" << name << "'.\n";
+        return 1;
+      }
+      image_writer writer(frame_out, output_format);
+      cam.render(world, writer);
+      if (!writer.finish()) {
+        std::cerr << "ERROR: Could not write frame '" << name << "'.\n";
+        return 1;
+      }
+      std::clog << "Frame " << frame << ": BVH " << kind_names[int(kind)]
+                << " in " << update_seconds * 1000 << " ms\n";
+    }
+  } else if (many_views) {
+    // The views share the scene and one pool of threads.
+    auto views = turntable > 0 ? turntable_views(cam, turntable)
+                               : std::vector<camera>(view_settings.size(), cam);
+    for (std::size_t k = 0; k < view_settings.size(); k++)
+      if (!apply_camera_settings(view_settings[k], views[k],
+                                 "view " + std::to_string(k)))
+        return 1;
+
+    std::vector<std::ofstream> view_outs;
+    std::vector<std::unique_ptr<image_writer>> writers;
+    std::vector<image_writer *> writer_list;
+    for (std::size_t k = 0; k < views.size(); k++) {
+      auto name = frame_file(output_file, int(k));
+      view_outs.emplace_back(name, std::ios::binary);
+      if (!view_outs.back()) {
+        std::cerr << "ERROR: Could not open output file '" << name << "'.\n";
+        return 1;
+      }
+    }
+    for (auto &view_out : view_outs) {
+      writers.push_back(
+          std::make_unique<image_writer>(view_out, output_format));
+      writer_list.push_back(writers.back().get());
+    }
 
-  cam.aspect_ratio = 1.0;
-  cam.image_width = 600;
-  cam.samples_per_pixel = 200;
-  cam.max_depth = 50;
-  cam.background = color(0, 0, 0);
-
-  cam.vfov = 40;
-  cam.lookfrom = point3(278, 278, -800);
-  cam.lookat = point3(278, 278, 0);
-  cam.vup = vec3(0, 1, 0);
+    camera::render_views(world, views, writer_list, cam.thread_count);
+    for (std::size_t k = 0; k < views.size(); k++) {
+      if (!writers[k]->finish()) {
+        std::cerr << "ERROR: Could not write view '"
+                  << frame_file(output_file, int(k)) << "'.\n";
+        return 1;
+      }
+    }
+    // Stats and heatmaps are of the last view.
+    cam = views.back();
+  } else if (listen_address.empty()) {
+    // Previews are written to a file beside the preview file, then renamed
+    // over it, so that viewers watching it never see half an image.
+    camera::preview_function preview;
+    if (!preview_file.empty()) {
+      preview = [&](const std::vector<color> &pixels, int block_size) {
+        const auto &region = cam.region();
+        auto partial = preview_file + ".partial";
+        {
+          std::ofstream preview_out(partial, std::ios::binary);
+          write_image(preview_out, image_format_for_file(preview_file),
+                      region.x1 - region.x0, region.y1 - region.y0, pixels);
+          if (!preview_out) {
+            std::cerr << "ERROR: Could not write preview '" << partial
+                      << "'.\n";
+            return;
+          }
+        }
+        if (std::rename(partial.c_str(), preview_file.c_str()) != 0) {
+          std::cerr << "ERROR: Could not replace preview '" << preview_file
+                    << "'.\n";
+          return;
+        }
+        std::clog << "\rPreview at 1/" << block_size
+                  << " resolution written to " << preview_file << " after "
+                  << seconds_between(program_start, render_clock::now())
+                  << " s\n";
+      };
+    }
 
-  cam.defocus_angle = 0;
+    image_writer writer(out, output_format);
+    if (numa) {
+      std::vector<const hittable *> worlds;
+      for (const auto &replica : replicas)
+        worlds.push_back(&replica->world);
+      cam.render(worlds, topology, writer, preview);
+    } else {
+      cam.render(world, writer, preview);
+    }
+    if (!writer.finish()) {
+      std::cerr << "ERROR: Could not write the image.\n";
+      return 1;
+    }
+  } else {
+    auto listener = socket_handle::listen(listen_address);
+    tile_coordinator coordinator(scene_file, source, camera_settings, cam,
+                                 passes);
+    std::vector<color> pixels;
+    if (!listener.is_open() || !coordinator.run(listener, pixels))
+      return 1;
+
+    const auto &region = cam.region();
+    if (!write_image(out, output_format, region.x1 - region.x0,
+                     region.y1 - region.y0, pixels)) {
+      std::cerr << "ERROR: Could not write the image.\n";
+      return 1;
+    }
+  }
 
-  cam.render(world);
-}
+  if (!stats_file.empty()) {
+    std::ofstream stats(stats_file);
+    cam.last_render_stats().report_json(stats);
+    if (!stats) {
+      std::cerr << "ERROR: Could not write stats file '" << stats_file
+                << "'.\n";
+      return 1;
+    }
+  }
 
-int main() {
-  switch (8) {
-  case 1:
-    bouncing_spheres();
-    break;
-  case 2:
-    checkered_spheres();
-    break;
-  case 3:
-    earth();
-    break;
-  case 4:
-    perlin_spheres();
-    break;
-  case 5:
-    quads();
-    break;
-  case 6:
-    simple_light();
-    break;
-  case 7:
-    cornell_box();
-    break;
-  case 8:
-    cornell_smoke();
-    break;
+  if (!heatmap_name.empty()) {
+    std::ofstream image(heatmap_name + ".ppm");
+    write_tile_heatmap(image, cam.last_tile_costs(), cam.region());
+    std::ofstream table(heatmap_name + ".csv");
+    write_tile_costs_csv(table, cam.last_tile_costs());
+    if (!image || !table) {
+      std::cerr << "ERROR: Could not write heatmap '" << heatmap_name << "'.\n";
+      return 1;
+    }
   }
+  return 0;
 }
@@ -0,0 +1,47 @@
+#include "raytracing/asset_loader.h"
+#include "raytracing/texture_cache.h"
+#include "raytracing/vec3.h"
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+
+TEST(AssetLoaderTest, LoadedTexturesSampleTheDecodedImage) {
+  // A 2x1 image: black on the left, white on the right.
+  auto filename = testing::TempDir() + "asset_loader.pgm";
+  {
+    std::ofstream out(filename, std::ios::binary);
+    out << "P5\n2 1\n255\n";
+    out.put(char(0));
+    out.put(char(255));
+  }
+
+  texture_cache cache;
+  asset_loader assets(2, cache);
+
+  auto first = assets.load_image(filename);
+  auto second = assets.load_image(filename);
+  assets.wait();
+  std::remove(filename.c_str());
+
+  // Both textures share a single decode.
+  EXPECT_EQ(cache.decode_count(), 1u);
+
+  auto left = first->value(0.25, 0.5, point3(0, 0, 0));
+  auto right = second->value(0.75, 0.5, point3(0, 0, 0));
+  EXPECT_DOUBLE_EQ(left.x(), 0.0);
+  EXPECT_DOUBLE_EQ(right.x(), 1.0);
+}
+
+TEST(AssetLoaderTest, TexturesCanBeSampledBeforeWaiting) {
+  texture_cache cache;
+  asset_loader assets(1, cache);
+
+  // Sampling blocks until the decode is done. A missing file decodes to an
+  // empty image, which textures show as cyan.
+  auto missing = assets.load_image("no/such/image.png");
+  auto c = missing->value(0.5, 0.5, point3(0, 0, 0));
+  EXPECT_DOUBLE_EQ(c.x(), 0.0);
+  EXPECT_DOUBLE_EQ(c.y(), 1.0);
+  EXPECT_DOUBLE_EQ(c.z(), 1.0);
+}
@@ -0,0 +1,116 @@
+#include "raytracing/box.h"
+#include "raytracing/constant_medium.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/material.h"
+#include "raytracing/quad.h"
+#include <cmath>
+#include <gtest/gtest.h>
+
+static hittable_list six_quads(const point3 &min, const point3 &max,
+                               shared_ptr<material> mat) {
+  // The six sides box() used to build.
+  auto dx = vec3(max.x() - min.x(), 0, 0);
+  auto dy = vec3(0, max.y() - min.y(), 0);
+  auto dz = vec3(0, 0, max.z() - min.z());
+
+  hittable_list sides;
+  sides.add(make_shared<quad>(point3(min.x(), min.y(), max.z()), dx, dy, mat));
+  sides.add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz, dy, mat));
+  sides.add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx, dy, mat));
+  sides.add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dz, dy, mat));
+  sides.add(make_shared<quad>(point3(min.x(), max.y(), max.z()), dx, -dz, mat));
+  sides.add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dx, dz, mat));
+  return sides;
+}
+
+TEST(BoxTest, HitsMatchSixQuads) {
+  // Rays from outside and from inside the box hit the same face at the same
+  // place as they would the six quads, with the same texture coordinates.
+  auto mat = make_shared<lambertian>(color(.5, .5, .5));
+  point3 min(-1, 0, 2), max(3, 1.5, 2.5);
+  axis_aligned_box solid(max, min, mat);
+  auto sides = six_quads(min, max, mat);
+
+  random_generator().seed(3);
+  int hits = 0;
+  for (int i = 0; i < 4000; i++) {
+    auto origin = i % 2 ? point3::random(-4, 6) : point3(random_double(-1, 3),
+                                                         random_double(0, 1.5),
+                                                         random_double(2, 2.5));
+    ray r(origin, random_unit_vector());
+
+    hit_record expected, rec;
+    bool hit = sides.hit(r, interval(0.001, infinity), expected);
+    ASSERT_EQ(solid.hit(r, interval(0.001, infinity), rec), hit) << i;
+    if (!hit)
+      continue;
+    hits++;
+    EXPECT_NEAR(rec.t, expected.t, 1e-12);
+    EXPECT_NEAR((rec.p - expected.p).length(), 0, 1e-12);
+    EXPECT_NEAR((rec.normal - expected.normal).length(), 0, 1e-12);
+    EXPECT_EQ(rec.front_face, expected.front_face);
+    EXPECT_NEAR(rec.u, expected.u, 1e-12);
+    EXPECT_NEAR(rec.v, expected.v, 1e-12);
+    EXPECT_EQ(rec.mat, mat);
+  }
+  EXPECT_GT(hits, 2000);
+
+  auto box = solid.bounding_box();
+  EXPECT_DOUBLE_EQ(box.x.min, -1);
+  EXPECT_DOUBLE_EQ(box.z.max, 2.5);
+}
+
+TEST(BoxTest, SpanIsTheEntryAndExit) {
+  auto mat = make_shared<lambertian>(color(.5, .5, .5));
+  auto solid = box(point3(0, 0, 0), point3(2, 2, 2), mat);
+
+  interval span;
+  ASSERT_TRUE(solid->hit_span(ray(point3(-1, 1, 1), vec3(1, 0, 0)), span));
+  EXPECT_DOUBLE_EQ(span.min, 1);
+  EXPECT_DOUBLE_EQ(span.max, 3);
+
+  // The span covers the whole line, behind the origin too.
+  ASSERT_TRUE(solid->hit_span(ray(point3(1, 1, 1), vec3(0, 0, 0.5)), span));
+  EXPECT_DOUBLE_EQ(span.min, -2);
+  EXPECT_DOUBLE_EQ(span.max, 2);
+
+  EXPECT_FALSE(solid->hit_span(ray(point3(-1, 3, 1), vec3(1, 0, 0)), span));
+
+  // Instances pass the span through from the box.
+  auto moved = make_shared<translate>(make_shared<rotate_y>(solid, 90),
+                                      vec3(10, 0, 0));
+  ASSERT_TRUE(moved->hit_span(ray(point3(0, 1, -1), vec3(1, 0, 0)), span));
+  EXPECT_NEAR(span.min, 10, 1e-12);
+  EXPECT_NEAR(span.max, 12, 1e-12);
+
+  // Other objects find the span with two hits.
+  auto quads = six_quads(point3(0, 0, 0), point3(2, 2, 2), mat);
+  ASSERT_TRUE(quads.hit_span(ray(point3(-1, 1, 1), vec3(1, 0, 0)), span));
+  EXPECT_DOUBLE_EQ(span.min, 1);
+  EXPECT_DOUBLE_EQ(span.max, 3);
+}
+
+TEST(BoxTest, BoundsAConstantMedium) {
+  // Rays crossing one unit of a medium of density one scatter in it with
+  // probability 1 - 1/e.
+  auto solid = box(point3(0, 0, 0), point3(1, 1, 1),
+                   make_shared<lambertian>(color(.5, .5, .5)));
+  constant_medium fog(solid, 1, color(1, 1, 1));
+
+  random_generator().seed(5);
+  int scattered = 0, trials = 20000;
+  for (int i = 0; i < trials; i++) {
+    hit_record rec;
+    ray r(point3(-1, 0.5, 0.5), vec3(1, 0, 0));
+    if (fog.hit(r, interval(0.001, infinity), rec)) {
+      scattered++;
+      ASSERT_GE(rec.t, 1);
+      ASSERT_LE(rec.t, 2);
+    }
+  }
+  EXPECT_NEAR(double(scattered) / trials, 1 - std::exp(-1.0), 0.01);
+
+  hit_record rec;
+  EXPECT_FALSE(fog.hit(ray(point3(-1, 2, 0.5), vec3(1, 0, 0)),
+                       interval(0.001, infinity), rec));
+}
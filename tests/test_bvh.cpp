@@ -0,0 +1,187 @@
+#include "raytracing/aabb.h"
+#include "raytracing/bvh.h"
+#include "raytracing/flat_bvh.h"
+#include "raytracing/hittable.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/interval.h"
+#include "raytracing/ray.h"
+#include "raytracing/rtweekend.h"
+#include "raytracing/sphere.h"
+#include "raytracing/vec3.h"
+#include <gtest/gtest.h>
+
+static hittable_list moving_spheres() {
+  // A field of small spheres, half of which move over the shutter interval.
+  hittable_list world;
+  for (int a = -5; a < 5; a++) {
+    for (int b = -5; b < 5; b++) {
+      point3 center(a + 0.5, 0.2, b + 0.5);
+      if ((a + b) % 2 == 0)
+        world.add(make_shared<sphere>(center, 0.2, nullptr));
+      else
+        world.add(make_shared<sphere>(center, center + vec3(0, 0.5, 0), 0.2,
+                                      nullptr));
+    }
+  }
+  return world;
+}
+
+TEST(BvhTest, MovingSphereBoxesFollowTheCenter) {
+  sphere s(point3(0, 0, 0), point3(2, 0, 0), 1, nullptr);
+
+  auto open = s.bounding_box_at(0);
+  auto close = s.bounding_box_at(1);
+  auto whole = s.bounding_box();
+
+  EXPECT_DOUBLE_EQ(open.x.min, -1);
+  EXPECT_DOUBLE_EQ(open.x.max, 1);
+  EXPECT_DOUBLE_EQ(close.x.min, 1);
+  EXPECT_DOUBLE_EQ(close.x.max, 3);
+  EXPECT_DOUBLE_EQ(whole.x.min, -1);
+  EXPECT_DOUBLE_EQ(whole.x.max, 3);
+
+  auto halfway = interpolate(open, close, 0.5);
+  EXPECT_DOUBLE_EQ(halfway.x.min, 0);
+  EXPECT_DOUBLE_EQ(halfway.x.max, 2);
+}
+
+TEST(BvhTest, TranslatedBoxesMoveWithTheObject) {
+  auto s = make_shared<sphere>(point3(0, 0, 0), point3(0, 2, 0), 1, nullptr);
+  translate moved(s, vec3(5, 0, 0));
+
+  auto box = moved.bounding_box_at(1);
+  EXPECT_DOUBLE_EQ(box.x.min, 4);
+  EXPECT_DOUBLE_EQ(box.y.min, 1);
+  EXPECT_DOUBLE_EQ(box.y.max, 3);
+}
+
+TEST(BvhTest, HitsMatchBruteForceAtEveryTime) {
+  auto world = moving_spheres();
+  bvh_node motion_bvh(world, true);
+  bvh_node static_bvh(world, false);
+
+  for (int i = 0; i < 2000; i++) {
+    point3 origin(random_double(-6, 6), 3, random_double(-6, 6));
+    auto target = point3(random_double(-5, 5), 0, random_double(-5, 5));
+    ray r(origin, target - origin, random_double());
+
+    hit_record expected, motion, fixed;
+    bool hit = world.hit(r, interval(0.001, infinity), expected);
+
+    ASSERT_EQ(motion_bvh.hit(r, interval(0.001, infinity), motion), hit);
+    ASSERT_EQ(static_bvh.hit(r, interval(0.001, infinity), fixed), hit);
+    if (hit) {
+      EXPECT_DOUBLE_EQ(motion.t, expected.t);
+      EXPECT_DOUBLE_EQ(fixed.t, expected.t);
+    }
+  }
+}
+
+TEST(BvhTest, FlatHierarchyMatchesBruteForce) {
+  auto world = moving_spheres();
+  flat_bvh bvh(world.objects);
+
+  EXPECT_TRUE(flat_bvh::is_valid(bvh.arrays(), world.objects.size()));
+  EXPECT_FALSE(flat_bvh::is_valid(bvh.arrays(), world.objects.size() + 1));
+
+  for (int i = 0; i < 2000; i++) {
+    point3 origin(random_double(-6, 6), 3, random_double(-6, 6));
+    auto target = point3(random_double(-5, 5), 0, random_double(-5, 5));
+    ray r(origin, target - origin, random_double());
+
+    hit_record expected, flat;
+    bool hit = world.hit(r, interval(0.001, infinity), expected);
+
+    ASSERT_EQ(bvh.hit(r, interval(0.001, infinity), flat), hit);
+    if (hit) {
+      EXPECT_DOUBLE_EQ(flat.t, expected.t);
+    }
+  }
+}
+
+TEST(BvhTest, FlatHierarchyValidationAcceptsOnlyTrees) {
+  // Node 2 is the second child of the root and also the first child of node
+  // 1, so it has two parents.
+  flat_bvh_node nodes[4] = {};
+  nodes[0].first = 2;
+  nodes[1].first = 3;
+  nodes[2].count = 1;
+  nodes[3].first = 1;
+  nodes[3].count = 1;
+  std::uint32_t order[2] = {0, 1};
+
+  flat_bvh_layout layout{nodes, 4, order, 2, nullptr};
+  EXPECT_FALSE(flat_bvh::is_valid(layout, 2));
+
+  // As a tree: the root's children are both leaves.
+  nodes[1].first = 1;
+  nodes[1].count = 1;
+  layout.node_count = 3;
+  EXPECT_TRUE(flat_bvh::is_valid(layout, 2));
+}
+
+TEST(BvhTest, FlatHierarchyCanBeRebuiltFromItsArrays) {
+  auto world = moving_spheres();
+  flat_bvh built(world.objects);
+  flat_bvh reused(world.objects, built.arrays());
+  flat_bvh copied(world.objects, flat_bvh::copy(built.arrays()));
+  EXPECT_NE(copied.arrays().nodes, built.arrays().nodes);
+
+  for (int i = 0; i < 200; i++) {
+    point3 origin(random_double(-6, 6), 3, random_double(-6, 6));
+    ray r(origin, point3(0, 0, 0) - origin, random_double());
+
+    hit_record a, b, c;
+    bool hit = built.hit(r, interval(0.001, infinity), a);
+    ASSERT_EQ(reused.hit(r, interval(0.001, infinity), b), hit);
+    ASSERT_EQ(copied.hit(r, interval(0.001, infinity), c), hit);
+  }
+}
+
+TEST(BvhTest, FlatHierarchyFollowsMovedObjects) {
+  // Spheres that move from frame to frame, in a hierarchy kept up to date by
+  // update(). Small moves only need a refit; scattering them needs rebuilds.
+  auto world = moving_spheres();
+  std::vector<shared_ptr<translate>> movers;
+  hittable_list moved;
+  for (const auto &object : world.objects) {
+    movers.push_back(make_shared<translate>(object, vec3(0, 0, 0)));
+    moved.add(movers.back());
+  }
+
+  flat_bvh built(moved.objects);
+  flat_bvh reused(moved.objects, built.arrays());
+
+  auto expect_matches = [&](flat_bvh &bvh) {
+    for (int i = 0; i < 500; i++) {
+      point3 origin(random_double(-12, 12), 12, random_double(-12, 12));
+      auto target = point3(random_double(-10, 10), 0, random_double(-10, 10));
+      ray r(origin, target - origin, random_double());
+
+      hit_record expected, flat;
+      bool hit = moved.hit(r, interval(0.001, infinity), expected);
+      ASSERT_EQ(bvh.hit(r, interval(0.001, infinity), flat), hit);
+      if (hit) {
+        EXPECT_DOUBLE_EQ(flat.t, expected.t);
+      }
+    }
+  };
+
+  for (auto &m : movers)
+    m->set_offset(vec3(0.01, 0, 0));
+  EXPECT_EQ(built.update(), flat_bvh::update_kind::refit);
+  EXPECT_EQ(reused.update(), flat_bvh::update_kind::refit);
+  expect_matches(built);
+  expect_matches(reused);
+
+  for (auto &m : movers)
+    m->set_offset(random_double(-5, 5) * vec3(1, 0, 1));
+  EXPECT_NE(built.update(), flat_bvh::update_kind::refit);
+  expect_matches(built);
+  EXPECT_TRUE(flat_bvh::is_valid(built.arrays(), moved.objects.size()));
+
+  auto rebuilt_cost = built.sah_cost();
+  built.rebuild();
+  EXPECT_LE(built.sah_cost(), rebuilt_cost * 1.5);
+  expect_matches(built);
+}
@@ -0,0 +1,177 @@
+#include "raytracing/camera.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/image_writer.h"
+#include "raytracing/material.h"
+#include "raytracing/numa.h"
+#include "raytracing/sphere.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static hittable_list test_world() {
+  hittable_list world;
+  world.add(make_shared<sphere>(point3(0, 0, -1), 0.5,
+                                make_shared<lambertian>(color(.5, .2, .2))));
+  world.add(make_shared<sphere>(point3(0.6, 0.2, -0.8), 0.2,
+                                make_shared<diffuse_light>(color(4, 4, 4))));
+  world.add(make_shared<sphere>(point3(0, -100.5, -1), 100,
+                                make_shared<lambertian>(color(.8, .8, .8))));
+  return world;
+}
+
+static camera test_camera() {
+  // Samples come from a sampler, so each pixel gets the same ones however
+  // the image is split up.
+  camera cam;
+  cam.image_width = 40;
+  cam.aspect_ratio = 4.0 / 3.0;
+  cam.samples_per_pixel = 4;
+  cam.max_depth = 4;
+  cam.background = color(0.5, 0.7, 1.0);
+  cam.sampling = sampler_type::sobol;
+  cam.tile_size = 8;
+  cam.show_progress = false;
+  return cam;
+}
+
+static std::string render_ppm(camera &cam, const hittable &world,
+                              const camera::preview_function &preview =
+                                  nullptr) {
+  std::ostringstream out;
+  image_writer writer(out, image_format::ppm);
+  cam.render(world, writer, preview);
+  EXPECT_TRUE(writer.finish());
+  return out.str();
+}
+
+static std::string ppm_pixels(const std::string &ppm, int width, int height) {
+  // The RGB bytes of a binary PPM image of the given size.
+  auto header = "P6\n" + std::to_string(width) + ' ' +
+                std::to_string(height) + "\n255\n";
+  EXPECT_EQ(ppm.substr(0, header.size()), header);
+  return ppm.substr(header.size());
+}
+
+TEST(CameraTest, CropRendersThatPartOfTheFrame) {
+  auto world = test_world();
+  auto cam = test_camera();
+  auto full = ppm_pixels(render_ppm(cam, world), 40, 30);
+
+  // Edges round up to the next pixel boundary: columns 10 to 29 and rows 8
+  // to 14.
+  cam.crop_x0 = 0.25;
+  cam.crop_y0 = 0.25;
+  cam.crop_x1 = 0.74;
+  cam.crop_y1 = 0.5;
+  auto cropped = ppm_pixels(render_ppm(cam, world), 20, 7);
+  auto region = cam.region();
+  EXPECT_EQ(region.x0, 10);
+  EXPECT_EQ(region.y0, 8);
+  EXPECT_EQ(region.x1, 30);
+  EXPECT_EQ(region.y1, 15);
+
+  for (int j = 0; j < 7; j++)
+    EXPECT_EQ(cropped.substr(j * 20 * 3, 20 * 3),
+              full.substr(((8 + j) * 40 + 10) * 3, 20 * 3))
+        << j;
+
+  // Tiles cover just the region, and an empty window keeps one pixel.
+  for (const auto &tile : cam.tiles()) {
+    EXPECT_GE(tile.x0, 10);
+    EXPECT_LE(tile.y1, 15);
+  }
+  cam.crop_x0 = cam.crop_x1 = 2;
+  cam.prepare();
+  EXPECT_EQ(cam.region().x0, 39);
+  EXPECT_EQ(cam.region().x1, 40);
+}
+
+TEST(CameraTest, PreviewsRefineToTheSameImage) {
+  // Each preview level fills blocks from pixels of the final image, so no
+  // pixel is traced twice and the final image is as without previews.
+  auto world = test_world();
+  auto cam = test_camera();
+  cam.crop_y0 = 0.1;
+  auto expected = render_ppm(cam, world);
+
+  std::vector<int> block_sizes;
+  std::vector<std::vector<color>> previews;
+  auto image = render_ppm(cam, world, [&](const std::vector<color> &pixels,
+                                          int block_size) {
+    block_sizes.push_back(block_size);
+    previews.push_back(pixels);
+  });
+  EXPECT_EQ(image, expected);
+  EXPECT_EQ(block_sizes, (std::vector<int>{8, 4, 2}));
+
+  auto pixels = ppm_pixels(image, 40, 27);
+  auto byte = [&](const color &c) {
+    unsigned char rgb[3];
+    color_to_bytes(c, rgb);
+    return std::string(rgb, rgb + 3);
+  };
+  for (std::size_t p = 0; p < previews.size(); p++) {
+    ASSERT_EQ(previews[p].size(), 40u * 27u);
+    int block = block_sizes[p];
+    for (int y = 0; y < 27; y++) {
+      for (int x = 0; x < 40; x++) {
+        // Every pixel shows the final colour of its block's corner.
+        auto corner = std::size_t(y / block * block) * 40 + x / block * block;
+        ASSERT_EQ(byte(previews[p][std::size_t(y) * 40 + x]),
+                  pixels.substr(corner * 3, 3))
+            << block << ' ' << x << ' ' << y;
+      }
+    }
+  }
+}
+
+TEST(CameraTest, ViewsRenderAsTheyWouldAlone) {
+  // Views of different sizes and crops share one pool, and each image is
+  // what its camera renders by itself.
+  auto world = test_world();
+  std::vector<camera> views(3, test_camera());
+  views[1].lookfrom = point3(1, 0.5, 0.5);
+  views[1].vfov = 60;
+  views[2].image_width = 24;
+  views[2].crop_x1 = 0.5;
+
+  std::vector<std::string> expected;
+  for (auto view : views)
+    expected.push_back(render_ppm(view, world));
+
+  std::vector<std::ostringstream> outs(views.size());
+  std::vector<std::unique_ptr<image_writer>> writers;
+  std::vector<image_writer *> writer_list;
+  for (auto &out : outs) {
+    writers.push_back(std::make_unique<image_writer>(out, image_format::ppm));
+    writer_list.push_back(writers.back().get());
+  }
+  camera::render_views(world, views, writer_list, 2);
+
+  for (std::size_t k = 0; k < views.size(); k++) {
+    EXPECT_TRUE(writers[k]->finish());
+    EXPECT_EQ(outs[k].str(), expected[k]) << k;
+  }
+  EXPECT_NE(expected[0], expected[1]);
+  EXPECT_EQ(views[2].region().x1, 12);
+}
+
+TEST(CameraTest, ReplicasRenderTheSameImage) {
+  // Each node's threads trace their own copy of the world, and the tiles
+  // they render land in the one image.
+  auto world = test_world();
+  auto cam = test_camera();
+  auto expected = render_ppm(cam, world);
+
+  auto first = test_world(), second = test_world();
+  numa_topology topology;
+  ASSERT_TRUE(numa_topology::parse("0;0", topology));
+  cam.thread_count = 3;
+  std::ostringstream out;
+  image_writer writer(out, image_format::ppm);
+  cam.render({&first, &second}, topology, writer);
+  EXPECT_TRUE(writer.finish());
+  EXPECT_EQ(out.str(), expected);
+}
@@ -0,0 +1,117 @@
+#include "raytracing/aabb.h"
+#include "raytracing/color.h"
+#include "raytracing/heterogeneous_medium.h"
+#include "raytracing/hittable.h"
+#include "raytracing/interval.h"
+#include "raytracing/ray.h"
+#include "raytracing/vec3.h"
+#include <cmath>
+#include <gtest/gtest.h>
+#include <vector>
+
+static density_grid uniform_grid(int n, float value) {
+  return density_grid(n, n, n, std::vector<float>(n * n * n, value));
+}
+
+TEST(DensityGridTest, UniformBricksStoreNoVoxels) {
+  auto grid = uniform_grid(32, 0.5f);
+
+  EXPECT_EQ(grid.bricks_x(), 4);
+  EXPECT_FLOAT_EQ(grid.value(0, 0, 0), 0.5f);
+  EXPECT_FLOAT_EQ(grid.value(31, 17, 9), 0.5f);
+  EXPECT_FLOAT_EQ(grid.majorant(3, 3, 3), 0.5f);
+
+  // Only per-brick bookkeeping, no voxel data.
+  EXPECT_LT(grid.memory_bytes(), 64 * 32u);
+}
+
+TEST(DensityGridTest, VaryingBricksKeepEveryVoxel) {
+  // A single dense voxel in an otherwise empty 20^3 grid.
+  const int n = 20;
+  std::vector<float> values(n * n * n, 0.0f);
+  values[(13 * n + 2) * n + 11] = 2.0f; // x = 11, y = 2, z = 13
+
+  density_grid grid(n, n, n, values);
+
+  // 20 voxels need three bricks per axis, the last one partially used.
+  EXPECT_EQ(grid.bricks_x(), 3);
+  EXPECT_FLOAT_EQ(grid.value(11, 2, 13), 2.0f);
+  EXPECT_FLOAT_EQ(grid.value(10, 2, 13), 0.0f);
+  EXPECT_FLOAT_EQ(grid.value(19, 19, 19), 0.0f);
+
+  EXPECT_FLOAT_EQ(grid.majorant(1, 0, 1), 2.0f);
+  EXPECT_FLOAT_EQ(grid.majorant(0, 0, 0), 0.0f);
+
+  // Only the one brick containing the dense voxel stores voxel data.
+  auto brick_voxels = density_grid::brick_size * density_grid::brick_size *
+                      density_grid::brick_size;
+  EXPECT_LT(grid.memory_bytes(), 2 * brick_voxels * sizeof(float));
+}
+
+TEST(HeterogeneousMediumTest, EmptyVolumeIsNeverHit) {
+  heterogeneous_medium medium(aabb(point3(0, 0, 0), point3(1, 1, 1)),
+                              uniform_grid(16, 0.0f), 10.0, color(1, 1, 1));
+
+  ray r(point3(-1, 0.5, 0.5), vec3(1, 0, 0));
+  hit_record rec;
+  for (int i = 0; i < 100; i++)
+    EXPECT_FALSE(medium.hit(r, interval(0, infinity), rec));
+
+  EXPECT_DOUBLE_EQ(medium.transmittance(r, interval(0, infinity)), 1.0);
+}
+
+TEST(HeterogeneousMediumTest, RaysMissingTheBoundsAreNeverHit) {
+  heterogeneous_medium medium(aabb(point3(0, 0, 0), point3(1, 1, 1)),
+                              uniform_grid(8, 1.0f), 100.0, color(1, 1, 1));
+
+  ray r(point3(-1, 2, 0.5), vec3(1, 0, 0));
+  hit_record rec;
+  EXPECT_FALSE(medium.hit(r, interval(0, infinity), rec));
+}
+
+TEST(HeterogeneousMediumTest, DeltaTrackingMatchesBeerLambert) {
+  // Half of a uniform unit cube has density 1.5, the other half is empty. The
+  // probability of scattering along a unit length path through it is
+  // 1 - exp(-1.5 * 0.5).
+  const int n = 16;
+  std::vector<float> values(n * n * n, 0.0f);
+  for (int z = 0; z < n; z++)
+    for (int y = 0; y < n; y++)
+      for (int x = 0; x < n / 2; x++)
+        values[(z * n + y) * n + x] = 1.0f;
+
+  heterogeneous_medium medium(aabb(point3(0, 0, 0), point3(1, 1, 1)),
+                              density_grid(n, n, n, values), 1.5,
+                              color(1, 1, 1));
+
+  // Use a non-unit direction to check that distances are handled correctly.
+  ray r(point3(-1, 0.3, 0.6), vec3(2, 0, 0));
+  hit_record rec;
+
+  const int trials = 20000;
+  int hits = 0;
+  for (int i = 0; i < trials; i++) {
+    if (medium.hit(r, interval(0.001, infinity), rec)) {
+      hits++;
+      EXPECT_LT(rec.p.x(), 0.5 + 1e-9);
+    }
+  }
+
+  auto expected = 1 - std::exp(-1.5 * 0.5);
+  EXPECT_NEAR(double(hits) / trials, expected, 0.015);
+}
+
+TEST(HeterogeneousMediumTest, RatioTrackingMatchesBeerLambert) {
+  heterogeneous_medium medium(aabb(point3(0, 0, 0), point3(2, 1, 1)),
+                              uniform_grid(8, 0.25f), 2.0, color(1, 1, 1));
+
+  ray r(point3(-1, 0.5, 0.5), vec3(1, 0, 0));
+
+  const int trials = 20000;
+  auto total = 0.0;
+  for (int i = 0; i < trials; i++)
+    total += medium.transmittance(r, interval(0, infinity));
+
+  auto expected = std::exp(-0.5 * 2);
+  EXPECT_NEAR(total / trials, expected, 0.01);
+}
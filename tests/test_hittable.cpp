@@ -0,0 +1,156 @@
+#include "raytracing/box.h"
+#include "raytracing/bvh.h"
+#include "raytracing/constant_medium.h"
+#include "raytracing/flat_bvh.h"
+#include "raytracing/hittable.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/material.h"
+#include "raytracing/quad.h"
+#include "raytracing/sphere.h"
+#include <gtest/gtest.h>
+#include <vector>
+
+class counting_sphere : public sphere {
+public:
+  // A sphere that counts how often its hits are finalized.
+  using sphere::sphere;
+
+  void finalize(const ray &r, hit_record &rec) const override {
+    finalized++;
+    sphere::finalize(r, rec);
+  }
+
+  mutable int finalized = 0;
+};
+
+TEST(HittableTest, OnlyTheClosestHitIsFinalized) {
+  // A row of spheres that a ray along the X axis passes through, added far
+  // to near so that every one of them is a closer candidate hit in turn.
+  auto mat = make_shared<lambertian>(color(.5, .5, .5));
+  hittable_list row;
+  std::vector<shared_ptr<counting_sphere>> spheres;
+  for (int i = 9; i >= 0; i--) {
+    spheres.push_back(
+        make_shared<counting_sphere>(point3(3 * i, 0, 0), 1, mat));
+    row.add(spheres.back());
+  }
+  bvh_node tree(row);
+  flat_bvh flat(row.objects);
+
+  ray r(point3(-5, 0.5, 0), vec3(1, 0, 0));
+  const hittable *worlds[] = {&row, &tree, &flat};
+  for (auto world : worlds) {
+    hit_record rec;
+    ASSERT_TRUE(world->intersect(r, interval(0.001, infinity), rec));
+    EXPECT_EQ(rec.object, spheres.back().get());
+    EXPECT_NEAR(rec.t, 5 - std::sqrt(0.75), 1e-12);
+    for (const auto &s : spheres)
+      EXPECT_EQ(s->finalized, 0);
+
+    rec.finalize(r);
+    EXPECT_EQ(rec.object, nullptr);
+    EXPECT_EQ(spheres.back()->finalized, 1);
+    EXPECT_NEAR(rec.p.x(), -std::sqrt(0.75), 1e-12);
+    EXPECT_EQ(rec.mat, mat);
+
+    // hit() gives the same record, finalizing it once more.
+    hit_record full;
+    ASSERT_TRUE(world->hit(r, interval(0.001, infinity), full));
+    EXPECT_EQ(full.object, nullptr);
+    EXPECT_EQ(spheres.back()->finalized, 2);
+    EXPECT_DOUBLE_EQ(full.t, rec.t);
+    EXPECT_DOUBLE_EQ((full.normal - rec.normal).length(), 0);
+    EXPECT_DOUBLE_EQ(full.u, rec.u);
+    EXPECT_DOUBLE_EQ(full.v, rec.v);
+    spheres.back()->finalized = 0;
+  }
+}
+
+TEST(HittableTest, DeferredAndFinishedHitsMix) {
+  // Objects that don't defer leave nothing to finalize, even when they
+  // replace a deferred hit found before them.
+  auto mat = make_shared<lambertian>(color(.5, .5, .5));
+  auto fog = make_shared<constant_medium>(
+      make_shared<sphere>(point3(0, 0, 0), 1, mat), 1e9, color(1, 1, 1));
+  auto wall = make_shared<quad>(point3(4, -2, -2), vec3(0, 4, 0),
+                                vec3(0, 0, 4), mat);
+  hittable_list world;
+  world.add(wall);
+  world.add(fog);
+
+  ray r(point3(-5, 0, 0), vec3(1, 0, 0));
+  hit_record rec;
+  ASSERT_TRUE(world.intersect(r, interval(0.001, infinity), rec));
+  EXPECT_EQ(rec.object, nullptr);
+  EXPECT_LT(rec.t, 5);
+
+  // Texture coordinates are among the attributes left for finalize().
+  ray past_the_fog(point3(-5, 1.5, 0), vec3(1, 0, 0));
+  rec.u = rec.v = -1;
+  ASSERT_TRUE(world.intersect(past_the_fog, interval(0.001, infinity), rec));
+  EXPECT_EQ(rec.object, wall.get());
+  EXPECT_EQ(rec.u, -1);
+  EXPECT_EQ(rec.v, -1);
+  rec.finalize(past_the_fog);
+  EXPECT_DOUBLE_EQ(rec.t, 9);
+  EXPECT_DOUBLE_EQ(rec.normal.x(), -1);
+  EXPECT_DOUBLE_EQ(rec.u, 0.875);
+  EXPECT_DOUBLE_EQ(rec.v, 0.5);
+}
+
+TEST(HittableTest, TransformsDeferTheirObjectsAttributes) {
+  // Hits inside transforms are finalized through them, and come out as the
+  // transforms' own hit() finds them. Transforms nested too deeply finalize
+  // their objects' hits right away instead.
+  auto mat = make_shared<lambertian>(color(.5, .5, .5));
+  auto inner = make_shared<counting_sphere>(point3(0, 1, 0), 1, mat);
+  shared_ptr<hittable> deep = make_shared<sphere>(point3(-2, 1, -2), 1, mat);
+  for (int i = 0; i < 6; i++)
+    deep = make_shared<translate>(make_shared<rotate_y>(deep, 20),
+                                  vec3(0.1, 0, 0.2));
+
+  std::vector<shared_ptr<hittable>> objects{
+      make_shared<translate>(make_shared<rotate_y>(inner, 45),
+                             vec3(1, 0, 0)),
+      deep,
+      make_shared<rotate_y>(box(point3(1, 0, 1), point3(2, 2, 2), mat), 30),
+      make_shared<translate>(
+          make_shared<quad>(point3(-5, 0, -5), vec3(10, 0, 0),
+                            vec3(0, 0, 10), mat),
+          vec3(0, -0.5, 0))};
+  hittable_list world;
+  for (const auto &object : objects)
+    world.add(object);
+
+  for (int i = 0; i < 1000; i++) {
+    point3 origin(random_double(-6, 6), 4, random_double(-6, 6));
+    auto target = point3(random_double(-3, 3), 0, random_double(-3, 3));
+    ray r(origin, target - origin);
+
+    hit_record expected, candidate;
+    bool hit = false;
+    auto ray_t = interval(0.001, infinity);
+    for (const auto &object : objects) {
+      if (object->hit(r, ray_t, candidate)) {
+        hit = true;
+        expected = candidate;
+        ray_t.max = candidate.t;
+      }
+    }
+
+    inner->finalized = 0;
+    hit_record rec;
+    ASSERT_EQ(world.intersect(r, interval(0.001, infinity), rec), hit);
+    if (!hit)
+      continue;
+    EXPECT_EQ(inner->finalized, 0);
+    rec.finalize(r);
+    EXPECT_LE(inner->finalized, 1);
+    EXPECT_DOUBLE_EQ(rec.t, expected.t);
+    EXPECT_NEAR((rec.p - expected.p).length(), 0, 1e-12);
+    EXPECT_NEAR((rec.normal - expected.normal).length(), 0, 1e-12);
+    EXPECT_NEAR(rec.u, expected.u, 1e-12);
+    EXPECT_NEAR(rec.v, expected.v, 1e-12);
+    EXPECT_EQ(rec.mat, expected.mat);
+  }
+}
@@ -0,0 +1,297 @@
+#include "raytracing/image_writer.h"
+#include <cstdint>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const int test_width = 37, test_height = 23;
+
+static std::vector<color> test_pixels() {
+  // Smooth gradients, a flat band and some noise, so that every kind of code
+  // of the encoders is used.
+  std::vector<color> pixels;
+  std::uint32_t state = 12345;
+  for (int j = 0; j < test_height; j++) {
+    for (int i = 0; i < test_width; i++) {
+      state = state * 1664525u + 1013904223u;
+      auto noise = (state >> 24) / 255.0;
+      if (j >= 8 && j < 12)
+        pixels.push_back(color(0.2, 0.4, 0.6));
+      else if (j >= 16)
+        pixels.push_back(color(noise, noise * noise, 1 - noise));
+      else
+        pixels.push_back(color(double(i) / test_width,
+                               double(j) / test_height, 0.5));
+    }
+  }
+  return pixels;
+}
+
+static std::vector<unsigned char> test_bytes() {
+  std::vector<unsigned char> rgb;
+  for (const auto &pixel : test_pixels()) {
+    unsigned char bytes[3];
+    color_to_bytes(pixel, bytes);
+    rgb.insert(rgb.end(), bytes, bytes + 3);
+  }
+  return rgb;
+}
+
+static std::string encode(image_format format) {
+  std::ostringstream out;
+  EXPECT_TRUE(
+      write_image(out, format, test_width, test_height, test_pixels()));
+  return out.str();
+}
+
+static std::uint32_t read_u32(const std::string &data, std::size_t at) {
+  std::uint32_t value = 0;
+  for (int i = 0; i < 4; i++)
+    value = value << 8 | (unsigned char)data[at + i];
+  return value;
+}
+
+class bit_reader {
+public:
+  // Reads a deflate stream's bits, from the least significant bit of each
+  // byte.
+  bit_reader(const std::string &data, std::size_t at) : data(data), at(at) {}
+
+  int bits(int count) {
+    int value = 0;
+    for (int b = 0; b < count; b++, bit++) {
+      value |= (((unsigned char)data.at(at + bit / 8) >> (bit % 8)) & 1) << b;
+    }
+    return value;
+  }
+
+  int code(int length) {
+    // Huffman codes start from their most significant bit.
+    int value = 0;
+    for (int b = 0; b < length; b++)
+      value = value << 1 | bits(1);
+    return value;
+  }
+
+  std::size_t byte_position() { return at + (bit + 7) / 8; }
+
+private:
+  const std::string &data;
+  std::size_t at;
+  std::size_t bit = 0;
+};
+
+static std::vector<unsigned char> inflate_fixed(const std::string &zlib) {
+  // Decodes a zlib stream of blocks with fixed Huffman codes, the only kind
+  // the encoder writes, and checks its Adler-32 checksum.
+  static const int base_lengths[29] = {3,  4,  5,  6,   7,   8,   9,   10,
+                                       11, 13, 15, 17,  19,  23,  27,  31,
+                                       35, 43, 51, 59,  67,  83,  99,  115,
+                                       131, 163, 195, 227, 258};
+  static const int base_distances[30] = {
+      1,    2,    3,    4,    5,    7,    9,    13,    17,    25,
+      33,   49,   65,   97,   129,  193,  257,  385,   513,   769,
+      1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+
+  EXPECT_EQ((unsigned char)zlib[0], 0x78);
+  std::vector<unsigned char> out;
+  bit_reader in(zlib, 2);
+  bool final = false;
+  while (!final) {
+    final = in.bits(1);
+    EXPECT_EQ(in.bits(2), 1);
+    while (true) {
+      // Seven bit codes are 256 and up, then eight, then nine bits.
+      int symbol = in.code(7);
+      if (symbol <= 0x17) {
+        symbol += 256;
+      } else {
+        symbol = symbol << 1 | in.bits(1);
+        if (symbol >= 0x30 && symbol <= 0xbf)
+          symbol -= 0x30;
+        else if (symbol >= 0xc0 && symbol <= 0xc7)
+          symbol = symbol - 0xc0 + 280;
+        else
+          symbol = (symbol << 1 | in.bits(1)) - 0x190 + 144;
+      }
+
+      if (symbol < 256) {
+        out.push_back((unsigned char)symbol);
+        continue;
+      }
+      if (symbol == 256)
+        break;
+
+      int code = symbol - 257;
+      int extra = code < 8 || code == 28 ? 0 : code / 4 - 1;
+      int length = base_lengths[code] + in.bits(extra);
+      int distance_code = in.code(5);
+      int distance_extra = distance_code < 4 ? 0 : distance_code / 2 - 1;
+      auto distance =
+          std::size_t(base_distances[distance_code] + in.bits(distance_extra));
+      EXPECT_LE(distance, out.size());
+      for (int k = 0; k < length; k++)
+        out.push_back(out[out.size() - distance]);
+    }
+  }
+
+  auto adler = deflate_stream::adler32(1, out.data(), out.size());
+  EXPECT_EQ(read_u32(zlib, in.byte_position()), adler);
+  return out;
+}
+
+static std::vector<unsigned char> decode_png(const std::string &png) {
+  EXPECT_EQ(png.substr(0, 8), "\x89PNG\r\n\x1a\n");
+
+  // Collect the chunks, checking their CRCs.
+  std::string header, compressed, last_type;
+  for (std::size_t at = 8; at < png.size();) {
+    auto length = read_u32(png, at);
+    auto type = png.substr(at + 4, 4);
+    auto data = png.substr(at + 8, length);
+    auto crc = png_encoder::crc32(
+        0, reinterpret_cast<const unsigned char *>(&png[at + 4]), length + 4);
+    EXPECT_EQ(read_u32(png, at + 8 + length), crc) << type;
+    if (type == "IHDR")
+      header = data;
+    else if (type == "IDAT")
+      compressed += data;
+    last_type = type;
+    at += 12 + length;
+  }
+  EXPECT_EQ(last_type, "IEND");
+  EXPECT_EQ(header.size(), 13u);
+  EXPECT_EQ(read_u32(header, 0), std::uint32_t(test_width));
+  EXPECT_EQ(read_u32(header, 4), std::uint32_t(test_height));
+  EXPECT_EQ(header[8], 8);
+  EXPECT_EQ(header[9], 2);
+
+  // Undo the filters, each row against the one decoded before it.
+  auto filtered = inflate_fixed(compressed);
+  auto row_size = std::size_t(test_width) * 3;
+  std::vector<unsigned char> rgb, above(row_size, 0);
+  if (filtered.size() != (row_size + 1) * test_height)
+    return rgb;
+  for (int j = 0; j < test_height; j++) {
+    auto row = &filtered[j * (row_size + 1)];
+    int type = row[0];
+    EXPECT_LE(type, 4);
+    std::vector<unsigned char> line(row_size);
+    for (std::size_t i = 0; i < row_size; i++) {
+      int a = i >= 3 ? line[i - 3] : 0, b = above[i];
+      int c = i >= 3 ? above[i - 3] : 0;
+      int p = a + b - c;
+      int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+      int paeth = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+      int predicted = type == 0   ? 0
+                      : type == 1 ? a
+                      : type == 2 ? b
+                      : type == 3 ? (a + b) / 2
+                                  : paeth;
+      line[i] = (unsigned char)(row[1 + i] + predicted);
+    }
+    rgb.insert(rgb.end(), line.begin(), line.end());
+    above = line;
+  }
+  return rgb;
+}
+
+static std::vector<unsigned char> decode_qoi(const std::string &qoi) {
+  EXPECT_EQ(qoi.substr(0, 4), "qoif");
+  EXPECT_EQ(read_u32(qoi, 4), std::uint32_t(test_width));
+  EXPECT_EQ(read_u32(qoi, 8), std::uint32_t(test_height));
+  EXPECT_EQ(qoi.substr(qoi.size() - 8), std::string(7, '\0') + '\1');
+
+  // The decoder of the QOI specification, for opaque pixels.
+  std::vector<unsigned char> rgb;
+  unsigned char index[64][4] = {};
+  unsigned char px[4] = {0, 0, 0, 255};
+  std::size_t pixel_count = std::size_t(test_width) * test_height;
+  for (std::size_t at = 14; rgb.size() < pixel_count * 3;) {
+    int op = (unsigned char)qoi.at(at++);
+    int run = 1;
+    if (op == 0xfe) {
+      for (int c = 0; c < 3; c++)
+        px[c] = (unsigned char)qoi.at(at++);
+    } else if ((op & 0xc0) == 0x00) {
+      for (int c = 0; c < 4; c++)
+        px[c] = index[op][c];
+    } else if ((op & 0xc0) == 0x40) {
+      px[0] += ((op >> 4) & 3) - 2;
+      px[1] += ((op >> 2) & 3) - 2;
+      px[2] += (op & 3) - 2;
+    } else if ((op & 0xc0) == 0x80) {
+      int dg = (op & 0x3f) - 32, next = (unsigned char)qoi.at(at++);
+      px[0] += dg + ((next >> 4) & 15) - 8;
+      px[1] += dg;
+      px[2] += dg + (next & 15) - 8;
+    } else {
+      run = (op & 0x3f) + 1;
+    }
+    auto slot = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+    for (int c = 0; c < 4; c++)
+      index[slot][c] = px[c];
+    for (int k = 0; k < run; k++)
+      rgb.insert(rgb.end(), px, px + 3);
+  }
+  return rgb;
+}
+
+TEST(ImageWriterTest, AsciiPpmMatchesWriteColor) {
+  std::ostringstream expected;
+  expected << "P3\n" << test_width << ' ' << test_height << "\n255\n";
+  for (const auto &pixel : test_pixels())
+    write_color(expected, pixel);
+  EXPECT_EQ(encode(image_format::ascii_ppm), expected.str());
+}
+
+TEST(ImageWriterTest, BinaryPpmHoldsTheBytes) {
+  auto rgb = test_bytes();
+  auto header = "P6\n37 23\n255\n";
+  EXPECT_EQ(encode(image_format::ppm),
+            header + std::string(rgb.begin(), rgb.end()));
+}
+
+TEST(ImageWriterTest, PngDecodesToThePixels) {
+  auto png = encode(image_format::png);
+  auto rgb = decode_png(png);
+  EXPECT_EQ(rgb, test_bytes());
+
+  // The flat band and gradients compress well below the raw size.
+  EXPECT_LT(png.size(), rgb.size() * 3 / 4);
+}
+
+TEST(ImageWriterTest, QoiDecodesToThePixels) {
+  EXPECT_EQ(decode_qoi(encode(image_format::qoi)), test_bytes());
+}
+
+TEST(ImageWriterTest, RowsCanArriveInAnyOrder) {
+  // Bands added bottom first are still written from the top, as soon as the
+  // rows above them are there.
+  auto pixels = test_pixels();
+  for (int f = 0; f < image_format_count; f++) {
+    std::ostringstream out;
+    image_writer writer(out, image_format(f));
+    writer.start(test_width, test_height);
+    for (int y0 : {20, 10, 5, 0, 15}) {
+      auto y1 = std::min(y0 + 5, test_height);
+      writer.add_rows(&pixels[std::size_t(y0) * test_width], y0, y1);
+    }
+    EXPECT_TRUE(writer.finish());
+
+    // PNG gets an IDAT chunk for each band, the others the same bytes.
+    if (image_format(f) == image_format::png)
+      EXPECT_EQ(decode_png(out.str()), test_bytes());
+    else
+      EXPECT_EQ(out.str(), encode(image_format(f))) << image_format_names[f];
+  }
+}
+
+TEST(ImageWriterTest, FormatFollowsTheFileName) {
+  EXPECT_EQ(image_format_for_file("out.png"), image_format::png);
+  EXPECT_EQ(image_format_for_file("dir.v2/out.qoi"), image_format::qoi);
+  EXPECT_EQ(image_format_for_file("out.ppm"), image_format::ascii_ppm);
+  EXPECT_EQ(image_format_for_file(""), image_format::ascii_ppm);
+}
@@ -0,0 +1,63 @@
+#include "raytracing/numa.h"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+TEST(NumaTest, ParsesCpuLists) {
+  std::vector<int> cpus;
+  ASSERT_TRUE(parse_cpu_list("0-3,8,10-11\n", cpus));
+  EXPECT_EQ(cpus, (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+
+  cpus.clear();
+  EXPECT_TRUE(parse_cpu_list("", cpus));
+  EXPECT_TRUE(cpus.empty());
+  EXPECT_FALSE(parse_cpu_list("3-1", cpus));
+  EXPECT_FALSE(parse_cpu_list("1,,2", cpus));
+  EXPECT_FALSE(parse_cpu_list("0-", cpus));
+  EXPECT_FALSE(parse_cpu_list("one", cpus));
+
+  // CPUs that can't be pinned to are rejected, however large the range.
+  cpus.clear();
+  EXPECT_FALSE(parse_cpu_list("0-2000000000", cpus));
+  EXPECT_FALSE(parse_cpu_list(std::to_string(cpu_limit), cpus));
+  EXPECT_FALSE(parse_cpu_list("99999999999999999999", cpus));
+  EXPECT_TRUE(cpus.empty());
+  EXPECT_TRUE(parse_cpu_list(std::to_string(cpu_limit - 1), cpus));
+  EXPECT_EQ(cpus, (std::vector<int>{cpu_limit - 1}));
+}
+
+TEST(NumaTest, ParsesLayouts) {
+  numa_topology topology;
+  EXPECT_EQ(topology.node_count(), 1);
+  EXPECT_TRUE(topology.cpus(0).empty());
+
+  ASSERT_TRUE(numa_topology::parse("0-3;4-5", topology));
+  EXPECT_EQ(topology.node_count(), 2);
+  EXPECT_EQ(topology.cpus(1), (std::vector<int>{4, 5}));
+
+  // A node needs at least one CPU, and a bad layout changes nothing.
+  EXPECT_FALSE(numa_topology::parse("0;", topology));
+  EXPECT_FALSE(numa_topology::parse("0;x", topology));
+  EXPECT_EQ(topology.node_count(), 2);
+
+  // Whatever the machine, there is a node with a CPU to run on.
+  auto detected = numa_topology::detect();
+  EXPECT_GE(detected.node_count(), 1);
+}
+
+TEST(NumaTest, ThreadsAreSharedOutByCpus) {
+  // Nodes get threads in proportion to their CPUs, and the first threads go
+  // to different nodes.
+  numa_topology topology;
+  ASSERT_TRUE(numa_topology::parse("0-3;4-5", topology));
+  auto nodes = topology.worker_nodes(6);
+  EXPECT_EQ(std::count(nodes.begin(), nodes.end(), 0), 4);
+  EXPECT_EQ(std::count(nodes.begin(), nodes.end(), 1), 2);
+  EXPECT_NE(nodes[0], nodes[1]);
+
+  // More threads than CPUs go round again.
+  nodes = topology.worker_nodes(12);
+  EXPECT_EQ(std::count(nodes.begin(), nodes.end(), 1), 4);
+  EXPECT_EQ(numa_topology().worker_nodes(3), (std::vector<int>{0, 0, 0}));
+}
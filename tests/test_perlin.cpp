@@ -0,0 +1,102 @@
+#include "raytracing/perlin.h"
+#include "raytracing/rtweekend.h"
+#include "raytracing/vec3.h"
+#include <gtest/gtest.h>
+#include <vector>
+
+// The batched kernel works in single precision, so results are compared against
+// the double-precision scalar implementation with a small tolerance.
+static const double tolerance = 1e-5;
+
+static std::vector<point3> random_points(int n, double min, double max) {
+  std::vector<point3> points;
+  for (int i = 0; i < n; i++)
+    points.push_back(vec3::random(min, max));
+  return points;
+}
+
+TEST(PerlinTest, BatchNoiseMatchesScalar) {
+  perlin noise;
+  auto points = random_points(64, -50, 50);
+
+  std::vector<double> x, y, z;
+  for (const auto &p : points) {
+    x.push_back(p.x());
+    y.push_back(p.y());
+    z.push_back(p.z());
+  }
+
+  std::vector<double> out(points.size());
+  noise.noise(int(points.size()), x.data(), y.data(), z.data(), out.data());
+
+  for (size_t i = 0; i < points.size(); i++)
+    EXPECT_NEAR(out[i], noise.noise(points[i]), tolerance) << "point " << i;
+}
+
+TEST(PerlinTest, BatchNoiseHandlesPartialBatches) {
+  perlin noise;
+  const int n = perlin::batch_width + 5;
+  auto points = random_points(n, -4, 4);
+
+  double x[n], y[n], z[n], out[n + 1];
+  for (int i = 0; i < n; i++) {
+    x[i] = points[i].x();
+    y[i] = points[i].y();
+    z[i] = points[i].z();
+  }
+
+  // The sentinel past the end must not be written.
+  out[n] = 42.0;
+  noise.noise(n, x, y, z, out);
+
+  for (int i = 0; i < n; i++)
+    EXPECT_NEAR(out[i], noise.noise(points[i]), tolerance);
+  EXPECT_DOUBLE_EQ(out[n], 42.0);
+}
+
+TEST(PerlinTest, BatchNoiseOnLatticePointsIsZero) {
+  perlin noise;
+  double x[] = {0, 1, -3, 17};
+  double y[] = {0, 2, 5, -9};
+  double z[] = {0, -1, 8, 256};
+  double out[4];
+
+  noise.noise(4, x, y, z, out);
+
+  for (int i = 0; i < 4; i++)
+    EXPECT_NEAR(out[i], 0.0, tolerance);
+}
+
+TEST(PerlinTest, BatchTurbMatchesScalar) {
+  perlin noise;
+  auto points = random_points(20, -10, 10);
+
+  std::vector<double> x, y, z;
+  for (const auto &p : points) {
+    x.push_back(p.x());
+    y.push_back(p.y());
+    z.push_back(p.z());
+  }
+
+  std::vector<double> out(points.size());
+  noise.turb(int(points.size()), x.data(), y.data(), z.data(), 7, out.data());
+
+  for (size_t i = 0; i < points.size(); i++)
+    EXPECT_NEAR(out[i], noise.turb(points[i], 7), tolerance);
+}
+
+TEST(PerlinTest, FastTurbMatchesScalar) {
+  perlin noise;
+
+  // Include points far from the origin, like those on the ground sphere of the
+  // perlin_spheres scene.
+  auto points = random_points(50, -5, 5);
+  auto far_points = random_points(50, -2000, 2000);
+  points.insert(points.end(), far_points.begin(), far_points.end());
+
+  for (const auto &p : points) {
+    EXPECT_NEAR(noise.fast_turb(p, 7), noise.turb(p, 7), tolerance);
+    EXPECT_NEAR(noise.fast_turb(p, 1), noise.turb(p, 1), tolerance);
+    EXPECT_NEAR(noise.fast_turb(p, 11), noise.turb(p, 11), tolerance);
+  }
+}
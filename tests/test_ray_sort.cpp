@@ -0,0 +1,76 @@
+#include "raytracing/camera.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/material.h"
+#include "raytracing/ray_sort.h"
+#include "raytracing/sphere.h"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <vector>
+
+TEST(RaySortTest, MortonCodeInterleavesBits) {
+  EXPECT_EQ(morton_code(0, 0, 0), 0u);
+  EXPECT_EQ(morton_code(1, 0, 0), 4u);
+  EXPECT_EQ(morton_code(0, 1, 0), 2u);
+  EXPECT_EQ(morton_code(0, 0, 1), 1u);
+  EXPECT_EQ(morton_code(2, 0, 0), 32u);
+  EXPECT_EQ(morton_code(1023, 1023, 1023), (1u << 30) - 1);
+}
+
+TEST(RaySortTest, KeysGroupOctantsThenPlaces) {
+  aabb bounds(point3(0, 0, 0), point3(10, 10, 10));
+  auto near = ray_sort_key(ray(point3(1, 1, 1), vec3(1, 1, 1)), bounds);
+  auto nearer = ray_sort_key(ray(point3(1.01, 1, 1), vec3(1, 2, 3)), bounds);
+  auto far = ray_sort_key(ray(point3(9, 9, 9), vec3(1, 1, 1)), bounds);
+  auto back = ray_sort_key(ray(point3(1, 1, 1), vec3(-1, 1, 1)), bounds);
+  EXPECT_EQ(near, nearer);
+  EXPECT_LT(near, far);
+  EXPECT_LT(far, back);
+
+  // Origins outside the bounds count as on their faces, and unbounded axes
+  // are left out.
+  EXPECT_EQ(ray_sort_key(ray(point3(-5, 20, 0), vec3(1, 1, 1)), bounds),
+            ray_sort_key(ray(point3(0, 10, 0), vec3(1, 1, 1)), bounds));
+  aabb unbounded(interval(-infinity, infinity), interval(0, 1), interval(0, 1));
+  EXPECT_EQ(ray_sort_key(ray(point3(5, 0, 0), vec3(1, 1, 1)), unbounded),
+            ray_sort_key(ray(point3(-5, 0, 0), vec3(1, 1, 1)), unbounded));
+}
+
+TEST(RaySortTest, OrderIsAStableSort) {
+  aabb bounds(point3(0, 0, 0), point3(1, 1, 1));
+  std::vector<ray> rays = {
+      ray(point3(0.9, 0.9, 0.9), vec3(1, 1, 1)),
+      ray(point3(0.1, 0.1, 0.1), vec3(-1, 1, 1)),
+      ray(point3(0.1, 0.1, 0.1), vec3(1, 1, 1)),
+      ray(point3(0.9, 0.9, 0.9), vec3(1, 1, 1)),
+  };
+  std::vector<std::uint32_t> order;
+  sort_ray_order(rays, bounds, order);
+  EXPECT_EQ(order, (std::vector<std::uint32_t>{2, 0, 3, 1}));
+}
+
+TEST(RaySortTest, SortedTracingMatchesPixelOrder) {
+  // With a sampler, each path draws the same numbers in either order, so the
+  // images are the same but for rounding.
+  hittable_list world;
+  world.add(make_shared<sphere>(point3(0, 0, -1), 0.5,
+                                make_shared<lambertian>(color(.5, .5, .5))));
+  world.add(make_shared<sphere>(point3(0.6, 0.2, -0.8), 0.2,
+                                make_shared<diffuse_light>(color(4, 4, 4))));
+  world.add(make_shared<sphere>(point3(0, -100.5, -1), 100,
+                                make_shared<lambertian>(color(.8, .8, .8))));
+
+  camera cam;
+  cam.image_width = 16;
+  cam.max_depth = 5;
+  cam.background = color(0.5, 0.7, 1.0);
+  cam.sampling = sampler_type::sobol;
+  cam.prepare();
+
+  image_tile tile = {0, 0, 16, 16};
+  std::vector<float> in_pixel_order(16 * 16 * 3), sorted(16 * 16 * 3);
+  cam.render_samples(world, tile, 8, in_pixel_order.data(), 8);
+  cam.sort_rays = true;
+  cam.render_samples(world, tile, 8, sorted.data(), 8);
+  for (std::size_t v = 0; v < sorted.size(); v++)
+    ASSERT_NEAR(sorted[v], in_pixel_order[v], 1e-4) << v;
+}
@@ -0,0 +1,102 @@
+#include "raytracing/render_server.h"
+#include "raytracing/socket.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+static const char *scene = "camera image_width 40\n"
+                           "camera samples_per_pixel 2\n"
+                           "camera background 1 1 1\n"
+                           "material white lambertian 1 1 1\n"
+                           "sphere 0 0 -1 0.5 white\n";
+
+TEST(RenderServerTest, RendersRequestsAndKeepsScenesBuilt) {
+  auto address = "/tmp/raytracing_test_" + std::to_string(getpid()) + "_server";
+  auto listener = socket_handle::listen(address);
+  ASSERT_TRUE(listener.is_open());
+
+  render_server server(2);
+  std::thread serving([&] { EXPECT_TRUE(server.serve(listener)); });
+
+  server_render_result first;
+  ASSERT_TRUE(
+      request_server_render(address, "white", scene, "", first, false));
+  EXPECT_FALSE(first.was_cached);
+  EXPECT_EQ(first.width, 40);
+  EXPECT_EQ(first.height, 40);
+  ASSERT_EQ(first.pixels.size(), 40u * 40u);
+  for (const auto &pixel : first.pixels)
+    ASSERT_NEAR(pixel.y(), 1.0, 1e-5);
+
+  // Camera settings apply on top of the cached scene's.
+  server_render_result second;
+  ASSERT_TRUE(request_server_render(address, "white", scene,
+                                    "camera image_width 24\n"
+                                    "camera aspect_ratio 2\n",
+                                    second, false));
+  EXPECT_TRUE(second.was_cached);
+  EXPECT_EQ(second.width, 24);
+  EXPECT_EQ(second.height, 12);
+
+  // A crop window makes the image just that part of the frame.
+  server_render_result cropped;
+  ASSERT_TRUE(request_server_render(address, "white", scene,
+                                    "camera crop 0.5 0 1 0.25\n", cropped,
+                                    false));
+  EXPECT_EQ(cropped.width, 20);
+  EXPECT_EQ(cropped.height, 10);
+  ASSERT_EQ(cropped.pixels.size(), 20u * 10u);
+  for (const auto &pixel : cropped.pixels)
+    ASSERT_NEAR(pixel.y(), 1.0, 1e-5);
+
+  // Bad requests are answered with an error, and the server carries on.
+  server_render_result failed;
+  testing::internal::CaptureStderr();
+  EXPECT_FALSE(request_server_render(address, "white", scene,
+                                     "sphere 0 0 0 1 white\n", failed, false));
+  EXPECT_FALSE(request_server_render(address, "broken", "teapot\n", "", failed,
+                                     false));
+  testing::internal::GetCapturedStderr();
+
+  EXPECT_TRUE(request_server_stop(address));
+  serving.join();
+  unlink(address.c_str());
+}
+
+TEST(RenderServerTest, IdleClientsDoNotHoldUpOthers) {
+  auto address = "/tmp/raytracing_test_" + std::to_string(getpid()) + "_idle";
+  auto listener = socket_handle::listen(address);
+  ASSERT_TRUE(listener.is_open());
+
+  render_server server(1);
+  server.idle_timeout = 0.2;
+  std::thread serving([&] { EXPECT_TRUE(server.serve(listener)); });
+
+  // A client that connects and never sends a request, one that starts a
+  // request and stops partway through it, and one that asks for an image too
+  // large to fit in the socket's buffers and never reads it.
+  auto idle = socket_handle::connect(address);
+  ASSERT_TRUE(idle.is_open());
+  auto stalled = socket_handle::connect(address);
+  ASSERT_TRUE(stalled.is_open());
+  std::uint32_t type = std::uint32_t(server_message::render);
+  ASSERT_TRUE(stalled.send_all(&type, sizeof(type)));
+  auto deaf = socket_handle::connect(address);
+  ASSERT_TRUE(deaf.is_open());
+  message_payload request;
+  request.put_string("white");
+  request.put_string(scene);
+  request.put_string("camera image_width 800\n"
+                     "camera samples_per_pixel 1\n");
+  ASSERT_TRUE(send_message(deaf, type, request));
+
+  server_render_result result;
+  EXPECT_TRUE(
+      request_server_render(address, "white", scene, "", result, false));
+  EXPECT_EQ(result.width, 40);
+
+  EXPECT_TRUE(request_server_stop(address));
+  serving.join();
+  unlink(address.c_str());
+}
@@ -0,0 +1,57 @@
+#include "raytracing/render_stats.h"
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+
+TEST(RenderStatsTest, HistogramBinsArePowersOfTwo) {
+  EXPECT_EQ(trace_counters::bin(0), 0);
+  EXPECT_EQ(trace_counters::bin(1), 1);
+  EXPECT_EQ(trace_counters::bin(2), 2);
+  EXPECT_EQ(trace_counters::bin(3), 2);
+  EXPECT_EQ(trace_counters::bin(4), 3);
+  EXPECT_EQ(trace_counters::bin(~std::uint64_t(0)),
+            trace_counters::histogram_bins - 1);
+}
+
+TEST(RenderStatsTest, EndingARayAddsItsCounts) {
+  trace_counters counters;
+  counters.begin_ray();
+  counters.ray_node_visits = 5;
+  counters.ray_primitive_tests = 2;
+  counters.end_ray(0);
+
+  counters.begin_ray();
+  counters.end_ray(trace_counters::depth_bins + 10);
+
+  EXPECT_EQ(counters.rays(), 2u);
+  EXPECT_EQ(counters.rays_by_depth[0], 1u);
+  EXPECT_EQ(counters.rays_by_depth[trace_counters::depth_bins - 1], 1u);
+  EXPECT_EQ(counters.node_visits, 5u);
+  EXPECT_EQ(counters.primitive_tests, 2u);
+  EXPECT_EQ(counters.node_visits_per_ray[0], 1u);
+  EXPECT_EQ(counters.node_visits_per_ray[3], 1u);
+  EXPECT_EQ(counters.primitive_tests_per_ray[2], 1u);
+
+  trace_counters totals;
+  totals.merge(counters);
+  totals.merge(counters);
+  EXPECT_EQ(totals.rays(), 4u);
+  EXPECT_EQ(totals.node_visits, 10u);
+  EXPECT_EQ(totals.node_visits_per_ray[3], 2u);
+}
+
+TEST(RenderStatsTest, ReportsJson) {
+  render_stats stats;
+  stats.render_seconds = 2;
+  stats.counters.begin_ray();
+  stats.counters.end_ray(1);
+
+  std::ostringstream out;
+  stats.report_json(out);
+  auto json = out.str();
+
+  EXPECT_EQ(json.front(), '{');
+  EXPECT_NE(json.find("\"render\": 2"), std::string::npos);
+  EXPECT_EQ(json.find("\"rays_by_depth\": [0, 1]") != std::string::npos,
+            trace_stats_enabled);
+}
@@ -0,0 +1,139 @@
+#include "raytracing/color.h"
+#include "raytracing/rtw_stb_image.h"
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+// One 8-bit step, the precision of the stored pixel data.
+static const double byte_step = 1.0 / 255.0;
+
+static std::vector<float> gradient_image(int width, int height) {
+  // Red increases to the right, green increases downwards, blue is constant.
+  std::vector<float> pixels;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      pixels.push_back(float(x) / width);
+      pixels.push_back(float(y) / height);
+      pixels.push_back(0.5f);
+    }
+  }
+  return pixels;
+}
+
+TEST(RtwImageTest, EmptyImageHasNoSize) {
+  rtw_image image;
+  EXPECT_EQ(image.width(), 0);
+  EXPECT_EQ(image.height(), 0);
+  EXPECT_EQ(image.mip_levels(), 0);
+
+  // Missing data is shown as magenta.
+  auto c = image.texel(0, 0);
+  EXPECT_DOUBLE_EQ(c.x(), 1.0);
+  EXPECT_DOUBLE_EQ(c.y(), 0.0);
+  EXPECT_DOUBLE_EQ(c.z(), 1.0);
+}
+
+TEST(RtwImageTest, TexelsRoundTripThroughTiledStorage) {
+  const int width = 21, height = 13; // Not a multiple of the tile size
+  auto pixels = gradient_image(width, height);
+  rtw_image image(width, height, pixels.data());
+
+  ASSERT_EQ(image.width(), width);
+  ASSERT_EQ(image.height(), height);
+  EXPECT_EQ(image.channels(), 3);
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      auto c = image.texel(x, y);
+      EXPECT_NEAR(c.x(), float(x) / width, byte_step);
+      EXPECT_NEAR(c.y(), float(y) / height, byte_step);
+      EXPECT_NEAR(c.z(), 0.5, byte_step);
+    }
+  }
+}
+
+TEST(RtwImageTest, TexelCoordinatesAreClamped) {
+  auto pixels = gradient_image(4, 4);
+  rtw_image image(4, 4, pixels.data());
+
+  auto inside = image.texel(3, 0);
+  auto outside = image.texel(100, -5);
+  EXPECT_DOUBLE_EQ(inside.x(), outside.x());
+  EXPECT_DOUBLE_EQ(inside.y(), outside.y());
+}
+
+TEST(RtwImageTest, MipChainGoesDownToOnePixel) {
+  auto pixels = gradient_image(20, 12);
+  rtw_image image(20, 12, pixels.data());
+
+  // 20x12, 10x6, 5x3, 2x1, 1x1
+  ASSERT_EQ(image.mip_levels(), 5);
+  EXPECT_EQ(image.width(1), 10);
+  EXPECT_EQ(image.height(1), 6);
+  EXPECT_EQ(image.width(3), 2);
+  EXPECT_EQ(image.height(3), 1);
+  EXPECT_EQ(image.width(4), 1);
+  EXPECT_EQ(image.height(4), 1);
+  EXPECT_EQ(image.width(5), 0);
+}
+
+TEST(RtwImageTest, MipLevelsAverageTheLevelAbove) {
+  // A 2x2 checkerboard of black and white averages to mid gray.
+  float pixels[] = {0, 0, 0, 1, 1, 1, 1, 1, 1, 0, 0, 0};
+  rtw_image image(2, 2, pixels);
+
+  ASSERT_EQ(image.mip_levels(), 2);
+  auto c = image.texel(0, 0, 1);
+  EXPECT_NEAR(c.x(), 0.5, byte_step);
+  EXPECT_NEAR(c.y(), 0.5, byte_step);
+  EXPECT_NEAR(c.z(), 0.5, byte_step);
+}
+
+TEST(RtwImageTest, BilinearBlendsNeighboringTexels) {
+  float pixels[] = {0, 0, 0, 1, 1, 1};
+  rtw_image image(2, 1, pixels);
+
+  // Pixel centers reproduce the texels exactly.
+  EXPECT_NEAR(image.bilinear(0.5, 0.5).x(), 0.0, byte_step);
+  EXPECT_NEAR(image.bilinear(1.5, 0.5).x(), 1.0, byte_step);
+
+  // Halfway between the two centers is the average.
+  EXPECT_NEAR(image.bilinear(1.0, 0.5).x(), 0.5, byte_step);
+}
+
+TEST(RtwImageTest, StorageIsSmallerThanFloatData) {
+  const int width = 64, height = 64;
+  auto pixels = gradient_image(width, height);
+  rtw_image image(width, height, pixels.data());
+
+  // 8-bit RGB for the base level plus roughly a third for the mip chain.
+  auto float_bytes = pixels.size() * sizeof(float);
+  EXPECT_LT(image.memory_bytes(), float_bytes / 2);
+  EXPECT_GE(image.memory_bytes(), std::size_t(width) * height * 3);
+}
+
+TEST(RtwImageTest, GrayscaleFilesUseOneChannel) {
+  // Write a tiny binary PGM file, which stb_image decodes with one component.
+  auto filename = testing::TempDir() + "rtw_image_gray.pgm";
+  {
+    std::ofstream out(filename, std::ios::binary);
+    out << "P5\n2 1\n255\n";
+    out.put(char(0));
+    out.put(char(255));
+  }
+
+  rtw_image image;
+  ASSERT_TRUE(image.load(filename));
+  std::remove(filename.c_str());
+
+  EXPECT_EQ(image.channels(), 1);
+  EXPECT_EQ(image.width(), 2);
+  EXPECT_EQ(image.height(), 1);
+
+  auto white = image.texel(1, 0);
+  EXPECT_NEAR(white.x(), 1.0, byte_step);
+  EXPECT_DOUBLE_EQ(white.x(), white.y());
+  EXPECT_DOUBLE_EQ(white.x(), white.z());
+}
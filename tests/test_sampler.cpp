@@ -0,0 +1,134 @@
+#include "raytracing/camera.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/material.h"
+#include "raytracing/sampler.h"
+#include "raytracing/sphere.h"
+#include <cmath>
+#include <gtest/gtest.h>
+#include <vector>
+
+TEST(SamplerTest, SobolSamplesAreStratified) {
+  // Any power of two run of samples has one sample in each interval of that
+  // many in every dimension, and one in each cell of a square grid of them
+  // in a pair of dimensions.
+  sobol_sampler source;
+  for (std::uint32_t dimension : {0u, 6u}) {
+    std::vector<int> xs(16), ys(16), cells(16);
+    for (std::uint32_t index = 16; index < 32; index++) {
+      auto x = source.value(3, 5, index, dimension);
+      auto y = source.value(3, 5, index, dimension + 1);
+      xs[int(x * 16)]++;
+      ys[int(y * 16)]++;
+      cells[int(y * 4) * 4 + int(x * 4)]++;
+    }
+    for (int i = 0; i < 16; i++) {
+      EXPECT_EQ(xs[i], 1);
+      EXPECT_EQ(ys[i], 1);
+      EXPECT_EQ(cells[i], 1);
+    }
+  }
+
+  // Pixels and pairs of dimensions are scrambled differently.
+  EXPECT_NE(source.value(0, 0, 0, 0), source.value(1, 0, 0, 0));
+  EXPECT_NE(source.value(0, 0, 0, 0), source.value(0, 0, 0, 2));
+}
+
+TEST(SamplerTest, HaltonSamplesAreRotatedRadicalInverses) {
+  EXPECT_DOUBLE_EQ(halton_sampler::radical_inverse(2, 1), 0.5);
+  EXPECT_DOUBLE_EQ(halton_sampler::radical_inverse(2, 6), 0.375);
+  EXPECT_DOUBLE_EQ(halton_sampler::radical_inverse(3, 5), 7.0 / 9);
+
+  halton_sampler source;
+  for (std::uint32_t dimension : {0u, 1u, 63u, 64u, 200u}) {
+    for (std::uint32_t index = 0; index < 100; index++) {
+      auto value = source.value(7, 2, index, dimension);
+      ASSERT_GE(value, 0.0);
+      ASSERT_LT(value, 1.0);
+    }
+  }
+
+  // Consecutive samples of a dimension are a fixed rotation apart.
+  auto first = source.value(7, 2, 0, 0), second = source.value(7, 2, 1, 0);
+  EXPECT_NEAR(std::fabs(second - first), 0.5, 1e-12);
+}
+
+TEST(SamplerTest, BlueNoiseMaskIsAPermutationOfItsLevels) {
+  auto mask = make_blue_noise_mask(16);
+  ASSERT_EQ(mask.size(), 256u);
+  std::vector<int> levels(256);
+  for (auto value : mask)
+    levels[int(value * 256)]++;
+  for (auto count : levels)
+    ASSERT_EQ(count, 1);
+
+  // Blue noise has little energy at low frequencies: the means of its 4x4
+  // blocks are much closer to a half than those of white noise would be.
+  for (int by = 0; by < 16; by += 4) {
+    for (int bx = 0; bx < 16; bx += 4) {
+      double sum = 0;
+      for (int y = by; y < by + 4; y++)
+        for (int x = bx; x < bx + 4; x++)
+          sum += mask[y * 16 + x];
+      EXPECT_NEAR(sum / 16, 0.5, 0.15);
+    }
+  }
+}
+
+TEST(SamplerTest, RandomDoubleDrawsFromTheScope) {
+  sobol_sampler source;
+  {
+    sampler_scope samples(&source);
+    samples.start_sample(1, 2, 3);
+    samples.start_dimensions(4, 2);
+    EXPECT_EQ(random_double(), source.value(1, 2, 3, 4));
+    EXPECT_EQ(random_double(), source.value(1, 2, 3, 5));
+    EXPECT_EQ(thread_sample_stream(), &samples);
+  }
+  EXPECT_EQ(thread_sample_stream(), nullptr);
+
+  sampler_scope none(nullptr);
+  EXPECT_EQ(thread_sample_stream(), nullptr);
+}
+
+static std::vector<float> render_means(sampler_type type,
+                                       int samples_per_pixel) {
+  // Renders a diffuse sphere on the ground under a white sky, returning the
+  // mean of each pixel's samples.
+  hittable_list world;
+  world.add(make_shared<sphere>(point3(0, 0, -1), 0.5,
+                                make_shared<lambertian>(color(.5, .5, .5))));
+  world.add(make_shared<sphere>(point3(0, -100.5, -1), 100,
+                                make_shared<lambertian>(color(.8, .8, .8))));
+
+  camera cam;
+  cam.image_width = 16;
+  cam.max_depth = 4;
+  cam.background = color(1, 1, 1);
+  cam.sampling = type;
+  cam.prepare();
+
+  std::vector<float> means(std::size_t(16) * 16 * 3, 0.0f);
+  random_generator().seed(1);
+  cam.render_samples(world, {0, 0, 16, 16}, samples_per_pixel, means.data());
+  for (auto &value : means)
+    value /= samples_per_pixel;
+  return means;
+}
+
+static double rms_error(const std::vector<float> &image,
+                        const std::vector<float> &reference) {
+  double squared_error = 0;
+  for (std::size_t v = 0; v < image.size(); v++)
+    squared_error += std::pow(image[v] - reference[v], 2);
+  return std::sqrt(squared_error / image.size());
+}
+
+TEST(SamplerTest, LowDiscrepancySamplesConvergeFaster) {
+  auto reference = render_means(sampler_type::sobol, 2048);
+  auto independent =
+      rms_error(render_means(sampler_type::independent, 16), reference);
+  for (auto type :
+       {sampler_type::halton, sampler_type::sobol, sampler_type::blue_noise})
+    EXPECT_LT(rms_error(render_means(type, 16), reference), 0.9 * independent)
+        << sampler_type_names[int(type)];
+}
@@ -0,0 +1,43 @@
+#include "raytracing/box.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/material.h"
+#include "raytracing/scene_arena.h"
+#include "raytracing/sphere.h"
+#include <cstdint>
+#include <gtest/gtest.h>
+
+TEST(SceneArenaTest, AllocationsAreAlignedAndPacked) {
+  scene_arena arena;
+  auto a = arena.allocate(3, 1);
+  auto b = arena.allocate(8, 8);
+  auto c = arena.allocate(4, 4);
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(b) % 8, 0u);
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(c) % 4, 0u);
+  EXPECT_LT(static_cast<char *>(a), static_cast<char *>(b));
+  EXPECT_EQ(static_cast<char *>(c), static_cast<char *>(b) + 8);
+  EXPECT_EQ(arena.bytes_used(), 15u);
+  EXPECT_EQ(arena.block_count(), 1u);
+
+  // Objects larger than a block get one of their own.
+  arena.allocate(scene_arena::max_block_size * 2, 16);
+  EXPECT_EQ(arena.block_count(), 2u);
+  EXPECT_GE(arena.bytes_reserved(), scene_arena::max_block_size * 2);
+}
+
+TEST(SceneArenaTest, ObjectsKeepTheirArenaAlive) {
+  hittable_list world;
+  {
+    auto arena = make_shared<scene_arena>();
+    auto mat = make_in<lambertian>(arena, color(.5, .5, .5));
+    world.add(make_in<sphere>(arena, point3(0, 0, -1), 0.5, mat));
+    world.add(box(point3(-1, -1, -3), point3(1, 1, -2), mat, arena));
+    EXPECT_EQ(arena->block_count(), 1u);
+    EXPECT_GT(arena->bytes_used(), sizeof(sphere) + sizeof(axis_aligned_box));
+  }
+
+  hit_record rec;
+  ray r(point3(0, 0, 0), vec3(0, 0, -1));
+  ASSERT_TRUE(world.hit(r, interval(0.001, infinity), rec));
+  EXPECT_DOUBLE_EQ(rec.t, 0.5);
+  EXPECT_TRUE(rec.mat);
+}
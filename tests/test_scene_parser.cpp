@@ -0,0 +1,191 @@
+#include "raytracing/camera.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/scene_description.h"
+#include "raytracing/scene_parser.h"
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+
+static bool parse(const std::string &text, scene_description &scene) {
+  return scene_parser(scene).parse(text);
+}
+
+TEST(SceneParserTest, ParsesStatementsAndSkipsComments) {
+  scene_description scene;
+  ASSERT_TRUE(parse("# A comment\n"
+                    "\n"
+                    "camera lookfrom 1 2 3   # trailing comment\n"
+                    "material white lambertian .73 .73 .73\n"
+                    "sphere 0 -1.5 0 1e3 white\n",
+                    scene));
+
+  ASSERT_EQ(scene.statements.size(), 3u);
+
+  const auto &camera_setting = scene.statements[0];
+  EXPECT_EQ(camera_setting.op, scene_op::camera);
+  EXPECT_EQ(camera_setting.line, 3u);
+  EXPECT_EQ(scene.strings[camera_setting.name], "lookfrom");
+  EXPECT_EQ(camera_setting.count, 3u);
+
+  const auto &s = scene.statements[2];
+  EXPECT_EQ(s.op, scene_op::sphere);
+  EXPECT_EQ(s.name, scene_statement::no_string);
+  EXPECT_EQ(scene.strings[s.ref], "white");
+  ASSERT_EQ(s.count, 4u);
+  EXPECT_DOUBLE_EQ(scene.numbers[s.first + 1], -1.5);
+  EXPECT_DOUBLE_EQ(scene.numbers[s.first + 3], 1000);
+}
+
+TEST(SceneParserTest, ColorArgumentsTakeNumbersOrATexture) {
+  scene_description scene;
+  ASSERT_TRUE(parse("texture marble noise 4\n"
+                    "material a lambertian marble\n"
+                    "material b lambertian 0.5 0.5 0.5\n",
+                    scene));
+
+  EXPECT_EQ(scene.strings[scene.statements[1].ref], "marble");
+  EXPECT_EQ(scene.statements[1].count, 0u);
+  EXPECT_EQ(scene.statements[2].ref, scene_statement::no_string);
+  EXPECT_EQ(scene.statements[2].count, 3u);
+}
+
+TEST(SceneParserTest, RejectsMalformedStatements) {
+  const char *bad[] = {
+      "teapot 1 2 3\n",                     // Unknown statement
+      "camera zoom 2\n",                    // Unknown camera setting
+      "sphere 0 0 0 white\n",               // Missing number
+      "sphere 0 0 zero 1 white\n",          // Not a number
+      "material m dielectric 1.5 extra\n",  // Trailing argument
+      "material\n",                         // Missing name
+      "rotate_y\n",                         // Missing name
+      "quad 0 0 0  1 0 0  0 1 0\n",         // Missing material
+      "camera samples_per_pixel 0\n",       // Count below 1
+      "camera image_width -5\n",            // Negative count
+      "camera max_depth 2.5\n",             // Count not a whole number
+      "camera aspect_ratio 0\n",            // Zero aspect ratio
+      "camera aspect_ratio -2\n",           // Negative aspect ratio
+      "camera aspect_ratio nan\n",          // Not a finite number
+      "camera vfov 0\n",                    // View angle too narrow
+      "camera vfov 180\n",                  // View angle too wide
+      "camera focus_dist 0\n",              // Zero focus distance
+      "camera lookfrom 0 inf 0\n",          // Not a finite number
+      "smoke 0 0 0 1 1 1 -1 4 4 1 t\n",     // Negative grid size
+      "smoke 0 0 0 1 1 1 0 4 4 1 t\n",      // Empty grid
+      "smoke 0 0 0 1 1 1 9e3 9e3 1 1 t\n",  // Grid too large
+  };
+
+  for (auto text : bad) {
+    scene_description scene;
+    testing::internal::CaptureStderr();
+    EXPECT_FALSE(parse(text, scene)) << text;
+    EXPECT_NE(testing::internal::GetCapturedStderr().find(":1: "),
+              std::string::npos);
+  }
+}
+
+TEST(SceneParserTest, BuildsTheWorldAndCamera) {
+  scene_description scene;
+  ASSERT_TRUE(parse("camera image_width 64\n"
+                    "camera background 0.1 0.2 0.3\n"
+                    "material white lambertian .73 .73 .73\n"
+                    "sphere 0 0 -1 0.5 white\n"
+                    "object b box 0 0 0  1 1 1 white\n"
+                    "rotate_y b 15\n"
+                    "translate b 2 0 0\n"
+                    "object hidden sphere 0 0 0 1 white\n"
+                    "add b\n",
+                    scene));
+
+  hittable_list world;
+  camera cam;
+  ASSERT_TRUE(scene.build(world, cam));
+
+  // Objects with a name are only part of the world once they are added.
+  EXPECT_EQ(world.objects.size(), 2u);
+  EXPECT_EQ(cam.image_width, 64);
+  EXPECT_DOUBLE_EQ(cam.background.z(), 0.3);
+  EXPECT_GE(world.objects[1]->bounding_box().x.min, 1.5);
+}
+
+TEST(SceneParserTest, AnimatedObjectsMoveEachFrame) {
+  scene_description scene;
+  ASSERT_TRUE(parse("material white lambertian .73 .73 .73\n"
+                    "sphere 0 0 0 1 white\n"
+                    "object ball sphere 0 0 0 1 white\n"
+                    "animate ball 1 0 0\n"
+                    "add ball\n"
+                    "bvh\n",
+                    scene));
+
+  hittable_list world;
+  camera cam;
+  asset_loader assets;
+  scene_animation animation;
+  ASSERT_TRUE(scene.build(world, cam, assets, nullptr, &animation));
+  EXPECT_FALSE(animation.empty());
+
+  // The hierarchy's bounds follow the ball, which starts where it was defined.
+  animation.set_frame(0);
+  EXPECT_DOUBLE_EQ(world.objects[0]->bounding_box().x.max, 1);
+  animation.set_frame(3);
+  EXPECT_DOUBLE_EQ(world.objects[0]->bounding_box().x.max, 4);
+  EXPECT_EQ(animation.set_frame(3, true), flat_bvh::update_kind::full_rebuild);
+  EXPECT_DOUBLE_EQ(world.objects[0]->bounding_box().x.max, 4);
+}
+
+TEST(SceneParserTest, BuildReportsUndefinedNames) {
+  const char *bad[] = {
+      "sphere 0 0 0 1 missing\n",
+      "material m lambertian missing\n",
+      "add missing\n",
+  };
+
+  for (auto text : bad) {
+    scene_description scene;
+    ASSERT_TRUE(parse(text, scene));
+
+    hittable_list world;
+    camera cam;
+    testing::internal::CaptureStderr();
+    EXPECT_FALSE(scene.build(world, cam)) << text;
+    EXPECT_NE(testing::internal::GetCapturedStderr().find("'missing'"),
+              std::string::npos);
+  }
+}
+
+TEST(SceneParserTest, RendersWithSeveralThreads) {
+  scene_description scene;
+  ASSERT_TRUE(parse("camera image_width 40\n"
+                    "camera samples_per_pixel 2\n"
+                    "camera background 1 1 1\n"
+                    "material white lambertian 1 1 1\n"
+                    "sphere 0 0 -1 0.5 white\n",
+                    scene));
+
+  hittable_list world;
+  camera cam;
+  ASSERT_TRUE(scene.build(world, cam));
+  cam.thread_count = 3;
+  cam.tile_size = 16;
+
+  std::ostringstream image;
+  testing::internal::CaptureStderr();
+  cam.render(world, image);
+  testing::internal::GetCapturedStderr();
+
+  // Header, then every pixel once. A white sky on a white sphere stays white.
+  std::istringstream in(image.str());
+  std::string magic;
+  int width, height, max_value;
+  in >> magic >> width >> height >> max_value;
+  EXPECT_EQ(magic, "P3");
+  EXPECT_EQ(width, 40);
+  EXPECT_EQ(height, 40);
+
+  int pixels = 0, r, g, b;
+  while (in >> r >> g >> b) {
+    EXPECT_EQ(r, 255);
+    pixels++;
+  }
+  EXPECT_EQ(pixels, 40 * 40);
+}
@@ -0,0 +1,156 @@
+#include "raytracing/camera.h"
+#include "raytracing/flat_bvh.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/scene_description.h"
+#include "raytracing/scene_parser.h"
+#include "raytracing/scene_snapshot.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+static const char *scene_text = "camera vfov 35\n"
+                                "texture marble noise 4\n"
+                                "material ground lambertian marble\n"
+                                "material glass dielectric 1.5\n"
+                                "sphere 0 -100 0 100 ground\n"
+                                "sphere 0 1 0 1 glass\n"
+                                "moving_sphere 2 1 0 2 1.5 0 0.5 glass\n"
+                                "object b box 0 0 0 1 1 1 ground\n"
+                                "translate b -3 0 0\n"
+                                "add b\n"
+                                "bvh\n";
+
+static std::vector<flat_bvh_layout> build(const scene_description &scene,
+                                          hittable_list &world) {
+  camera cam;
+  asset_loader assets(1);
+  std::vector<flat_bvh_layout> bvhs;
+  EXPECT_TRUE(scene.build(world, cam, assets, &bvhs));
+  return bvhs;
+}
+
+TEST(SceneSnapshotTest, RoundTripsTheSceneAndItsBvh) {
+  auto filename = testing::TempDir() + "roundtrip.rtsnap";
+  auto hash = fnv1a_hash(scene_text);
+
+  scene_description original;
+  ASSERT_TRUE(scene_parser(original).parse(scene_text));
+  hittable_list original_world;
+  auto bvhs = build(original, original_world);
+  ASSERT_EQ(bvhs.size(), 1u);
+  ASSERT_TRUE(scene_snapshot::write(filename, original, bvhs, hash));
+
+  scene_description loaded;
+  ASSERT_TRUE(scene_snapshot::read(filename, hash, loaded));
+  std::remove(filename.c_str());
+
+  EXPECT_EQ(loaded.statements.size(), original.statements.size());
+  EXPECT_EQ(loaded.numbers, original.numbers);
+  EXPECT_EQ(loaded.strings, original.strings);
+  ASSERT_EQ(loaded.bvh_layouts.size(), 1u);
+  EXPECT_EQ(loaded.bvh_layouts[0].node_count, bvhs[0].node_count);
+
+  // The world built from the snapshot uses the saved hierarchy, and sees the
+  // same surfaces.
+  hittable_list loaded_world;
+  build(loaded, loaded_world);
+  for (int i = 0; i < 500; i++) {
+    point3 origin(random_double(-8, 8), 5, random_double(-8, 8));
+    ray r(origin, point3(random_double(-4, 4), 0, 0) - origin,
+          random_double());
+
+    hit_record a, b;
+    bool hit = original_world.hit(r, interval(0.001, infinity), a);
+    ASSERT_EQ(loaded_world.hit(r, interval(0.001, infinity), b), hit);
+    if (hit) {
+      EXPECT_DOUBLE_EQ(a.t, b.t);
+    }
+  }
+}
+
+TEST(SceneSnapshotTest, IgnoresSnapshotsOfOtherSources) {
+  auto filename = testing::TempDir() + "stale.rtsnap";
+
+  scene_description original;
+  ASSERT_TRUE(scene_parser(original).parse(scene_text));
+  hittable_list world;
+  auto bvhs = build(original, world);
+  ASSERT_TRUE(
+      scene_snapshot::write(filename, original, bvhs, fnv1a_hash(scene_text)));
+
+  scene_description loaded;
+  loaded.source = "edited.scene";
+  EXPECT_FALSE(scene_snapshot::read(filename, fnv1a_hash("bvh\n"), loaded));
+  EXPECT_TRUE(loaded.statements.empty());
+  EXPECT_EQ(loaded.source, "edited.scene");
+
+  std::remove(filename.c_str());
+  EXPECT_FALSE(
+      scene_snapshot::read(filename, fnv1a_hash(scene_text), loaded));
+}
+
+TEST(SceneSnapshotTest, RejectsDamagedSnapshots) {
+  auto filename = testing::TempDir() + "damaged.rtsnap";
+  auto hash = fnv1a_hash(scene_text);
+
+  scene_description original;
+  ASSERT_TRUE(scene_parser(original).parse(scene_text));
+  hittable_list world;
+  auto bvhs = build(original, world);
+  ASSERT_TRUE(scene_snapshot::write(filename, original, bvhs, hash));
+
+  std::string bytes;
+  ASSERT_TRUE(scene_parser::read_file(filename, bytes));
+
+  // A truncated file.
+  std::ofstream(filename, std::ios::binary | std::ios::trunc)
+      << bytes.substr(0, bytes.size() / 2);
+  scene_description loaded;
+  EXPECT_FALSE(scene_snapshot::read(filename, hash, loaded));
+
+  // A snapshot written by a build that lays out its records differently,
+  // which shows in the layout stamp after the magic, version and byte order.
+  auto restamped = bytes;
+  restamped[16] ^= 1;
+  std::ofstream(filename, std::ios::binary | std::ios::trunc) << restamped;
+  EXPECT_FALSE(scene_snapshot::read(filename, hash, loaded));
+
+  // A statement that refers past the end of the string table.
+  scene_description broken = original;
+  broken.statements[1].name = std::uint32_t(broken.strings.size());
+  ASSERT_TRUE(scene_snapshot::write(filename, broken, bvhs, hash));
+  EXPECT_FALSE(scene_snapshot::read(filename, hash, loaded));
+
+  std::remove(filename.c_str());
+}
+
+TEST(SceneSnapshotTest, WritesZerosForPadding) {
+  auto filename = testing::TempDir() + "padding.rtsnap";
+  auto hash = fnv1a_hash(scene_text);
+
+  scene_description original;
+  ASSERT_TRUE(scene_parser(original).parse(scene_text));
+  hittable_list world;
+  auto bvhs = build(original, world);
+
+  // Fill the padding of every statement in memory with garbage.
+  for (auto &s : original.statements) {
+    auto copy = s;
+    std::memset(&s, 0xab, sizeof(s));
+    s.op = copy.op;
+    s.line = copy.line;
+    s.name = copy.name;
+    s.ref = copy.ref;
+    s.first = copy.first;
+    s.count = copy.count;
+  }
+  ASSERT_TRUE(scene_snapshot::write(filename, original, bvhs, hash));
+
+  std::string bytes;
+  ASSERT_TRUE(scene_parser::read_file(filename, bytes));
+  std::remove(filename.c_str());
+  EXPECT_EQ(bytes.find("\xab\xab\xab"), std::string::npos);
+}
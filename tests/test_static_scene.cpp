@@ -0,0 +1,69 @@
+#include "raytracing/box.h"
+#include "raytracing/camera.h"
+#include "raytracing/hittable.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/material.h"
+#include "raytracing/quad.h"
+#include "raytracing/sphere.h"
+#include "raytracing/static_scene.h"
+#include <gtest/gtest.h>
+
+TEST(StaticSceneTest, HitsMatchTheDynamicScene) {
+  auto white = make_shared<lambertian>(color(.73, .73, .73));
+
+  hittable_list dynamic;
+  dynamic.add(make_shared<sphere>(point3(0, 1, 0), 1, white));
+  dynamic.add(make_shared<quad>(point3(-5, 0, -5), vec3(10, 0, 0),
+                                vec3(0, 0, 10), white));
+  shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(1, 2, 1), white);
+  box1 = make_shared<rotate_y>(box1, 30);
+  dynamic.add(make_shared<translate>(box1, vec3(2, 0, 1)));
+
+  static_scene fixed(
+      sphere(point3(0, 1, 0), 1, white),
+      quad(point3(-5, 0, -5), vec3(10, 0, 0), vec3(0, 0, 10), white),
+      static_translate(
+          static_rotate_y(static_box(point3(0, 0, 0), point3(1, 2, 1), white),
+                          30),
+          vec3(2, 0, 1)));
+
+  auto expected_box = dynamic.bounding_box(), box = fixed.bounding_box();
+  for (int axis = 0; axis < 3; axis++) {
+    EXPECT_DOUBLE_EQ(box.axis_interval(axis).min,
+                     expected_box.axis_interval(axis).min);
+    EXPECT_DOUBLE_EQ(box.axis_interval(axis).max,
+                     expected_box.axis_interval(axis).max);
+  }
+
+  for (int i = 0; i < 2000; i++) {
+    point3 origin(random_double(-6, 6), 4, random_double(-6, 6));
+    auto target = point3(random_double(-3, 3), 0, random_double(-3, 3));
+    ray r(origin, target - origin);
+
+    hit_record expected, rec;
+    bool hit = dynamic.hit(r, interval(0.001, infinity), expected);
+    ASSERT_EQ(fixed.hit(r, interval(0.001, infinity), rec), hit);
+    if (hit) {
+      EXPECT_DOUBLE_EQ(rec.t, expected.t);
+      EXPECT_NEAR((rec.p - expected.p).length(), 0, 1e-12);
+      EXPECT_NEAR((rec.normal - expected.normal).length(), 0, 1e-12);
+      EXPECT_NEAR(rec.u, expected.u, 1e-12);
+      EXPECT_NEAR(rec.v, expected.v, 1e-12);
+      EXPECT_EQ(rec.mat, expected.mat);
+    }
+  }
+}
+
+struct test_view : default_view {
+  static constexpr int image_width = 40;
+  static constexpr point3 lookfrom = point3(0, 0, 9);
+};
+
+TEST(StaticSceneTest, ViewsSetTheCamera) {
+  camera cam;
+  cam.vfov = 20;
+  apply_view<test_view>(cam);
+  EXPECT_EQ(cam.image_width, 40);
+  EXPECT_DOUBLE_EQ(cam.lookfrom.z(), 9);
+  EXPECT_DOUBLE_EQ(cam.vfov, 90);
+}
@@ -0,0 +1,162 @@
+#include "raytracing/texture_cache.h"
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::string write_gray_image(const std::string &name, int width) {
+  // Writes a binary PGM file of the given width and height 1, and returns its
+  // path.
+  auto filename = testing::TempDir() + name;
+  std::ofstream out(filename, std::ios::binary);
+  out << "P5\n" << width << " 1\n255\n";
+  for (int i = 0; i < width; i++)
+    out.put(char(i));
+  return filename;
+}
+
+TEST(TextureCacheTest, DecodesEachFileOnce) {
+  auto filename = write_gray_image("cache_once.pgm", 16);
+  texture_cache cache;
+
+  auto first = cache.acquire(filename);
+  auto second = cache.acquire(filename);
+  std::remove(filename.c_str());
+
+  EXPECT_EQ(first.get(), second.get());
+  EXPECT_EQ(first->width(), 16);
+  EXPECT_EQ(cache.decode_count(), 1u);
+  EXPECT_EQ(cache.size(), 1u);
+  EXPECT_EQ(cache.memory_bytes(), first->memory_bytes());
+}
+
+TEST(TextureCacheTest, MissingFilesYieldEmptyImages) {
+  texture_cache cache;
+  auto image = cache.acquire("no/such/image.png");
+
+  ASSERT_NE(image, nullptr);
+  EXPECT_EQ(image->width(), 0);
+  EXPECT_EQ(image->height(), 0);
+}
+
+TEST(TextureCacheTest, ResolveFallsBackToTheGivenName) {
+  texture_cache cache;
+  EXPECT_EQ(cache.resolve("no/such/image.png"), "no/such/image.png");
+
+  auto filename = write_gray_image("cache_resolve.pgm", 4);
+  EXPECT_EQ(cache.resolve(filename), filename);
+  std::remove(filename.c_str());
+}
+
+static std::string write_gray_square(const std::string &name, int size) {
+  // Writes a binary PGM file of a size x size pattern, and returns its path.
+  auto filename = testing::TempDir() + name;
+  std::ofstream out(filename, std::ios::binary);
+  out << "P5\n" << size << ' ' << size << "\n255\n";
+  for (int y = 0; y < size; y++)
+    for (int x = 0; x < size; x++)
+      out.put(char((x * 7 + y * 13) % 256));
+  return filename;
+}
+
+static void expect_same_pixels(const rtw_image &image,
+                               const rtw_image &expected) {
+  // Compares every pixel of every mip level.
+  for (int level = 0; level < expected.mip_levels(); level++)
+    for (int y = 0; y < expected.height(level); y++)
+      for (int x = 0; x < expected.width(level); x++)
+        ASSERT_DOUBLE_EQ(image.texel(x, y, level).x(),
+                         expected.texel(x, y, level).x())
+            << level << ' ' << x << ' ' << y;
+}
+
+TEST(TextureCacheTest, EvictsLeastRecentlyUsedTilesOfImagesInUse) {
+  auto filename = write_gray_square("cache_tiles.pgm", 64);
+  rtw_image expected(filename.c_str());
+  auto tile = std::size_t(rtw_image::tile_size) * rtw_image::tile_size;
+
+  texture_cache cache;
+  auto image = cache.acquire(filename);
+  ASSERT_EQ(image->tile_count(), 64 + 16 + 4 + 1 + 1 + 1 + 1);
+  EXPECT_EQ(cache.memory_bytes(), image->tile_count() * tile);
+
+  // The first four tiles of the top row were used last, so they are the
+  // ones kept when the budget only has room for them.
+  for (int x = 0; x < 32; x++)
+    image->texel(x, 0);
+  cache.set_memory_budget(4 * tile + tile / 2);
+  EXPECT_LE(cache.memory_bytes(), 4 * tile + tile / 2);
+  for (int t = 0; t < image->tile_count(); t++)
+    EXPECT_EQ(image->tile_resident(t), t < 4) << t;
+  EXPECT_EQ(cache.decode_count(), 1u);
+
+  // Evicted tiles are decoded again, or filtered again from the level above,
+  // as they are looked up, and the budget still holds.
+  expect_same_pixels(*image, expected);
+  EXPECT_GT(cache.decode_count(), 1u);
+  EXPECT_LE(cache.memory_bytes(), 4 * tile + tile / 2);
+  EXPECT_EQ(cache.memory_bytes(), image->memory_bytes());
+
+  cache.set_memory_budget(std::size_t(-1));
+  std::remove(filename.c_str());
+}
+
+TEST(TextureCacheTest, DecodesOnceForManyEvictedTiles) {
+  auto filename = write_gray_square("cache_decodes.pgm", 64);
+  rtw_image expected(filename.c_str());
+  auto tile = std::size_t(rtw_image::tile_size) * rtw_image::tile_size;
+
+  texture_cache cache;
+  auto image = cache.acquire(filename);
+  EXPECT_EQ(cache.decode_count(), 1u);
+
+  // The smallest level is filtered down from all the full size tiles, which
+  // one decode brings back. It also brings back the rest of them, now that
+  // the budget has room.
+  cache.set_memory_budget(tile);
+  EXPECT_EQ(cache.memory_bytes(), 0u);
+  cache.set_memory_budget(std::size_t(-1));
+  image->texel(0, 0, image->mip_levels() - 1);
+  EXPECT_EQ(cache.decode_count(), 2u);
+  for (int t = 0; t < 64; t++)
+    EXPECT_TRUE(image->tile_resident(t)) << t;
+
+  // Looking up every evicted pixel takes one decode too.
+  cache.set_memory_budget(tile);
+  cache.set_memory_budget(std::size_t(-1));
+  expect_same_pixels(*image, expected);
+  EXPECT_EQ(cache.decode_count(), 3u);
+  EXPECT_EQ(cache.memory_bytes(), image->memory_bytes());
+
+  // With room for only half of the tiles, scanning the image decodes it
+  // once per row of tiles, rather than once per tile.
+  cache.set_memory_budget(tile);
+  cache.set_memory_budget(32 * tile + tile / 2);
+  for (int y = 0; y < 64; y++)
+    for (int x = 0; x < 64; x++)
+      image->texel(x, y);
+  EXPECT_LE(cache.decode_count(), 3u + 8u);
+  EXPECT_LE(cache.memory_bytes(), 32 * tile + tile / 2);
+
+  cache.set_memory_budget(std::size_t(-1));
+  std::remove(filename.c_str());
+}
+
+TEST(TextureCacheTest, ThreadsLookUpTilesBeingEvicted) {
+  auto filename = write_gray_square("cache_threads.pgm", 32);
+  rtw_image expected(filename.c_str());
+
+  texture_cache cache(std::size_t(rtw_image::tile_size) *
+                      rtw_image::tile_size * 3);
+  auto image = cache.acquire(filename);
+  std::vector<std::thread> threads;
+  for (int k = 0; k < 4; k++)
+    threads.emplace_back([&] { expect_same_pixels(*image, expected); });
+  for (auto &thread : threads)
+    thread.join();
+
+  EXPECT_EQ(cache.memory_bytes(), image->memory_bytes());
+  std::remove(filename.c_str());
+}
@@ -0,0 +1,92 @@
+#include "raytracing/numa.h"
+#include "raytracing/thread_pool.h"
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <gtest/gtest.h>
+#include <vector>
+
+TEST(ThreadPoolTest, DefaultsToAtLeastOneThread) {
+  thread_pool pool;
+  EXPECT_GE(pool.size(), 1u);
+
+  thread_pool three(3);
+  EXPECT_EQ(three.size(), 3u);
+}
+
+TEST(ThreadPoolTest, SubmitReturnsTaskResults) {
+  thread_pool pool(4);
+
+  std::vector<std::future<int>> results;
+  for (int i = 0; i < 100; i++)
+    results.push_back(pool.submit([i] { return i * i; }));
+
+  for (int i = 0; i < 100; i++)
+    EXPECT_EQ(results[i].get(), i * i);
+}
+
+TEST(ThreadPoolTest, TasksRunConcurrently) {
+  // Two tasks that each wait for the other can only finish if they run on
+  // different threads at the same time.
+  thread_pool pool(2);
+  std::promise<void> first_started, second_started;
+  auto first_seen = first_started.get_future().share();
+  auto second_seen = second_started.get_future().share();
+
+  auto a = pool.submit([&] {
+    first_started.set_value();
+    return second_seen.wait_for(std::chrono::seconds(10)) ==
+           std::future_status::ready;
+  });
+  auto b = pool.submit([&] {
+    second_started.set_value();
+    return first_seen.wait_for(std::chrono::seconds(10)) ==
+           std::future_status::ready;
+  });
+
+  EXPECT_TRUE(a.get());
+  EXPECT_TRUE(b.get());
+}
+
+TEST(ThreadPoolTest, DestructorFinishesQueuedTasks) {
+  std::atomic<int> completed{0};
+  {
+    thread_pool pool(2);
+    for (int i = 0; i < 50; i++)
+      pool.submit([&completed] { completed++; });
+  }
+  EXPECT_EQ(completed.load(), 50);
+}
+
+TEST(ThreadPoolTest, WorkersPreferTheirOwnNodesTasks) {
+  // A single worker on the first of two nodes runs the tasks queued for its
+  // node first, oldest first, then steals the other node's, newest first.
+  numa_topology topology;
+  ASSERT_TRUE(numa_topology::parse("0;0", topology));
+  thread_pool pool(topology, 1);
+  EXPECT_EQ(pool.node_count(), 2);
+
+  std::promise<void> release;
+  auto gate = release.get_future().share();
+  pool.submit_to(0, [gate] { gate.wait(); });
+
+  std::mutex mutex;
+  std::vector<int> order, nodes;
+  std::vector<std::future<void>> done;
+  for (int i = 0; i < 6; i++) {
+    int node = i % 2 ? 0 : 1;
+    done.push_back(pool.submit_to(node, [&, i] {
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(i);
+      nodes.push_back(thread_pool::current_node());
+    }));
+  }
+  release.set_value();
+  for (auto &task : done)
+    task.wait();
+
+  EXPECT_EQ(order, (std::vector<int>{1, 3, 5, 4, 2, 0}));
+  EXPECT_EQ(nodes, std::vector<int>(6, 0));
+  EXPECT_EQ(thread_pool::current_node(), 0);
+}
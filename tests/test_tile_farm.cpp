@@ -0,0 +1,255 @@
+#include "raytracing/camera.h"
+#include "raytracing/scene_description.h"
+#include "raytracing/scene_parser.h"
+#include "raytracing/socket.h"
+#include "raytracing/tile_farm.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// A white sky on a white sphere stays white, however it is sampled.
+static const char *white_scene = "camera image_width 40\n"
+                                 "camera samples_per_pixel 4\n"
+                                 "camera background 1 1 1\n"
+                                 "material white lambertian 1 1 1\n"
+                                 "sphere 0 0 -1 0.5 white\n";
+
+static std::string socket_path(const char *name) {
+  return "/tmp/raytracing_test_" + std::to_string(getpid()) + "_" + name;
+}
+
+static void expect_white(const std::vector<color> &pixels) {
+  ASSERT_EQ(pixels.size(), 40u * 40u);
+  for (const auto &pixel : pixels)
+    ASSERT_NEAR(pixel.x(), 1.0, 1e-5);
+}
+
+TEST(TileFarmTest, PayloadsRoundTrip) {
+  message_payload out;
+  out.put(std::uint32_t(7));
+  out.put_string("scene");
+  out.put(1.5f);
+
+  message_payload in(out.data());
+  std::uint32_t n;
+  std::string text;
+  float f;
+  ASSERT_TRUE(in.get(n));
+  ASSERT_TRUE(in.get_string(text));
+  ASSERT_TRUE(in.get(f));
+  EXPECT_EQ(n, 7u);
+  EXPECT_EQ(text, "scene");
+  EXPECT_EQ(f, 1.5f);
+  EXPECT_TRUE(in.at_end());
+  EXPECT_FALSE(in.get(n));
+}
+
+TEST(TileFarmTest, WorkersRenderTheImage) {
+  camera cam;
+  cam.image_width = 40;
+  cam.samples_per_pixel = 4;
+  cam.tile_size = 16;
+
+  auto address = socket_path("farm");
+  auto listener = socket_handle::listen(address);
+  ASSERT_TRUE(listener.is_open());
+
+  tile_coordinator coordinator("white", white_scene, "", cam, 2);
+  coordinator.show_progress = false;
+  EXPECT_EQ(coordinator.unit_count(), 9u * 2u);
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < 2; i++)
+    workers.emplace_back([&] { EXPECT_TRUE(run_tile_worker(address, 2)); });
+
+  std::vector<color> pixels;
+  EXPECT_TRUE(coordinator.run(listener, pixels));
+  for (auto &w : workers)
+    w.join();
+  unlink(address.c_str());
+
+  expect_white(pixels);
+}
+
+TEST(TileFarmTest, UnitsOfFailedWorkersAreReassigned) {
+  camera cam;
+  cam.image_width = 40;
+  cam.samples_per_pixel = 4;
+  cam.tile_size = 16;
+
+  auto address = socket_path("failing");
+  auto listener = socket_handle::listen(address);
+  ASSERT_TRUE(listener.is_open());
+
+  tile_coordinator coordinator("white", white_scene, "", cam);
+  coordinator.show_progress = false;
+
+  // A worker that takes every unit and disconnects without returning any,
+  // followed by one that does the work.
+  std::thread workers([&] {
+    auto failing = socket_handle::connect(address);
+    ASSERT_TRUE(failing.is_open());
+    message_payload hello;
+    hello.put(farm_protocol_version);
+    hello.put(std::uint32_t(100));
+    ASSERT_TRUE(send_farm_message(failing, farm_message::hello, hello));
+
+    farm_message type;
+    message_payload payload;
+    ASSERT_TRUE(receive_farm_message(failing, type, payload));
+    EXPECT_EQ(type, farm_message::job);
+    ASSERT_TRUE(receive_farm_message(failing, type, payload));
+    EXPECT_EQ(type, farm_message::unit);
+    failing.close();
+
+    EXPECT_TRUE(run_tile_worker(address, 1));
+  });
+
+  std::vector<color> pixels;
+  EXPECT_TRUE(coordinator.run(listener, pixels));
+  workers.join();
+  unlink(address.c_str());
+
+  expect_white(pixels);
+}
+
+TEST(TileFarmTest, StalledWorkersDoNotHoldUpOthers) {
+  camera cam;
+  cam.image_width = 40;
+  cam.samples_per_pixel = 4;
+  cam.tile_size = 16;
+
+  auto address = socket_path("stalled");
+  auto listener = socket_handle::listen(address);
+  ASSERT_TRUE(listener.is_open());
+
+  tile_coordinator coordinator("white", white_scene, "", cam);
+  coordinator.show_progress = false;
+  coordinator.read_timeout = 0.2;
+
+  // A worker that sends the start of a greeting and then goes quiet, and one
+  // that does the work.
+  auto stalled = socket_handle::connect(address);
+  ASSERT_TRUE(stalled.is_open());
+  std::uint32_t type = std::uint32_t(farm_message::hello);
+  ASSERT_TRUE(stalled.send_all(&type, sizeof(type)));
+  std::thread worker([&] { EXPECT_TRUE(run_tile_worker(address, 1)); });
+
+  std::vector<color> pixels;
+  EXPECT_TRUE(coordinator.run(listener, pixels));
+  worker.join();
+  unlink(address.c_str());
+
+  expect_white(pixels);
+}
+
+TEST(TileFarmTest, WorkersThatStopReadingAreDropped) {
+  camera cam;
+  cam.image_width = 40;
+  cam.samples_per_pixel = 400;
+  cam.tile_size = 16;
+
+  auto address = socket_path("deaf");
+  auto listener = socket_handle::listen(address);
+  ASSERT_TRUE(listener.is_open());
+
+  // One sample per unit makes more units than the socket's buffers hold.
+  tile_coordinator coordinator("white", white_scene, "", cam, 400);
+  coordinator.show_progress = false;
+  coordinator.read_timeout = 0.2;
+
+  // A worker that asks for every unit and never reads them, and one that
+  // does the work.
+  auto deaf = socket_handle::connect(address);
+  ASSERT_TRUE(deaf.is_open());
+  message_payload hello;
+  hello.put(farm_protocol_version);
+  hello.put(std::uint32_t(coordinator.unit_count()));
+  ASSERT_TRUE(send_farm_message(deaf, farm_message::hello, hello));
+  std::thread worker([&] { EXPECT_TRUE(run_tile_worker(address, 4)); });
+
+  std::vector<color> pixels;
+  EXPECT_TRUE(coordinator.run(listener, pixels));
+  worker.join();
+  unlink(address.c_str());
+
+  expect_white(pixels);
+}
+
+TEST(TileFarmTest, FailsWhenNoWorkersAreLeft) {
+  camera cam;
+  cam.image_width = 40;
+  cam.samples_per_pixel = 4;
+
+  auto address = socket_path("abandoned");
+  auto listener = socket_handle::listen(address);
+  ASSERT_TRUE(listener.is_open());
+
+  tile_coordinator coordinator("white", white_scene, "", cam);
+  coordinator.show_progress = false;
+  coordinator.worker_timeout = 0.2;
+
+  // No worker ever connects.
+  std::vector<color> pixels;
+  EXPECT_FALSE(coordinator.run(listener, pixels));
+
+  // A worker that gives up on the scene, leaving no one to do its units.
+  std::thread worker([&] {
+    auto failing = socket_handle::connect(address);
+    ASSERT_TRUE(failing.is_open());
+    message_payload hello;
+    hello.put(farm_protocol_version);
+    hello.put(std::uint32_t(1));
+    ASSERT_TRUE(send_farm_message(failing, farm_message::hello, hello));
+    EXPECT_TRUE(send_farm_message(failing, farm_message::failed));
+  });
+  EXPECT_FALSE(coordinator.run(listener, pixels));
+  worker.join();
+
+  // A deadline on the whole render.
+  coordinator.worker_timeout = 60;
+  coordinator.time_limit = 0.2;
+  EXPECT_FALSE(coordinator.run(listener, pixels));
+  unlink(address.c_str());
+}
+
+TEST(TileFarmTest, WorkersApplyTheCameraSettings) {
+  // A black sphere in front of a white sky. The default view sees the sky
+  // around the sphere, and a narrow one only the sphere.
+  const char *sphere_scene = "camera image_width 40\n"
+                             "camera samples_per_pixel 2\n"
+                             "camera background 1 1 1\n"
+                             "material black lambertian 0 0 0\n"
+                             "sphere 0 0 -1 0.5 black\n";
+  const char *settings = "camera vfov 20\n"
+                         "camera image_width 24\n"
+                         "camera aspect_ratio 2\n";
+
+  scene_description scene;
+  ASSERT_TRUE(scene_parser(scene).parse(sphere_scene));
+  asset_loader assets(1);
+  hittable_list world;
+  camera cam;
+  ASSERT_TRUE(scene.build(world, cam, assets));
+  ASSERT_TRUE(apply_camera_settings(settings, cam, "test"));
+  cam.tile_size = 8;
+
+  auto address = socket_path("camera");
+  auto listener = socket_handle::listen(address);
+  ASSERT_TRUE(listener.is_open());
+
+  tile_coordinator coordinator("sphere", sphere_scene, settings, cam);
+  coordinator.show_progress = false;
+  std::thread worker([&] { EXPECT_TRUE(run_tile_worker(address, 1)); });
+
+  std::vector<color> pixels;
+  EXPECT_TRUE(coordinator.run(listener, pixels));
+  worker.join();
+  unlink(address.c_str());
+
+  ASSERT_EQ(pixels.size(), 24u * 12u);
+  for (const auto &pixel : pixels)
+    ASSERT_EQ(pixel.x(), 0.0);
+}
@@ -0,0 +1,86 @@
+#include "raytracing/camera.h"
+#include "raytracing/hittable_list.h"
+#include "raytracing/material.h"
+#include "raytracing/sphere.h"
+#include "raytracing/tile_heatmap.h"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+TEST(TileHeatmapTest, HeatColorRunsFromBlackToWhite) {
+  EXPECT_EQ(heat_color(0).length_squared(), 0);
+  EXPECT_DOUBLE_EQ(heat_color(1).x(), 1);
+  EXPECT_DOUBLE_EQ(heat_color(1).z(), 1);
+  EXPECT_DOUBLE_EQ(heat_color(0.25).z(), 1);
+  EXPECT_DOUBLE_EQ(heat_color(2).y(), 1);
+}
+
+TEST(TileHeatmapTest, CameraRecordsEveryTile) {
+  hittable_list world;
+  world.add(make_shared<sphere>(point3(0, 0, -1), 0.5,
+                                make_shared<lambertian>(color(.5, .5, .5))));
+
+  camera cam;
+  cam.image_width = 40;
+  cam.aspect_ratio = 2;
+  cam.samples_per_pixel = 1;
+  cam.tile_size = 16;
+  cam.thread_count = 2;
+  cam.show_progress = false;
+  cam.time_tiles = true;
+
+  std::ostringstream image;
+  cam.render(world, image);
+
+  // A 40x20 image in 16 pixel tiles is 3 tiles across and 2 down.
+  const auto &costs = cam.last_tile_costs();
+  ASSERT_EQ(costs.size(), 6u);
+  EXPECT_EQ(costs[2].tile.x1, 40);
+  EXPECT_EQ(costs[5].tile.y0, 16);
+  for (const auto &cost : costs)
+    EXPECT_GT(cost.seconds, 0);
+
+  std::ostringstream heatmap;
+  write_tile_heatmap(heatmap, costs, cam.region());
+  std::istringstream in(heatmap.str());
+  std::string magic;
+  int width, height;
+  in >> magic >> width >> height;
+  EXPECT_EQ(magic, "P3");
+  EXPECT_EQ(width, 40);
+  EXPECT_EQ(height, 20);
+
+  std::ostringstream table;
+  write_tile_costs_csv(table, costs);
+  auto csv = table.str();
+  EXPECT_EQ(std::count(csv.begin(), csv.end(), '\n'), 7);
+}
+
+TEST(TileHeatmapTest, HeatmapCoversTheCropWindow) {
+  // Tiles of the right half of the bottom of a 40x20 frame, in frame
+  // coordinates, all as slow per pixel as each other.
+  image_tile region{20, 10, 40, 20};
+  std::vector<tile_cost> costs(2);
+  costs[0].tile = {20, 10, 36, 20};
+  costs[0].seconds = 160;
+  costs[1].tile = {36, 10, 40, 20};
+  costs[1].seconds = 40;
+
+  // The heatmap is the size of the region, and every pixel of it is the
+  // colour of the slowest tiles.
+  std::ostringstream heatmap;
+  write_tile_heatmap(heatmap, costs, region);
+  std::istringstream in(heatmap.str());
+  std::string magic;
+  int width, height, max_value;
+  in >> magic >> width >> height >> max_value;
+  EXPECT_EQ(width, 20);
+  EXPECT_EQ(height, 10);
+  for (int p = 0; p < width * height; p++) {
+    int r, g, b;
+    ASSERT_TRUE(in >> r >> g >> b);
+    EXPECT_EQ(r + g + b, 3 * 255) << "pixel " << p;
+  }
+}
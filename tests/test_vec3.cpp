@@ -133,3 +133,118 @@ TEST(Vec3Test, UnitVector) {
   EXPECT_DOUBLE_EQ(unitV.y(), 2.0 / len);
   EXPECT_DOUBLE_EQ(unitV.z(), 2.0 / len);
 }
+
+// The sampling mappings are checked on a grid of evenly spread inputs, for
+// which the moments and the share of points in each region of the shape
+// match those of the distribution closely. Shares are off by up to the
+// points in grid cells on the region's edge.
+template <typename F> static void for_sample_grid(F f) {
+  const int n = 256;
+  for (int i = 0; i < n; i++)
+    for (int j = 0; j < n; j++)
+      f((i + 0.5) / n, (j + 0.5) / n);
+}
+
+static const double grid_points = 256.0 * 256.0;
+
+TEST(Vec3Test, SinCosTurns) {
+  for (int i = -1000; i <= 1000; i++) {
+    auto turns = i / 1000.0;
+    double s, c;
+    sin_cos_turns(turns, s, c);
+    ASSERT_NEAR(s, std::sin(2 * pi * turns), 1e-13);
+    ASSERT_NEAR(c, std::cos(2 * pi * turns), 1e-13);
+  }
+}
+
+TEST(Vec3Test, SphereSamplesAreUniform) {
+  vec3 sum, squares;
+  double octants[8] = {}, cap = 0;
+  for_sample_grid([&](double u1, double u2) {
+    auto p = sphere_sample(u1, u2);
+    ASSERT_NEAR(p.length(), 1.0, 1e-12);
+    sum += p;
+    squares += p * p;
+    octants[(p.x() > 0) + 2 * (p.y() > 0) + 4 * (p.z() > 0)]++;
+    cap += p.z() > 0.5; // A quarter of the sphere's area
+  });
+
+  for (int c = 0; c < 3; c++) {
+    EXPECT_NEAR(sum[c] / grid_points, 0.0, 1e-3);
+    EXPECT_NEAR(squares[c] / grid_points, 1.0 / 3, 1e-3);
+  }
+  for (auto count : octants)
+    EXPECT_NEAR(count / grid_points, 1.0 / 8, 3e-3);
+  EXPECT_NEAR(cap / grid_points, 0.25, 3e-3);
+}
+
+TEST(Vec3Test, DiskSamplesAreUniform) {
+  double quadrants[4] = {}, inner = 0, sector = 0, squared_radii = 0;
+  for_sample_grid([&](double u1, double u2) {
+    auto p = disk_sample(u1, u2);
+    ASSERT_LE(p.length(), 1.0 + 1e-12);
+    ASSERT_EQ(p.z(), 0.0);
+    quadrants[(p.x() > 0) + 2 * (p.y() > 0)]++;
+    inner += p.length() < 0.5;
+    sector += std::atan2(p.y(), p.x()) > 0 &&
+              std::atan2(p.y(), p.x()) < pi / 3; // A sixth of the disk
+    squared_radii += p.length_squared();
+  });
+
+  for (auto count : quadrants)
+    EXPECT_NEAR(count / grid_points, 0.25, 3e-3);
+  EXPECT_NEAR(inner / grid_points, 0.25, 3e-3);
+  EXPECT_NEAR(sector / grid_points, 1.0 / 6, 3e-3);
+  EXPECT_NEAR(squared_radii / grid_points, 0.5, 1e-3);
+
+  auto centre = disk_sample(0.5, 0.5);
+  EXPECT_EQ(centre.length(), 0.0);
+}
+
+TEST(Vec3Test, CosineHemisphereSamplesAreCosineWeighted) {
+  double heights = 0, within_60_degrees = 0;
+  for_sample_grid([&](double u1, double u2) {
+    auto p = cosine_hemisphere_sample(u1, u2);
+    ASSERT_NEAR(p.length(), 1.0, 1e-12);
+    ASSERT_GE(p.z(), 0.0);
+    heights += p.z();
+    within_60_degrees += p.z() > 0.5;
+  });
+
+  // With density cos(theta) / pi, the mean cosine is 2/3, and the share of
+  // directions within theta of the axis is sin^2(theta).
+  EXPECT_NEAR(heights / grid_points, 2.0 / 3, 1e-3);
+  EXPECT_NEAR(within_60_degrees / grid_points, 0.75, 3e-3);
+}
+
+TEST(Vec3Test, BatchSamplesMatchSinglePoints) {
+  const int n = 37;
+  double u1[n], u2[n], x[n], y[n], z[n];
+  for (int i = 0; i < n; i++) {
+    u1[i] = std::fmod(i * 0.618033988749895, 1.0);
+    u2[i] = double(i) / n;
+  }
+
+  sphere_sample(n, u1, u2, x, y, z);
+  for (int i = 0; i < n; i++) {
+    auto p = sphere_sample(u1[i], u2[i]);
+    EXPECT_NEAR(x[i], p.x(), 1e-12);
+    EXPECT_NEAR(y[i], p.y(), 1e-12);
+    EXPECT_NEAR(z[i], p.z(), 1e-12);
+  }
+
+  disk_sample(n, u1, u2, x, y);
+  for (int i = 0; i < n; i++) {
+    auto p = disk_sample(u1[i], u2[i]);
+    EXPECT_NEAR(x[i], p.x(), 1e-12);
+    EXPECT_NEAR(y[i], p.y(), 1e-12);
+  }
+
+  cosine_hemisphere_sample(n, u1, u2, x, y, z);
+  for (int i = 0; i < n; i++) {
+    auto p = cosine_hemisphere_sample(u1[i], u2[i]);
+    EXPECT_NEAR(x[i], p.x(), 1e-12);
+    EXPECT_NEAR(y[i], p.y(), 1e-12);
+    EXPECT_NEAR(z[i], p.z(), 1e-12);
+  }
+}